@@ -36,6 +36,7 @@ CKernel::CKernel(void)
     , m_Timer(&m_Interrupt)
     , m_Logger(m_Options.GetLogLevel(), &m_Timer)
     , m_I2CMaster(CMachineInfo::Get()->GetDevice(DeviceI2CMaster), TRUE)
+    , m_EMMC(&m_Interrupt, &m_Timer, &m_ActLED)
     ,
 #ifndef USB_GADGET_MODE
     m_pUSB(new CUSBHCIDevice(&m_Interrupt, &m_Timer, TRUE))
@@ -96,6 +97,14 @@ boolean CKernel::Initialize(void)
 		bOK = m_I2CMaster.Initialize();
 	}
 
+	if (bOK) {
+		// only wavetables are read from the card; without one, patches
+		// that name a wavetable fail to load and everything else works
+		if (!m_EMMC.Initialize() || f_mount(&m_FileSystem, "SD:", 1) != FR_OK) {
+			m_Logger.Write(FromKernel, LogWarning, "Cannot mount SD card; no wavetables");
+		}
+	}
+
 	if (bOK) {
 		assert(m_pUSB);
 		bOK = m_pUSB->Initialize();
@@ -21,6 +21,7 @@
 #define _kernel_h
 
 #include "miniorgan.h"
+#include <SDCard/emmc.h>
 #include <circle/actled.h>
 #include <circle/devicenameservice.h>
 #include <circle/exceptionhandler.h>
@@ -32,6 +33,7 @@
 #include <circle/timer.h>
 #include <circle/types.h>
 #include <circle/usb/usbcontroller.h>
+#include <fatfs/ff.h>
 
 // #include <circle/usb/usbhcidevice.h>
 
@@ -62,6 +64,8 @@ class CKernel {
 	CTimer m_Timer;
 	CLogger m_Logger;
 	CI2CMaster m_I2CMaster;
+	CEMMCDevice m_EMMC;
+	FATFS m_FileSystem; // SD:, where wavetables are read from
 	CUSBController* m_pUSB;
 
 	// for ethernet
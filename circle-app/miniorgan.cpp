@@ -26,42 +26,35 @@
 
 #include <circle/startup.h>
 #include <circle/string.h>
-
+#include <circle/synchronize.h>
+#include <fatfs/ff.h>
+
+#include "../common/arena.h"
+#include "../common/capture.h"
+#include "../common/controls.h"
+#include "../common/crc32.h"
+#include "../common/midi.h"
+#include "../common/mixdown.h"
+#include "../common/note_queue.h"
+#include "../common/parts.h"
+#include "../common/patch_bank.h"
+#include "../common/patch_bin.h"
+#include "../common/serial_frame.h"
 #include "../common/synth.h"
+#include "../common/trace.h"
+#include "../common/wavetable.h"
 #include "patch_contents.h"
+#include "sdcard.h"
 #include "voicemanager.h"
 
 #define VOLUME_PERCENT 20
 
-#define MIDI_NOTE_OFF 0b1000
-#define MIDI_NOTE_ON 0b1001
-#define MIDI_CC 0b1011
-
-#define MIDI_CC_VOLUME 7
-
 #define KEY_NONE 255
 
 #define CHUNK_BUF_NUM_ELEM 1024 * 2
 
 static const char FromMiniOrgan[] = "organ";
 
-// See: http://www.deimos.ca/notefreqs/
-const float CMiniOrgan::s_KeyFrequency[/* MIDI key number */] = {
-	8.17580, 8.66196, 9.17702, 9.72272, 10.3009, 10.9134, 11.5623, 12.2499, 12.9783, 13.7500,
-	14.5676, 15.4339, 16.3516, 17.3239, 18.3540, 19.4454, 20.6017, 21.8268, 23.1247, 24.4997,
-	25.9565, 27.5000, 29.1352, 30.8677, 32.7032, 34.6478, 36.7081, 38.8909, 41.2034, 43.6535,
-	46.2493, 48.9994, 51.9131, 55.0000, 58.2705, 61.7354, 65.4064, 69.2957, 73.4162, 77.7817,
-	82.4069, 87.3071, 92.4986, 97.9989, 103.826, 110.000, 116.541, 123.471, 130.813, 138.591,
-	146.832, 155.563, 164.814, 174.614, 184.997, 195.998, 207.652, 220.000, 233.082, 246.942,
-	261.626, 277.183, 293.665, 311.127, 329.628, 349.228, 369.994, 391.995, 415.305, 440.000,
-	466.164, 493.883, 523.251, 554.365, 587.330, 622.254, 659.255, 698.456, 739.989, 783.991,
-	830.609, 880.000, 932.328, 987.767, 1046.50, 1108.73, 1174.66, 1244.51, 1318.51, 1396.91,
-	1479.98, 1567.98, 1661.22, 1760.00, 1864.66, 1975.53, 2093.00, 2217.46, 2349.32, 2489.02,
-	2637.02, 2793.83, 2959.96, 3135.96, 3322.44, 3520.00, 3729.31, 3951.07, 4186.01, 4434.92,
-	4698.64, 4978.03, 5274.04, 5587.65, 5919.91, 6271.93, 6644.88, 7040.00, 7458.62, 7902.13,
-	8372.02, 8869.84, 9397.27, 9956.06, 10548.1, 11175.3, 11839.8, 12543.9
-};
-
 const TNoteInfo CMiniOrgan::s_Keys[] = {
 	{ ',', 72 }, // C4
 	{ 'M', 71 }, // B4
@@ -78,11 +71,34 @@ const TNoteInfo CMiniOrgan::s_Keys[] = {
 	{ 'Z', 60 } // C3
 };
 
-#define SERIAL_BUFFER_SIZE 1024 * 100
+// the largest payload a frame header can announce
+#define SERIAL_BUFFER_SIZE 65535
+
+// All engine state is carved out of static arenas in the constructor; after
+// that nothing on the audio path touches the heap. Per core voice state lives
+// in VoiceManager's arenas, everything else in this one.
+#define ENGINE_ARENA_SIZE (ARENA_SIZE(sizeof(struct key) * MAX_KEYS) \
+    + ARENA_SIZE(CHUNK_BUF_NUM_ELEM * sizeof(u32)) \
+    + 3 * ARENA_SIZE(sizeof(struct patch)) \
+    + ARENA_SIZE(sizeof(struct patch_bank)) \
+    + ARENA_SIZE(sizeof(struct parts)) \
+    + ARENA_SIZE(sizeof(struct note_queue)) \
+    + ARENA_SIZE(sizeof(struct capture)) \
+    + ARENA_SIZE(sizeof(struct serial_frame)) \
+    + ARENA_SIZE(SERIAL_BUFFER_SIZE))
 
-#define SERIAL_BUFFER_STATE_INIT 0
-#define SERIAL_BUFFER_STATE_NEW_PACKET 1
-#define SERIAL_BUFFER_STATE_PAYLOAD 2
+static u8 s_EngineArenaMem[ENGINE_ARENA_SIZE] __attribute__((aligned(CACHE_LINE)));
+
+// Wavetables are far too big for the kernel image, so theirs is the one arena
+// taken from the heap, once, in the constructor. 16 MB holds three tables of
+// 256 frames, or hundreds of single cycles.
+#define WAVETABLE_ARENA_SIZE (16 << 20)
+
+// where the patch bank is read from, see LoadBank()
+#define BANK_DIR "SD:/patches"
+
+// the multi-timbral setup, see LoadParts()
+#define PARTS_FILE "SD:/parts.txt"
 
 #define RAND_MAX 32767
 
@@ -114,9 +130,9 @@ CMiniOrgan::CMiniOrgan(CInterruptSystem* pInterrupt, CI2CMaster* pI2CMaster)
 #endif
 #endif
           )
-    , voice_manager(CMemorySystem::Get())
     , m_pMIDIDevice(0)
     , m_pKeyboard(0)
+    , voice_manager(CMemorySystem::Get())
     ,
 #if RASPPI <= 3 && defined(USE_USB_FIQ)
     m_Serial(pInterrupt, FALSE)
@@ -130,18 +146,10 @@ CMiniOrgan::CMiniOrgan(CInterruptSystem* pInterrupt, CI2CMaster* pI2CMaster)
     , m_nSampleCount(0)
     , m_nPrevFrequency(0)
     , m_bSetVolume(FALSE)
-    , m_nPitchBend(0.f)
     , m_uchVolume(127)
-    , m_modulation(0.f)
-    , m_noise(0)
-    , m_detune(0)
-    , serial_buffer_state(0)
 {
 	s_pThis = this;
 
-	params = static_cast<struct params*>(::operator new(sizeof(struct params)));
-	memset(params, 0, sizeof(struct params));
-	voice_manager.params = params;
 
 	m_nLowLevel = GetRangeMin() * VOLUME_PERCENT / 100;
 	m_nHighLevel = GetRangeMax() * VOLUME_PERCENT / 100;
@@ -153,25 +161,56 @@ CMiniOrgan::CMiniOrgan(CInterruptSystem* pInterrupt, CI2CMaster* pI2CMaster)
 
 	// hackmsg[0] = '\0';
 
-	chunkBuff = static_cast<u32*>(::operator new(CHUNK_BUF_NUM_ELEM * 4));
+	// the arenas are sized for exactly what is allocated here, so none of
+	// these can fail unless the two get out of step; Initialize() checks
+	arena_init(&arena, s_EngineArenaMem, ENGINE_ARENA_SIZE);
+
+	mixdown_init(&master, m_uchVolume / 127.f, m_nNullLevel, m_nDiffLevel, 2);
+
+	chunkBuff = static_cast<u32*>(arena_alloc(&arena, CHUNK_BUF_NUM_ELEM * sizeof(u32)));
 
 	keys = 0;
-	synth_new(&keys);
-
-	// TODO move this into common
-	// size_t key_bytes = sizeof(struct key) * MAX_KEYS;
-	// size_t osc_bytes = sizeof(struct osc) * NUM_OSCS * NUM_OSC_TYPES;
-	// keys = static_cast<struct key*>(::operator new(key_bytes));
-	// memset(keys, 0, key_bytes);
-	// for (size_t i = 0; i < MAX_KEYS; i++) {
-	// 	keys[i].oscs = static_cast<struct osc*>(::operator new(osc_bytes));
-	// 	memset(keys[i].oscs, 0, osc_bytes);
-	// }
-
-	LoadPatch(patch_contents);
-
-	serial_buffer = new u8[SERIAL_BUFFER_SIZE];
-	serial_buffer_len = 0;
+	synth_new(&keys, &arena, voice_manager.GetCoreArenas(), VOICE_CORES);
+
+	default_patch = static_cast<struct patch*>(arena_alloc(&arena, sizeof(struct patch)));
+	serial_patches[0] = static_cast<struct patch*>(arena_alloc(&arena, sizeof(struct patch)));
+	serial_patches[1] = static_cast<struct patch*>(arena_alloc(&arena, sizeof(struct patch)));
+	staging_patch = serial_patches[0];
+	pending_patch = 0;
+	for (int i = 0; i < MAX_PARTS; i++) {
+		m_nProgram[i] = -1;
+	}
+	if (patch_compile(patch_contents, sizeof(patch_contents) - 1, default_patch) != 0) {
+		tmp.Format("loading patch failed: %s;", load_patch_err());
+		hackmsg.Append(tmp);
+	}
+
+	parts = static_cast<struct parts*>(arena_alloc(&arena, sizeof(struct parts)));
+
+	notes = static_cast<struct note_queue*>(arena_alloc(&arena, sizeof(struct note_queue)));
+	note_queue_init(notes);
+
+	capture = static_cast<struct capture*>(arena_alloc(&arena, sizeof(struct capture)));
+	capture_init(capture, SAMPLE_RATE, 1024);
+
+	u8* pWavetableMem = new u8[WAVETABLE_ARENA_SIZE + CACHE_LINE];
+	arena_init(&wavetable_arena, pWavetableMem + (CACHE_LINE - (uintptr)pWavetableMem % CACHE_LINE) % CACHE_LINE, WAVETABLE_ARENA_SIZE);
+	wavetable_init(&wavetable_arena);
+
+	// the bank's patches come from the heap too, about a megabyte for all 128
+	u8* pBankMem = new u8[PATCH_BANK_ARENA_BYTES + CACHE_LINE];
+	arena_init(&bank_arena, pBankMem + (CACHE_LINE - (uintptr)pBankMem % CACHE_LINE) % CACHE_LINE, PATCH_BANK_ARENA_BYTES);
+	bank = static_cast<struct patch_bank*>(arena_alloc(&arena, sizeof(struct patch_bank)));
+	patch_bank_init(bank, &bank_arena);
+
+	// a single part until Initialize() reads the setup off the SD card
+	struct part_setup Setup;
+	part_setup_default(&Setup);
+	SetupParts(&Setup);
+
+	serial_buffer = static_cast<u8*>(arena_alloc(&arena, SERIAL_BUFFER_SIZE));
+	serial_frame = static_cast<struct serial_frame*>(arena_alloc(&arena, sizeof(struct serial_frame)));
+	serial_frame_init(serial_frame, serial_buffer, SERIAL_BUFFER_SIZE);
 }
 
 CMiniOrgan::~CMiniOrgan(void)
@@ -184,9 +223,37 @@ boolean CMiniOrgan::Initialize(void)
 	CLogger::Get()->Write(FromMiniOrgan, LogNotice,
 	    "Please atttttttttach an USB keyboard or use serial MIDI!");
 
+	CString tmp;
+	tmp.Format("engine arena: %u of %u bytes used", (unsigned)arena.wanted, (unsigned)arena.size);
+	CLogger::Get()->Write(FromMiniOrgan, LogNotice, tmp);
+	voice_manager.ReportArenas();
+	boolean bArenasFit = arena.wanted <= arena.size;
+	for (unsigned nCore = 0; nCore < CORES; nCore++) {
+		const struct arena* a = &voice_manager.GetCoreArenas()[nCore];
+		bArenasFit = bArenasFit && a->wanted <= a->size;
+	}
+	if (!bArenasFit) {
+		CLogger::Get()->Write(FromMiniOrgan, LogError, "engine state does not fit in its arenas");
+		return FALSE;
+	}
+
+#ifdef TRACE
+	trace_init();
+	trace_name_core(0, "core 0 (main, voices)");
+	for (unsigned nCore = 1; nCore < VOICE_CORES; nCore++) {
+		trace_name_core(nCore, "voices");
+	}
+	trace_name_core(FX_CORE, "effects (voices when there are none)");
+#endif
+
 	// TODO error checking
 	voice_manager.Initialize(keys);
 
+	// the kernel has mounted the card by now; each part starts on its
+	// program, if the bank has it
+	LoadBank();
+	LoadParts();
+
 	if (m_Serial.Initialize(115200)) {
 		m_bUseSerial = TRUE;
 
@@ -196,36 +263,261 @@ boolean CMiniOrgan::Initialize(void)
 	return FALSE;
 }
 
-void CMiniOrgan::LoadPatch(const char* patch)
+void CMiniOrgan::LoadPatch(const char* src, size_t len)
 {
-	synth_clear(keys);
-
 	CString tmp;
-	int n = strlen(patch);
-	char* patch_contents_copy = static_cast<char*>(::operator new(n + 1));
 
-	for (size_t i = 0; i < MAX_KEYS; i++) {
-		tmp.Format("loading patch for key %p (freq set to %f);", &keys[i], keys[i].freq);
+	if (pending_patch != 0) {
+		// the staging slot is still waiting to be swapped in
+		hackmsg.Append("patch swap already pending; ignoring new patch;");
+		return;
+	}
+
+	// the text is parsed once; voices copy the compiled patch at note-on.
+	// Compiling into the staging slot leaves the active patch untouched, so
+	// nothing sounding is disturbed until FillChunkBuff swaps it in.
+	int err;
+	if (patch_bin_detect(src, len)) {
+		err = patch_bin_load(src, len, staging_patch);
+	} else {
+		err = patch_compile(src, len, staging_patch);
+	}
+	if (err != 0) {
+		tmp.Format("loading patch failed: %s;", load_patch_err());
 		hackmsg.Append(tmp);
-		strcpy(patch_contents_copy, patch);
-		if (load_patch(patch_contents_copy, keys[i].oscs) != 0) {
-			tmp.Format("loading patch for key %p failed: %s;", &keys[i], load_patch_err());
+		return;
+	}
+	__atomic_store_n(&pending_patch, staging_patch, __ATOMIC_RELEASE);
+}
+
+// Called between blocks, while the other cores are idle: swaps a patch sent
+// over serial into the first part, then the programs Program Changes asked
+// for into their parts, if any.
+void CMiniOrgan::SwapPendingPatch()
+{
+	struct patch* p = __atomic_load_n(&pending_patch, __ATOMIC_ACQUIRE);
+	if (p != 0) {
+		SwapTo(0, p);
+		__atomic_store_n(&pending_patch, (struct patch*)0, __ATOMIC_RELEASE);
+	}
+
+	for (int i = 0; i < parts->setup.num_parts; i++) {
+		int nProgram = __atomic_exchange_n(&m_nProgram[i], -1, __ATOMIC_ACQUIRE);
+		if (nProgram < 0) {
+			continue;
+		}
+		p = patch_bank_get(bank, nProgram);
+		if (p != 0) {
+			SwapTo(i, p);
+		} else {
+			CString tmp;
+			tmp.Format("part %d: no patch for program %d;", i + 1, nProgram);
 			hackmsg.Append(tmp);
-			return;
 		}
 	}
+}
+
+// The MIDI interrupt reads the part's CC maps (controls_cc), so it is held
+// off while the patch changes.
+void CMiniOrgan::SwapTo(int nPart, struct patch* p)
+{
+	EnterCritical(IRQ_LEVEL);
+	parts_swap(parts, keys, nPart, p, SAMPLE_RATE);
+	LeaveCritical();
+
+	if (nPart == 0) {
+		// a bank patch frees both serial ones
+		staging_patch = p == serial_patches[0] ? serial_patches[1] : serial_patches[0];
+	}
+
+	capture_patch(capture, m_nSampleCount, nPart, p);
+}
+
+// Puts every part on the built-in patch, and asks for its program to be
+// swapped in by the next FillChunkBuff. Only while nothing is sounding.
+void CMiniOrgan::SetupParts(const struct part_setup* pSetup)
+{
+	parts_init(parts, pSetup, default_patch);
+	staging_patch = serial_patches[0];
+	capture_set_parts(capture, pSetup);
+	for (int i = 0; i < pSetup->num_parts; i++) {
+		capture_patch(capture, m_nSampleCount, i, default_patch);
+		int nProgram = pSetup->parts[i].program;
+		if (nProgram != PART_NO_PROGRAM && patch_bank_get(bank, nProgram) != 0) {
+			m_nProgram[i] = nProgram;
+		}
+	}
+}
+
+// Reads the multi-timbral setup from PARTS_FILE (see common/parts.h); without
+// one, a single part plays every channel. Called once, at boot, after the
+// bank is loaded.
+void CMiniOrgan::LoadParts()
+{
+	CString tmp;
+
+	struct part_setup Setup;
+	part_setup_default(&Setup);
+	size_t nLen = 0;
+	u8* pData = ReadSDFile(PARTS_FILE, &nLen);
+	if (pData != 0) {
+		if (part_setup_parse((const char*)pData, nLen, &Setup) != 0) {
+			tmp.Format(PARTS_FILE ": %s; playing a single part", load_patch_err());
+			CLogger::Get()->Write(FromMiniOrgan, LogWarning, tmp);
+		}
+		delete[] pData;
+	}
+	SetupParts(&Setup);
+
+	for (int i = 0; i < Setup.num_parts; i++) {
+		const struct part* pPart = &Setup.parts[i];
+		CString Channel;
+		if (pPart->channel == PART_OMNI) {
+			Channel = "every channel";
+		} else {
+			Channel.Format("channel %d", pPart->channel);
+		}
+		CString Program;
+		if (pPart->program == PART_NO_PROGRAM) {
+			Program = "the built-in patch";
+		} else if (m_nProgram[i] < 0) {
+			Program.Format("program %d (not in the bank)", pPart->program);
+		} else {
+			Program.Format("program %d", pPart->program);
+		}
+		tmp.Format("part %d: %s, keys %d-%d, %s, %d voices, priority %d", i + 1, (const char*)Channel,
+		    pPart->lo, pPart->hi, (const char*)Program, pPart->max_voices, pPart->priority);
+		CLogger::Get()->Write(FromMiniOrgan, LogNotice, tmp);
+	}
+}
+
+// Compiles the patches in BANK_DIR into the bank, skipping files that haven't
+// changed since the last time; see common/patch_bank.h. Called at boot and
+// when asked over serial, on core 0 between blocks, so audio stops while the
+// card is read.
+void CMiniOrgan::LoadBank()
+{
+	CString tmp;
+
+	DIR Dir;
+	if (f_opendir(&Dir, BANK_DIR) != FR_OK) {
+		CLogger::Get()->Write(FromMiniOrgan, LogNotice, "no " BANK_DIR " on the SD card; no patch bank");
+		return;
+	}
 
-	for (int i = 0; i < MAX_KEYS; i++) {
-		for (int j = 0; j < NUM_OSCS * NUM_OSC_TYPES; j++) {
-			struct osc* osc = &keys[i].oscs[j];
-			if (osc->osc_type == OSC_TYPE_VFO) {
-				tmp.Format("%d,%d is VFO type; ", i, j);
-				hackmsg.Append(tmp);
+	patch_bank_begin(bank);
+	boolean bReswap[MAX_PARTS] = { FALSE };
+	unsigned nCompiled = 0;
+	FILINFO Info;
+	while (f_readdir(&Dir, &Info) == FR_OK && Info.fname[0] != '\0') {
+		if ((Info.fattrib & AM_DIR) || patch_bank_program(Info.fname) < 0) {
+			continue;
+		}
+		CString Path;
+		Path.Format(BANK_DIR "/%s", Info.fname);
+		size_t nLen = 0;
+		u8* pData = ReadSDFile(Path, &nLen);
+		if (pData == 0) {
+			tmp.Format("can't read %s", (const char*)Path);
+			CLogger::Get()->Write(FromMiniOrgan, LogWarning, tmp);
+			continue;
+		}
+
+		int nProgram;
+		int nResult = patch_bank_offer(bank, Info.fname, pData, nLen, &nProgram);
+		delete[] pData;
+		switch (nResult) {
+		case PATCH_BANK_COMPILED: {
+			// one that's playing is overwritten in place, so swap it in again
+			boolean bPlaying = FALSE;
+			for (int i = 0; i < parts->setup.num_parts; i++) {
+				if (parts->patch[i] == patch_bank_slot(bank, nProgram)) {
+					bReswap[i] = TRUE;
+					bPlaying = TRUE;
+				}
+			}
+			if (bPlaying) {
+				EnterCritical(IRQ_LEVEL);
+				patch_bank_store(bank);
+				LeaveCritical();
+			} else {
+				patch_bank_store(bank);
 			}
+			nCompiled++;
+			break;
+		}
+		case PATCH_BANK_FAILED:
+			tmp.Format("%s: %s", Info.fname, load_patch_err());
+			CLogger::Get()->Write(FromMiniOrgan, LogWarning, tmp);
+			break;
+		case PATCH_BANK_DUPLICATE:
+			tmp.Format("%s: another file is already program %d; ignored", Info.fname, nProgram);
+			CLogger::Get()->Write(FromMiniOrgan, LogWarning, tmp);
+			break;
+		case PATCH_BANK_NO_MEMORY:
+			tmp.Format("%s: out of memory for the patch bank", Info.fname);
+			CLogger::Get()->Write(FromMiniOrgan, LogWarning, tmp);
+			break;
+		}
+	}
+	f_closedir(&Dir);
+
+	int nLoaded = patch_bank_end(bank);
+	tmp.Format("patch bank: %d programs, %u compiled", nLoaded, nCompiled);
+	CLogger::Get()->Write(FromMiniOrgan, LogNotice, tmp);
+
+	for (int i = 0; i < parts->setup.num_parts; i++) {
+		if (bReswap[i]) {
+			SwapTo(i, parts->patch[i]);
+		}
+	}
+}
+
+// Serial is handled on core 0 between calls to FillChunkBuff, so the other
+// cores are idle and this is already a block boundary. Notes are queued by
+// the MIDI interrupt rather than played from it, so nothing else touches the
+// voices or the patch's oscillators meanwhile.
+void CMiniOrgan::SetParams(const u8* data, size_t len)
+{
+	CString tmp;
+
+	size_t n = len / sizeof(struct serial_param);
+	if (n * sizeof(struct serial_param) != len) {
+		tmp.Format("ignoring %d bytes of parameters; not a whole number of records", (int)len);
+		CLogger::Get()->Write(FromMiniOrgan, LogNotice, tmp);
+		return;
+	}
+
+	// A bank program or the built-in patch may be other parts' too, and is
+	// what a later Program Change expects to find, so the first part moves
+	// onto a serial slot of its own before its patch is edited.
+	struct patch* pLive = parts->patch[0];
+	if (pLive != serial_patches[0] && pLive != serial_patches[1]) {
+		struct patch* pCopy = pending_patch == serial_patches[0] ? serial_patches[1] : serial_patches[0];
+		patch_copy(pCopy, pLive);
+		EnterCritical(IRQ_LEVEL);
+		parts_move(parts, 0, pCopy);
+		LeaveCritical();
+		if (pending_patch == 0) {
+			staging_patch = pCopy == serial_patches[0] ? serial_patches[1] : serial_patches[0];
+		}
+	}
+
+	int failed = 0;
+	for (size_t i = 0; i < n; i++) {
+		struct serial_param p;
+		memcpy(&p, data + i * sizeof(p), sizeof(p));
+		failed |= synth_set_param(parts->patch[0], keys, 0, p.osc_index, p.param, p.value);
+		// SetParams runs between blocks, so this is the next block's start
+		capture_param(capture, m_nSampleCount, p.osc_index, p.param, p.value);
+		if (pending_patch != 0) {
+			// keep the edit when the pending patch is swapped in
+			synth_set_param(pending_patch, 0, 0, p.osc_index, p.param, p.value);
 		}
 	}
 
-	delete patch_contents_copy;
+	tmp.Format("set %d parameters%s", (int)n, failed ? "; some were invalid" : "");
+	CLogger::Get()->Write(FromMiniOrgan, LogNotice, tmp);
 }
 
 void CMiniOrgan::Process(boolean bPlugAndPlayUpdated)
@@ -234,6 +526,7 @@ void CMiniOrgan::Process(boolean bPlugAndPlayUpdated)
 	// CLogger::Get ()->Write (FromMiniOrgan, LogNotice, "Process called");
 
 	if (hackmsg.GetLength() > 0) {
+		TRACE_SCOPE(0, "logging");
 		CLogger::Get()->Write(FromMiniOrgan, LogNotice, hackmsg);
 		hackmsg.Format("");
 	}
@@ -254,7 +547,9 @@ void CMiniOrgan::Process(boolean bPlugAndPlayUpdated)
 		num_underruns = 0;
 	}
 
+	TRACE_BEGIN(0, "serial");
 	CheckSerialForUpdates();
+	TRACE_END(0, "serial");
 
 	// The sound controller is callable from TASK_LEVEL only. That's why we must do
 	// this here and not in MIDIPacketHandler(), which is called from IRQ_LEVEL too.
@@ -280,7 +575,6 @@ void CMiniOrgan::Process(boolean bPlugAndPlayUpdated)
 		}
 	}
 
-	set_knobs();
 	FillChunkBuff();
 
 	if (m_pMIDIDevice != 0) {
@@ -319,40 +613,27 @@ void CMiniOrgan::Process(boolean bPlugAndPlayUpdated)
 
 unsigned CMiniOrgan::GetChunk(u32* pBuffer, unsigned nChunkSize)
 {
-	// CString tmp;
-	unsigned nChannels = GetHWTXChannels();
 	assert(s_pThis != 0);
 
-	unsigned chunksNeeded = nChunkSize / nChannels;
+	// chunkBuff is already in the device's format and channel layout
+	unsigned nReady = 0;
 	if (chunk_ready) {
-		for (unsigned i = 0; i < chunksNeeded; i++) {
-			for (unsigned j = 0; j < nChannels; j++) {
-				*pBuffer++ = s_pThis->chunkBuff[i];
-			}
-		}
+		nReady = nChunkSize < CHUNK_BUF_NUM_ELEM ? nChunkSize : CHUNK_BUF_NUM_ELEM;
+		memcpy(pBuffer, s_pThis->chunkBuff, nReady * sizeof(u32));
 		chunk_ready = 0;
+		TRACE_INSTANT(0, "chunk taken");
 	} else {
-		for (unsigned i = 0; i < chunksNeeded; i++) {
-			for (unsigned j = 0; j < nChannels; j++) {
-				*pBuffer++ = (u32)m_nNullLevel;
-			}
-		}
 		num_underruns++;
+		// keep the blocks that led up to it until the trace is dumped
+		TRACE_INSTANT(0, "underrun");
+		TRACE_STOP();
+	}
+	for (unsigned i = nReady; i < nChunkSize; i++) {
+		pBuffer[i] = (u32)m_nNullLevel;
 	}
 	return nChunkSize;
 }
 
-void CMiniOrgan::set_knobs()
-{
-
-	// range from 0.0 (never changes) to 1.0 (instant change)
-	// const float freq_smoothing = 0.0001f;
-	// s_pThis->voice_manager.params->pitch = m_nPitchBend * freq_smoothing + s_pThis->voice_manager.params->pitch * (1.0f - freq_smoothing);
-
-	s_pThis->voice_manager.params->pitch = m_nPitchBend;
-	s_pThis->voice_manager.params->mod = m_modulation;
-}
-
 void CMiniOrgan::FillChunkBuff()
 {
 	assert(s_pThis != 0);
@@ -360,65 +641,55 @@ void CMiniOrgan::FillChunkBuff()
 	if (chunk_ready) {
 		return; // waiting to be consumed
 	}
-
-	// fill the whole buffer
-	unsigned numToWrite = CHUNK_BUF_NUM_ELEM - chunkBuffReadAvail;
-
+	TRACE_SCOPE(0, "block");
+
+	TRACE_BEGIN(0, "swap patch");
+	SwapPendingPatch();
+	TRACE_END(0, "swap patch");
+	// notes played during the previous block start at the beginning of this
+	// one, the same time they got when played straight from the interrupt
+	TRACE_BEGIN(0, "notes");
+	note_queue_apply(notes, keys, parts, ((float)m_nSampleCount) / SAMPLE_RATE);
+	TRACE_END(0, "notes");
+	// MIDI from now on is heard from the next block (a controller that lands
+	// before controls_publish below is, strictly, heard a block early)
+	capture_set_clock(capture, m_nSampleCount + 1024);
+	voice_manager.num_parts = parts->setup.num_parts;
+	for (int i = 0; i < parts->setup.num_parts; i++) {
+		voice_manager.controls[i] = controls_publish(&parts->controls[i], parts->patch[i], SAMPLE_RATE, 1024);
+	}
+	// the master effects are the first part's
+	voice_manager.fx = &parts->patch[0]->fx;
 	voice_manager.ProduceOutput(m_nSampleCount);
 
-	for (unsigned chunk_i = 0; chunk_i < 1024; chunk_i++) {
-		m_nSampleCount++;
-		if (m_nSampleCount == 0) {
-			CString tmp;
-			tmp.Format("m_nSampleCount rolled over;");
-			hackmsg.Append(tmp);
-			// TODO adjust all the pressed_at / released_at times? or just clear all keys?
-		}
-
-		float output = voice_manager.GetOutput(chunk_i);
-
-		if (output > 1.0f) {
-			output = 1.0f;
-		} else if (output < -1.0f) {
-			output = -1.0f;
-		}
-
-		u32 nSample = (u32)m_nNullLevel + output * m_nDiffLevel * (m_uchVolume / 127.f);
-
-		chunkBuff[chunk_i] = nSample;
-		chunkBuffReadAvail++;
-		numToWrite--;
+	unsigned long nPrevSampleCount = m_nSampleCount;
+	m_nSampleCount += 1024;
+	if (m_nSampleCount < nPrevSampleCount) {
+		CString tmp;
+		tmp.Format("m_nSampleCount rolled over;");
+		hackmsg.Append(tmp);
+		// TODO adjust all the pressed_at / released_at times? or just clear all keys?
 	}
 
-	chunk_ready = 1;
-}
+	// ramp to the volume set by MIDI CC 7 over the block, and convert to the
+	// device's format in one pass
+	const float* output[CORES];
+	int nOutputs = voice_manager.GetOutput(output);
+	master.channels = GetHWTXChannels();
+	assert(1024 * master.channels <= CHUNK_BUF_NUM_ELEM);
+	TRACE_BEGIN(0, "mixdown");
+	mixdown_u32(&master, output, nOutputs, 1024, m_uchVolume / 127.f, chunkBuff);
+	TRACE_END(0, "mixdown");
 
-// Note that circle comes with ether_crc; which also includes the bits
-// this function only does the first half, so it matches python's zlib.crc32 function
-u32 crc(size_t ulLength, const u8* pData)
-{
-	u32 nCRC = ~0;
-	while (ulLength--) {
-		nCRC ^= *pData++;
-
-		for (unsigned i = 0; i < 8; i++) {
-			nCRC = (nCRC >> 1) ^ ((nCRC & 1) ? 0xEDB88320 : 0);
-		}
-	}
-	return ~nCRC;
+	chunk_ready = 1;
 }
 
 void CMiniOrgan::CheckSerialForUpdates()
 {
-
 	CString tmp;
 
-	int maxRead = SERIAL_BUFFER_SIZE - serial_buffer_len;
-	if (maxRead > 1024) {
-		maxRead = 1024;
-	}
-
-	int nResult = m_Serial.Read(serial_buffer + serial_buffer_len, maxRead);
+	u8 buf[1024];
+	int nResult = m_Serial.Read(buf, sizeof(buf));
 	if (nResult == 0) {
 		return;
 	}
@@ -428,63 +699,104 @@ void CMiniOrgan::CheckSerialForUpdates()
 		return;
 	}
 
-	serial_buffer_len += nResult;
-
-	const char* reboot_magic_string = "magic-reboot-string-omg";
-	if (memmem(serial_buffer, serial_buffer_len, reboot_magic_string, strlen(reboot_magic_string))) {
-		tmp.Format("found a reboot");
-		CLogger::Get()->Write(FromMiniOrgan, LogNotice, tmp);
-		reboot();
-		assert(0); // should never get here
-	}
-
-	const char* packet_magic_header = "here-comes-a-new-patch";
-	u8* packet_start = (u8*)memmem(serial_buffer, serial_buffer_len, packet_magic_header, strlen(packet_magic_header));
-	if (packet_start) {
-		size_t payload_start_offset = (packet_start - serial_buffer) + (size_t)strlen(packet_magic_header);
-		memmove(serial_buffer, serial_buffer + payload_start_offset, serial_buffer_len - payload_start_offset);
-		serial_buffer_len -= payload_start_offset;
-		serial_buffer_state = SERIAL_BUFFER_STATE_NEW_PACKET;
-		tmp.Format("packet found; remaining bytes in buffer: %d", serial_buffer_len);
-		CLogger::Get()->Write(FromMiniOrgan, LogNotice, tmp);
+	size_t off = 0;
+	while (off < (size_t)nResult) {
+		size_t used = 0;
+		int event = serial_frame_feed(serial_frame, buf + off, nResult - off, &used);
+		off += used;
+
+		switch (event) {
+		case SERIAL_FRAME_NONE:
+			break;
+		case SERIAL_FRAME_REBOOT:
+			CLogger::Get()->Write(FromMiniOrgan, LogNotice, "found a reboot");
+			reboot();
+			assert(0); // should never get here
+			break;
+		case SERIAL_FRAME_PATCH:
+			tmp.Format("got all %d bytes; and the crc matches", (int)serial_frame->payload_len);
+			CLogger::Get()->Write(FromMiniOrgan, LogNotice, tmp);
+			LoadPatch((const char*)serial_frame->payload, serial_frame->payload_len);
+			break;
+		case SERIAL_FRAME_PARAMS:
+			SetParams(serial_frame->payload, serial_frame->payload_len);
+			break;
+		case SERIAL_FRAME_TRACE:
+			SendTrace();
+			break;
+		case SERIAL_FRAME_CAPTURE:
+			SendCapture();
+			break;
+		case SERIAL_FRAME_BANK:
+			LoadBank();
+			break;
+		case SERIAL_FRAME_BAD_CRC:
+			tmp.Format("got all %d bytes; calculated crc is %u but expect %u", (int)serial_frame->payload_len, serial_frame->crc, serial_frame->expected_crc);
+			CLogger::Get()->Write(FromMiniOrgan, LogNotice, tmp);
+			break;
+		case SERIAL_FRAME_TOO_LONG:
+			tmp.Format("ignoring packet of %d bytes; the limit is %d", (int)serial_frame->payload_len, SERIAL_BUFFER_SIZE);
+			CLogger::Get()->Write(FromMiniOrgan, LogNotice, tmp);
+			break;
+		}
 	}
+}
 
-	if (serial_buffer_state == SERIAL_BUFFER_STATE_NEW_PACKET && serial_buffer_len >= 6) {
-		serial_buffer_expected_payload = ((u16*)serial_buffer)[0];
-		serial_buffer_expected_crc = ((u32*)(serial_buffer + sizeof(u16)))[0];
-		serial_buffer_state = SERIAL_BUFFER_STATE_PAYLOAD;
-		memmove(serial_buffer, serial_buffer + 6, serial_buffer_len - 6);
-		serial_buffer_len -= 6;
-
-		tmp.Format("header found expected size=%d crc=%d; remaining bytes in buffer: %d", serial_buffer_expected_payload, serial_buffer_expected_crc, serial_buffer_len);
-		CLogger::Get()->Write(FromMiniOrgan, LogNotice, tmp);
+// the serial device takes only what fits in its transmit buffer; wait for
+// the interrupt to drain it and carry on
+static void WriteSerial(void* pUser, const void* pData, size_t n)
+{
+	CSerialDevice* pSerial = static_cast<CSerialDevice*>(pUser);
+	const u8* p = static_cast<const u8*>(pData);
+	while (n > 0) {
+		int nWritten = pSerial->Write(p, n);
+		if (nWritten < 0) {
+			return;
+		}
+		p += nWritten;
+		n -= nWritten;
 	}
+}
 
-	if (serial_buffer_state == SERIAL_BUFFER_STATE_PAYLOAD && serial_buffer_len >= serial_buffer_expected_payload) {
-
-		u32 calculated_crc = crc(serial_buffer_expected_payload, serial_buffer);
-		int crc2 = calculated_crc;
+#ifdef TRACE
+static void WriteTrace(void* pUser, const char* s, size_t n)
+{
+	WriteSerial(pUser, s, n);
+}
+#endif
 
-		if (calculated_crc == serial_buffer_expected_crc) {
-			tmp.Format("got all %d bytes; and the crc matches", serial_buffer_expected_payload);
-			serial_buffer[serial_buffer_expected_payload] = 0; // TODO potential +1 buffer overflow
-			LoadPatch((const char*)serial_buffer);
-		} else {
-			int crc = serial_buffer_expected_crc;
-			tmp.Format("got all %d bytes; calculated crc is %d but expect %d", serial_buffer_expected_payload, crc2, crc);
-		}
+// Called from CheckSerialForUpdates, so the other cores are idle and nothing
+// records meanwhile. Sending takes many blocks' worth of time; expect
+// underruns while it runs (they are not recorded; tracing is off).
+void CMiniOrgan::SendTrace()
+{
+#ifdef TRACE
+	static const char Begin[] = "trace-begins\n";
+	static const char End[] = "trace-ends\n";
+	WriteSerial(&m_Serial, Begin, sizeof(Begin) - 1);
+	trace_dump(WriteTrace, &m_Serial);
+	WriteSerial(&m_Serial, End, sizeof(End) - 1);
+#else
+	CLogger::Get()->Write(FromMiniOrgan, LogNotice, "asked for a trace, but built without TRACE");
+#endif
+}
 
-		CLogger::Get()->Write(FromMiniOrgan, LogNotice, tmp);
-		// TODO load the patch
-		serial_buffer_state = SERIAL_BUFFER_STATE_INIT;
-		serial_buffer_len = 0;
-	}
+// Sent as "capture-begins\n", a u32 length, then the dump itself; see
+// common/capture.h. Like SendTrace, this holds up audio while it's sent.
+void CMiniOrgan::SendCapture()
+{
+	static const char Begin[] = "capture-begins\n";
+	u32 nSize = capture_dump_size(capture);
+	WriteSerial(&m_Serial, Begin, sizeof(Begin) - 1);
+	WriteSerial(&m_Serial, &nSize, sizeof(nSize));
+	capture_dump(capture, WriteSerial, &m_Serial, m_nSampleCount);
 }
 
 void CMiniOrgan::MIDIPacketHandler(unsigned nCable, u8* pPacket, unsigned nLength)
 {
 	CString tmp;
 	assert(s_pThis != 0);
+	TRACE_SCOPE(0, "midi");
 
 	// CLogger::Get ()->Write (FromMiniOrgan, LogNotice,
 	//			"MIDIPacketHandler called");
@@ -500,96 +812,46 @@ void CMiniOrgan::MIDIPacketHandler(unsigned nCable, u8* pPacket, unsigned nLengt
 		return;
 	}
 
-	u8 ucStatus = pPacket[0];
-	// u8 ucChannel   = ucStatus & 0x0F;
-	u8 ucType = ucStatus >> 4;
-	u8 ucKeyNumber = pPacket[1];
-	u8 ucVelocity = pPacket[2];
-
 	if (nLength > 3) {
 		tmp.Format("MIDIPacketHandler error got overrun nLength %u;", nLength);
 		hackmsg.Append(tmp);
 		return;
 	}
 
-	// TODO deduplicate this (via macro or inline?)
-	float t = ((float)s_pThis->m_nSampleCount) / SAMPLE_RATE;
+	capture_midi(s_pThis->capture, pPacket);
 
-	if (ucType == MIDI_NOTE_ON) {
-		assert(ucKeyNumber < 128);
-		float freq = s_KeyFrequency[ucKeyNumber];
-		tmp.Format("%f MIDI_NOTE_ON key=%d;", freq, ucKeyNumber);
-		hackmsg.Append(tmp);
-		struct key* k = 0;
-		get_key(s_pThis->keys, freq, &k, TRUE);
-		if (k) {
-			bool keep_output = (k->freq == freq);
-			k->freq = freq;
-			if (ucVelocity > 127) {
-				ucVelocity = 127;
-			}
-			// tmp.Format("%f pressed at %f vel=%d keep_output=%d t=%f key=%p;", freq, t, ucVelocity, keep_output, t, k);
-			// hackmsg.Append(tmp);
-			k->velocity = (float)ucVelocity / 127.0;
-			k->pressed_at = t;
-			k->released_at = 0.0f;
-			for (int i = 0; i < NUM_OSCS; i++) {
-				struct osc* osc = &k->oscs[i];
-				osc->freq = freq;
-				if (keep_output) {
-					osc->output_volume_attack_start = osc->output_volume;
-				} else {
-					osc->output_volume_attack_start = 0;
-				}
-			}
-			for (int i = 0; i < NUM_OSCS; i++) {
-				struct osc* osc = &k->oscs[i + NUM_OSCS]; // LFOs are in the second set
-				if (osc->freq_sync) {
-					osc->freq = freq;
-				}
+	u8 ucType = pPacket[0] >> 4;
+	u8 ucKeyNumber = pPacket[1] & 0x7f;
+
+	if (ucType == MIDI_CC && pPacket[1] == MIDI_CC_VOLUME) {
+		s_pThis->m_uchVolume = pPacket[2];
+		s_pThis->m_bSetVolume = TRUE;
+		return;
+	}
+	if (ucType == MIDI_PROGRAM_CHANGE) {
+		// swapped into every part on the channel at the next block, see
+		// SwapPendingPatch()
+		const struct part_setup* pSetup = &s_pThis->parts->setup;
+		for (int i = 0; i < pSetup->num_parts; i++) {
+			if (part_hears(&pSetup->parts[i], pPacket[0])) {
+				s_pThis->m_nProgram[i] = pPacket[1] & 0x7f;
 			}
 		}
-	} else if (ucType == MIDI_NOTE_OFF) {
-		float freq = s_KeyFrequency[ucKeyNumber];
-		struct key* k = 0;
-		get_key(s_pThis->keys, freq, &k, FALSE);
-		if (k) {
-			k->released_at = t;
-		}
-	} else if (ucType == MIDI_CC) {
-		if (pPacket[1] == MIDI_CC_VOLUME) {
-			// hackmsg.Format("got MIDI_CC MIDI_CC_VOLUME");
-			s_pThis->m_uchVolume = pPacket[2];
-			s_pThis->m_bSetVolume = TRUE;
-		} else if (pPacket[1] == 1) {
-			// modulation
-			s_pThis->m_modulation = (float)pPacket[2] / 127.f; // 0.0 to 1.0
-			// hackmsg.Format("mod set to %f", s_pThis->m_modulation);
-		} else if (pPacket[1] == 74) {
-			// c1 dial
-			s_pThis->m_noise = pPacket[2];
-		} else if (pPacket[1] == 71) {
-			// c1 dial
-			s_pThis->m_detune = pPacket[2];
-		} else {
-			// TODO handle pPacket[1] == 1 (modulation)
-			// TODO handle pPacket[1] == 74 (c1)
-			// TODO handle pPacket[1] == 71 (c2)
-			// TODO handle pPacket[1] == 73 (c3)
-			// TODO handle pPacket[1] == 72 (c4)
-			hackmsg.Format("got MIDI_CC %u", pPacket[1]);
-		}
-	} else if (ucType == 14) {
-		if (pPacket[1] == 0) {
-			unsigned pitch_bend = pPacket[2]; // 64 is off (middle pos), range is 0 to 127
-			s_pThis->m_nPitchBend = ((float)pitch_bend - 64.f) / 64.f;
-			// hackmsg.Format("pitch bend %u -> %f", pitch_bend, s_pThis->m_nPitchBend); // 0 -> -1, 64 -> 0, 127 -> 0.97
-		} else {
-			hackmsg.Format("got ucType=14 %u %u", pPacket[1], pPacket[2]);
-		}
-	} else {
-		// TODO handle 14 (pitch bend)
-		hackmsg.Format("got unknown type %u", ucType);
+		return;
+	}
+	if (ucType == MIDI_NOTE_ON) {
+		tmp.Format("%f MIDI_NOTE_ON key=%d;", midi_key_freq[ucKeyNumber], ucKeyNumber);
+		hackmsg.Append(tmp);
+	}
+
+	switch (midi_apply(pPacket, s_pThis->notes, s_pThis->parts)) {
+	case MIDI_QUEUE_FULL:
+		hackmsg.Append(ucType == MIDI_NOTE_ON ? "note queue full; dropped note on;" : "note queue full; dropped note off;");
+		break;
+	case MIDI_UNHANDLED:
+		tmp.Format("got unhandled MIDI %u %u %u;", pPacket[0], pPacket[1], pPacket[2]);
+		hackmsg.Append(tmp);
+		break;
 	}
 }
 
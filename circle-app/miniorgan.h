@@ -54,6 +54,7 @@
 #include <circle/usb/usbkeyboard.h>
 #include <circle/usb/usbmidi.h>
 
+#include "../common/mixdown.h"
 #include "voicemanager.h"
 
 struct TNoteInfo {
@@ -62,6 +63,13 @@ struct TNoteInfo {
 };
 
 struct key;
+struct patch;
+struct serial_frame;
+struct parts;
+struct part_setup;
+struct note_queue;
+struct capture;
+struct patch_bank;
 
 class CMiniOrgan : public SOUND_CLASS {
     public:
@@ -84,22 +92,31 @@ class CMiniOrgan : public SOUND_CLASS {
 
 	static void USBDeviceRemovedHandler(CDevice* pDevice, void* pContext);
 
-	void set_knobs();
 	void FillChunkBuff();
 	void CheckSerialForUpdates();
-	void LoadPatch(const char* s);
+	void SendTrace();
+	void SendCapture();
+	void LoadPatch(const char* src, size_t len);
+	void LoadBank();
+	void LoadParts();
+	void SetupParts(const struct part_setup* pSetup);
+	void SwapPendingPatch();
+	void SwapTo(int nPart, struct patch* p);
+	void SetParams(const u8* data, size_t len);
 
 	u8* serial_buffer;
-	int serial_buffer_len;
-	int serial_buffer_state;
-	u16 serial_buffer_expected_payload;
-	u32 serial_buffer_expected_crc;
+	struct serial_frame* serial_frame;
 
     private:
 	CUSBMIDIDevice* volatile m_pMIDIDevice;
 	CUSBKeyboardDevice* volatile m_pKeyboard;
 
-	struct params* params;
+	struct arena arena; // everything but the per core state in voice_manager
+	struct arena wavetable_arena; // see common/wavetable.h
+	struct arena bank_arena; // the bank's patches
+	struct parts* parts; // the patch and controls of each MIDI channel or key range
+	struct note_queue* notes; // from the MIDI interrupt, applied by FillChunkBuff
+	struct capture* capture; // everything we're played with, for replaying on Linux
 	VoiceManager voice_manager;
 
 	CSerialDevice m_Serial;
@@ -114,24 +131,24 @@ class CMiniOrgan : public SOUND_CLASS {
 	int m_nCurrentLevel;
 	unsigned long m_nSampleCount;
 	unsigned m_nPrevFrequency;
-	float m_nPitchBend;
 
 	boolean m_bSetVolume;
 	u8 m_uchVolume;
-	float m_modulation;
-	u8 m_noise;
-	u8 m_detune;
 
 	unsigned m_nRandSeed;
 
-	u16 chunkBuffReadIndex;
-	u16 chunkBuffReadAvail;
-	u32* chunkBuff;
+	struct mixdown master;
+	u32* chunkBuff; // one block, ready to hand to the device
 
 	struct key* keys;
+	struct patch* default_patch; // patch_contents, which every part starts on
+	struct patch* serial_patches[2]; // for patches sent over serial, which go to the first part
+	struct patch* staging_patch; // LoadPatch compiles into this one, whichever of the two the first part isn't playing
+	struct patch* volatile pending_patch; // swapped in by the next FillChunkBuff
+	struct patch_bank* bank; // one patch per MIDI program, from the SD card
+	volatile int m_nProgram[MAX_PARTS]; // from a Program Change, swapped in by the next FillChunkBuff; -1 for none
 	// unsigned tt; // TODO can I use uint32_t instead?
 
-	static const float s_KeyFrequency[];
 	static const TNoteInfo s_Keys[];
 
 	static CMiniOrgan* s_pThis;
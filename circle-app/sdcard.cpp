@@ -0,0 +1,58 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Reading files from the SD card, which CKernel mounts as SD: with the fatfs
+// addon; also supplies common/wavetable.h's file hooks.
+
+#include "sdcard.h"
+#include <circle/string.h>
+#include <fatfs/ff.h>
+
+#include "../common/wavetable.h"
+
+// Only ever called from Process() on core 0, loading patches and the
+// wavetables they name, never while rendering.
+u8* ReadSDFile(const char* pPath, size_t* pLen)
+{
+	FIL File;
+	if (f_open(&File, pPath, FA_READ | FA_OPEN_EXISTING) != FR_OK) {
+		return 0;
+	}
+	FSIZE_t nSize = f_size(&File);
+	u8* pData = nSize > 0 ? new u8[nSize] : 0;
+	UINT nRead = 0;
+	if (pData == 0 || f_read(&File, pData, nSize, &nRead) != FR_OK || nRead != nSize) {
+		delete[] pData;
+		f_close(&File);
+		return 0;
+	}
+	f_close(&File);
+
+	*pLen = nSize;
+	return pData;
+}
+
+const void* wavetable_file_open(const char* name, size_t* len)
+{
+	CString Path;
+	Path.Format("SD:/%s", name);
+	return ReadSDFile(Path, len);
+}
+
+void wavetable_file_close(const void* data, size_t len)
+{
+	delete[] static_cast<const u8*>(data);
+}
@@ -0,0 +1,28 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Files on the SD card, which CKernel mounts as SD: with the fatfs addon.
+
+#ifndef _sdcard_h
+#define _sdcard_h
+
+#include <circle/types.h>
+
+// Reads the whole of a file, e.g. "SD:/patches/1 bass.txt", into a buffer
+// from the heap, to be freed with delete[]. Returns 0 if it can't.
+u8* ReadSDFile(const char* pPath, size_t* pLen);
+
+#endif
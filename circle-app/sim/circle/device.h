@@ -0,0 +1,9 @@
+#pragma once
+class CDevice;
+typedef void TDeviceRemovedHandler(CDevice* pDevice, void* pContext);
+// devices are never removed in the sim
+class CDevice {
+public:
+	virtual ~CDevice() {}
+	void RegisterRemovedHandler(TDeviceRemovedHandler* pHandler, void* pContext = 0) {}
+};
@@ -0,0 +1,8 @@
+#pragma once
+#include <circle/device.h>
+#include <circle/types.h>
+class CDeviceNameService {
+public:
+	static CDeviceNameService* Get();
+	CDevice* GetDevice(const char* pName, boolean bBlockDevice);
+};
@@ -0,0 +1,8 @@
+#pragma once
+#include <circle/string.h>
+enum TLogSeverity { LogPanic, LogError, LogWarning, LogNotice, LogDebug };
+class CLogger {
+public:
+	static CLogger* Get();
+	void Write(const char* pSource, TLogSeverity Severity, const char* pMessage, ...);
+};
@@ -0,0 +1,13 @@
+#pragma once
+#include <circle/memory.h>
+#include <circle/synchronize.h>
+#include <circle/sysconfig.h>
+#include <circle/types.h>
+class CMultiCoreSupport {
+public:
+	CMultiCoreSupport(CMemorySystem* pMemorySystem);
+	virtual ~CMultiCoreSupport();
+	boolean Initialize();
+	virtual void Run(unsigned nCore) = 0;
+	static unsigned ThisCore();
+};
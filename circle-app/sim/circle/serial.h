@@ -0,0 +1,11 @@
+#pragma once
+#include <circle/device.h>
+#include <circle/interrupt.h>
+#include <circle/types.h>
+class CSerialDevice : public CDevice {
+public:
+	CSerialDevice(CInterruptSystem* pInterruptSystem = 0, boolean bUseFIQ = FALSE, unsigned nDevice = 0);
+	boolean Initialize(unsigned nBaudrate = 115200);
+	int Read(void* pBuffer, size_t nCount);
+	int Write(const void* pBuffer, size_t nCount);
+};
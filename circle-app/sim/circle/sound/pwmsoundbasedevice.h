@@ -0,0 +1,26 @@
+#pragma once
+#include <circle/interrupt.h>
+#include <circle/sound/soundcontroller.h>
+#include <circle/types.h>
+// Nothing is clocked out here; the sim's DMA (see sim.h) takes each chunk
+// with SimTakeChunk(), from whatever plays the part of its interrupt.
+class CPWMSoundBaseDevice {
+public:
+	CPWMSoundBaseDevice(CInterruptSystem* pInterrupt, unsigned nSampleRate = 44100, unsigned nChunkSize = 2048);
+	virtual ~CPWMSoundBaseDevice();
+	int GetRangeMin() const;
+	int GetRangeMax() const;
+	unsigned GetHWTXChannels() const;
+	CSoundController* GetController();
+	boolean Start();
+	boolean IsActive() const;
+	virtual unsigned GetChunk(u32* pBuffer, unsigned nChunkSize) = 0;
+	// sim only
+	unsigned SimGetChunkSize() const { return m_nChunkSize; }
+	unsigned SimGetSampleRate() const { return m_nSampleRate; }
+	void SimStop() { m_bActive = FALSE; }
+private:
+	unsigned m_nSampleRate;
+	unsigned m_nChunkSize;
+	volatile boolean m_bActive;
+};
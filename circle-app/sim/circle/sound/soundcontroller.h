@@ -0,0 +1,10 @@
+#pragma once
+class CSoundController {
+public:
+	enum TControl { ControlVolume };
+	enum TJack { JackDefaultOut };
+	enum TChannel { ChannelAll };
+	struct TControlInfo { bool Supported; int RangeMin; int RangeMax; };
+	TControlInfo GetControlInfo(TControl, TJack, TChannel) { TControlInfo i = { false, 0, 0 }; return i; }
+	bool SetControl(TControl, TJack, TChannel, int) { return false; }
+};
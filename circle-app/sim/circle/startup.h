@@ -0,0 +1,5 @@
+#pragma once
+#define EXIT_HALT 0
+#define EXIT_REBOOT 1
+void reboot(void);
+void halt(void);
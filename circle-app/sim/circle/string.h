@@ -0,0 +1,45 @@
+#pragma once
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+class CString {
+public:
+	CString() : m_pBuffer(0), m_nLength(0) {}
+	CString(const char* s) : m_pBuffer(0), m_nLength(0) { Append(s); }
+	~CString() { delete[] m_pBuffer; }
+	operator const char*() const { return m_pBuffer ? m_pBuffer : ""; }
+	CString& operator=(const char* s)
+	{
+		m_nLength = 0;
+		Append(s);
+		return *this;
+	}
+	void Append(const char* p)
+	{
+		size_t n = strlen(p);
+		char* b = new char[m_nLength + n + 1];
+		if (m_pBuffer) {
+			memcpy(b, m_pBuffer, m_nLength);
+		}
+		memcpy(b + m_nLength, p, n + 1);
+		delete[] m_pBuffer;
+		m_pBuffer = b;
+		m_nLength += n;
+	}
+	void Format(const char* fmt, ...)
+	{
+		char b[4096];
+		va_list ap;
+		va_start(ap, fmt);
+		vsnprintf(b, sizeof b, fmt, ap);
+		va_end(ap);
+		m_nLength = 0;
+		Append(b);
+	}
+	size_t GetLength() const { return m_nLength; }
+private:
+	CString(const CString&);
+	CString& operator=(const CString&);
+	char* m_pBuffer;
+	size_t m_nLength;
+};
@@ -0,0 +1,8 @@
+#pragma once
+#define DataSyncBarrier() __sync_synchronize()
+#define DataMemBarrier() __sync_synchronize()
+#define IRQ_LEVEL 1
+#define FIQ_LEVEL 2
+// holds off the simulated interrupts (see sim.h); nests, like Circle's
+void EnterCritical(unsigned nTargetLevel = IRQ_LEVEL);
+void LeaveCritical(void);
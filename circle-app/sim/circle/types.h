@@ -0,0 +1,17 @@
+#pragma once
+#include <stddef.h>
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+typedef signed char s8;
+typedef short s16;
+typedef int s32;
+typedef long long s64;
+typedef unsigned long uintptr;
+typedef bool boolean;
+#define TRUE true
+#define FALSE false
@@ -0,0 +1,9 @@
+#pragma once
+#include <circle/device.h>
+#include <circle/types.h>
+typedef void TKeyStatusHandlerRaw(unsigned char ucModifiers, const unsigned char RawKeys[6]);
+// never attached in the sim
+class CUSBKeyboardDevice : public CDevice {
+public:
+	void RegisterKeyStatusHandlerRaw(TKeyStatusHandlerRaw* pKeyStatusHandlerRaw, boolean bMixedMode = FALSE) {}
+};
@@ -0,0 +1,18 @@
+#pragma once
+#include <circle/device.h>
+#include <circle/types.h>
+typedef void TMIDIPacketHandler(unsigned nCable, u8* pPacket, unsigned nLength);
+class CUSBMIDIDevice : public CDevice {
+public:
+	CUSBMIDIDevice() : m_pPacketHandler(0) {}
+	void RegisterPacketHandler(TMIDIPacketHandler* pPacketHandler) { m_pPacketHandler = pPacketHandler; }
+	// sim only: a packet arriving, from the simulated interrupt
+	void SimReceive(u8* pPacket, unsigned nLength)
+	{
+		if (m_pPacketHandler) {
+			(*m_pPacketHandler)(0, pPacket, nLength);
+		}
+	}
+private:
+	TMIDIPacketHandler* m_pPacketHandler;
+};
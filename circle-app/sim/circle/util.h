@@ -0,0 +1,11 @@
+#pragma once
+#include <string.h>
+#include <strings.h>
+#include <circle/types.h>
+// common/synth.c uses assert() without including it; Circle's headers
+// bring it in
+#include <assert.h>
+#ifdef __cplusplus
+extern "C"
+#endif
+int atoi(const char* pString);
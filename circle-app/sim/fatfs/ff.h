@@ -0,0 +1,27 @@
+#pragma once
+// backed by stdio; SD: is the directory given to SimSetSDCard()
+typedef unsigned int UINT;
+typedef unsigned char BYTE;
+typedef unsigned long long FSIZE_t;
+typedef struct { int dummy; } FATFS;
+typedef struct { FSIZE_t obj_size; void* fp; } FIL;
+typedef struct { void* dir; } DIR;
+typedef struct { FSIZE_t fsize; BYTE fattrib; char fname[256]; } FILINFO;
+typedef enum { FR_OK = 0, FR_DISK_ERR, FR_NO_FILE, FR_NO_PATH } FRESULT;
+#define FA_READ 0x01
+#define FA_OPEN_EXISTING 0x00
+#define AM_DIR 0x10
+#define f_size(fp) ((fp)->obj_size)
+#ifdef __cplusplus
+extern "C" {
+#endif
+FRESULT f_mount(FATFS* fs, const char* path, unsigned char opt);
+FRESULT f_open(FIL* fp, const char* path, unsigned char mode);
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br);
+FRESULT f_close(FIL* fp);
+FRESULT f_opendir(DIR* dp, const char* path);
+FRESULT f_readdir(DIR* dp, FILINFO* fno);
+FRESULT f_closedir(DIR* dp);
+#ifdef __cplusplus
+}
+#endif
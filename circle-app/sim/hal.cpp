@@ -0,0 +1,357 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// The stand-ins' implementations; see sim.h.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <circle/devicenameservice.h>
+#include <circle/logger.h>
+#include <circle/memory.h>
+#include <circle/multicore.h>
+#include <circle/serial.h>
+#include <circle/sound/pwmsoundbasedevice.h>
+#include <circle/startup.h>
+#include <circle/synchronize.h>
+// fatfs and dirent.h both have a DIR
+#define DIR FF_DIR
+#include <fatfs/ff.h>
+#undef DIR
+#include <dirent.h>
+
+#include "sim.h"
+
+// interrupts
+
+static pthread_mutex_t s_InterruptLock;
+static pthread_once_t s_InterruptOnce = PTHREAD_ONCE_INIT;
+
+static void InitInterruptLock(void)
+{
+	// EnterCritical() nests, and handlers may use it too
+	pthread_mutexattr_t Attr;
+	pthread_mutexattr_init(&Attr);
+	pthread_mutexattr_settype(&Attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&s_InterruptLock, &Attr);
+	pthread_mutexattr_destroy(&Attr);
+}
+
+void SimEnterInterrupt(void)
+{
+	pthread_once(&s_InterruptOnce, InitInterruptLock);
+	pthread_mutex_lock(&s_InterruptLock);
+}
+
+void SimLeaveInterrupt(void)
+{
+	pthread_mutex_unlock(&s_InterruptLock);
+}
+
+void EnterCritical(unsigned nTargetLevel)
+{
+	SimEnterInterrupt();
+}
+
+void LeaveCritical(void)
+{
+	SimLeaveInterrupt();
+}
+
+// cores
+
+static thread_local unsigned t_nCore = 0;
+
+struct TCoreStart {
+	CMultiCoreSupport* pThis;
+	unsigned nCore;
+};
+
+static void* CoreThread(void* pParam)
+{
+	TCoreStart* pStart = static_cast<TCoreStart*>(pParam);
+	t_nCore = pStart->nCore;
+	pStart->pThis->Run(pStart->nCore);
+	return 0;
+}
+
+CMultiCoreSupport::CMultiCoreSupport(CMemorySystem* pMemorySystem)
+{
+}
+
+CMultiCoreSupport::~CMultiCoreSupport()
+{
+}
+
+boolean CMultiCoreSupport::Initialize()
+{
+	static TCoreStart s_Start[CORES];
+	for (unsigned nCore = 1; nCore < CORES; nCore++) {
+		s_Start[nCore].pThis = this;
+		s_Start[nCore].nCore = nCore;
+		pthread_t Thread;
+		if (pthread_create(&Thread, 0, CoreThread, &s_Start[nCore]) != 0) {
+			return FALSE;
+		}
+		// the cores never stop; the process exits around them
+		pthread_detach(Thread);
+	}
+	return TRUE;
+}
+
+unsigned CMultiCoreSupport::ThisCore()
+{
+	return t_nCore;
+}
+
+CMemorySystem* CMemorySystem::Get()
+{
+	static CMemorySystem s_Memory;
+	return &s_Memory;
+}
+
+// sound
+
+CPWMSoundBaseDevice::CPWMSoundBaseDevice(CInterruptSystem* pInterrupt, unsigned nSampleRate, unsigned nChunkSize)
+    : m_nSampleRate(nSampleRate)
+    , m_nChunkSize(nChunkSize)
+    , m_bActive(FALSE)
+{
+}
+
+CPWMSoundBaseDevice::~CPWMSoundBaseDevice()
+{
+}
+
+// the Pi's range depends on its PWM clock; this one gives 16 bits at the
+// organ's volume, and starts at 0 as the Pi's does
+int CPWMSoundBaseDevice::GetRangeMin() const
+{
+	return 0;
+}
+
+int CPWMSoundBaseDevice::GetRangeMax() const
+{
+	return 65535 * 5;
+}
+
+unsigned CPWMSoundBaseDevice::GetHWTXChannels() const
+{
+	return 2;
+}
+
+CSoundController* CPWMSoundBaseDevice::GetController()
+{
+	return 0;
+}
+
+boolean CPWMSoundBaseDevice::Start()
+{
+	m_bActive = TRUE;
+	return TRUE;
+}
+
+boolean CPWMSoundBaseDevice::IsActive() const
+{
+	return m_bActive;
+}
+
+// USB
+
+static CUSBMIDIDevice s_MIDIDevice;
+
+CUSBMIDIDevice* SimGetMIDIDevice(void)
+{
+	return &s_MIDIDevice;
+}
+
+CDeviceNameService* CDeviceNameService::Get()
+{
+	static CDeviceNameService s_NameService;
+	return &s_NameService;
+}
+
+CDevice* CDeviceNameService::GetDevice(const char* pName, boolean bBlockDevice)
+{
+	if (strcmp(pName, "umidi1") == 0) {
+		return &s_MIDIDevice;
+	}
+	return 0;
+}
+
+// serial
+
+static int s_nSerialIn = -1;
+static int s_nSerialOut = -1;
+
+void SimSetSerial(int fd_in, int fd_out)
+{
+	s_nSerialIn = fd_in;
+	s_nSerialOut = fd_out;
+}
+
+CSerialDevice::CSerialDevice(CInterruptSystem* pInterruptSystem, boolean bUseFIQ, unsigned nDevice)
+{
+}
+
+boolean CSerialDevice::Initialize(unsigned nBaudrate)
+{
+	return TRUE;
+}
+
+// like Circle's, never blocks: returns what has arrived, if anything
+int CSerialDevice::Read(void* pBuffer, size_t nCount)
+{
+	if (s_nSerialIn < 0) {
+		return 0;
+	}
+	ssize_t n = read(s_nSerialIn, pBuffer, nCount);
+	if (n < 0) {
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	}
+	return n;
+}
+
+int CSerialDevice::Write(const void* pBuffer, size_t nCount)
+{
+	if (s_nSerialOut < 0) {
+		return nCount;
+	}
+	ssize_t n = write(s_nSerialOut, pBuffer, nCount);
+	if (n < 0) {
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	}
+	return n;
+}
+
+// logging
+
+CLogger* CLogger::Get()
+{
+	static CLogger s_Logger;
+	return &s_Logger;
+}
+
+void CLogger::Write(const char* pSource, TLogSeverity Severity, const char* pMessage, ...)
+{
+	static const char* const s_Severity[] = { "!!! ", "error: ", "warning: ", "", "" };
+	va_list Args;
+	va_start(Args, pMessage);
+	flockfile(stderr);
+	fprintf(stderr, "%s: %s", pSource, s_Severity[Severity]);
+	vfprintf(stderr, pMessage, Args);
+	fputc('\n', stderr);
+	funlockfile(stderr);
+	va_end(Args);
+}
+
+void reboot(void)
+{
+	fprintf(stderr, "reboot\n");
+	exit(EXIT_REBOOT);
+}
+
+void halt(void)
+{
+	exit(EXIT_HALT);
+}
+
+// SD card
+
+static const char* s_pSDCard = ".";
+
+void SimSetSDCard(const char* dir)
+{
+	s_pSDCard = dir;
+}
+
+FRESULT f_mount(FATFS* fs, const char* path, unsigned char opt)
+{
+	return FR_OK;
+}
+
+// the host path of an SD: one
+static bool HostPath(char* pOut, size_t nSize, const char* pPath)
+{
+	if (strncmp(pPath, "SD:", 3) != 0) {
+		return false;
+	}
+	snprintf(pOut, nSize, "%s%s", s_pSDCard, pPath + 3);
+	return true;
+}
+
+FRESULT f_open(FIL* fp, const char* path, unsigned char mode)
+{
+	char Path[4096];
+	if (!HostPath(Path, sizeof(Path), path)) {
+		return FR_NO_FILE;
+	}
+	FILE* pFile = fopen(Path, "rb");
+	if (pFile == 0) {
+		return FR_NO_FILE;
+	}
+	fseek(pFile, 0, SEEK_END);
+	fp->obj_size = ftell(pFile);
+	fseek(pFile, 0, SEEK_SET);
+	fp->fp = pFile;
+	return FR_OK;
+}
+
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br)
+{
+	*br = fread(buff, 1, btr, static_cast<FILE*>(fp->fp));
+	return ferror(static_cast<FILE*>(fp->fp)) ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT f_close(FIL* fp)
+{
+	fclose(static_cast<FILE*>(fp->fp));
+	return FR_OK;
+}
+
+FRESULT f_opendir(FF_DIR* dp, const char* path)
+{
+	char Path[4096];
+	if (!HostPath(Path, sizeof(Path), path) || (dp->dir = opendir(Path)) == 0) {
+		return FR_NO_PATH;
+	}
+	return FR_OK;
+}
+
+// like fatfs, an empty fname marks the end
+FRESULT f_readdir(FF_DIR* dp, FILINFO* fno)
+{
+	struct dirent* pEntry;
+	do {
+		pEntry = readdir(static_cast<DIR*>(dp->dir));
+	} while (pEntry && pEntry->d_name[0] == '.');
+	fno->fname[0] = '\0';
+	if (pEntry) {
+		snprintf(fno->fname, sizeof(fno->fname), "%s", pEntry->d_name);
+		fno->fattrib = pEntry->d_type == DT_DIR ? AM_DIR : 0;
+	}
+	return FR_OK;
+}
+
+FRESULT f_closedir(FF_DIR* dp)
+{
+	closedir(static_cast<DIR*>(dp->dir));
+	return FR_OK;
+}
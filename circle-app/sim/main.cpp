@@ -0,0 +1,359 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Plays the part of CKernel: constructs the organ, starts it, and calls
+// Process() in a loop, while the simulated DMA takes each chunk the organ
+// renders and the scripted MIDI arrives as interrupts.
+//
+// By default the DMA runs on a simulated clock: a chunk is taken, and the
+// clock moves on a chunk, each time Process() returns. Nothing waits on the
+// wall clock, so a run is as fast as the host allows and plays the same way
+// every time; what each Process() call cost is reported at the end. With -x
+// the DMA is a thread that takes a chunk every chunk's worth of real time
+// instead, as the Pi's interrupt does, and reports each chunk that wasn't
+// ready in time.
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../miniorgan.h"
+#include "sim.h"
+
+// set by the organ when a chunk is ready for the DMA
+extern volatile int chunk_ready;
+
+#define MAX_EVENTS 65536
+
+struct TMIDIEvent {
+	unsigned long nFrame; // arrives once the DMA has taken this many frames
+	u8 Packet[3];
+};
+
+static TMIDIEvent s_Events[MAX_EVENTS];
+static unsigned s_nEvents;
+static unsigned s_nNextEvent;
+
+static const char* s_pWavePath = 0;
+static FILE* s_pWave = 0;
+static unsigned long s_nWaveFrames = 0;
+static int s_nNullLevel = -1;
+
+static volatile unsigned long s_nFrames = 0; // taken by the DMA
+static volatile unsigned s_nUnderruns = 0;
+
+static void Usage(void)
+{
+	fprintf(stderr,
+	    "usage: sim.out [options]\n"
+	    "  -n 10        seconds to run for (default 10)\n"
+	    "  -m midi.txt  MIDI to play (default: an 8 note chord, held throughout)\n"
+	    "  -s file      read serial from file, e.g. a FIFO (see README)\n"
+	    "  -S file      write what's sent over serial to file\n"
+	    "  -D dir       directory to use as the SD card (default .)\n"
+	    "  -d out.wav   write the first channel to a wav file\n"
+	    "  -x           run the DMA in real time, and report underruns\n");
+	exit(1);
+}
+
+static void AddEvent(double fSeconds, u8 uchStatus, u8 uchData1, u8 uchData2)
+{
+	if (s_nEvents == MAX_EVENTS) {
+		return;
+	}
+	TMIDIEvent* e = &s_Events[s_nEvents++];
+	e->nFrame = (unsigned long)(fSeconds * SAMPLE_RATE);
+	e->Packet[0] = uchStatus;
+	e->Packet[1] = uchData1 & 0x7f;
+	e->Packet[2] = uchData2 & 0x7f;
+}
+
+// One message per line, stamped with the second it arrives at:
+//
+//   0.0 on 60 100      note on, key and velocity
+//   1.5 off 60         note off
+//   0.5 cc 74 20       control change
+//   2.0 90 3c 64       any other message, as three hex bytes
+//
+// everything on channel 1; blank lines and ones starting with # are skipped.
+// Lines must be in time order.
+static int LoadMIDI(const char* pPath)
+{
+	FILE* pFile = fopen(pPath, "r");
+	if (pFile == 0) {
+		fprintf(stderr, "failed to open %s\n", pPath);
+		return 1;
+	}
+	char Line[256];
+	for (int nLine = 1; fgets(Line, sizeof(Line), pFile); nLine++) {
+		double t;
+		char Word[16];
+		unsigned a, b = 0, c = 0;
+		if (Line[0] == '#' || sscanf(Line, "%lf", &t) != 1) {
+			continue;
+		}
+		if (sscanf(Line, "%lf on %u %u", &t, &a, &b) == 3) {
+			AddEvent(t, 0x90, a, b);
+		} else if (sscanf(Line, "%lf off %u", &t, &a) == 2) {
+			AddEvent(t, 0x80, a, 0);
+		} else if (sscanf(Line, "%lf cc %u %u", &t, &a, &b) == 3) {
+			AddEvent(t, 0xb0, a, b);
+		} else if (sscanf(Line, "%lf %x %x %x", &t, &a, &b, &c) == 4) {
+			AddEvent(t, a, b, c);
+		} else {
+			sscanf(Line, "%lf %15s", &t, Word);
+			fprintf(stderr, "%s:%d: can't read \"%s\"\n", pPath, nLine, Word);
+			fclose(pFile);
+			return 1;
+		}
+	}
+	fclose(pFile);
+	return 0;
+}
+
+static void WriteWaveHeader(unsigned long nFrames)
+{
+	struct {
+		char riff[4];
+		u32 flength;
+		char wave[4];
+		char fmt[4];
+		u32 chunk_size;
+		u16 format_tag;
+		u16 num_chans;
+		u32 srate;
+		u32 bytes_per_sec;
+		u16 bytes_per_samp;
+		u16 bits_per_samp;
+		char data[4];
+		u32 dlength;
+	} h = { { 'R', 'I', 'F', 'F' }, (u32)(36 + nFrames * 2), { 'W', 'A', 'V', 'E' }, { 'f', 'm', 't', ' ' },
+		16, 1, 1, SAMPLE_RATE, SAMPLE_RATE * 2, 2, 16, { 'd', 'a', 't', 'a' }, (u32)(nFrames * 2) };
+	fseek(s_pWave, 0, SEEK_SET);
+	fwrite(&h, sizeof(h), 1, s_pWave);
+}
+
+static void WriteWave(const u32* pChunk, unsigned nFrames, unsigned nChannels)
+{
+	if (s_nNullLevel < 0) {
+		// the organ's range starts at 0, so silence is half way up it; the
+		// first chunk is always silence, as MIDI only arrives once it's taken
+		s_nNullLevel = pChunk[0];
+	}
+	if (s_pWave == 0 || s_nNullLevel == 0) {
+		return;
+	}
+	s16 Samples[CHUNK_SIZE];
+	for (unsigned i = 0; i < nFrames; i++) {
+		float x = ((int)pChunk[i * nChannels] - s_nNullLevel) / (float)s_nNullLevel;
+		x = x < -1.f ? -1.f : x > 1.f ? 1.f : x;
+		Samples[i] = (s16)(x * 32767.f);
+	}
+	fwrite(Samples, sizeof(s16), nFrames, s_pWave);
+	s_nWaveFrames += nFrames;
+}
+
+// the DMA interrupt: takes a chunk, and delivers the MIDI that arrived
+// while the last one played
+static void Interrupt(CMiniOrgan* pOrgan)
+{
+	static u32 s_Chunk[CHUNK_SIZE];
+	const unsigned nChannels = pOrgan->GetHWTXChannels();
+	const unsigned nChunkSize = pOrgan->SimGetChunkSize();
+
+	SimEnterInterrupt();
+	if (!chunk_ready) {
+		s_nUnderruns++;
+	}
+	pOrgan->GetChunk(s_Chunk, nChunkSize);
+	unsigned long nFrames = s_nFrames + nChunkSize / nChannels;
+	while (s_nNextEvent < s_nEvents && s_Events[s_nNextEvent].nFrame < nFrames) {
+		SimGetMIDIDevice()->SimReceive(s_Events[s_nNextEvent].Packet, 3);
+		s_nNextEvent++;
+	}
+	s_nFrames = nFrames;
+	SimLeaveInterrupt();
+
+	WriteWave(s_Chunk, nChunkSize / nChannels, nChannels);
+}
+
+static double Now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static unsigned long s_nRunFrames;
+
+static void* DMAThread(void* pParam)
+{
+	CMiniOrgan* pOrgan = static_cast<CMiniOrgan*>(pParam);
+	const unsigned nFrames = pOrgan->SimGetChunkSize() / pOrgan->GetHWTXChannels();
+	const long nPeriod = 1000000000L / SAMPLE_RATE * nFrames + 1000000000L % SAMPLE_RATE * nFrames / SAMPLE_RATE;
+
+	struct timespec Wake;
+	clock_gettime(CLOCK_MONOTONIC, &Wake);
+	while (s_nFrames < s_nRunFrames) {
+		Wake.tv_nsec += nPeriod;
+		while (Wake.tv_nsec >= 1000000000L) {
+			Wake.tv_sec++;
+			Wake.tv_nsec -= 1000000000L;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Wake, 0);
+
+		unsigned nUnderruns = s_nUnderruns;
+		Interrupt(pOrgan);
+		if (s_nUnderruns != nUnderruns) {
+			fprintf(stderr, "sim: underrun at %.3f s\n", (double)s_nFrames / SAMPLE_RATE);
+		}
+	}
+	pOrgan->SimStop();
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	double fSeconds = 10.0;
+	const char* pMIDIPath = 0;
+	const char* pSerialIn = 0;
+	const char* pSerialOut = 0;
+	bool bRealTime = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:m:s:S:D:d:x")) != -1) {
+		switch (opt) {
+		case 'n':
+			fSeconds = atof(optarg);
+			break;
+		case 'm':
+			pMIDIPath = optarg;
+			break;
+		case 's':
+			pSerialIn = optarg;
+			break;
+		case 'S':
+			pSerialOut = optarg;
+			break;
+		case 'D':
+			SimSetSDCard(optarg);
+			break;
+		case 'd':
+			s_pWavePath = optarg;
+			break;
+		case 'x':
+			bRealTime = true;
+			break;
+		default:
+			Usage();
+		}
+	}
+	if (optind != argc || fSeconds <= 0.0) {
+		Usage();
+	}
+	s_nRunFrames = (unsigned long)(fSeconds * SAMPLE_RATE);
+	if (sysconf(_SC_NPROCESSORS_ONLN) < CORES) {
+		// a core spinning on another's status waits out the whole timeslice
+		fprintf(stderr, "sim: warning: fewer than %d CPUs; timings will be meaningless\n", CORES);
+	}
+
+	if (pMIDIPath) {
+		if (LoadMIDI(pMIDIPath) != 0) {
+			return 1;
+		}
+	} else {
+		static const u8 Chord[] = { 48, 52, 55, 60, 64, 67, 72, 76 };
+		for (unsigned i = 0; i < sizeof(Chord); i++) {
+			AddEvent(0.0, 0x90, Chord[i], 100);
+		}
+	}
+
+	int nSerialIn = -1;
+	int nSerialOut = -1;
+	if (pSerialIn && (nSerialIn = open(pSerialIn, O_RDONLY | O_NONBLOCK)) < 0) {
+		fprintf(stderr, "failed to open %s\n", pSerialIn);
+		return 1;
+	}
+	if (pSerialOut && (nSerialOut = open(pSerialOut, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		fprintf(stderr, "failed to open %s\n", pSerialOut);
+		return 1;
+	}
+	SimSetSerial(nSerialIn, nSerialOut);
+
+	if (s_pWavePath) {
+		s_pWave = fopen(s_pWavePath, "wb");
+		if (s_pWave == 0) {
+			fprintf(stderr, "failed to open %s\n", s_pWavePath);
+			return 1;
+		}
+		WriteWaveHeader(0);
+	}
+
+	static CInterruptSystem s_Interrupt;
+	static CI2CMaster s_I2CMaster;
+	// never deleted, as on the Pi; the cores run until the process exits
+	CMiniOrgan* pOrgan = new CMiniOrgan(&s_Interrupt, &s_I2CMaster);
+	if (!pOrgan->Initialize()) {
+		return 1;
+	}
+	pOrgan->Start();
+
+	unsigned long nCalls = 0;
+	double fTotal = 0.0;
+	double fWorst = 0.0;
+	if (bRealTime) {
+		pthread_t Thread;
+		if (pthread_create(&Thread, 0, DMAThread, pOrgan) != 0) {
+			fprintf(stderr, "unable to create the DMA thread\n");
+			return 1;
+		}
+		for (nCalls = 0; pOrgan->IsActive(); nCalls++) {
+			pOrgan->Process(nCalls == 0);
+		}
+		pthread_join(Thread, 0);
+	} else {
+		for (nCalls = 0; s_nFrames < s_nRunFrames; nCalls++) {
+			double t = Now();
+			pOrgan->Process(nCalls == 0);
+			t = Now() - t;
+			fTotal += t;
+			fWorst = t > fWorst ? t : fWorst;
+			Interrupt(pOrgan);
+		}
+	}
+
+	if (s_pWave) {
+		WriteWaveHeader(s_nWaveFrames);
+		fclose(s_pWave);
+	}
+
+	const unsigned nFrames = pOrgan->SimGetChunkSize() / pOrgan->GetHWTXChannels();
+	const double fChunk = (double)nFrames / SAMPLE_RATE;
+	printf("%lu frames in %lu chunks of %u\n", s_nFrames, s_nFrames / nFrames, nFrames);
+	if (bRealTime) {
+		printf("%lu calls to Process, %u underruns\n", nCalls, s_nUnderruns);
+	} else {
+		printf("Process: %.1f us a chunk on average (%.1f%% of real time), %.1f us at worst (%.1f%%)\n",
+		    fTotal / nCalls * 1e6, fTotal / nCalls / fChunk * 100.0, fWorst * 1e6, fWorst / fChunk * 100.0);
+	}
+	// the cores are still spinning, but only ever touch the organ, which is
+	// never freed
+	exit(s_nUnderruns > 0 ? 2 : 0);
+}
@@ -0,0 +1,48 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// The sim builds CMiniOrgan and VoiceManager, unchanged, for Linux, so the
+// firmware's own threading and block hand-off can be profiled and run under
+// the sanitizers without a Pi. The headers beside this one stand in for the
+// parts of Circle the organ uses, and no more:
+//
+//   - each of cores 1 to CORES - 1 is a thread, started by
+//     CMultiCoreSupport::Initialize() and spinning in Run() as the cores do
+//   - the interrupt is a lock: whatever plays the part of an interrupt
+//     handler holds it (SimEnterInterrupt), and EnterCritical() takes it too
+//   - the sound device's DMA is the caller taking chunks with GetChunk(),
+//     either on a simulated clock or in real time (see main.cpp)
+//   - "umidi1" is a MIDI device whose packets the caller delivers
+//   - serial reads from, and writes to, file descriptors
+//   - the SD card is a directory, read with stdio
+//   - the logger writes to stderr
+
+#pragma once
+
+#include <circle/usb/usbmidi.h>
+
+void SimEnterInterrupt(void);
+void SimLeaveInterrupt(void);
+
+// the device GetDevice("umidi1") finds
+CUSBMIDIDevice* SimGetMIDIDevice(void);
+
+// what CSerialDevice::Read() returns, or -1 for nothing; Write() goes to
+// fd_out, or nowhere if it is -1
+void SimSetSerial(int fd_in, int fd_out);
+
+// the directory fatfs finds SD: in
+void SimSetSDCard(const char* dir);
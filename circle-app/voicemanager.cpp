@@ -34,21 +34,104 @@
 #include <circle/atomic.h>
 #include <circle/string.h>
 
+#include "../common/controls.h"
+#include "../common/filter.h"
+#include "../common/fx.h"
+#include "../common/parts.h"
 #include "../common/synth.h"
+#include "../common/trace.h"
 
-#if MAX_KEYS % CORES != 0
-#error "MAX_KEYS % CORES != 0"
-#endif
+// of nCores voice cores, core n renders voices [first_key(n, nCores),
+// first_key(n + 1, nCores)); with VOICE_CORES this is the same split
+// synth_new() uses for the arenas
+#define KEYS_PER_CORE_NO_FX ((MAX_KEYS + CORES - 1) / CORES)
+static inline int first_key(unsigned nCore, unsigned nCores)
+{
+	return nCore < nCores ? (nCore * MAX_KEYS + nCores - 1) / nCores : MAX_KEYS;
+}
+
+static inline int keys_on_core(unsigned nCore, unsigned nCores)
+{
+	return first_key(nCore + 1, nCores) - first_key(nCore, nCores);
+}
+
+static inline unsigned key_core(int nKey, unsigned nCores)
+{
+	unsigned nCore = 0;
+	while (first_key(nCore + 1, nCores) <= nKey) {
+		nCore++;
+	}
+	return nCore;
+}
+
+// a core's filters, its two output buffers, and its copies of the parts'
+// control snapshots
+#define RENDER_ARENA_SIZE (ARENA_SIZE(sizeof(struct filter_bank)) + 2 * ARENA_SIZE(CHUNK_SIZE * sizeof(float)) \
+    + ARENA_SIZE(MAX_PARTS * sizeof(struct control_snapshot)))
+
+// those, and the oscillators of the core's share of the voices
+#define CORE_ARENA_SIZE (KEYS_PER_CORE * SYNTH_OSC_ARENA_BYTES + RENDER_ARENA_SIZE)
+
+// those for when it renders voices, the effects' state and delay lines, and
+// their output buffer
+#define FX_CORE_ARENA_SIZE (KEYS_PER_CORE_NO_FX * SYNTH_OSC_ARENA_BYTES + RENDER_ARENA_SIZE \
+    + ARENA_SIZE(sizeof(struct fx_state)) + FX_ARENA_BYTES + ARENA_SIZE(CHUNK_SIZE * sizeof(float)))
+
+static u8 s_CoreArenaMem[VOICE_CORES][CORE_ARENA_SIZE] __attribute__((aligned(CACHE_LINE)));
+static u8 s_FxArenaMem[FX_CORE_ARENA_SIZE] __attribute__((aligned(CACHE_LINE)));
+
+static const char FromVoiceManager[] = "voices";
+
+// samples over which the output fades from one block to another when the
+// effects are turned on or off
+#define SPLICE_SAMPLES 256
 
 VoiceManager::VoiceManager(CMemorySystem* pMemorySystem)
     : CMultiCoreSupport(pMemorySystem)
 {
 
+	num_parts = 0;
+	fx = 0;
+	m_nBlock = 0;
+	m_nVoiceCores[0] = m_nVoiceCores[1] = VOICE_CORES;
+	m_bEffects = TRUE;
+	m_bSpliced = FALSE;
 	for (unsigned nCore = 0; nCore < CORES; nCore++) {
-		m_CoreStatus[nCore] = CoreStatusInit;
+		m_CoreStatus[nCore].Status = CoreStatusInit;
+	}
 
-		pitchwheel[nCore] = 0.0f;
-		m_fOutputLevel[nCore] = static_cast<float*>(::operator new(CHUNK_SIZE * sizeof(float)));
+	for (unsigned nCore = 0; nCore < CORES; nCore++) {
+		struct arena* a = &m_CoreArena[nCore];
+		if (nCore == FX_CORE) {
+			arena_init(a, s_FxArenaMem, FX_CORE_ARENA_SIZE);
+		} else {
+			arena_init(a, s_CoreArenaMem[nCore], CORE_ARENA_SIZE);
+		}
+		m_fOutputLevel[0][nCore] = static_cast<float*>(arena_alloc(a, CHUNK_SIZE * sizeof(float)));
+		m_fOutputLevel[1][nCore] = static_cast<float*>(arena_alloc(a, CHUNK_SIZE * sizeof(float)));
+		m_pFilters[nCore] = static_cast<struct filter_bank*>(arena_alloc(a, sizeof(struct filter_bank)));
+		if (m_pFilters[nCore] != 0) {
+			filter_bank_init(m_pFilters[nCore]);
+		}
+		m_pSnapshots[nCore] = static_cast<struct control_snapshot*>(arena_alloc(a, MAX_PARTS * sizeof(struct control_snapshot)));
+
+		// synth_new() gives the core its voices' oscillators for when the
+		// effects are on; room for any more it has without them
+		int nSpare = keys_on_core(nCore, CORES) - keys_on_core(nCore, VOICE_CORES);
+		m_nSpare[nCore] = 0;
+		for (int i = 0; i < nSpare; i++) {
+			const size_t nBytes = sizeof(struct osc) * NUM_OSCS * NUM_OSC_TYPES;
+			m_pSpareOscs[nCore][i] = static_cast<struct osc*>(arena_alloc(a, nBytes));
+			m_pSpareXfadeOscs[nCore][i] = static_cast<struct osc*>(arena_alloc(a, nBytes));
+			m_nSpare[nCore]++;
+		}
+	}
+
+	struct arena* a = &m_CoreArena[FX_CORE];
+	m_fEffectsOut = static_cast<float*>(arena_alloc(a, CHUNK_SIZE * sizeof(float)));
+	m_pFx = static_cast<struct fx_state*>(arena_alloc(a, sizeof(struct fx_state)));
+	if (m_pFx != 0) {
+		fx_init(m_pFx, a, SAMPLE_RATE);
 	}
 }
 
@@ -56,6 +139,17 @@ VoiceManager::~VoiceManager(void)
 {
 }
 
+void VoiceManager::ReportArenas(void)
+{
+	CString tmp;
+	for (unsigned nCore = 0; nCore < CORES; nCore++) {
+		const struct arena* a = &m_CoreArena[nCore];
+		tmp.Format("core %u arena%s: %u of %u bytes used%s", nCore, nCore == FX_CORE ? " (effects)" : "",
+		    (unsigned)a->wanted, (unsigned)a->size, a->wanted > a->size ? "; too small" : "");
+		CLogger::Get()->Write(FromVoiceManager, LogNotice, tmp);
+	}
+}
+
 boolean VoiceManager::Initialize(struct key* keys)
 {
 	this->keys = keys;
@@ -71,7 +165,7 @@ boolean VoiceManager::Initialize(struct key* keys)
 void VoiceManager::wait_for_idle_cores()
 {
 	for (unsigned nCore = 1; nCore < CORES; nCore++) {
-		while (m_CoreStatus[nCore] != CoreStatusIdle) {
+		while (m_CoreStatus[nCore].Status != CoreStatusIdle) {
 			// just wait
 		}
 	}
@@ -80,7 +174,7 @@ void VoiceManager::wait_for_idle_cores()
 void VoiceManager::set_cores_busy()
 {
 	for (unsigned nCore = 1; nCore < CORES; nCore++) {
-		m_CoreStatus[nCore] = CoreStatusBusy;
+		m_CoreStatus[nCore].Status = CoreStatusBusy;
 	}
 }
 
@@ -89,16 +183,21 @@ void VoiceManager::Run(unsigned nCore)
 	assert(1 <= nCore && nCore < CORES);
 	while (1) {
 
-		m_CoreStatus[nCore] = CoreStatusIdle; // ready to be kicked
-		while (m_CoreStatus[nCore] == CoreStatusIdle) {
+		m_CoreStatus[nCore].Status = CoreStatusIdle; // ready to be kicked
+		while (m_CoreStatus[nCore].Status == CoreStatusIdle) {
 			// just wait
 		}
-		assert(m_CoreStatus[nCore] == CoreStatusBusy);
+		assert(m_CoreStatus[nCore].Status == CoreStatusBusy);
 
-		produce_keys(nCore);
+		DataSyncBarrier();
+		if (nCore == FX_CORE && m_bEffects) {
+			run_effects();
+		} else {
+			produce_keys(nCore);
+		}
 
 		// indicate thread is done
-		m_CoreStatus[nCore] = CoreStatusIdle;
+		m_CoreStatus[nCore].Status = CoreStatusIdle;
 	}
 	// CLogger::Get()->Write("VOICEMAN", LogNotice, "core %u called", nCore);
 }
@@ -108,87 +207,183 @@ void VoiceManager::produce_keys(unsigned nCore)
 	DataSyncBarrier();
 	unsigned long tick = this->tick;
 
-	const int start = nCore * (MAX_KEYS / CORES);
-	const int end = (nCore + 1) * (MAX_KEYS / CORES);
+	const unsigned nCores = m_nVoiceCores[m_nBlock];
+	const int start = first_key(nCore, nCores);
+	const int end = first_key(nCore + 1, nCores);
+	float* out = m_fOutputLevel[m_nBlock][nCore];
+	TRACE_BEGIN_N(nCore, "voices", synth_sounding(keys, start, end));
+
+	// the core's voices, grouped by part so each part's controls are
+	// stepped over, and its voices rendered, together
+	unsigned char voices[KEYS_PER_CORE];
+	int first[MAX_PARTS + 1];
+	parts_group(keys, start, end, num_parts, voices, first);
 
-	struct params thread_param;
+	// every core steps its own copy of each part's snapshot, so they all see
+	// the same smoothed values without sharing anything while rendering
+	struct control_snapshot* snap = m_pSnapshots[nCore];
+	for (int p = 0; p < num_parts; p++) {
+		if (first[p + 1] > first[p]) {
+			snap[p] = *controls[p];
+		}
+	}
+	struct params thread_param[MAX_PARTS];
 
 	const float dt = 1.f / SAMPLE_RATE;
+	struct filter_bank* filters = m_pFilters[nCore];
 
 	for (int chunk_i = 0; chunk_i < 1024; chunk_i++) {
+		if (chunk_i % CONTROL_BLOCK == 0) {
+			for (int p = 0; p < num_parts; p++) {
+				if (first[p + 1] > first[p]) {
+					controls_step(&snap[p], &thread_param[p], keys, voices + first[p], first[p + 1] - first[p]);
+				}
+			}
+			filter_bank_update(filters, keys, start, end, SAMPLE_RATE);
+		}
 		float t = ((float)tick) / SAMPLE_RATE;
 		tick++;
 
-		// It's chirping
-		// const float freq_smoothing = 0.98f;
-		// const float tolerance = 1e-10f;
-		// if ((pitchwheel[nCore] - params->pitch) > tolerance || (params->pitch - pitchwheel[nCore]) > tolerance) {
-		// 	pitchwheel[nCore] = pitchwheel[nCore] * freq_smoothing + params->pitch * (1.0f - freq_smoothing);
-		// } else {
-		// 	pitchwheel[nCore] = params->pitch;
-		// }
-		// thread_param.pitch = pitchwheel[nCore];
-
-		const float tolerance = 1e-2f; // TODO change this to 1e6 (to effectively disable it) and see if this slow ramp up time is actually needed
-		const float delta = tolerance / 2.f;
-		const float diff = pitchwheel[nCore] - params->pitch;
-		if (diff > tolerance) {
-			pitchwheel[nCore] -= delta;
-		} else if (-diff > tolerance) {
-			pitchwheel[nCore] += delta;
-		} else {
-			pitchwheel[nCore] = params->pitch;
+		for (int v = 0; v < end - start; v++) {
+			struct key* k = &keys[voices[v]];
+			filters->in[voices[v] - start] = key_render(k, &thread_param[k->part], t, dt);
 		}
-		thread_param.pitch = pitchwheel[nCore];
-
-		float output = 0.0f;
-		for (int i = start; i < end; i++) {
-			struct key* k = &keys[i];
-			bool done = true;
-			for (int j = 0; j < NUM_OSCS * NUM_OSC_TYPES; j++) {
-				struct osc* osc = &k->oscs[j];
-
-				// TODO maybe I can deleted all this moving average code now?
-				// osc_set_output(k, osc, &thread_param, t, dt);
-
-				osc_set_output(k, osc, params, t, dt);
-				if (osc->osc_type == OSC_TYPE_VFO) {
-					// if( osc->output > 0.0f ) {
-					//	CLogger::Get()->Write("VOICEMAN", LogNotice, "t=%f core=%u freq=%f index=%u output=%f", t, nCore, k->freq, i, osc->output);
-					// }
-					output += osc->output * osc->output_volume * osc->output_volume_m;
-					if (osc->output_volume > 0.0 || k->released_at == 0.0) {
-						done = false;
-					}
-				}
-			}
-			if (done) {
-				// if (k->pressed_at > 0.f) {
-				//	CLogger::Get()->Write("VOICEMAN", LogNotice, "t=%f core=%u freq=%f index=%u is done", t, nCore, k->freq, i);
-				// }
-				k->pressed_at = 0.f;
-				k->released_at = 0.f;
-				k->freq = 0.f;
+		out[chunk_i] = filter_bank_render(filters, end - start);
+	}
+	TRACE_END(nCore, "voices");
+	DataSyncBarrier();
+}
+
+// runs on FX_CORE, on the block the voice cores rendered last time
+void VoiceManager::run_effects()
+{
+	DataSyncBarrier();
+
+	// normally VOICE_CORES; CORES if the effects were off last block
+	const unsigned nCores = m_nVoiceCores[m_nBlock ^ 1];
+	const float* in[CORES];
+	for (unsigned nCore = 0; nCore < nCores; nCore++) {
+		in[nCore] = m_fOutputLevel[m_nBlock ^ 1][nCore];
+	}
+	TRACE_BEGIN(FX_CORE, "effects");
+	fx_process(m_pFx, fx, in, nCores, m_fEffectsOut, 1024);
+	TRACE_END(FX_CORE, "effects");
+
+	DataSyncBarrier();
+}
+
+// The voices are split differently with and without the effects. Each one
+// that changes core takes its oscillators into the new core's arena, and its
+// filter state into the new core's bank.
+void VoiceManager::move_voices(unsigned nFromCores, unsigned nToCores)
+{
+	// a voice can only move into a spare slot, and one moving out leaves its
+	// old slot spare for the next, so go round until they have all moved
+	boolean bMoved[MAX_KEYS];
+	int nLeft = 0;
+	for (int i = 0; i < MAX_KEYS; i++) {
+		bMoved[i] = key_core(i, nFromCores) == key_core(i, nToCores);
+		nLeft += !bMoved[i];
+	}
+	while (nLeft > 0) {
+		int nBefore = nLeft;
+		for (int i = 0; i < MAX_KEYS; i++) {
+			unsigned nFrom = key_core(i, nFromCores);
+			unsigned nTo = key_core(i, nToCores);
+			if (bMoved[i] || m_nSpare[nTo] == 0) {
+				continue;
 			}
+			struct osc* pOscs = keys[i].oscs;
+			struct osc* pXfadeOscs = keys[i].xfade_oscs;
+			m_nSpare[nTo]--;
+			key_move_oscs(&keys[i], m_pSpareOscs[nTo][m_nSpare[nTo]], m_pSpareXfadeOscs[nTo][m_nSpare[nTo]]);
+			m_pSpareOscs[nFrom][m_nSpare[nFrom]] = pOscs;
+			m_pSpareXfadeOscs[nFrom][m_nSpare[nFrom]] = pXfadeOscs;
+			m_nSpare[nFrom]++;
+			bMoved[i] = TRUE;
+			nLeft--;
 		}
-		m_fOutputLevel[nCore][chunk_i] = output;
+		assert(nLeft < nBefore);
+	}
+
+	struct filter_bank ByKey;
+	for (unsigned nCore = 0; nCore < nFromCores; nCore++) {
+		const int start = first_key(nCore, nFromCores);
+		for (int i = start; i < first_key(nCore + 1, nFromCores); i++) {
+			filter_bank_move(&ByKey, i, m_pFilters[nCore], i - start);
+		}
+	}
+	for (unsigned nCore = 0; nCore < nToCores; nCore++) {
+		const int start = first_key(nCore, nToCores);
+		for (int i = start; i < first_key(nCore + 1, nToCores); i++) {
+			filter_bank_move(m_pFilters[nCore], i - start, &ByKey, i);
+		}
+	}
+}
+
+// Writes into m_fEffectsOut the sum of the nFrom buffers crossfading into the
+// sum of the nTo buffers over SPLICE_SAMPLES; to may be m_fEffectsOut itself.
+void VoiceManager::splice(const float* const* from, unsigned nFrom, const float* const* to, unsigned nTo)
+{
+	for (int i = 0; i < 1024; i++) {
+		float a = 0.f, b = 0.f;
+		for (unsigned j = 0; j < nFrom; j++) {
+			a += from[j][i];
+		}
+		for (unsigned j = 0; j < nTo; j++) {
+			b += to[j][i];
+		}
+		float w = i < SPLICE_SAMPLES ? (float)i / SPLICE_SAMPLES : 1.f;
+		m_fEffectsOut[i] = a + (b - a) * w;
 	}
-	DataSyncBarrier();
 }
 
 void VoiceManager::ProduceOutput(unsigned long t)
 {
 	tick = t;
+	m_nBlock ^= 1;
+
+	m_bEffects = fx_active(fx);
+	const unsigned nCores = m_bEffects ? VOICE_CORES : CORES;
+	const unsigned nPrevCores = m_nVoiceCores[m_nBlock ^ 1];
+	if (nCores != nPrevCores) {
+		move_voices(nPrevCores, nCores);
+	}
+	m_nVoiceCores[m_nBlock] = nCores;
+
 	set_cores_busy();
 	produce_keys(0);
+	TRACE_BEGIN(0, "wait for cores");
 	wait_for_idle_cores();
+	TRACE_END(0, "wait for cores");
+
+	// Turning the effects off skips the block they had yet to process, and
+	// turning them on plays the last block again, through them. Either way
+	// the block that follows on from what was last heard fades into the new
+	// one, rather than jumping to it. Both only happen when a patch is
+	// loaded or edited.
+	m_bSpliced = nCores != nPrevCores;
+	if (m_bSpliced) {
+		TRACE_BEGIN(0, "splice");
+		const float* const* pThis = m_fOutputLevel[m_nBlock];
+		const float* const* pPrev = m_fOutputLevel[m_nBlock ^ 1];
+		if (m_bEffects) {
+			splice(pThis, nCores, &m_fEffectsOut, 1);
+		} else {
+			splice(pPrev, nPrevCores, pThis, nCores);
+		}
+		TRACE_END(0, "splice");
+	}
 }
 
-float VoiceManager::GetOutput(int chunk_i)
+int VoiceManager::GetOutput(const float** pOut) const
 {
-	float output = m_fOutputLevel[0][chunk_i];
-	for (unsigned nCore = 1; nCore < CORES; nCore++) {
-		output += m_fOutputLevel[nCore][chunk_i];
+	if (m_bEffects || m_bSpliced) {
+		pOut[0] = m_fEffectsOut;
+		return 1;
+	}
+	for (unsigned nCore = 0; nCore < CORES; nCore++) {
+		pOut[nCore] = m_fOutputLevel[m_nBlock][nCore];
 	}
-	return output;
+	return CORES;
 }
@@ -30,6 +30,9 @@
 #include <circle/serial.h>
 #include <circle/types.h>
 
+#include "../common/arena.h"
+#include "../common/parts.h"
+
 enum TCoreStatus {
 	CoreStatusInit,
 	CoreStatusIdle,
@@ -38,29 +41,83 @@ enum TCoreStatus {
 	CoreStatusUnknown
 };
 
+// When the first part's patch has effects on, the last core runs them on the
+// previous block while the others render voices for the next one, so effects
+// cost a block of latency but no voice rendering time. Without effects, every
+// core renders voices and the block is heard as soon as it's done.
+#if CORES < 2
+#error "the effects need a core of their own"
+#endif
+#define FX_CORE (CORES - 1)
+#define VOICE_CORES (CORES - 1) // the voice cores while the effects are on
+#define KEYS_PER_CORE ((MAX_KEYS + VOICE_CORES - 1) / VOICE_CORES) // the most voices a core renders
+
+struct filter_bank;
+struct fx;
+struct fx_state;
+
 class VoiceManager : public CMultiCoreSupport {
     public:
 	VoiceManager(CMemorySystem* pMemorySystem);
 	~VoiceManager(void);
 
+	// one per core; core n's voices take their oscillators from the nth,
+	// see synth_new(). FX_CORE's holds the effects, and the oscillators of
+	// the voices it renders while they're off.
+	struct arena* GetCoreArenas(void) { return m_CoreArena; }
+	void ReportArenas(void);
+
 	boolean Initialize(struct key* keys);
 	void Run(unsigned nCore);
 	void ProduceOutput(unsigned long t);
-	float GetOutput(int chunk_i);
+	// the finished block, as buffers to be summed, valid once ProduceOutput
+	// returns: with effects, the one from the ProduceOutput before last;
+	// without, this one's
+	int GetOutput(const float** pOut) const;
 
-	struct params* params;
+	// published by core 0 before each ProduceOutput, one snapshot per part
+	int num_parts;
+	const struct control_snapshot* controls[MAX_PARTS];
+	const struct fx* fx;
 
     protected:
 	struct key* keys;
 	void produce_keys(unsigned nCore);
+	void run_effects();
+	void move_voices(unsigned nFromCores, unsigned nToCores);
+	void splice(const float* const* from, unsigned nFrom, const float* const* to, unsigned nTo);
 	void wait_for_idle_cores();
 	void set_cores_busy();
 
-	float pitchwheel[CORES];
-
 	unsigned long tick;
-	float* m_fOutputLevel[CORES];
-	volatile TCoreStatus m_CoreStatus[CORES];
+	struct arena m_CoreArena[CORES];
+
+	// voice cores render into m_fOutputLevel[m_nBlock] while the effects
+	// core reads the other set; each buffer is in its core's arena.
+	// m_nVoiceCores[b] is how many cores rendered set b: VOICE_CORES with
+	// effects, CORES without.
+	unsigned m_nBlock;
+	unsigned m_nVoiceCores[2];
+	boolean m_bEffects; // for the block being rendered
+	boolean m_bSpliced; // the effects were turned on or off for it
+	float* m_fOutputLevel[2][CORES];
+	struct filter_bank* m_pFilters[CORES];
+
+	// oscillator space in each core's arena that none of its voices is using,
+	// for voices that move to it when the effects are turned on or off
+	struct osc* m_pSpareOscs[CORES][KEYS_PER_CORE];
+	struct osc* m_pSpareXfadeOscs[CORES][KEYS_PER_CORE];
+	unsigned m_nSpare[CORES];
+	struct control_snapshot* m_pSnapshots[CORES]; // each core's copies of controls
+
+	struct fx_state* m_pFx;
+	float* m_fEffectsOut;
+
+	// every core spins on its own status, so give each one a cache line
+	struct TCoreSlot {
+		volatile TCoreStatus Status;
+	} __attribute__((aligned(CACHE_LINE)));
+	TCoreSlot m_CoreStatus[CORES];
 };
 
 #endif
@@ -0,0 +1,28 @@
+#include "arena.h"
+
+#ifdef __circle__
+#include <circle/util.h>
+#else
+#include <string.h>
+#endif
+
+void arena_init(struct arena* a, void* mem, size_t size)
+{
+	a->base = mem;
+	a->size = size;
+	a->used = 0;
+	a->wanted = 0;
+}
+
+void* arena_alloc(struct arena* a, size_t n)
+{
+	n = ARENA_SIZE(n);
+	a->wanted += n;
+	if (n > a->size - a->used) {
+		return NULL;
+	}
+	void* p = a->base + a->used;
+	a->used += n;
+	memset(p, 0, n);
+	return p;
+}
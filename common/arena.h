@@ -0,0 +1,34 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stddef.h>
+
+// the cache line size of every Pi the circle build targets (and of x86)
+#define CACHE_LINE 64
+
+// bytes an allocation of n takes out of an arena
+#define ARENA_SIZE(n) (((n) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE)
+
+// A bump allocator over a fixed, statically allocated buffer. Everything is
+// handed out zeroed and cache line aligned, so two allocations never share a
+// line, and nothing is ever freed; engine state is carved out once at startup
+// and the heap is never touched again.
+struct arena {
+	unsigned char* base;
+	size_t size;
+	size_t used; // nothing is freed, so this is also the high water mark
+	size_t wanted; // what used would be if no allocation had failed
+};
+
+// mem must be CACHE_LINE aligned
+void arena_init(struct arena* a, void* mem, size_t size);
+
+// returns NULL (and remembers how much was asked for) once the arena is full
+void* arena_alloc(struct arena* a, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
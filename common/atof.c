@@ -1,3 +1,6 @@
+// circle has no libc; on linux the libc atof (which returns a double) must be used instead
+#ifdef __circle__
+
 #define true 1
 #define false 0
 #define bool int
@@ -36,3 +39,5 @@ float atof(const char* s)
 
 	return negative ? -result : result;
 }
+
+#endif
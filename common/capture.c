@@ -0,0 +1,210 @@
+#include "capture.h"
+
+#ifdef __circle__
+#include <circle/util.h>
+#else
+#include <string.h>
+#endif
+
+void capture_init(struct capture* c, uint32_t sample_rate, uint16_t block)
+{
+	memset(c, 0, sizeof(struct capture));
+	for (int i = 0; i < MAX_PARTS; i++) {
+		c->base_patch[i] = CAPTURE_NO_PATCH;
+		c->playing[i] = CAPTURE_NO_PATCH;
+	}
+	part_setup_default(&c->setup);
+	c->sample_rate = sample_rate;
+	c->block = block;
+}
+
+void capture_set_clock(struct capture* c, uint32_t sample)
+{
+	c->clock = sample;
+}
+
+static void record(struct capture* c, uint32_t sample, int type, const uint8_t* msg, uint32_t arg)
+{
+	if (c->paused) {
+		return;
+	}
+	// the MIDI interrupt may record in between; taking the slot atomically
+	// keeps both events
+	uint32_t i = __atomic_fetch_add(&c->head, 1, __ATOMIC_RELAXED);
+	struct capture_event* e = &c->events[i & (CAPTURE_EVENTS - 1)];
+	if (i >= CAPTURE_EVENTS && e->type == CAPTURE_PATCH && e->msg[0] < MAX_PARTS) {
+		// what's kept now starts out with the patch this one swapped in
+		c->base_patch[e->msg[0]] = e->arg;
+	}
+	e->sample = sample;
+	e->type = type;
+	memcpy(e->msg, msg, sizeof(e->msg));
+	e->arg = arg;
+}
+
+void capture_midi(struct capture* c, const uint8_t msg[3])
+{
+	record(c, c->clock, CAPTURE_MIDI, msg, 0);
+}
+
+void capture_set_parts(struct capture* c, const struct part_setup* s)
+{
+	memcpy(&c->setup, s, sizeof(struct part_setup));
+}
+
+void capture_patch(struct capture* c, uint32_t sample, int part, const struct patch* patch)
+{
+	uint32_t seq = c->next_seq++;
+	struct capture_patch* p = &c->patches[seq % CAPTURE_PATCHES];
+	p->seq = seq;
+	p->len = patch_bin_encode(patch, p->data, sizeof(p->data));
+	c->playing[part] = seq;
+
+	const uint8_t msg[3] = { (uint8_t)part, 0, 0 };
+	record(c, sample, CAPTURE_PATCH, msg, seq);
+}
+
+void capture_param(struct capture* c, uint32_t sample, int osc_index, int param, float value)
+{
+	uint8_t msg[3] = { (uint8_t)osc_index, (uint8_t)param, 0 };
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	record(c, sample, CAPTURE_PARAM, msg, bits);
+}
+
+static int patch_kept(const struct capture* c, uint32_t seq)
+{
+	const struct capture_patch* p = &c->patches[seq % CAPTURE_PATCHES];
+	return seq != CAPTURE_NO_PATCH && p->seq == seq && p->len > 0;
+}
+
+// patches from before the oldest base one are of no use to a replay
+static int patch_dumped(const struct capture* c, uint32_t seq)
+{
+	uint32_t base = CAPTURE_NO_PATCH;
+	for (int i = 0; i < MAX_PARTS; i++) {
+		base = c->base_patch[i] < base ? c->base_patch[i] : base;
+	}
+	return patch_kept(c, seq) && (base == CAPTURE_NO_PATCH || seq >= base);
+}
+
+// the oldest patch that can still be kept
+static uint32_t first_seq(const struct capture* c)
+{
+	return c->next_seq > CAPTURE_PATCHES ? c->next_seq - CAPTURE_PATCHES : 0;
+}
+
+// works out what a dump holds: the header, and the first event kept
+static uint32_t plan(const struct capture* c, struct capture_header* h, uint32_t now)
+{
+	uint32_t head = c->head;
+	uint32_t first = head > CAPTURE_EVENTS ? head - CAPTURE_EVENTS : 0;
+
+	h->magic = CAPTURE_MAGIC;
+	h->version = CAPTURE_VERSION;
+	h->block = c->block;
+	h->sample_rate = c->sample_rate;
+	h->start = first > 0 ? c->events[first & (CAPTURE_EVENTS - 1)].sample : c->start;
+	h->end = now;
+	h->num_events = head - first;
+	h->num_parts = c->setup.num_parts;
+	memset(h->parts, 0, sizeof(h->parts));
+	for (int i = 0; i < MAX_PARTS; i++) {
+		const struct part* part = &c->setup.parts[i];
+		h->parts[i].channel = part->channel;
+		h->parts[i].lo = part->lo;
+		h->parts[i].hi = part->hi;
+		h->parts[i].max_voices = part->max_voices;
+		h->parts[i].priority = part->priority;
+		h->base_patch[i] = patch_kept(c, c->base_patch[i]) ? c->base_patch[i] : CAPTURE_NO_PATCH;
+	}
+	h->num_patches = 0;
+	for (uint32_t seq = first_seq(c); seq < c->next_seq; seq++) {
+		h->num_patches += patch_dumped(c, seq);
+	}
+	return first;
+}
+
+size_t capture_dump_size(const struct capture* c)
+{
+	struct capture_header h;
+	plan(c, &h, 0);
+	size_t n = sizeof(h) + h.num_events * sizeof(struct capture_event);
+	for (uint32_t seq = first_seq(c); seq < c->next_seq; seq++) {
+		if (patch_dumped(c, seq)) {
+			n += 2 * sizeof(uint32_t) + c->patches[seq % CAPTURE_PATCHES].len;
+		}
+	}
+	return n;
+}
+
+size_t capture_dump(struct capture* c, capture_write_fn write, void* user, uint32_t now)
+{
+	c->paused = 1;
+
+	struct capture_header h;
+	uint32_t first = plan(c, &h, now);
+	size_t n = 0;
+	write(user, &h, sizeof(h));
+	n += sizeof(h);
+	for (uint32_t i = first; i != first + h.num_events; i++) {
+		write(user, &c->events[i & (CAPTURE_EVENTS - 1)], sizeof(struct capture_event));
+		n += sizeof(struct capture_event);
+	}
+	for (uint32_t seq = first_seq(c); seq < c->next_seq; seq++) {
+		if (patch_dumped(c, seq)) {
+			const struct capture_patch* p = &c->patches[seq % CAPTURE_PATCHES];
+			write(user, &p->seq, sizeof(p->seq));
+			write(user, &p->len, sizeof(p->len));
+			write(user, p->data, p->len);
+			n += 2 * sizeof(uint32_t) + p->len;
+		}
+	}
+
+	c->head = 0;
+	c->start = now;
+	memcpy(c->base_patch, c->playing, sizeof(c->base_patch));
+	c->paused = 0;
+	return n;
+}
+
+const struct capture_header* capture_parse(const void* data, size_t len, const struct capture_event** events)
+{
+	const struct capture_header* h = (const struct capture_header*)data;
+	if (len < sizeof(*h) || h->magic != CAPTURE_MAGIC || h->version != CAPTURE_VERSION) {
+		return NULL;
+	}
+	if (h->num_parts < 1 || h->num_parts > MAX_PARTS) {
+		return NULL;
+	}
+	if (h->num_events > (len - sizeof(*h)) / sizeof(struct capture_event)) {
+		return NULL;
+	}
+	*events = (const struct capture_event*)(h + 1);
+	return h;
+}
+
+const void* capture_find_patch(const void* data, size_t len, uint32_t seq, size_t* patch_len)
+{
+	const struct capture_header* h = (const struct capture_header*)data;
+	const uint8_t* p = (const uint8_t*)data + sizeof(*h) + h->num_events * sizeof(struct capture_event);
+	const uint8_t* end = (const uint8_t*)data + len;
+	for (uint32_t i = 0; i < h->num_patches; i++) {
+		uint32_t s, n;
+		if (end - p < 8) {
+			return NULL;
+		}
+		memcpy(&s, p, sizeof(s));
+		memcpy(&n, p + 4, sizeof(n));
+		p += 8;
+		if ((size_t)(end - p) < n) {
+			return NULL;
+		}
+		if (s == seq) {
+			*patch_len = n;
+			return p;
+		}
+		p += n;
+	}
+	return NULL;
+}
@@ -0,0 +1,125 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parts.h"
+#include "patch_bin.h"
+
+// A flight recorder for what the Pi is played with: every MIDI message, every
+// patch swapped into a part and every parameter set over serial, stamped with
+// the sample at which it took effect. Inputs are only ever latched at block
+// boundaries, so these stamps are exact, and replaying a capture through the
+// same engine (./a.out -R) reproduces what the Pi rendered sample for sample.
+//
+// The last CAPTURE_EVENTS events are kept, along with the last
+// CAPTURE_PATCHES patches and the part setup (see parts.h) at the time of the
+// dump; everything is allocated up front.
+//
+// Dump format (little-endian): struct capture_header, then num_events
+// struct capture_event, then num_patches of { u32 seq, u32 len, len bytes of
+// binary patch }.
+
+#define CAPTURE_MAGIC 0x50434f4d // "MOCP"
+#define CAPTURE_VERSION 2
+
+#define CAPTURE_EVENTS 4096 // must be a power of two
+#define CAPTURE_PATCHES (MAX_PARTS + 4)
+
+#define CAPTURE_MIDI 1 // msg holds the three bytes as received
+#define CAPTURE_PATCH 2 // msg[0] is the part, arg the patch's seq
+#define CAPTURE_PARAM 3 // msg[0] is the osc index, msg[1] the PARAM_*; arg holds the float's bits
+
+#define CAPTURE_NO_PATCH 0xffffffff
+
+struct capture_event {
+	uint32_t sample; // the start of the block it took effect in
+	uint8_t type; // CAPTURE_*
+	uint8_t msg[3];
+	uint32_t arg;
+} __attribute__((packed));
+
+// one part of the setup, see struct part
+struct capture_part {
+	uint8_t channel;
+	uint8_t lo;
+	uint8_t hi;
+	uint8_t max_voices;
+	uint8_t priority;
+	uint8_t reserved[3];
+} __attribute__((packed));
+
+struct capture_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t block; // samples per block on the device
+	uint32_t sample_rate;
+	uint32_t start; // the sample the oldest event kept was recorded at (or capture began)
+	uint32_t end; // the sample the capture was dumped at
+	uint32_t num_events;
+	uint32_t num_patches;
+	uint32_t num_parts;
+	struct capture_part parts[MAX_PARTS];
+	uint32_t base_patch[MAX_PARTS]; // seq of the patch each part was playing at start, or CAPTURE_NO_PATCH if it wasn't kept
+} __attribute__((packed));
+
+struct capture_patch {
+	uint32_t seq;
+	uint32_t len;
+	uint8_t data[PATCH_BIN_MAX_SIZE];
+};
+
+struct capture {
+	struct capture_event events[CAPTURE_EVENTS];
+	struct capture_patch patches[CAPTURE_PATCHES]; // seq n is in patches[n % CAPTURE_PATCHES]
+	uint32_t head; // events recorded ever
+	uint32_t next_seq;
+	uint32_t base_patch[MAX_PARTS]; // what each part was playing when the oldest kept event was recorded
+	uint32_t playing[MAX_PARTS]; // the latest seq swapped into each part
+	struct part_setup setup;
+	uint32_t start;
+	volatile uint32_t clock; // when an event recorded from an interrupt takes effect
+	volatile int paused;
+	uint32_t sample_rate;
+	uint16_t block;
+};
+
+void capture_init(struct capture* c, uint32_t sample_rate, uint16_t block);
+
+// sets the sample that MIDI recorded from now on takes effect at; call once
+// the block's notes and controls have been latched
+void capture_set_clock(struct capture* c, uint32_t sample);
+
+// safe to call from the MIDI interrupt
+void capture_midi(struct capture* c, const uint8_t msg[3]);
+
+// the setup a dump says it was made with; set it before the parts' first patches
+void capture_set_parts(struct capture* c, const struct part_setup* s);
+
+void capture_patch(struct capture* c, uint32_t sample, int part, const struct patch* patch);
+void capture_param(struct capture* c, uint32_t sample, int osc_index, int param, float value);
+
+typedef void (*capture_write_fn)(void* user, const void* data, size_t n);
+
+// writes out everything kept, in the dump format above, then starts afresh
+// from the parts' current patches; returns the number of bytes written. Nothing is
+// recorded while it runs.
+size_t capture_dump(struct capture* c, capture_write_fn write, void* user, uint32_t now);
+
+// the size capture_dump() would write
+size_t capture_dump_size(const struct capture* c);
+
+// Checks a dump and returns its header, with *events pointing at its events;
+// NULL if it's malformed.
+const struct capture_header* capture_parse(const void* data, size_t len, const struct capture_event** events);
+
+// finds patch seq in a dump; NULL if it wasn't kept
+const void* capture_find_patch(const void* data, size_t len, uint32_t seq, size_t* patch_len);
+
+#ifdef __cplusplus
+}
+#endif
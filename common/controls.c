@@ -0,0 +1,218 @@
+#include "controls.h"
+
+#ifdef __circle__
+#include <circle/util.h>
+#else
+#include <string.h>
+#endif
+#include <math.h>
+
+void controls_init(struct controls* c, const struct patch* patch)
+{
+	memset(c, 0, sizeof(struct controls));
+	rng_seed(&c->lfo_key.rng, 0);
+	controls_set_patch(c, patch);
+}
+
+void controls_set_patch(struct controls* c, const struct patch* patch)
+{
+	c->patch = patch;
+	for (int i = 0; i < patch->num_cc_maps; i++) {
+		const struct cc_map* m = &patch->cc_maps[i];
+		float v = synth_get_param(patch, m->osc_index, m->param);
+		c->target[CONTROL_CC + i] = v;
+		c->value[CONTROL_CC + i] = v;
+	}
+}
+
+void controls_pitch_bend(struct controls* c, float bend)
+{
+	c->target[CONTROL_PITCH] = bend;
+}
+
+void controls_mod_wheel(struct controls* c, float mod)
+{
+	c->target[CONTROL_MOD] = mod;
+}
+
+void controls_aftertouch(struct controls* c, float pressure)
+{
+	c->target[CONTROL_AFTERTOUCH] = pressure;
+}
+
+void controls_cc(struct controls* c, int cc, int value)
+{
+	const struct patch* patch = c->patch;
+	for (int i = 0; i < patch->num_cc_maps; i++) {
+		const struct cc_map* m = &patch->cc_maps[i];
+		if (m->cc == cc) {
+			c->target[CONTROL_CC + i] = m->min + (m->max - m->min) * value / 127.f;
+		}
+	}
+}
+
+static float smoothing_coeff(float smoothing, float sample_rate)
+{
+	if (smoothing <= 0.f) {
+		return 1.f;
+	}
+	return 1.f - expf(-CONTROL_BLOCK / (smoothing * sample_rate));
+}
+
+// Points the snapshot at the patch's global LFOs, bringing each one's
+// settings up to date from the patch (which live edits change) and the
+// snapshot's mapped CCs, while it keeps its place in the wave.
+static void find_lfos(struct controls* c, struct control_snapshot* s, const struct patch* patch)
+{
+	const struct osc* patch_lfos = &patch->oscs[NUM_OSCS];
+	s->num_lfos = 0;
+	s->block = 0;
+	for (int i = 0; i < NUM_OSCS; i++) {
+		const struct osc* src = &patch_lfos[i];
+		if (!src->global) {
+			continue;
+		}
+		struct osc* lfo = &c->lfos[i];
+		struct osc prev = *lfo;
+		*lfo = *src;
+		for (int j = CONTROL_CC; j < s->num_controls; j++) {
+			if (s->osc_index[j] == NUM_OSCS + i) {
+				osc_set_param(lfo, s->param[j], s->value[j], NULL);
+			}
+		}
+		// this is the one that actually runs
+		lfo->global = false;
+		lfo->wave_pos = prev.wave_pos;
+		lfo->output = prev.output;
+		lfo->held = prev.held;
+		memcpy(lfo->unison.pos, prev.unison.pos, sizeof(lfo->unison.pos));
+		// only another global LFO can be an input; patch_compile() refuses
+		// anything else, and a binary patch that tries gets no input
+		lfo->phase_input = src->phase_input && src->phase_input->global ? c->lfos + (src->phase_input - patch_lfos) : NULL;
+		lfo->amp_input = src->amp_input && src->amp_input->global ? c->lfos + (src->amp_input - patch_lfos) : NULL;
+		s->lfo_index[s->num_lfos++] = NUM_OSCS + i;
+	}
+}
+
+// Shapes that jump rather than move smoothly. A line between control steps
+// would turn their edges into ramps, so they hold still through each control
+// block instead, and step at the next.
+static bool lfo_jumps(const struct osc* lfo)
+{
+	switch (lfo->wave_type) {
+	case WAVE_TYPE_SQUARE:
+	case WAVE_TYPE_PULSE12:
+	case WAVE_TYPE_PULSE25:
+	case WAVE_TYPE_RAND:
+	case WAVE_TYPE_SAMPLE_HOLD:
+		return true;
+	}
+	return false;
+}
+
+// steps the global LFOs through the n samples of control block b, recording
+// where each one starts and the line to where it ends
+static void render_lfos(struct controls* c, struct control_snapshot* s, int b, size_t n, float sample_rate)
+{
+	struct params params = { c->value[CONTROL_PITCH], c->value[CONTROL_MOD], c->value[CONTROL_AFTERTOUCH] };
+	const float dt = 1.f / sample_rate;
+	for (size_t k = 0; k < n; k++) {
+		for (int i = 0; i < s->num_lfos; i++) {
+			struct osc* lfo = &c->lfos[s->lfo_index[i] - NUM_OSCS];
+			osc_set_output(&c->lfo_key, lfo, &params, 0.f, dt);
+			if (k == 0) {
+				s->lfo_start[b][i] = lfo->output;
+			}
+		}
+	}
+	for (int i = 0; i < s->num_lfos; i++) {
+		const struct osc* lfo = &c->lfos[s->lfo_index[i] - NUM_OSCS];
+		s->lfo_step[b][i] = n > 1 && !lfo_jumps(lfo) ? (lfo->output - s->lfo_start[b][i]) / (n - 1) : 0.f;
+	}
+}
+
+const struct control_snapshot* controls_publish(struct controls* c, const struct patch* patch, float sample_rate, size_t n)
+{
+	int back = !c->front;
+	struct control_snapshot* s = &c->snapshots[back];
+
+	s->num_controls = CONTROL_CC + patch->num_cc_maps;
+	for (int i = 0; i < s->num_controls; i++) {
+		s->value[i] = c->value[i];
+		s->target[i] = c->target[i];
+	}
+	s->coeff[CONTROL_PITCH] = smoothing_coeff(CONTROL_SMOOTHING, sample_rate);
+	s->coeff[CONTROL_MOD] = s->coeff[CONTROL_PITCH];
+	s->coeff[CONTROL_AFTERTOUCH] = s->coeff[CONTROL_PITCH];
+	for (int i = 0; i < patch->num_cc_maps; i++) {
+		const struct cc_map* m = &patch->cc_maps[i];
+		s->coeff[CONTROL_CC + i] = smoothing_coeff(m->smoothing, sample_rate);
+		s->osc_index[CONTROL_CC + i] = m->osc_index;
+		s->param[CONTROL_CC + i] = m->param;
+	}
+
+	s->num_mod_routes = patch->num_mod_routes;
+	memcpy(s->mod_routes, patch->mod_routes, sizeof(struct mod_route) * patch->num_mod_routes);
+	find_lfos(c, s, patch);
+
+	// run the same filter the renderers will, so the next block starts
+	// exactly where this one ends
+	for (size_t k = 0, b = 0; k < n; k += CONTROL_BLOCK, b++) {
+		if (s->num_lfos > 0 && b < CONTROL_MAX_BLOCKS) {
+			render_lfos(c, s, b, MIN(n - k, CONTROL_BLOCK), sample_rate);
+		}
+		for (int i = 0; i < s->num_controls; i++) {
+			c->value[i] += (s->target[i] - c->value[i]) * s->coeff[i];
+		}
+	}
+
+	__atomic_store_n(&c->front, back, __ATOMIC_RELEASE);
+	return s;
+}
+
+// sets a voice's copies of the global LFOs on course for control block b
+static void follow_lfos(const struct control_snapshot* s, int b, struct osc* oscs, const unsigned char* active, int num_active)
+{
+	for (int a = 0; a < num_active; a++) {
+		struct osc* osc = &oscs[active[a]];
+		if (!osc->global) {
+			continue;
+		}
+		// a voice still playing an older patch may have a global LFO the
+		// current one doesn't; it holds still
+		osc->global_step = 0.f;
+		for (int i = 0; i < s->num_lfos; i++) {
+			if (s->lfo_index[i] == active[a]) {
+				// the first sample's step lands on lfo_start
+				osc->output = s->lfo_start[b][i] - s->lfo_step[b][i];
+				osc->global_step = s->lfo_step[b][i];
+			}
+		}
+	}
+}
+
+void controls_step(struct control_snapshot* s, struct params* params, struct key* keys, const unsigned char* voices, int n)
+{
+	params->pitch = s->value[CONTROL_PITCH];
+	params->mod = s->value[CONTROL_MOD];
+	params->aftertouch = s->value[CONTROL_AFTERTOUCH];
+	for (int i = CONTROL_CC; i < s->num_controls; i++) {
+		for (int j = 0; j < n; j++) {
+			struct key* k = &keys[voices[j]];
+			if (k->freq != 0.f) {
+				key_set_param(k, s->osc_index[i], s->param[i], s->value[i]);
+			}
+		}
+	}
+	int b = MIN(s->block, CONTROL_MAX_BLOCKS - 1);
+	for (int j = 0; j < n; j++) {
+		struct key* k = &keys[voices[j]];
+		follow_lfos(s, b, k->oscs, k->active, k->num_active);
+		follow_lfos(s, b, k->xfade_oscs, k->xfade_active, k->xfade_num_active);
+	}
+	s->block++;
+	synth_modulate(s->mod_routes, s->num_mod_routes, params, keys, voices, n);
+	for (int i = 0; i < s->num_controls; i++) {
+		s->value[i] += (s->target[i] - s->value[i]) * s->coeff[i];
+	}
+}
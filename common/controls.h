@@ -0,0 +1,96 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stddef.h>
+
+#include "synth.h"
+
+// Control-rate inputs: pitch bend, the mod wheel, aftertouch, and the CCs a
+// patch maps to oscillator parameters. MIDI handlers only ever set targets; values move
+// towards them through a one-pole filter that is evaluated once every
+// CONTROL_BLOCK samples rather than once per sample.
+
+#define CONTROL_BLOCK 64
+
+// the most control blocks in one render block, i.e. render blocks of up to
+// 1024 samples
+#define CONTROL_MAX_BLOCKS 16
+
+#define CONTROL_PITCH 0
+#define CONTROL_MOD 1
+#define CONTROL_AFTERTOUCH 2
+#define CONTROL_CC 3 // first of the patch's cc_maps
+#define NUM_CONTROLS (CONTROL_CC + MAX_CC_MAPS)
+
+// seconds; for pitch bend, the mod wheel and aftertouch
+#define CONTROL_SMOOTHING 0.005f
+
+// Where every control starts a render block, and how it moves. It's all a
+// renderer needs, so each core steps its own copy through the block and they
+// all see identical values.
+struct control_snapshot {
+	int num_controls;
+	float value[NUM_CONTROLS];
+	float target[NUM_CONTROLS];
+	float coeff[NUM_CONTROLS]; // fraction of the way to target covered per control block
+	int osc_index[NUM_CONTROLS]; // for CONTROL_CC and up
+	int param[NUM_CONTROLS];
+
+	int num_mod_routes;
+	struct mod_route mod_routes[MAX_MOD_ROUTES];
+
+	// Global LFOs (scope=global) are rendered once, by controls_publish(),
+	// rather than once per voice. In control block b, lfo_index[i]'s output
+	// starts at lfo_start[b][i] and moves by lfo_step[b][i] each sample;
+	// square, pulse, rand and sample_hold ones hold still (a step of 0).
+	int num_lfos;
+	unsigned char lfo_index[NUM_OSCS]; // slots in key->oscs
+	float lfo_start[CONTROL_MAX_BLOCKS][NUM_OSCS];
+	float lfo_step[CONTROL_MAX_BLOCKS][NUM_OSCS];
+	int block; // control blocks stepped through so far
+};
+
+struct controls {
+	float target[NUM_CONTROLS]; // written by the MIDI handlers
+	float value[NUM_CONTROLS];
+	const struct patch* patch; // the one cc_maps are looked up in
+
+	// double buffered; renderers read the one front points at
+	struct control_snapshot snapshots[2];
+	int front;
+
+	// the global LFOs, in the same order as the LFO half of patch->oscs
+	struct osc lfos[NUM_OSCS];
+	struct key lfo_key; // for their noise
+};
+
+void controls_init(struct controls* c, const struct patch* patch);
+
+// call after swapping in a new patch; CCs it maps start at the patch's values
+void controls_set_patch(struct controls* c, const struct patch* patch);
+
+void controls_pitch_bend(struct controls* c, float bend); // -1.0 to 1.0
+void controls_mod_wheel(struct controls* c, float mod); // 0.0 to 1.0
+void controls_aftertouch(struct controls* c, float pressure); // 0.0 to 1.0
+void controls_cc(struct controls* c, int cc, int value); // MIDI value, 0 to 127
+
+// Called between render blocks of n samples (at most CONTROL_MAX_BLOCKS *
+// CONTROL_BLOCK). Publishes (and returns) the snapshot for the coming block,
+// and renders the patch's global LFOs through the block. patch itself is
+// never written: mapped CCs only reach the voices (see controls_step()) and
+// the global LFOs, so parts sharing a patch don't move each other's values.
+const struct control_snapshot* controls_publish(struct controls* c, const struct patch* patch, float sample_rate, size_t n);
+
+// Called every CONTROL_BLOCK samples by a renderer with its own copy of the
+// snapshot: writes pitch, mod and aftertouch into params, applies mapped CCs,
+// global LFOs and the modulation matrix to the n keys listed in voices, then
+// moves every control one control block on. Notes started between blocks
+// pick up the mapped CCs here, before their first sample.
+void controls_step(struct control_snapshot* s, struct params* params, struct key* keys, const unsigned char* voices, int n);
+
+#ifdef __cplusplus
+}
+#endif
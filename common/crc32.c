@@ -0,0 +1,68 @@
+#include "crc32.h"
+
+#ifdef __circle__
+#include <circle/util.h>
+#else
+#include <string.h>
+#endif
+
+// Note that circle comes with ether_crc; which also includes the bits
+// this function only does the first half, so it matches python's zlib.crc32 function
+
+#define CRC32_POLY 0xEDB88320
+
+// slice-by-8: table[k][b] is the crc of byte b followed by k zero bytes, so
+// eight input bytes can be folded in with eight independent lookups
+static uint32_t table[8][256];
+static int table_ready = 0;
+
+static void init_table(void)
+{
+	for (unsigned b = 0; b < 256; b++) {
+		uint32_t crc = b;
+		for (unsigned i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLY : 0);
+		}
+		table[0][b] = crc;
+	}
+	for (unsigned b = 0; b < 256; b++) {
+		for (unsigned k = 1; k < 8; k++) {
+			table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+		}
+	}
+	// racing initializers write identical values, so the worst case is
+	// building the table twice
+	__atomic_store_n(&table_ready, 1, __ATOMIC_RELEASE);
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t len)
+{
+	if (!__atomic_load_n(&table_ready, __ATOMIC_ACQUIRE)) {
+		init_table();
+	}
+
+	crc = ~crc;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (len >= 8) {
+		uint32_t lo, hi;
+		memcpy(&lo, data, 4);
+		memcpy(&hi, data + 4, 4);
+		lo ^= crc;
+		crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff]
+		    ^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24]
+		    ^ table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff]
+		    ^ table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+		data += 8;
+		len -= 8;
+	}
+#endif
+	while (len--) {
+		crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xff];
+	}
+	return ~crc;
+}
+
+uint32_t crc32(const uint8_t* data, size_t len)
+{
+	return crc32_update(0, data, len);
+}
@@ -0,0 +1,18 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// matches python's zlib.crc32
+uint32_t crc32(const uint8_t* data, size_t len);
+
+// continue a crc over more data; crc32_update(0, ...) is the same as crc32()
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,95 @@
+#include "fast_math.h"
+#include "simd.h"
+
+#ifdef SIMD
+
+// p * t + c
+static inline vf vf_step(vf p, vf t, float c)
+{
+	return vf_add(vf_mul(p, t), vf_set(c));
+}
+
+static inline vf vec_exp2(vf x)
+{
+	x = vf_min(vf_max(x, vf_set(-126.f)), vf_set(126.f));
+	vf r = vf_sub(vf_add(x, vf_set(FAST_MATH_ROUND)), vf_set(FAST_MATH_ROUND));
+	vf t = vf_sub(x, r);
+	vf p = vf_set(FAST_EXP2_C6);
+	p = vf_step(p, t, FAST_EXP2_C5);
+	p = vf_step(p, t, FAST_EXP2_C4);
+	p = vf_step(p, t, FAST_EXP2_C3);
+	p = vf_step(p, t, FAST_EXP2_C2);
+	p = vf_step(p, t, FAST_EXP2_C1);
+	p = vf_step(p, t, 1.f);
+	return vf_mul(p, vi_as_float(vi_shl23(vi_add(vf_to_int(r), vi_set(127)))));
+}
+
+static inline vf vec_log2(vf x)
+{
+	vi u = vf_bits(x);
+	vi e = vi_sra23(vi_sub(u, vi_set(FAST_LOG2_SQRT_HALF)));
+	vf t = vf_sub(vi_as_float(vi_sub(u, vi_shl23(e))), vf_set(1.f));
+	vf p = vf_set(FAST_LOG2_C8);
+	p = vf_step(p, t, FAST_LOG2_C7);
+	p = vf_step(p, t, FAST_LOG2_C6);
+	p = vf_step(p, t, FAST_LOG2_C5);
+	p = vf_step(p, t, FAST_LOG2_C4);
+	p = vf_step(p, t, FAST_LOG2_C3);
+	p = vf_step(p, t, FAST_LOG2_C2);
+	p = vf_step(p, t, FAST_LOG2_C1);
+	return vf_add(vi_to_float(e), vf_mul(t, p));
+}
+
+static inline vf vec_sin_turns(vf turns)
+{
+	vf r = vf_sub(turns, vf_sub(vf_add(turns, vf_set(FAST_MATH_ROUND)), vf_set(FAST_MATH_ROUND)));
+	vf half = vi_as_float(vi_or(vf_bits(vf_set(0.5f)), vi_and(vf_bits(r), vi_set(INT32_MIN))));
+	r = vf_gt_select(vf_abs(r), vf_set(0.25f), vf_sub(half, r), r);
+	vf r2 = vf_mul(r, r);
+	vf p = vf_set(FAST_SIN_C5);
+	p = vf_step(p, r2, FAST_SIN_C4);
+	p = vf_step(p, r2, FAST_SIN_C3);
+	p = vf_step(p, r2, FAST_SIN_C2);
+	p = vf_step(p, r2, FAST_SIN_C1);
+	return vf_mul(r, p);
+}
+
+static inline vf vec_tanh(vf x)
+{
+	vf c = vf_min(vf_max(x, vf_set(-FAST_TANH_MAX)), vf_set(FAST_TANH_MAX));
+	vf e = vec_exp2(vf_mul(c, vf_set(2.885390082f)));
+	vf one = vf_set(1.f);
+	vf big = vf_div(vf_sub(e, one), vf_add(e, one));
+	vf x2 = vf_mul(x, x);
+	vf small = vf_add(x, vf_mul(vf_mul(x, x2), vf_step(vf_set(0.133333333f), x2, -0.333333333f)));
+	return vf_lt_select(vf_abs(x), vf_set(FAST_TANH_SMALL), small, big);
+}
+
+#define BLOCK_FN(name, vec, scalar)                                  \
+	void name(float* out, const float* in, size_t n)             \
+	{                                                            \
+		size_t i = 0;                                        \
+		for (; i + SIMD_LANES <= n; i += SIMD_LANES) {         \
+			vf_store(&out[i], vec(vf_load(&in[i])));     \
+		}                                                    \
+		for (; i < n; i++) {                                 \
+			out[i] = scalar(in[i]);                      \
+		}                                                    \
+	}
+
+#else
+
+#define BLOCK_FN(name, vec, scalar)                      \
+	void name(float* out, const float* in, size_t n) \
+	{                                                \
+		for (size_t i = 0; i < n; i++) {         \
+			out[i] = scalar(in[i]);          \
+		}                                        \
+	}
+
+#endif
+
+BLOCK_FN(fast_exp2_block, vec_exp2, fast_exp2)
+BLOCK_FN(fast_log2_block, vec_log2, fast_log2)
+BLOCK_FN(fast_sin_turns_block, vec_sin_turns, fast_sin_turns)
+BLOCK_FN(fast_tanh_block, vec_tanh, fast_tanh)
@@ -0,0 +1,165 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Approximations of exp2, log2, sin and tanh for the render path, where
+// libm's versions (a bare-metal newlib on the Pi) cost far more than the
+// accuracy is worth. None of them branch: the scalar forms compile to a
+// handful of multiplies and adds, and the _block forms run the same
+// approximations four at a time with NEON or SSE2 when available.
+//
+// Worst case error against libm (in double precision), over every float in
+// the range for exp2, log2 and tanh, and 2^24 evenly spaced points for sin:
+//
+//   fast_exp2(x)       -126 .. 126           relative 9.5e-8 (1.1 ulp)
+//   fast_log2(x)       any positive normal   relative 3.7e-7
+//   fast_sin_turns(x)  -4 .. 4               absolute 2.0e-7
+//                      -2^22 .. 2^22         absolute 2.0e-7
+//   fast_sin(x)        -7 .. 7               absolute 6.4e-7
+//                      -1000 .. 1000         absolute 8.8e-5; reducing x
+//                                            costs more the larger it is
+//   fast_tanh(x)       -20 .. 20             absolute 1.4e-7, relative 6.2e-7
+//
+// For pitch, 9.5e-8 is 0.0002 cents. fast_exp2(0) and fast_log2(1) are
+// exact, so unmodulated pitches stay put. fast_log2 of zero, a negative, a
+// denormal, an infinity or a NaN is meaningless; fast_exp2 clamps its input,
+// so it never returns 0 or infinity.
+
+// 1.5 * 2^23: adding and subtracting it rounds any float under 2^22 to the
+// nearest integer
+#define FAST_MATH_ROUND 12582912.f
+
+// 2^t - 1 = t * (c1 + t * (c2 + ...)) for t in -0.5 .. 0.5
+#define FAST_EXP2_C1 6.931471879e-01f
+#define FAST_EXP2_C2 2.402264979e-01f
+#define FAST_EXP2_C3 5.550357434e-02f
+#define FAST_EXP2_C4 9.618237494e-03f
+#define FAST_EXP2_C5 1.339073553e-03f
+#define FAST_EXP2_C6 1.540351280e-04f
+
+// log2(1 + t) = t * (c1 + t * (c2 + ...)) for 1 + t in sqrt(0.5) .. sqrt(2)
+#define FAST_LOG2_C1 1.442694962e+00f
+#define FAST_LOG2_C2 -7.213527881e-01f
+#define FAST_LOG2_C3 4.809232423e-01f
+#define FAST_LOG2_C4 -3.602396390e-01f
+#define FAST_LOG2_C5 2.870986980e-01f
+#define FAST_LOG2_C6 -2.488768737e-01f
+#define FAST_LOG2_C7 2.340423870e-01f
+#define FAST_LOG2_C8 -1.458116778e-01f
+// the bits of sqrt(0.5)
+#define FAST_LOG2_SQRT_HALF 0x3f3504f3
+
+// sin(2 pi r) = r * (c1 + r^2 * (c2 + ...)) for r in -0.25 .. 0.25
+#define FAST_SIN_C1 6.283185274e+00f
+#define FAST_SIN_C2 -4.134167748e+01f
+#define FAST_SIN_C3 8.160223124e+01f
+#define FAST_SIN_C4 -7.657499220e+01f
+#define FAST_SIN_C5 3.971091815e+01f
+
+// tanh is 1.f from here on
+#define FAST_TANH_MAX 9.f
+// below this, tanh(x) = x - x^3 / 3 + 2 x^5 / 15 is closer than going
+// through exp2, which loses precision in the subtraction
+#define FAST_TANH_SMALL 0.0625f
+
+static inline uint32_t fast_math_bits(float x)
+{
+	union {
+		float f;
+		uint32_t u;
+	} v = { x };
+	return v.u;
+}
+
+static inline float fast_math_float(uint32_t u)
+{
+	union {
+		uint32_t u;
+		float f;
+	} v = { u };
+	return v.f;
+}
+
+static inline float fast_exp2(float x)
+{
+	x = x < -126.f ? -126.f : x;
+	x = x > 126.f ? 126.f : x;
+	float r = (x + FAST_MATH_ROUND) - FAST_MATH_ROUND;
+	float t = x - r;
+	float p = FAST_EXP2_C6;
+	p = p * t + FAST_EXP2_C5;
+	p = p * t + FAST_EXP2_C4;
+	p = p * t + FAST_EXP2_C3;
+	p = p * t + FAST_EXP2_C2;
+	p = p * t + FAST_EXP2_C1;
+	p = p * t + 1.f;
+	return p * fast_math_float((uint32_t)((int32_t)r + 127) << 23);
+}
+
+static inline float fast_log2(float x)
+{
+	// x = 2^e * m, with m in sqrt(0.5) .. sqrt(2) so log2(m) is near 0
+	uint32_t u = fast_math_bits(x);
+	int32_t e = (int32_t)(u - FAST_LOG2_SQRT_HALF) >> 23;
+	float t = fast_math_float(u - ((uint32_t)e << 23)) - 1.f;
+	float p = FAST_LOG2_C8;
+	p = p * t + FAST_LOG2_C7;
+	p = p * t + FAST_LOG2_C6;
+	p = p * t + FAST_LOG2_C5;
+	p = p * t + FAST_LOG2_C4;
+	p = p * t + FAST_LOG2_C3;
+	p = p * t + FAST_LOG2_C2;
+	p = p * t + FAST_LOG2_C1;
+	return (float)e + t * p;
+}
+
+// sin(2 pi turns), for phases kept in 0 .. 1
+static inline float fast_sin_turns(float turns)
+{
+	float r = turns - ((turns + FAST_MATH_ROUND) - FAST_MATH_ROUND);
+	// r is in -0.5 .. 0.5; sin(2 pi r) = sin(2 pi (+-0.5 - r)) folds it
+	// into -0.25 .. 0.25
+	float half = fast_math_float(fast_math_bits(0.5f) | (fast_math_bits(r) & 0x80000000));
+	float a = fast_math_float(fast_math_bits(r) & 0x7fffffff);
+	r = a > 0.25f ? half - r : r;
+	float r2 = r * r;
+	float p = FAST_SIN_C5;
+	p = p * r2 + FAST_SIN_C4;
+	p = p * r2 + FAST_SIN_C3;
+	p = p * r2 + FAST_SIN_C2;
+	p = p * r2 + FAST_SIN_C1;
+	return r * p;
+}
+
+static inline float fast_sin(float x)
+{
+	return fast_sin_turns(x * 0.159154943f);
+}
+
+static inline float fast_tanh(float x)
+{
+	float c = x < -FAST_TANH_MAX ? -FAST_TANH_MAX : x;
+	c = c > FAST_TANH_MAX ? FAST_TANH_MAX : c;
+	// e^2x = 2^(2x / ln 2)
+	float e = fast_exp2(c * 2.885390082f);
+	float big = (e - 1.f) / (e + 1.f);
+	float x2 = x * x;
+	float small = x + x * x2 * (-0.333333333f + x2 * 0.133333333f);
+	float a = fast_math_float(fast_math_bits(x) & 0x7fffffff);
+	return a < FAST_TANH_SMALL ? small : big;
+}
+
+// the same, over n values; out may be in
+void fast_exp2_block(float* out, const float* in, size_t n);
+void fast_log2_block(float* out, const float* in, size_t n);
+void fast_sin_turns_block(float* out, const float* in, size_t n);
+void fast_tanh_block(float* out, const float* in, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
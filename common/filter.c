@@ -0,0 +1,128 @@
+#include "filter.h"
+#include "controls.h"
+#include "fast_math.h"
+
+#ifdef __circle__
+#include <circle/util.h>
+#else
+#include <string.h>
+#endif
+#include <math.h>
+
+#define FILTER_CUTOFF_MIN 20.f
+#define PI_F 3.14159265f
+
+void filter_bank_init(struct filter_bank* f)
+{
+	memset(f, 0, sizeof(struct filter_bank));
+	for (int j = 0; j < MAX_KEYS; j++) {
+		f->a1[j] = 1.f;
+		f->k[j] = 2.f;
+		f->dry[j] = 1.f;
+	}
+}
+
+void filter_bank_update(struct filter_bank* f, struct key* keys, int start, int end, float sample_rate)
+{
+	const float ramp = 1.f / CONTROL_BLOCK;
+	f->active = false;
+	for (int i = start; i < end; i++) {
+		struct key* key = &keys[i];
+		int j = i - start;
+
+		// voices without a filter pass their input straight through; the
+		// coefficients are left where they were, which is harmless since
+		// the output ignores the filter
+		f->dry[j] = 1.f;
+		f->lp[j] = f->bp[j] = f->hp[j] = 0.f;
+		f->d_a1[j] = f->d_a2[j] = f->d_a3[j] = f->d_k[j] = 0.f;
+		if (key->freq == 0.f || key->filter.type == FILTER_NONE) {
+			continue;
+		}
+		f->active = true;
+
+		float cutoff = key->filter.cutoff * fast_exp2(key->mod_cutoff);
+		cutoff = MIN(MAX(cutoff, FILTER_CUTOFF_MIN), 0.49f * sample_rate);
+		float resonance = MIN(MAX(key->filter.resonance + key->mod_resonance, 0.f), FILTER_RESONANCE_MAX);
+
+		float g = tanf(PI_F * cutoff / sample_rate);
+		float k = 2.f - 2.f * resonance;
+		float a1 = 1.f / (1.f + g * (g + k));
+		float a2 = g * a1;
+		float a3 = g * a2;
+
+		if (key->filter_reset) {
+			// a new note; start from silence with no ramp
+			key->filter_reset = false;
+			f->ic1[j] = f->ic2[j] = 0.f;
+			f->a1[j] = a1;
+			f->a2[j] = a2;
+			f->a3[j] = a3;
+			f->k[j] = k;
+		} else {
+			f->d_a1[j] = (a1 - f->a1[j]) * ramp;
+			f->d_a2[j] = (a2 - f->a2[j]) * ramp;
+			f->d_a3[j] = (a3 - f->a3[j]) * ramp;
+			f->d_k[j] = (k - f->k[j]) * ramp;
+		}
+
+		f->dry[j] = 0.f;
+		switch (key->filter.type) {
+		case FILTER_LOWPASS:
+			f->lp[j] = 1.f;
+			break;
+		case FILTER_HIGHPASS:
+			f->hp[j] = 1.f;
+			break;
+		case FILTER_BANDPASS:
+			f->bp[j] = 1.f;
+			break;
+		}
+	}
+}
+
+void filter_bank_move(struct filter_bank* dst, int dst_j, const struct filter_bank* src, int src_j)
+{
+	dst->ic1[dst_j] = src->ic1[src_j];
+	dst->ic2[dst_j] = src->ic2[src_j];
+	dst->a1[dst_j] = src->a1[src_j];
+	dst->a2[dst_j] = src->a2[src_j];
+	dst->a3[dst_j] = src->a3[src_j];
+	dst->k[dst_j] = src->k[src_j];
+}
+
+float filter_bank_render(struct filter_bank* f, int n)
+{
+	float output = 0.0f;
+	if (!f->active) {
+		for (int j = 0; j < n; j++) {
+			output += f->in[j];
+		}
+		return output;
+	}
+
+	// no branches and no dependencies between voices, so the compiler can
+	// run this across voices in vector registers
+	float out[MAX_KEYS];
+	for (int j = 0; j < n; j++) {
+		float v0 = f->in[j];
+		float v3 = v0 - f->ic2[j];
+		float v1 = f->a1[j] * f->ic1[j] + f->a2[j] * v3;
+		float v2 = f->ic2[j] + f->a2[j] * f->ic1[j] + f->a3[j] * v3;
+		f->ic1[j] = 2.f * v1 - f->ic1[j];
+		f->ic2[j] = 2.f * v2 - f->ic2[j];
+
+		float hp = v0 - f->k[j] * v1 - v2;
+		// the band pass is scaled by k so its peak stays at unity gain
+		out[j] = f->dry[j] * v0 + f->lp[j] * v2 + f->bp[j] * f->k[j] * v1 + f->hp[j] * hp;
+
+		f->a1[j] += f->d_a1[j];
+		f->a2[j] += f->d_a2[j];
+		f->a3[j] += f->d_a3[j];
+		f->k[j] += f->d_k[j];
+	}
+	for (int j = 0; j < n; j++) {
+		output += out[j];
+	}
+	return output;
+}
@@ -0,0 +1,52 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include "synth.h"
+
+// The voice filter: a state variable filter (the trapezoidal kind, which
+// stays stable however fast its cutoff moves) on the sum of each voice's VFOs.
+//
+// State and coefficients are kept per voice, laid out voice-minor like the
+// modulation matrix, so every sample is one pass across all of a renderer's
+// voices. Coefficients are worked out once per control block, from the
+// voice's [filter] settings plus its cutoff and resonance modulation, and
+// ramped linearly to over the block.
+//
+// Each renderer (each core on the Pi) owns one bank for the voices it
+// renders; voice start + j is at index j.
+struct filter_bank {
+	// this sample's input from each voice, filled in by the caller
+	float in[MAX_KEYS];
+
+	float ic1[MAX_KEYS];
+	float ic2[MAX_KEYS];
+
+	// coefficients, and how much they move per sample
+	float a1[MAX_KEYS], a2[MAX_KEYS], a3[MAX_KEYS], k[MAX_KEYS];
+	float d_a1[MAX_KEYS], d_a2[MAX_KEYS], d_a3[MAX_KEYS], d_k[MAX_KEYS];
+
+	// how much of the input and each response make up the output
+	float dry[MAX_KEYS], lp[MAX_KEYS], bp[MAX_KEYS], hp[MAX_KEYS];
+
+	bool active; // false if none of the voices has a filter
+};
+
+void filter_bank_init(struct filter_bank* f);
+
+// call once per control block, after controls_step()
+void filter_bank_update(struct filter_bank* f, struct key* keys, int start, int end, float sample_rate);
+
+// copies what voice src_j of src carries from one block to the next (its
+// state and where its coefficients had got to) to voice dst_j of dst, for
+// when a voice moves to another renderer; call between blocks
+void filter_bank_move(struct filter_bank* dst, int dst_j, const struct filter_bank* src, int src_j);
+
+// filters f->in[0 .. n) and returns the sum
+float filter_bank_render(struct filter_bank* f, int n);
+
+#ifdef __cplusplus
+}
+#endif
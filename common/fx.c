@@ -0,0 +1,152 @@
+#include "fx.h"
+#include "fast_math.h"
+
+#define CHORUS_BASE_DELAY 0.007f // seconds, before modulation
+#define CHORUS_LFO_BLOCK 64 // samples of LFO worked out at a time
+
+// Freeverb's tunings, in samples at 44.1 kHz
+static const unsigned comb_tuning[FX_NUM_COMBS] = { 1116, 1188, 1277, 1356, 1422, 1491, 1557, 1617 };
+static const unsigned allpass_tuning[FX_NUM_ALLPASSES] = { 556, 441, 341, 225 };
+
+#define REVERB_INPUT_GAIN 0.015f
+#define REVERB_ALLPASS_FEEDBACK 0.5f
+
+static unsigned scale_tuning(unsigned samples, float sample_rate, unsigned ring)
+{
+	unsigned n = samples * sample_rate / 44100.f;
+	return n < ring ? n : ring - 1;
+}
+
+int fx_init(struct fx_state* s, struct arena* arena, float sample_rate)
+{
+	s->sample_rate = sample_rate;
+	s->pos = 0;
+	s->chorus_phase = 0.f;
+	s->delay = arena_alloc(arena, FX_DELAY_RING * sizeof(float));
+	s->chorus = arena_alloc(arena, FX_CHORUS_RING * sizeof(float));
+	int err = s->delay == NULL || s->chorus == NULL;
+	for (int i = 0; i < FX_NUM_COMBS; i++) {
+		s->comb[i] = arena_alloc(arena, FX_COMB_RING * sizeof(float));
+		s->comb_len[i] = scale_tuning(comb_tuning[i], sample_rate, FX_COMB_RING);
+		s->comb_store[i] = 0.f;
+		err |= s->comb[i] == NULL;
+	}
+	for (int i = 0; i < FX_NUM_ALLPASSES; i++) {
+		s->allpass[i] = arena_alloc(arena, FX_ALLPASS_RING * sizeof(float));
+		s->allpass_len[i] = scale_tuning(allpass_tuning[i], sample_rate, FX_ALLPASS_RING);
+		err |= s->allpass[i] == NULL;
+	}
+	return err;
+}
+
+static void chorus(struct fx_state* s, const struct fx* fx, float* buf, size_t n)
+{
+	const unsigned mask = FX_CHORUS_RING - 1;
+	const float max_delay = (FX_CHORUS_RING - 2) / s->sample_rate;
+	const float depth = MIN(fx->chorus_depth, max_delay - CHORUS_BASE_DELAY);
+	const float phase_step = fx->chorus_rate / s->sample_rate;
+	float phase = s->chorus_phase;
+	float lfo[CHORUS_LFO_BLOCK];
+	for (size_t i = 0; i < n; i++) {
+		size_t l = i % CHORUS_LFO_BLOCK;
+		if (l == 0) {
+			// the LFO for the next stretch, all at once
+			size_t m = MIN(n - i, CHORUS_LFO_BLOCK);
+			for (size_t j = 0; j < m; j++) {
+				lfo[j] = phase;
+				phase += phase_step;
+				if (phase >= 1.f) {
+					phase -= 1.f;
+				}
+			}
+			fast_sin_turns_block(lfo, lfo, m);
+		}
+		unsigned pos = s->pos + i;
+		float x = buf[i];
+		s->chorus[pos & mask] = x;
+
+		// linear interpolation between the two samples around the tap
+		float d = (CHORUS_BASE_DELAY + depth * 0.5f * (1.f + lfo[l])) * s->sample_rate;
+		unsigned whole = d;
+		float frac = d - whole;
+		float a = s->chorus[(pos - whole) & mask];
+		float b = s->chorus[(pos - whole - 1) & mask];
+		float wet = a + (b - a) * frac;
+
+		buf[i] = x + (wet - x) * fx->chorus_mix;
+	}
+	s->chorus_phase = phase;
+}
+
+static void delay(struct fx_state* s, const struct fx* fx, float* buf, size_t n)
+{
+	const unsigned mask = FX_DELAY_RING - 1;
+	unsigned len = fx->delay_time * s->sample_rate;
+	if (len < 1) {
+		len = 1;
+	} else if (len > mask) {
+		len = mask;
+	}
+	const float feedback = fx->delay_feedback;
+	const float mix = fx->delay_mix;
+	for (size_t i = 0; i < n; i++) {
+		unsigned pos = s->pos + i;
+		float echo = s->delay[(pos - len) & mask];
+		s->delay[pos & mask] = buf[i] + echo * feedback;
+		buf[i] += echo * mix;
+	}
+}
+
+static void reverb(struct fx_state* s, const struct fx* fx, float* buf, size_t n)
+{
+	const float feedback = 0.7f + 0.28f * fx->reverb_size;
+	const float damp = 0.4f * fx->reverb_damping;
+	const float mix = fx->reverb_mix;
+	for (size_t i = 0; i < n; i++) {
+		unsigned pos = s->pos + i;
+		float x = buf[i];
+		float in = x * REVERB_INPUT_GAIN;
+		float wet = 0.f;
+		for (int c = 0; c < FX_NUM_COMBS; c++) {
+			float* ring = s->comb[c];
+			float y = ring[(pos - s->comb_len[c]) & (FX_COMB_RING - 1)];
+			s->comb_store[c] = y * (1.f - damp) + s->comb_store[c] * damp;
+			ring[pos & (FX_COMB_RING - 1)] = in + s->comb_store[c] * feedback;
+			wet += y;
+		}
+		for (int a = 0; a < FX_NUM_ALLPASSES; a++) {
+			float* ring = s->allpass[a];
+			float y = ring[(pos - s->allpass_len[a]) & (FX_ALLPASS_RING - 1)];
+			ring[pos & (FX_ALLPASS_RING - 1)] = wet + y * REVERB_ALLPASS_FEEDBACK;
+			wet = y - wet;
+		}
+		buf[i] = x + (wet - x) * mix;
+	}
+}
+
+int fx_active(const struct fx* fx)
+{
+	return fx->chorus_mix > 0.f || fx->delay_mix > 0.f || fx->reverb_mix > 0.f;
+}
+
+void fx_process(struct fx_state* s, const struct fx* fx, const float* const* in, int num_in, float* out, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		float x = in[0][i];
+		for (int b = 1; b < num_in; b++) {
+			x += in[b][i];
+		}
+		out[i] = x;
+	}
+
+	if (fx->chorus_mix > 0.f) {
+		chorus(s, fx, out, n);
+	}
+	if (fx->delay_mix > 0.f) {
+		delay(s, fx, out, n);
+	}
+	if (fx->reverb_mix > 0.f) {
+		reverb(s, fx, out, n);
+	}
+	s->pos += n;
+}
@@ -0,0 +1,58 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include "arena.h"
+#include "synth.h"
+
+// Master effects: chorus, then delay, then reverb, applied to the sum of all
+// the voices. Settings come from the patch (struct fx); the state, including
+// every delay line, is allocated once by fx_init and never resized. Delay
+// lines are power of two rings indexed by one shared, ever increasing write
+// position, so a read is a subtract and a mask.
+
+#define FX_DELAY_RING (1 << 17) // > FX_DELAY_MAX at up to 65 kHz
+#define FX_CHORUS_RING (1 << 11)
+#define FX_COMB_RING (1 << 11)
+#define FX_ALLPASS_RING (1 << 10)
+
+#define FX_NUM_COMBS 8
+#define FX_NUM_ALLPASSES 4
+
+// what fx_init takes from its arena
+#define FX_ARENA_BYTES (ARENA_SIZE(FX_DELAY_RING * sizeof(float)) \
+    + ARENA_SIZE(FX_CHORUS_RING * sizeof(float)) \
+    + FX_NUM_COMBS * ARENA_SIZE(FX_COMB_RING * sizeof(float)) \
+    + FX_NUM_ALLPASSES * ARENA_SIZE(FX_ALLPASS_RING * sizeof(float)))
+
+struct fx_state {
+	float sample_rate;
+	unsigned pos;
+
+	float* delay;
+	float* chorus;
+	float chorus_phase; // 0 to 1
+
+	// a mono Freeverb: parallel low-passed combs into series allpasses
+	float* comb[FX_NUM_COMBS];
+	unsigned comb_len[FX_NUM_COMBS];
+	float comb_store[FX_NUM_COMBS];
+	float* allpass[FX_NUM_ALLPASSES];
+	unsigned allpass_len[FX_NUM_ALLPASSES];
+};
+
+// returns non-zero if the arena is too small
+int fx_init(struct fx_state* s, struct arena* arena, float sample_rate);
+
+// non-zero if any of the effects is on
+int fx_active(const struct fx* fx);
+
+// sums the num_in buffers and runs them through the effects into out; out
+// may be the same buffer as in[0]. With every effect off this is just the sum.
+void fx_process(struct fx_state* s, const struct fx* fx, const float* const* in, int num_in, float* out, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,91 @@
+#include "midi.h"
+#include "controls.h"
+#include "note_queue.h"
+#include "parts.h"
+
+const float midi_key_freq[128] = {
+	8.17580, 8.66196, 9.17702, 9.72272, 10.3009, 10.9134, 11.5623, 12.2499, 12.9783, 13.7500,
+	14.5676, 15.4339, 16.3516, 17.3239, 18.3540, 19.4454, 20.6017, 21.8268, 23.1247, 24.4997,
+	25.9565, 27.5000, 29.1352, 30.8677, 32.7032, 34.6478, 36.7081, 38.8909, 41.2034, 43.6535,
+	46.2493, 48.9994, 51.9131, 55.0000, 58.2705, 61.7354, 65.4064, 69.2957, 73.4162, 77.7817,
+	82.4069, 87.3071, 92.4986, 97.9989, 103.826, 110.000, 116.541, 123.471, 130.813, 138.591,
+	146.832, 155.563, 164.814, 174.614, 184.997, 195.998, 207.652, 220.000, 233.082, 246.942,
+	261.626, 277.183, 293.665, 311.127, 329.628, 349.228, 369.994, 391.995, 415.305, 440.000,
+	466.164, 493.883, 523.251, 554.365, 587.330, 622.254, 659.255, 698.456, 739.989, 783.991,
+	830.609, 880.000, 932.328, 987.767, 1046.50, 1108.73, 1174.66, 1244.51, 1318.51, 1396.91,
+	1479.98, 1567.98, 1661.22, 1760.00, 1864.66, 1975.53, 2093.00, 2217.46, 2349.32, 2489.02,
+	2637.02, 2793.83, 2959.96, 3135.96, 3322.44, 3520.00, 3729.31, 3951.07, 4186.01, 4434.92,
+	4698.64, 4978.03, 5274.04, 5587.65, 5919.91, 6271.93, 6644.88, 7040.00, 7458.62, 7902.13,
+	8372.02, 8869.84, 9397.27, 9956.06, 10548.1, 11175.3, 11839.8, 12543.9
+};
+
+int midi_apply(const uint8_t msg[3], struct note_queue* notes, struct parts* parts)
+{
+	int type = msg[0] >> 4;
+	// data bytes are 7 bit; a stray status byte mustn't index past the table
+	int data1 = msg[1] & 0x7f;
+	int data2 = msg[2] & 0x7f;
+
+	switch (type) {
+	case MIDI_NOTE_ON:
+	case MIDI_NOTE_OFF:
+	case MIDI_AFTERTOUCH:
+		break;
+	case MIDI_CC:
+		if (data1 == MIDI_CC_VOLUME) {
+			return MIDI_UNHANDLED;
+		}
+		break;
+	case MIDI_PITCH_BEND:
+		// only the coarse half is used; 64 is the middle
+		if (data1 != 0) {
+			return MIDI_UNHANDLED;
+		}
+		break;
+	default:
+		return MIDI_UNHANDLED;
+	}
+
+	int result = MIDI_IGNORED;
+	for (int i = 0; i < parts->setup.num_parts; i++) {
+		const struct part* part = &parts->setup.parts[i];
+		struct controls* controls = &parts->controls[i];
+		if (!part_hears(part, msg[0])) {
+			continue;
+		}
+
+		switch (type) {
+		case MIDI_NOTE_ON:
+		case MIDI_NOTE_OFF:
+			if (data1 < part->lo || data1 > part->hi) {
+				continue;
+			}
+			if (note_queue_push(notes, type == MIDI_NOTE_ON ? NOTE_EVENT_ON : NOTE_EVENT_OFF, i, midi_key_freq[data1], type == MIDI_NOTE_ON ? data2 / 127.f : 0.f)) {
+				result = MIDI_QUEUE_FULL;
+				continue;
+			}
+			break;
+
+		case MIDI_CC:
+			if (data1 == MIDI_CC_MODWHEEL) {
+				controls_mod_wheel(controls, data2 / 127.f); // 0.0 to 1.0
+			}
+			// any CC (the c1 to c4 dials are 74, 71, 73, 72) can be mapped
+			// to a patch parameter with a [ccN] section
+			controls_cc(controls, data1, data2);
+			break;
+
+		case MIDI_AFTERTOUCH:
+			controls_aftertouch(controls, data1 / 127.f);
+			break;
+
+		case MIDI_PITCH_BEND:
+			controls_pitch_bend(controls, (data2 - 64.f) / 64.f); // 0 -> -1, 64 -> 0, 127 -> 0.97
+			break;
+		}
+		if (result == MIDI_IGNORED) {
+			result = MIDI_APPLIED;
+		}
+	}
+	return result;
+}
@@ -0,0 +1,42 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stdint.h>
+
+struct note_queue;
+struct parts;
+
+// channel message types, the status byte's high nibble
+#define MIDI_NOTE_OFF 0x8
+#define MIDI_NOTE_ON 0x9
+#define MIDI_CC 0xb
+#define MIDI_PROGRAM_CHANGE 0xc
+#define MIDI_AFTERTOUCH 0xd // channel pressure
+#define MIDI_PITCH_BEND 0xe
+
+#define MIDI_CC_MODWHEEL 1
+#define MIDI_CC_VOLUME 7
+
+// results of midi_apply()
+#define MIDI_APPLIED 0
+#define MIDI_QUEUE_FULL 1 // a note was dropped
+#define MIDI_UNHANDLED 2
+#define MIDI_IGNORED 3 // no part listens on its channel, or plays its key
+
+// the frequency of each MIDI key number; see http://www.deimos.ca/notefreqs/
+extern const float midi_key_freq[128];
+
+// Applies one three byte channel message to every part that hears its channel
+// (see parts.h): notes within a part's keys are queued on notes for it, and
+// controllers go to its controls. This is what the Pi does with MIDI, and
+// what a capture replay does with it (see capture.h), so the two can't drift
+// apart. Volume (CC 7) and Program Change are left to the caller and reported
+// as MIDI_UNHANDLED.
+int midi_apply(const uint8_t msg[3], struct note_queue* notes, struct parts* parts);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,109 @@
+#include "mixdown.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MIXDOWN_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define MIXDOWN_SSE
+#endif
+
+void mixdown_init(struct mixdown* m, float gain, int null_level, int diff_level, unsigned channels)
+{
+	m->gain = gain;
+	m->null_level = null_level;
+	m->diff_level = diff_level;
+	m->channels = channels;
+}
+
+static inline float sum_at(const float* const* bufs, int num_bufs, size_t i)
+{
+	float x = bufs[0][i];
+	for (int b = 1; b < num_bufs; b++) {
+		x += bufs[b][i];
+	}
+	return x;
+}
+
+// converts one sample; used for whatever the vector loop leaves over, and
+// for every sample when there is no vector unit
+static inline uint32_t convert(float x, float gain, const struct mixdown* m)
+{
+	if (x > 1.0f) {
+		x = 1.0f;
+	} else if (x < -1.0f) {
+		x = -1.0f;
+	}
+	return (uint32_t)(m->null_level + x * gain * m->diff_level);
+}
+
+void mixdown_u32(struct mixdown* m, const float* const* bufs, int num_bufs, size_t n, float target_gain, uint32_t* out)
+{
+	const unsigned channels = m->channels;
+	const float step = n > 0 ? (target_gain - m->gain) / n : 0.f;
+	size_t i = 0;
+
+	// the vector paths handle mono and stereo, which is everything circle's
+	// sound devices ask for; other layouts take the scalar loop below
+#if defined(MIXDOWN_NEON)
+	if (channels == 1 || channels == 2) {
+		const float32x4_t one = vdupq_n_f32(1.0f);
+		const float32x4_t minus_one = vdupq_n_f32(-1.0f);
+		const float32x4_t null_level = vdupq_n_f32(m->null_level);
+		const float32x4_t diff_level = vdupq_n_f32(m->diff_level);
+		const float32x4_t gain_step = vdupq_n_f32(4 * step);
+		const float ramp[4] = { 0.f, step, 2 * step, 3 * step };
+		float32x4_t gain = vaddq_f32(vdupq_n_f32(m->gain), vld1q_f32(ramp));
+		for (; i + 4 <= n; i += 4) {
+			float32x4_t x = vld1q_f32(&bufs[0][i]);
+			for (int b = 1; b < num_bufs; b++) {
+				x = vaddq_f32(x, vld1q_f32(&bufs[b][i]));
+			}
+			x = vminq_f32(vmaxq_f32(x, minus_one), one);
+			x = vmlaq_f32(null_level, vmulq_f32(x, gain), diff_level);
+			uint32x4_t s = vcvtq_u32_f32(x);
+			if (channels == 1) {
+				vst1q_u32(&out[i], s);
+			} else {
+				uint32x4x2_t lr = { { s, s } };
+				vst2q_u32(&out[2 * i], lr);
+			}
+			gain = vaddq_f32(gain, gain_step);
+		}
+	}
+#elif defined(MIXDOWN_SSE)
+	if (channels == 1 || channels == 2) {
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 minus_one = _mm_set1_ps(-1.0f);
+		const __m128 null_level = _mm_set1_ps(m->null_level);
+		const __m128 diff_level = _mm_set1_ps(m->diff_level);
+		const __m128 gain_step = _mm_set1_ps(4 * step);
+		__m128 gain = _mm_add_ps(_mm_set1_ps(m->gain), _mm_set_ps(3 * step, 2 * step, step, 0.f));
+		for (; i + 4 <= n; i += 4) {
+			__m128 x = _mm_loadu_ps(&bufs[0][i]);
+			for (int b = 1; b < num_bufs; b++) {
+				x = _mm_add_ps(x, _mm_loadu_ps(&bufs[b][i]));
+			}
+			x = _mm_min_ps(_mm_max_ps(x, minus_one), one);
+			x = _mm_add_ps(null_level, _mm_mul_ps(_mm_mul_ps(x, gain), diff_level));
+			// the levels are well below 2^31, so a signed conversion will do
+			__m128i s = _mm_cvttps_epi32(x);
+			if (channels == 1) {
+				_mm_storeu_si128((__m128i*)&out[i], s);
+			} else {
+				_mm_storeu_si128((__m128i*)&out[2 * i], _mm_unpacklo_epi32(s, s));
+				_mm_storeu_si128((__m128i*)&out[2 * i + 4], _mm_unpackhi_epi32(s, s));
+			}
+			gain = _mm_add_ps(gain, gain_step);
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		uint32_t s = convert(sum_at(bufs, num_bufs, i), m->gain + i * step, m);
+		for (unsigned c = 0; c < channels; c++) {
+			out[i * channels + c] = s;
+		}
+	}
+	m->gain = target_gain;
+}
@@ -0,0 +1,30 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Device output format for mixdown_u32(): samples are written as
+// null_level + x * diff_level, with x clipped to -1.0 .. 1.0, and every
+// frame is repeated across channels.
+struct mixdown {
+	float gain; // the gain the previous block ended on
+	float null_level;
+	float diff_level;
+	unsigned channels;
+};
+
+void mixdown_init(struct mixdown* m, float gain, int null_level, int diff_level, unsigned channels);
+
+// Sums n samples from each of num_bufs buffers, applies a gain that ramps
+// linearly from m->gain to target_gain over the block, clips and converts,
+// writing n * m->channels interleaved samples to out. Each sample is read
+// and written once; NEON or SSE2 is used when available.
+void mixdown_u32(struct mixdown* m, const float* const* bufs, int num_bufs, size_t n, float target_gain, uint32_t* out);
+
+#ifdef __cplusplus
+}
+#endif
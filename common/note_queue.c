@@ -0,0 +1,55 @@
+#include "note_queue.h"
+#include "parts.h"
+#include "synth.h"
+
+#ifdef __circle__
+#include <circle/util.h>
+#else
+#include <string.h>
+#endif
+
+void note_queue_init(struct note_queue* q)
+{
+	memset(q, 0, sizeof(struct note_queue));
+}
+
+int note_queue_push(struct note_queue* q, int type, int part, float freq, float velocity)
+{
+	unsigned head = q->head;
+	unsigned tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	if (head - tail == NOTE_QUEUE_SIZE) {
+		q->dropped++;
+		return 1;
+	}
+	struct note_event* e = &q->events[head & (NOTE_QUEUE_SIZE - 1)];
+	e->type = type;
+	e->part = part;
+	e->freq = freq;
+	e->velocity = velocity;
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int note_queue_pop(struct note_queue* q, struct note_event* e)
+{
+	unsigned tail = q->tail;
+	unsigned head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	if (head == tail) {
+		return 0;
+	}
+	*e = q->events[tail & (NOTE_QUEUE_SIZE - 1)];
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+void note_queue_apply(struct note_queue* q, struct key* keys, const struct parts* parts, float t)
+{
+	struct note_event e;
+	while (note_queue_pop(q, &e)) {
+		if (e.type == NOTE_EVENT_ON) {
+			synth_note_on(keys, parts->patch[e.part], e.part, parts->limits, e.freq, e.velocity, t);
+		} else {
+			synth_note_off(keys, e.part, e.freq, t);
+		}
+	}
+}
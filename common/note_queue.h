@@ -0,0 +1,51 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include "arena.h"
+
+struct key;
+struct parts;
+
+#define NOTE_QUEUE_SIZE 64 // must be a power of two
+
+#define NOTE_EVENT_OFF 0
+#define NOTE_EVENT_ON 1
+
+struct note_event {
+	int type;
+	int part; // see parts.h
+	float freq;
+	float velocity;
+};
+
+// Single producer, single consumer queue of note events. The MIDI interrupt
+// pushes; the audio loop drains it between blocks, so voices are only ever
+// written by whoever renders them and never while a core is rendering.
+struct note_queue {
+	struct note_event events[NOTE_QUEUE_SIZE];
+
+	// head is only written by the producer, tail only by the consumer
+	unsigned head __attribute__((aligned(CACHE_LINE)));
+	unsigned dropped;
+
+	unsigned tail __attribute__((aligned(CACHE_LINE)));
+};
+
+void note_queue_init(struct note_queue* q);
+
+// returns non-zero (and counts a drop) if the queue is full
+int note_queue_push(struct note_queue* q, int type, int part, float freq, float velocity);
+
+// returns zero once the queue is empty
+int note_queue_pop(struct note_queue* q, struct note_event* e);
+
+// pops every queued event and applies it to the voices at time t, each note
+// on instantiating its part's patch
+void note_queue_apply(struct note_queue* q, struct key* keys, const struct parts* parts, float t);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,231 @@
+#include "parts.h"
+
+#ifdef __circle__
+#include <circle/util.h>
+#else
+#include <string.h>
+#endif
+
+void part_setup_default(struct part_setup* s)
+{
+	memset(s, 0, sizeof(struct part_setup));
+	s->num_parts = 1;
+	s->parts[0].channel = PART_OMNI;
+	s->parts[0].lo = 0;
+	s->parts[0].hi = 127;
+	s->parts[0].program = 0;
+	s->parts[0].max_voices = MAX_KEYS;
+	s->parts[0].priority = 0;
+}
+
+// the setup file is parsed like a patch; see patch_compile()
+static bool tok_eq(const char* s, size_t n, const char* lit)
+{
+	size_t i = 0;
+	for (; i < n; i++) {
+		if (lit[i] != s[i]) {
+			return false;
+		}
+	}
+	return lit[i] == '\0';
+}
+
+static bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static void trim(const char** s, size_t* n)
+{
+	while (*n && is_space(**s)) {
+		(*s)++;
+		(*n)--;
+	}
+	while (*n && is_space((*s)[*n - 1])) {
+		(*n)--;
+	}
+}
+
+static size_t find_char(const char* s, size_t n, char c)
+{
+	size_t i = 0;
+	while (i < n && s[i] != c) {
+		i++;
+	}
+	return i;
+}
+
+// parses a whole token of decimal digits, from min to max
+static int parse_int(const char* s, size_t n, int min, int max, int* v)
+{
+	if (n == 0 || n > 6) {
+		return 1;
+	}
+	*v = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (s[i] < '0' || s[i] > '9') {
+			return 1;
+		}
+		*v = *v * 10 + (s[i] - '0');
+	}
+	return *v < min || *v > max;
+}
+
+// keys=36-59, or a single key
+static int parse_range(const char* s, size_t n, int* lo, int* hi)
+{
+	size_t dash = find_char(s, n, '-');
+	if (dash == n) {
+		if (parse_int(s, n, 0, 127, lo) != 0) {
+			return 1;
+		}
+		*hi = *lo;
+		return 0;
+	}
+	const char* a = s;
+	size_t a_len = dash;
+	const char* b = s + dash + 1;
+	size_t b_len = n - dash - 1;
+	trim(&a, &a_len);
+	trim(&b, &b_len);
+	return parse_int(a, a_len, 0, 127, lo) != 0 || parse_int(b, b_len, 0, 127, hi) != 0 || *lo > *hi;
+}
+
+int part_setup_parse(const char* src, size_t len, struct part_setup* s)
+{
+	struct part_setup staging;
+	struct part* part = NULL;
+	memset(&staging, 0, sizeof(struct part_setup));
+
+	const char* end = src + len;
+	int line_num = 0;
+	while (src < end) {
+		const char* line = src;
+		size_t n = find_char(src, end - src, '\n');
+		src += n < (size_t)(end - src) ? n + 1 : n;
+		line_num++;
+
+		n = find_char(line, n, '#');
+		const char* l = line;
+		trim(&l, &n);
+		if (n == 0) {
+			continue;
+		}
+		int col = (l - line) + 1;
+
+		if (l[0] == '[') {
+			if (l[n - 1] != ']') {
+				return patch_error(line_num, col, "expected ] to close", l, n);
+			}
+			const char* name = l + 1;
+			size_t name_len = n - 2;
+			trim(&name, &name_len);
+			int num;
+			if (name_len <= 4 || !tok_eq(name, 4, "part") || parse_int(name + 4, name_len - 4, 1, MAX_PARTS, &num) != 0) {
+				return patch_error(line_num, col + 1, "expected part1 to part8 but got", name, name_len);
+			}
+			if (num != staging.num_parts + 1) {
+				return patch_error(line_num, col + 1, "parts must be numbered in order from part1, but got", name, name_len);
+			}
+			part = &staging.parts[staging.num_parts++];
+			part->channel = PART_OMNI;
+			part->lo = 0;
+			part->hi = 127;
+			part->program = PART_NO_PROGRAM;
+			part->max_voices = MAX_KEYS;
+			part->priority = 0;
+			continue;
+		}
+		if (part == NULL) {
+			return patch_error(line_num, col, "expected a [partN] section before", l, n);
+		}
+
+		size_t eq = find_char(l, n, '=');
+		if (eq == n) {
+			return patch_error(line_num, col, "failed to parse key=value pair", l, n);
+		}
+		const char* key = l;
+		size_t key_len = eq;
+		const char* value = l + eq + 1;
+		size_t value_len = n - eq - 1;
+		trim(&key, &key_len);
+		trim(&value, &value_len);
+		int value_col = (value - line) + 1;
+
+		if (tok_eq(key, key_len, "channel")) {
+			if (tok_eq(value, value_len, "omni")) {
+				part->channel = PART_OMNI;
+			} else if (parse_int(value, value_len, 1, 16, &part->channel) != 0) {
+				return patch_error(line_num, value_col, "expected a MIDI channel from 1 to 16, or omni, but got", value, value_len);
+			}
+		} else if (tok_eq(key, key_len, "keys")) {
+			if (parse_range(value, value_len, &part->lo, &part->hi) != 0) {
+				return patch_error(line_num, value_col, "expected a range of MIDI notes (e.g. 36-59) but got", value, value_len);
+			}
+		} else if (tok_eq(key, key_len, "program")) {
+			if (tok_eq(value, value_len, "none")) {
+				part->program = PART_NO_PROGRAM;
+			} else if (parse_int(value, value_len, 0, 127, &part->program) != 0) {
+				return patch_error(line_num, value_col, "expected a program from 0 to 127, or none, but got", value, value_len);
+			}
+		} else if (tok_eq(key, key_len, "voices")) {
+			if (parse_int(value, value_len, 1, MAX_KEYS, &part->max_voices) != 0) {
+				return patch_error(line_num, value_col, "expected a number of voices from 1 to 8 but got", value, value_len);
+			}
+		} else if (tok_eq(key, key_len, "priority")) {
+			if (parse_int(value, value_len, 0, 127, &part->priority) != 0) {
+				return patch_error(line_num, value_col, "expected a priority from 0 to 127 but got", value, value_len);
+			}
+		} else {
+			return patch_error(line_num, col, "unknown key", key, key_len);
+		}
+	}
+
+	if (staging.num_parts == 0) {
+		part_setup_default(&staging);
+	}
+	memcpy(s, &staging, sizeof(struct part_setup));
+	return 0;
+}
+
+void parts_init(struct parts* p, const struct part_setup* s, struct patch* patch)
+{
+	memcpy(&p->setup, s, sizeof(struct part_setup));
+	for (int i = 0; i < MAX_PARTS; i++) {
+		p->limits[i].max_voices = s->parts[i].max_voices;
+		p->limits[i].priority = s->parts[i].priority;
+		p->patch[i] = patch;
+		controls_init(&p->controls[i], patch);
+	}
+}
+
+void parts_swap(struct parts* p, struct key* keys, int part, struct patch* patch, float sample_rate)
+{
+	synth_swap_patch(keys, part, patch, sample_rate);
+	p->patch[part] = patch;
+	controls_set_patch(&p->controls[part], patch);
+}
+
+void parts_move(struct parts* p, int part, struct patch* copy)
+{
+	p->patch[part] = copy;
+	p->controls[part].patch = copy;
+}
+
+void parts_group(const struct key* keys, int start, int end, int num_parts, unsigned char* voices, int* first)
+{
+	int next[MAX_PARTS];
+	for (int p = 0; p <= num_parts; p++) {
+		first[p] = 0;
+	}
+	for (int i = start; i < end; i++) {
+		first[keys[i].part + 1]++;
+	}
+	for (int p = 0; p < num_parts; p++) {
+		first[p + 1] += first[p];
+		next[p] = first[p];
+	}
+	for (int i = start; i < end; i++) {
+		voices[next[keys[i].part]++] = i;
+	}
+}
@@ -0,0 +1,84 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "controls.h"
+#include "synth.h"
+
+// Multi-timbral parts: each plays its own patch, from the notes of one MIDI
+// channel (or all of them) within a range of keys, so parts sharing a channel
+// split or layer the keyboard. Every part draws on the one pool of MAX_KEYS
+// voices; a voice belongs to the part that started its note (key->part), and
+// synth_note_on() balances them by each part's voice limit and priority.
+//
+// Each part has its own controls (pitch bend, CC maps, modulation and global
+// LFOs), published separately; a renderer groups its voices by part with
+// parts_group() and steps each part's snapshot over its own group.
+
+#define MAX_PARTS 8
+#define PART_OMNI 0 // the channel of a part that listens to all of them
+#define PART_NO_PROGRAM -1
+
+// one [partN] section of a setup file
+struct part {
+	int channel; // 1 to 16, or PART_OMNI
+	int lo; // the lowest MIDI note it plays
+	int hi; // and the highest
+	int program; // the bank program it starts on, or PART_NO_PROGRAM
+	int max_voices;
+	int priority;
+};
+
+struct part_setup {
+	int num_parts;
+	struct part parts[MAX_PARTS];
+};
+
+struct parts {
+	struct part_setup setup;
+	struct voice_limit limits[MAX_PARTS]; // from setup, for synth_note_on()
+	struct patch* patch[MAX_PARTS]; // the one each part's notes instantiate voices from
+	struct controls controls[MAX_PARTS];
+};
+
+// a single part, on every channel and key, that may use every voice and
+// starts on program 0
+void part_setup_default(struct part_setup* s);
+
+// Parses a setup file of [part1], [part2], ... sections; src does not need to
+// be NUL terminated. On failure s is left untouched and load_patch_err()
+// describes the line and column of the problem.
+int part_setup_parse(const char* src, size_t len, struct part_setup* s);
+
+// every part starts on patch; call while nothing is sounding
+void parts_init(struct parts* p, const struct part_setup* s, struct patch* patch);
+
+// Makes patch the one part plays (see synth_swap_patch()); must be called
+// between blocks, and kept from the MIDI interrupt, which reads the part's CC
+// maps.
+void parts_swap(struct parts* p, struct key* keys, int part, struct patch* patch, float sample_rate);
+
+// Moves part onto copy, a patch_copy() of the one it plays, leaving its voices
+// and controls as they are; the same conditions as parts_swap().
+void parts_move(struct parts* p, int part, struct patch* copy);
+
+// whether a channel message with this status byte is for part
+static inline bool part_hears(const struct part* part, uint8_t status)
+{
+	return part->channel == PART_OMNI || part->channel == (status & 0x0f) + 1;
+}
+
+// Lists keys[start..end) in voices grouped by part, so each part's controls
+// are stepped over, and its voices rendered, together: part p's are
+// voices[first[p] .. first[p + 1]), and first has num_parts + 1 entries.
+void parts_group(const struct key* keys, int start, int end, int num_parts, unsigned char* voices, int* first);
+
+#ifdef __cplusplus
+}
+#endif
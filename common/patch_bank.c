@@ -0,0 +1,117 @@
+#include "patch_bank.h"
+#include "crc32.h"
+#include "patch_bin.h"
+
+#ifdef __circle__
+#include <circle/util.h>
+#else
+#include <string.h>
+#endif
+
+void patch_bank_init(struct patch_bank* b, struct arena* arena)
+{
+	memset(b, 0, sizeof(*b));
+	b->arena = arena;
+	b->scratch = arena_alloc(arena, sizeof(struct patch));
+	b->offered = -1;
+}
+
+int patch_bank_program(const char* name)
+{
+	int program = 0;
+	int digits = 0;
+	for (; name[digits] >= '0' && name[digits] <= '9'; digits++) {
+		program = program * 10 + (name[digits] - '0');
+		if (program >= PATCH_BANK_PROGRAMS) {
+			return -1;
+		}
+	}
+	return digits > 0 ? program : -1;
+}
+
+void patch_bank_begin(struct patch_bank* b)
+{
+	for (int i = 0; i < PATCH_BANK_PROGRAMS; i++) {
+		b->programs[i].seen = 0;
+	}
+	b->offered = -1;
+}
+
+int patch_bank_offer(struct patch_bank* b, const char* name, const void* data, size_t len, int* program)
+{
+	b->offered = -1;
+	*program = patch_bank_program(name);
+	if (*program < 0) {
+		return PATCH_BANK_IGNORED;
+	}
+	struct patch_bank_program* p = &b->programs[*program];
+	if (p->seen) {
+		return PATCH_BANK_DUPLICATE;
+	}
+	p->seen = 1;
+
+	size_t n = 0;
+	while (n < PATCH_BANK_NAME_MAX - 1 && name[n] != '\0') {
+		n++;
+	}
+	memcpy(p->name, name, n);
+	p->name[n] = '\0';
+
+	uint32_t crc = crc32(data, len);
+	if (p->loaded && p->crc == crc) {
+		return PATCH_BANK_UNCHANGED;
+	}
+	if (b->scratch == NULL) {
+		return PATCH_BANK_NO_MEMORY;
+	}
+	if (p->patch == NULL) {
+		p->patch = arena_alloc(b->arena, sizeof(struct patch));
+		if (p->patch == NULL) {
+			return PATCH_BANK_NO_MEMORY;
+		}
+	}
+
+	int err;
+	if (patch_bin_detect(data, len)) {
+		err = patch_bin_load(data, len, b->scratch);
+	} else {
+		err = patch_compile(data, len, b->scratch);
+	}
+	if (err != 0) {
+		return PATCH_BANK_FAILED;
+	}
+	p->crc = crc;
+	b->offered = *program;
+	return PATCH_BANK_COMPILED;
+}
+
+struct patch* patch_bank_store(struct patch_bank* b)
+{
+	struct patch_bank_program* p = &b->programs[b->offered];
+	patch_copy(p->patch, b->scratch);
+	p->loaded = 1;
+	b->offered = -1;
+	return p->patch;
+}
+
+int patch_bank_end(struct patch_bank* b)
+{
+	int loaded = 0;
+	for (int i = 0; i < PATCH_BANK_PROGRAMS; i++) {
+		struct patch_bank_program* p = &b->programs[i];
+		if (!p->seen) {
+			// its patch stays allocated, for when the file comes back
+			p->loaded = 0;
+		}
+		loaded += p->loaded;
+	}
+	return loaded;
+}
+
+struct patch* patch_bank_get(struct patch_bank* b, int program)
+{
+	if (program < 0 || program >= PATCH_BANK_PROGRAMS || !b->programs[program].loaded) {
+		return NULL;
+	}
+	return b->programs[program].patch;
+}
@@ -0,0 +1,87 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "synth.h"
+
+// Patch bank: a patch compiled ahead of time for each MIDI program, so that
+// a Program Change is a pointer swap at the next block boundary, with no
+// parsing while playing.
+//
+// Each program comes from a file whose name starts with its number (0 to
+// 127), e.g. "5 strings.txt"; text and binary patches alike. A reload offers
+// every file again with patch_bank_offer(), between patch_bank_begin() and
+// patch_bank_end(), and only files whose crc32 has changed are compiled;
+// programs whose file has gone are dropped.
+
+#define PATCH_BANK_PROGRAMS 128
+#define PATCH_BANK_NAME_MAX 64
+
+// the most a bank can take from its arena: every program, plus a scratch
+// patch to compile into
+#define PATCH_BANK_ARENA_BYTES ((PATCH_BANK_PROGRAMS + 1) * ARENA_SIZE(sizeof(struct patch)))
+
+// results of patch_bank_offer()
+#define PATCH_BANK_UNCHANGED 0 // same crc as the one loaded
+#define PATCH_BANK_COMPILED 1 // compiled into the scratch patch; call patch_bank_store()
+#define PATCH_BANK_FAILED 2 // didn't compile; load_patch_err() says why, the old one is kept
+#define PATCH_BANK_IGNORED 3 // the name doesn't start with a program number
+#define PATCH_BANK_DUPLICATE 4 // another file already gave this program
+#define PATCH_BANK_NO_MEMORY 5
+
+struct patch_bank_program {
+	char name[PATCH_BANK_NAME_MAX]; // of the file it came from
+	uint32_t crc; // of the file
+	int loaded;
+	int seen; // offered during this reload
+	struct patch* patch; // from the arena, the first time the program is loaded
+};
+
+struct patch_bank {
+	struct arena* arena;
+	struct patch* scratch;
+	int offered; // the program the scratch patch was compiled for
+	struct patch_bank_program programs[PATCH_BANK_PROGRAMS];
+};
+
+// patches are taken from arena as programs are first loaded; size it with
+// PATCH_BANK_ARENA_BYTES
+void patch_bank_init(struct patch_bank* b, struct arena* arena);
+
+// the program number a file name starts with, or -1
+int patch_bank_program(const char* name);
+
+void patch_bank_begin(struct patch_bank* b);
+
+// Offers one file's contents; returns a PATCH_BANK_*, and sets *program to
+// the program it's for (or -1). After PATCH_BANK_COMPILED the program plays
+// as before until patch_bank_store().
+int patch_bank_offer(struct patch_bank* b, const char* name, const void* data, size_t len, int* program);
+
+// Copies what the last offer compiled into its program's patch, and returns
+// that patch. The patch is overwritten in place: if it is the one playing,
+// hold off whatever reads it meanwhile, and swap it in again afterwards.
+struct patch* patch_bank_store(struct patch_bank* b);
+
+// drops programs that weren't offered since patch_bank_begin(); returns how
+// many programs are loaded
+int patch_bank_end(struct patch_bank* b);
+
+// the program's patch, or NULL if it isn't loaded
+struct patch* patch_bank_get(struct patch_bank* b, int program);
+
+// the patch patch_bank_store() will overwrite
+static inline struct patch* patch_bank_slot(const struct patch_bank* b, int program)
+{
+	return b->programs[program].patch;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,487 @@
+#include "patch_bin.h"
+#include "crc32.h"
+
+#ifdef __circle__
+#include <circle/util.h>
+#else
+#include <string.h>
+#endif
+
+#include <math.h>
+
+int patch_bin_detect(const void* data, size_t len)
+{
+	uint32_t magic;
+	if (len < sizeof(magic)) {
+		return 0;
+	}
+	memcpy(&magic, data, sizeof(magic));
+	return magic == PATCH_BIN_MAGIC;
+}
+
+// appends a record at *used, or returns 1 if it doesn't fit
+static int put_record(void* out, size_t cap, size_t* used, const void* rec, size_t size)
+{
+	if (*used + size > cap) {
+		return 1;
+	}
+	memcpy((uint8_t*)out + *used, rec, size);
+	*used += size;
+	return 0;
+}
+
+size_t patch_bin_encode(const struct patch* patch, void* out, size_t cap)
+{
+	struct patch_bin_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = PATCH_BIN_MAGIC;
+	header.version = PATCH_BIN_VERSION;
+
+	size_t used = sizeof(header);
+	if (used > cap) {
+		return 0;
+	}
+
+	struct patch_bin_globals globals;
+	memset(&globals, 0, sizeof(globals));
+	globals.type = PATCH_BIN_REC_GLOBALS;
+	globals.size = sizeof(globals);
+	globals.swap_mode = patch->swap_mode;
+	globals.crossfade = patch->crossfade;
+	if (put_record(out, cap, &used, &globals, sizeof(globals))) {
+		return 0;
+	}
+	header.num_records++;
+
+	for (int i = 0; i < patch->num_cc_maps; i++) {
+		const struct cc_map* m = &patch->cc_maps[i];
+		struct patch_bin_cc rec;
+		memset(&rec, 0, sizeof(rec));
+		rec.type = PATCH_BIN_REC_CC;
+		rec.size = sizeof(rec);
+		rec.cc = m->cc;
+		rec.osc_index = m->osc_index;
+		rec.param = m->param;
+		rec.min = m->min;
+		rec.max = m->max;
+		rec.smoothing = m->smoothing;
+		if (put_record(out, cap, &used, &rec, sizeof(rec))) {
+			return 0;
+		}
+		header.num_records++;
+	}
+
+	for (int i = 0; i < patch->num_mod_routes; i++) {
+		const struct mod_route* r = &patch->mod_routes[i];
+		struct patch_bin_mod rec;
+		memset(&rec, 0, sizeof(rec));
+		rec.type = PATCH_BIN_REC_MOD;
+		rec.size = sizeof(rec);
+		rec.src = r->src;
+		rec.dst = r->dst;
+		rec.osc_index = r->osc_index;
+		rec.depth = r->depth;
+		if (put_record(out, cap, &used, &rec, sizeof(rec))) {
+			return 0;
+		}
+		header.num_records++;
+	}
+
+	if (patch->filter.type != FILTER_NONE) {
+		struct patch_bin_filter rec;
+		memset(&rec, 0, sizeof(rec));
+		rec.type = PATCH_BIN_REC_FILTER;
+		rec.size = sizeof(rec);
+		rec.filter_type = patch->filter.type;
+		rec.cutoff = patch->filter.cutoff;
+		rec.resonance = patch->filter.resonance;
+		if (put_record(out, cap, &used, &rec, sizeof(rec))) {
+			return 0;
+		}
+		header.num_records++;
+	}
+
+	const struct fx* fx = &patch->fx;
+	if (fx->chorus_mix > 0.f || fx->delay_mix > 0.f || fx->reverb_mix > 0.f) {
+		struct patch_bin_fx rec;
+		memset(&rec, 0, sizeof(rec));
+		rec.type = PATCH_BIN_REC_FX;
+		rec.size = sizeof(rec);
+		rec.chorus_rate = fx->chorus_rate;
+		rec.chorus_depth = fx->chorus_depth;
+		rec.chorus_mix = fx->chorus_mix;
+		rec.delay_time = fx->delay_time;
+		rec.delay_feedback = fx->delay_feedback;
+		rec.delay_mix = fx->delay_mix;
+		rec.reverb_size = fx->reverb_size;
+		rec.reverb_damping = fx->reverb_damping;
+		rec.reverb_mix = fx->reverb_mix;
+		if (put_record(out, cap, &used, &rec, sizeof(rec))) {
+			return 0;
+		}
+		header.num_records++;
+	}
+
+	for (int i = 0; i < NUM_OSCS * NUM_OSC_TYPES; i++) {
+		const struct osc* osc = &patch->oscs[i];
+		if (osc->osc_type == 0) {
+			// no section for this oscillator
+			continue;
+		}
+
+		struct patch_bin_osc rec;
+		memset(&rec, 0, sizeof(rec));
+		rec.type = PATCH_BIN_REC_OSC;
+		rec.size = sizeof(rec);
+		rec.index = i;
+		rec.osc_type = osc->osc_type;
+		rec.wave_type = osc->wave_type;
+		rec.flags = (osc->freq_sync ? PATCH_BIN_FLAG_FREQ_SYNC : 0) | (osc->global ? PATCH_BIN_FLAG_GLOBAL : 0);
+		rec.phase_input = osc->phase_input ? osc->phase_input - patch->oscs : PATCH_BIN_NO_INPUT;
+		rec.amp_input = osc->amp_input ? osc->amp_input - patch->oscs : PATCH_BIN_NO_INPUT;
+		rec.freq = osc->freq;
+		rec.freq_m = osc->freq_m;
+		rec.detune = osc->detune;
+		rec.phase_input_m = osc->phase_input_m;
+		rec.amp_input_m = osc->amp_input_m;
+		rec.output_volume_m = osc->output_volume_m;
+		rec.attack = osc->attack;
+		rec.decay = osc->decay;
+		rec.sustain = osc->sustain;
+		rec.release = osc->release;
+		rec.pitch_m = osc->pitch_m;
+		rec.mod_freq_m = osc->mod_freq_m;
+		rec.mod_output_m = osc->mod_output_m;
+		if (put_record(out, cap, &used, &rec, sizeof(rec))) {
+			return 0;
+		}
+		header.num_records++;
+
+		const struct unison* u = &osc->unison;
+		if (u->copies > 1 || u->detune != UNISON_DETUNE_DEFAULT || u->spread != UNISON_SPREAD_DEFAULT) {
+			struct patch_bin_unison urec;
+			memset(&urec, 0, sizeof(urec));
+			urec.type = PATCH_BIN_REC_UNISON;
+			urec.size = sizeof(urec);
+			urec.index = i;
+			urec.copies = u->copies;
+			urec.detune = u->detune;
+			urec.spread = u->spread;
+			if (put_record(out, cap, &used, &urec, sizeof(urec))) {
+				return 0;
+			}
+			header.num_records++;
+		}
+
+		if (osc->table) {
+			struct patch_bin_wavetable wrec;
+			memset(&wrec, 0, sizeof(wrec));
+			wrec.type = PATCH_BIN_REC_WAVETABLE;
+			wrec.size = sizeof(wrec);
+			wrec.index = i;
+			wrec.position = osc->position;
+			memcpy(wrec.name, osc->table->name, sizeof(wrec.name));
+			if (put_record(out, cap, &used, &wrec, sizeof(wrec))) {
+				return 0;
+			}
+			header.num_records++;
+		}
+	}
+
+	header.crc32 = crc32((uint8_t*)out + sizeof(header), used - sizeof(header));
+	memcpy(out, &header, sizeof(header));
+	return used;
+}
+
+static int check_osc(const struct patch_bin_osc* rec)
+{
+	const float f[] = { rec->freq, rec->freq_m, rec->detune, rec->phase_input_m, rec->amp_input_m,
+		rec->output_volume_m, rec->attack, rec->decay, rec->sustain, rec->release, rec->pitch_m,
+		rec->mod_freq_m, rec->mod_output_m };
+	for (size_t i = 0; i < sizeof(f) / sizeof(f[0]); i++) {
+		if (!isfinite(f[i])) {
+			return 0;
+		}
+	}
+	// patch_compile() never goes below these
+	return rec->freq >= 0.f && rec->attack >= (float)ATTACK_MIN && rec->decay >= (float)DECAY_MIN
+	    && rec->index < NUM_OSCS * NUM_OSC_TYPES
+	    && (rec->osc_type == OSC_TYPE_VFO || rec->osc_type == OSC_TYPE_LFO)
+	    && (!(rec->flags & PATCH_BIN_FLAG_GLOBAL) || (rec->osc_type == OSC_TYPE_LFO && !(rec->flags & PATCH_BIN_FLAG_FREQ_SYNC)))
+	    && rec->wave_type <= WAVE_TYPE_WAVETABLE
+	    && (rec->phase_input == PATCH_BIN_NO_INPUT || rec->phase_input < NUM_OSCS * NUM_OSC_TYPES)
+	    && (rec->amp_input == PATCH_BIN_NO_INPUT || rec->amp_input < NUM_OSCS * NUM_OSC_TYPES);
+}
+
+static void load_osc(const struct patch_bin_osc* rec, struct patch* patch)
+{
+	struct osc* osc = &patch->oscs[rec->index];
+	osc->osc_type = rec->osc_type;
+	osc->wave_type = rec->wave_type;
+	osc->freq_sync = (rec->flags & PATCH_BIN_FLAG_FREQ_SYNC) != 0;
+	osc->global = (rec->flags & PATCH_BIN_FLAG_GLOBAL) != 0;
+	osc->phase_input = rec->phase_input == PATCH_BIN_NO_INPUT ? NULL : &patch->oscs[rec->phase_input];
+	osc->amp_input = rec->amp_input == PATCH_BIN_NO_INPUT ? NULL : &patch->oscs[rec->amp_input];
+	osc->freq = rec->freq;
+	osc->freq_m = rec->freq_m;
+	osc->detune = rec->detune;
+	osc->phase_input_m = rec->phase_input_m;
+	osc->amp_input_m = rec->amp_input_m;
+	osc->output_volume_m = rec->output_volume_m;
+	osc->attack = rec->attack;
+	osc->decay = rec->decay;
+	osc->sustain = rec->sustain;
+	osc->release = rec->release;
+	osc->pitch_m = rec->pitch_m;
+	osc->mod_freq_m = rec->mod_freq_m;
+	osc->mod_output_m = rec->mod_output_m;
+	// unless a unison record follows
+	osc->unison.copies = 1;
+	osc->unison.detune = UNISON_DETUNE_DEFAULT;
+	osc->unison.spread = UNISON_SPREAD_DEFAULT;
+}
+
+// walks the records, validating them; only writes to patch if apply is set
+static const char* load_records(const uint8_t* records, size_t len, int num_records, struct patch* patch, int apply)
+{
+	size_t off = 0;
+	int num_cc_maps = 0;
+	int num_mod_routes = 0;
+	for (int i = 0; i < num_records; i++) {
+		struct patch_bin_rec rec;
+		if (len - off < sizeof(rec)) {
+			return "binary patch is truncated";
+		}
+		memcpy(&rec, records + off, sizeof(rec));
+		if (rec.size < sizeof(rec) || rec.size > len - off) {
+			return "binary patch has a bad record size";
+		}
+
+		switch (rec.type) {
+		case PATCH_BIN_REC_GLOBALS: {
+			struct patch_bin_globals g;
+			if (rec.size != sizeof(g)) {
+				return "binary patch has a bad record size";
+			}
+			memcpy(&g, records + off, sizeof(g));
+			if (g.swap_mode != PATCH_SWAP_KEEP && g.swap_mode != PATCH_SWAP_CROSSFADE) {
+				return "binary patch has an invalid globals record";
+			}
+			if (apply) {
+				patch->swap_mode = g.swap_mode;
+				patch->crossfade = g.crossfade;
+			}
+			break;
+		}
+		case PATCH_BIN_REC_OSC: {
+			struct patch_bin_osc o;
+			if (rec.size != sizeof(o)) {
+				return "binary patch has a bad record size";
+			}
+			memcpy(&o, records + off, sizeof(o));
+			if (!check_osc(&o)) {
+				return "binary patch has an invalid oscillator record";
+			}
+			if (apply) {
+				load_osc(&o, patch);
+			}
+			break;
+		}
+		case PATCH_BIN_REC_CC: {
+			struct patch_bin_cc m;
+			if (rec.size != sizeof(m)) {
+				return "binary patch has a bad record size";
+			}
+			memcpy(&m, records + off, sizeof(m));
+			if (m.cc > 127 || m.osc_index >= NUM_OSCS * NUM_OSC_TYPES || m.param >= NUM_PARAMS) {
+				return "binary patch has an invalid CC record";
+			}
+			if (num_cc_maps == MAX_CC_MAPS) {
+				return "binary patch has too many CC records";
+			}
+			if (apply) {
+				struct cc_map* cc = &patch->cc_maps[num_cc_maps];
+				cc->cc = m.cc;
+				cc->osc_index = m.osc_index;
+				cc->param = m.param;
+				cc->min = m.min;
+				cc->max = m.max;
+				cc->smoothing = m.smoothing;
+				patch->num_cc_maps = num_cc_maps + 1;
+			}
+			num_cc_maps++;
+			break;
+		}
+		case PATCH_BIN_REC_MOD: {
+			struct patch_bin_mod m;
+			if (rec.size != sizeof(m)) {
+				return "binary patch has a bad record size";
+			}
+			memcpy(&m, records + off, sizeof(m));
+			if (m.src >= NUM_MOD_SRCS || m.dst >= NUM_MOD_DSTS || m.osc_index >= NUM_OSCS * NUM_OSC_TYPES) {
+				return "binary patch has an invalid modulation record";
+			}
+			if (num_mod_routes == MAX_MOD_ROUTES) {
+				return "binary patch has too many modulation records";
+			}
+			if (apply) {
+				struct mod_route* r = &patch->mod_routes[num_mod_routes];
+				r->src = m.src;
+				r->dst = m.dst;
+				r->osc_index = m.osc_index;
+				r->depth = m.depth;
+				patch->num_mod_routes = num_mod_routes + 1;
+			}
+			num_mod_routes++;
+			break;
+		}
+		case PATCH_BIN_REC_FILTER: {
+			struct patch_bin_filter m;
+			if (rec.size != sizeof(m)) {
+				return "binary patch has a bad record size";
+			}
+			memcpy(&m, records + off, sizeof(m));
+			if (m.filter_type > FILTER_BANDPASS || !(m.cutoff > 0.f)
+			    || !(m.resonance >= 0.f && m.resonance <= FILTER_RESONANCE_MAX)) {
+				return "binary patch has an invalid filter record";
+			}
+			if (apply) {
+				patch->filter.type = m.filter_type;
+				patch->filter.cutoff = m.cutoff;
+				patch->filter.resonance = m.resonance;
+			}
+			break;
+		}
+		case PATCH_BIN_REC_FX: {
+			struct patch_bin_fx m;
+			if (rec.size != sizeof(m)) {
+				return "binary patch has a bad record size";
+			}
+			memcpy(&m, records + off, sizeof(m));
+			const float v[] = { m.chorus_rate, m.chorus_depth, m.chorus_mix, m.delay_time, m.delay_feedback,
+				m.delay_mix, m.reverb_size, m.reverb_damping, m.reverb_mix };
+			for (size_t j = 0; j < sizeof(v) / sizeof(v[0]); j++) {
+				// also rejects NaN
+				if (!(v[j] >= 0.f && v[j] <= 1000.f)) {
+					return "binary patch has an invalid effects record";
+				}
+			}
+			if (apply) {
+				struct fx* fx = &patch->fx;
+				fx->chorus_rate = m.chorus_rate;
+				fx->chorus_depth = m.chorus_depth;
+				fx->chorus_mix = m.chorus_mix;
+				fx->delay_time = m.delay_time;
+				fx->delay_feedback = m.delay_feedback;
+				fx->delay_mix = m.delay_mix;
+				fx->reverb_size = m.reverb_size;
+				fx->reverb_damping = m.reverb_damping;
+				fx->reverb_mix = m.reverb_mix;
+				fx_clamp(fx);
+			}
+			break;
+		}
+		case PATCH_BIN_REC_UNISON: {
+			struct patch_bin_unison m;
+			if (rec.size != sizeof(m)) {
+				return "binary patch has a bad record size";
+			}
+			memcpy(&m, records + off, sizeof(m));
+			if (m.index >= NUM_OSCS * NUM_OSC_TYPES || m.copies < 1 || m.copies > UNISON_MAX
+			    || !(m.detune >= 0.f && m.detune <= UNISON_DETUNE_MAX) || !(m.spread >= 0.f && m.spread <= 1.f)) {
+				return "binary patch has an invalid unison record";
+			}
+			if (apply) {
+				struct unison* u = &patch->oscs[m.index].unison;
+				u->copies = m.copies;
+				u->detune = m.detune;
+				u->spread = m.spread;
+			}
+			break;
+		}
+		case PATCH_BIN_REC_WAVETABLE: {
+			struct patch_bin_wavetable m;
+			if (rec.size != sizeof(m)) {
+				return "binary patch has a bad record size";
+			}
+			memcpy(&m, records + off, sizeof(m));
+			size_t name_len = 0;
+			while (name_len < sizeof(m.name) && m.name[name_len] != '\0') {
+				name_len++;
+			}
+			if (m.index >= NUM_OSCS * NUM_OSC_TYPES || !(m.position >= 0.f && m.position <= 1.f)) {
+				return "binary patch has an invalid wavetable record";
+			}
+			// loaded while validating, so a missing file fails the load;
+			// the second pass finds it already loaded
+			const char* err;
+			const struct wavetable* table = wavetable_load(m.name, name_len, &err);
+			if (table == NULL) {
+				return "binary patch names a wavetable that can't be loaded";
+			}
+			if (apply) {
+				patch->oscs[m.index].table = table;
+				patch->oscs[m.index].position = m.position;
+			}
+			break;
+		}
+		default:
+			// written by a newer encoder; skip it
+			break;
+		}
+		off += rec.size;
+	}
+	if (off != len) {
+		return "binary patch has the wrong length";
+	}
+	return NULL;
+}
+
+int patch_bin_load(const void* data, size_t len, struct patch* patch)
+{
+	struct patch_bin_header header;
+	const char* err = NULL;
+
+	if (len < sizeof(header)) {
+		err = "binary patch is truncated";
+		goto fail;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != PATCH_BIN_MAGIC) {
+		err = "not a binary patch";
+		goto fail;
+	}
+	if (header.version != PATCH_BIN_VERSION) {
+		err = "unsupported binary patch version";
+		goto fail;
+	}
+	const uint8_t* records = (const uint8_t*)data + sizeof(header);
+	size_t records_len = len - sizeof(header);
+	if (crc32(records, records_len) != header.crc32) {
+		err = "binary patch checksum mismatch";
+		goto fail;
+	}
+
+	// validate everything before touching patch
+	err = load_records(records, records_len, header.num_records, patch, 0);
+	if (err) {
+		goto fail;
+	}
+
+	memset(patch, 0, sizeof(struct patch));
+	patch->swap_mode = PATCH_SWAP_KEEP;
+	patch->crossfade = PATCH_CROSSFADE_DEFAULT;
+	patch->filter.cutoff = FILTER_CUTOFF_DEFAULT;
+	load_records(records, records_len, header.num_records, patch, 1);
+	for (int i = 0; i < NUM_OSCS * NUM_OSC_TYPES; i++) {
+		if (patch->oscs[i].osc_type != 0) {
+			unison_setup(&patch->oscs[i].unison, NULL);
+		}
+	}
+	patch_update_active(patch);
+	return 0;
+
+fail:
+	patch_set_err(err);
+	return 1;
+}
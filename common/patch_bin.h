@@ -0,0 +1,170 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "synth.h"
+
+// Binary patch format (all fields little-endian):
+//
+//   struct patch_bin_header
+//   record[num_records]
+//
+// Every record starts with a one byte type and a one byte size (of the whole
+// record, including those two bytes), so a loader can skip record types it
+// doesn't know about. crc32 covers all the records. Records are fixed size
+// per type and map directly onto struct patch, so loading is a bounds check
+// and a field copy. Bump PATCH_BIN_VERSION whenever an existing record's
+// layout changes; new record types don't need a bump.
+
+#define PATCH_BIN_MAGIC 0x504e5953 // "SYNP"
+#define PATCH_BIN_VERSION 3
+
+#define PATCH_BIN_REC_OSC 1
+#define PATCH_BIN_REC_GLOBALS 2
+#define PATCH_BIN_REC_CC 3
+#define PATCH_BIN_REC_MOD 4
+#define PATCH_BIN_REC_FILTER 5
+#define PATCH_BIN_REC_FX 6
+#define PATCH_BIN_REC_UNISON 7 // follows the oscillator record it belongs to
+#define PATCH_BIN_REC_WAVETABLE 8 // likewise
+
+#define PATCH_BIN_NO_INPUT 0xff
+
+#define PATCH_BIN_FLAG_FREQ_SYNC 0x01
+#define PATCH_BIN_FLAG_GLOBAL 0x02 // older loaders ignore it and run the LFO per voice
+
+struct patch_bin_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t num_records;
+	uint32_t crc32;
+	uint32_t reserved;
+} __attribute__((packed));
+
+struct patch_bin_rec {
+	uint8_t type; // PATCH_BIN_REC_*
+	uint8_t size;
+} __attribute__((packed));
+
+struct patch_bin_globals {
+	uint8_t type;
+	uint8_t size;
+	uint8_t swap_mode; // PATCH_SWAP_*
+	uint8_t reserved;
+	float crossfade;
+} __attribute__((packed));
+
+struct patch_bin_cc {
+	uint8_t type;
+	uint8_t size;
+	uint8_t cc;
+	uint8_t osc_index;
+	uint8_t param; // PARAM_*
+	uint8_t reserved[3];
+	float min;
+	float max;
+	float smoothing;
+} __attribute__((packed));
+
+struct patch_bin_mod {
+	uint8_t type;
+	uint8_t size;
+	uint8_t src; // MOD_SRC_*
+	uint8_t dst; // MOD_DST_*
+	uint8_t osc_index;
+	uint8_t reserved[3];
+	float depth;
+} __attribute__((packed));
+
+struct patch_bin_filter {
+	uint8_t type;
+	uint8_t size;
+	uint8_t filter_type; // FILTER_*
+	uint8_t reserved;
+	float cutoff;
+	float resonance;
+} __attribute__((packed));
+
+struct patch_bin_fx {
+	uint8_t type;
+	uint8_t size;
+	uint8_t reserved[2];
+	float chorus_rate;
+	float chorus_depth;
+	float chorus_mix;
+	float delay_time;
+	float delay_feedback;
+	float delay_mix;
+	float reverb_size;
+	float reverb_damping;
+	float reverb_mix;
+} __attribute__((packed));
+
+struct patch_bin_osc {
+	uint8_t type;
+	uint8_t size;
+	uint8_t index; // slot in patch->oscs, see osc_num_to_index()
+	uint8_t osc_type; // OSC_TYPE_*
+	uint8_t wave_type; // WAVE_TYPE_*
+	uint8_t flags; // PATCH_BIN_FLAG_*
+	uint8_t phase_input; // slot index, or PATCH_BIN_NO_INPUT
+	uint8_t amp_input; // slot index, or PATCH_BIN_NO_INPUT
+
+	float freq;
+	float freq_m;
+	float detune;
+	float phase_input_m;
+	float amp_input_m;
+	float output_volume_m;
+	float attack;
+	float decay;
+	float sustain;
+	float release;
+	float pitch_m;
+	float mod_freq_m;
+	float mod_output_m;
+} __attribute__((packed));
+
+// only written for oscillators whose unison settings aren't the defaults
+struct patch_bin_unison {
+	uint8_t type;
+	uint8_t size;
+	uint8_t index; // slot in patch->oscs
+	uint8_t copies;
+	float detune;
+	float spread;
+} __attribute__((packed));
+
+// only written for wavetable oscillators; the table is loaded by name, so
+// the file has to be where the loader looks for it (see wavetable.h)
+struct patch_bin_wavetable {
+	uint8_t type;
+	uint8_t size;
+	uint8_t index; // slot in patch->oscs
+	uint8_t reserved;
+	float position;
+	char name[WAVETABLE_NAME_MAX]; // NUL padded
+} __attribute__((packed));
+
+#define PATCH_BIN_MAX_SIZE (sizeof(struct patch_bin_header) + sizeof(struct patch_bin_globals) \
+    + (sizeof(struct patch_bin_osc) + sizeof(struct patch_bin_unison) + sizeof(struct patch_bin_wavetable)) * NUM_OSCS * NUM_OSC_TYPES \
+    + sizeof(struct patch_bin_cc) * MAX_CC_MAPS \
+    + sizeof(struct patch_bin_mod) * MAX_MOD_ROUTES + sizeof(struct patch_bin_filter) + sizeof(struct patch_bin_fx))
+
+// returns true if data looks like a binary patch (as opposed to text)
+int patch_bin_detect(const void* data, size_t len);
+
+// returns the number of bytes written to out, or 0 if cap is too small
+size_t patch_bin_encode(const struct patch* patch, void* out, size_t cap);
+
+// on failure patch is left untouched and load_patch_err() says why
+int patch_bin_load(const void* data, size_t len, struct patch* patch);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,78 @@
+#include "rng.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RNG_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RNG_SSE
+#endif
+
+// the top 24 bits of a draw, as a float in 0.0 .. 1.0
+#define RNG_SCALE (1.f / 16777216.f)
+
+// spreads nearby seeds (e.g. two notes a semitone apart) over the whole state
+static uint32_t mix32(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+static inline uint32_t xorshift32(uint32_t x)
+{
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+void rng_seed(struct rng* r, uint32_t seed)
+{
+	for (int i = 0; i < RNG_LANES; i++) {
+		// xorshift never leaves 0
+		r->lane[i] = mix32(seed + 0x9e3779b9 * (i + 1)) | 1;
+	}
+}
+
+void rng_fill(struct rng* r, float* out, size_t n)
+{
+#if defined(RNG_NEON)
+	const float32x4_t scale = vdupq_n_f32(RNG_SCALE);
+	uint32x4_t x = vld1q_u32(r->lane);
+	for (size_t i = 0; i < n; i += RNG_LANES) {
+		x = veorq_u32(x, vshlq_n_u32(x, 13));
+		x = veorq_u32(x, vshrq_n_u32(x, 17));
+		x = veorq_u32(x, vshlq_n_u32(x, 5));
+		vst1q_f32(&out[i], vmulq_f32(vcvtq_f32_u32(vshrq_n_u32(x, 8)), scale));
+	}
+	vst1q_u32(r->lane, x);
+#elif defined(RNG_SSE)
+	const __m128 scale = _mm_set1_ps(RNG_SCALE);
+	__m128i x = _mm_loadu_si128((const __m128i*)r->lane);
+	for (size_t i = 0; i < n; i += RNG_LANES) {
+		x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+		x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+		x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+		// 24 bits convert exactly, whether signed or not
+		_mm_storeu_ps(&out[i], _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(x, 8)), scale));
+	}
+	_mm_storeu_si128((__m128i*)r->lane, x);
+#else
+	for (size_t i = 0; i < n; i += RNG_LANES) {
+		for (int j = 0; j < RNG_LANES; j++) {
+			r->lane[j] = xorshift32(r->lane[j]);
+			out[i + j] = (r->lane[j] >> 8) * RNG_SCALE;
+		}
+	}
+#endif
+}
+
+float rng_float(struct rng* r)
+{
+	r->lane[0] = xorshift32(r->lane[0]);
+	return (r->lane[0] >> 8) * RNG_SCALE;
+}
@@ -0,0 +1,36 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Noise for random oscillators. Every voice owns one of these, seeded at
+// note-on from the note and its start time, so the same performance renders
+// the same noise, and no state is shared between the cores rendering voices.
+//
+// It is RNG_LANES independent xorshift32 generators side by side; rng_fill()
+// steps all of them at once with NEON or SSE2 when available.
+#define RNG_LANES 4
+
+// how many samples of noise a voice draws at a time
+#define RNG_BLOCK 16
+
+struct rng {
+	uint32_t lane[RNG_LANES];
+};
+
+void rng_seed(struct rng* r, uint32_t seed);
+
+// fills out with n uniform floats in 0.0 .. 1.0; n must be a multiple of
+// RNG_LANES
+void rng_fill(struct rng* r, float* out, size_t n);
+
+// a single uniform float in 0.0 .. 1.0, stepping only the first lane
+float rng_float(struct rng* r);
+
+#ifdef __cplusplus
+}
+#endif
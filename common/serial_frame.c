@@ -0,0 +1,137 @@
+#include "serial_frame.h"
+#include "crc32.h"
+
+#define STATE_SYNC 0
+#define STATE_HEADER 1
+#define STATE_PAYLOAD 2
+
+static void magic_init(struct serial_magic* m, const char* s)
+{
+	m->s = s;
+	m->len = 0;
+	while (s[m->len] && m->len < SERIAL_FRAME_MAX_MAGIC) {
+		m->len++;
+	}
+	m->matched = 0;
+
+	// fallback[i] is the length of the longest proper prefix of s[0..i] that
+	// is also a suffix of it; it's where matching resumes after a mismatch
+	m->fallback[0] = 0;
+	unsigned k = 0;
+	for (unsigned i = 1; i < m->len; i++) {
+		while (k > 0 && s[i] != s[k]) {
+			k = m->fallback[k - 1];
+		}
+		if (s[i] == s[k]) {
+			k++;
+		}
+		m->fallback[i] = k;
+	}
+}
+
+// returns true once the whole magic string has been seen
+static int magic_step(struct serial_magic* m, uint8_t c)
+{
+	while (m->matched > 0 && (uint8_t)m->s[m->matched] != c) {
+		m->matched = m->fallback[m->matched - 1];
+	}
+	if ((uint8_t)m->s[m->matched] == c) {
+		m->matched++;
+	}
+	if (m->matched == m->len) {
+		m->matched = m->fallback[m->len - 1];
+		return 1;
+	}
+	return 0;
+}
+
+void serial_frame_init(struct serial_frame* f, uint8_t* payload, size_t payload_cap)
+{
+	f->payload = payload;
+	f->payload_cap = payload_cap;
+	f->payload_len = 0;
+	f->state = STATE_SYNC;
+	f->got = 0;
+	magic_init(&f->patch_magic, SERIAL_FRAME_PATCH_MAGIC);
+	magic_init(&f->params_magic, SERIAL_FRAME_PARAMS_MAGIC);
+	magic_init(&f->reboot_magic, SERIAL_FRAME_REBOOT_MAGIC);
+	magic_init(&f->trace_magic, SERIAL_FRAME_TRACE_MAGIC);
+	magic_init(&f->capture_magic, SERIAL_FRAME_CAPTURE_MAGIC);
+	magic_init(&f->bank_magic, SERIAL_FRAME_BANK_MAGIC);
+}
+
+int serial_frame_feed(struct serial_frame* f, const uint8_t* data, size_t len, size_t* consumed)
+{
+	for (size_t i = 0; i < len; i++) {
+		uint8_t c = data[i];
+		*consumed = i + 1;
+
+		if (magic_step(&f->reboot_magic, c)) {
+			f->state = STATE_SYNC;
+			return SERIAL_FRAME_REBOOT;
+		}
+		if (magic_step(&f->trace_magic, c)) {
+			f->state = STATE_SYNC;
+			return SERIAL_FRAME_TRACE;
+		}
+		if (magic_step(&f->capture_magic, c)) {
+			f->state = STATE_SYNC;
+			return SERIAL_FRAME_CAPTURE;
+		}
+		if (magic_step(&f->bank_magic, c)) {
+			f->state = STATE_SYNC;
+			return SERIAL_FRAME_BANK;
+		}
+		int params = magic_step(&f->params_magic, c);
+		if (magic_step(&f->patch_magic, c) || params) {
+			f->state = STATE_HEADER;
+			f->kind = params ? SERIAL_FRAME_PARAMS : SERIAL_FRAME_PATCH;
+			f->got = 0;
+			continue;
+		}
+
+		switch (f->state) {
+		case STATE_SYNC:
+			break;
+
+		case STATE_HEADER:
+			f->header[f->got++] = c;
+			if (f->got < sizeof(f->header)) {
+				break;
+			}
+			f->payload_len = f->header[0] | (f->header[1] << 8);
+			f->expected_crc = (uint32_t)f->header[2] | ((uint32_t)f->header[3] << 8)
+			    | ((uint32_t)f->header[4] << 16) | ((uint32_t)f->header[5] << 24);
+			f->got = 0;
+			f->crc = 0;
+			if (f->payload_len > f->payload_cap) {
+				f->state = STATE_SYNC;
+				return SERIAL_FRAME_TOO_LONG;
+			}
+			f->state = STATE_PAYLOAD;
+			if (f->payload_len > 0) {
+				break;
+			}
+			// an empty payload is complete as soon as its header is
+			// fall through
+
+		case STATE_PAYLOAD:
+			if (f->got < f->payload_len) {
+				f->payload[f->got++] = c;
+				// fold in the crc a word at a time as the payload arrives,
+				// rather than all at once at the end
+				if ((f->got & 7) == 0) {
+					f->crc = crc32_update(f->crc, f->payload + f->got - 8, 8);
+				}
+			}
+			if (f->got < f->payload_len) {
+				break;
+			}
+			f->crc = crc32_update(f->crc, f->payload + (f->got & ~(size_t)7), f->got & 7);
+			f->state = STATE_SYNC;
+			return f->crc == f->expected_crc ? f->kind : SERIAL_FRAME_BAD_CRC;
+		}
+	}
+	*consumed = len;
+	return SERIAL_FRAME_NONE;
+}
@@ -0,0 +1,88 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Serial framing, as sent by tools/send.py:
+//
+//   "here-comes-a-new-patch" u16 len, u32 crc32, payload[len]
+//   "set-some-patch-params" u16 len, u32 crc32, struct serial_param[len / 6]
+//   "magic-reboot-string-omg"
+//   "send-me-the-trace-please" (answered with a trace dump, see trace.h)
+//   "send-me-the-capture-please" (answered with a capture dump, see capture.h)
+//   "reload-the-patch-bank" (see patch_bank.h)
+//
+// (integers little-endian). Bytes are fed in as they arrive and are looked at
+// exactly once, so the cost per byte is constant no matter how much junk comes
+// in between frames. A magic string seen anywhere, even part way through
+// another frame, restarts framing; a partial frame is simply dropped.
+
+#define SERIAL_FRAME_PATCH_MAGIC "here-comes-a-new-patch"
+#define SERIAL_FRAME_PARAMS_MAGIC "set-some-patch-params"
+#define SERIAL_FRAME_REBOOT_MAGIC "magic-reboot-string-omg"
+#define SERIAL_FRAME_TRACE_MAGIC "send-me-the-trace-please"
+#define SERIAL_FRAME_CAPTURE_MAGIC "send-me-the-capture-please"
+#define SERIAL_FRAME_BANK_MAGIC "reload-the-patch-bank"
+#define SERIAL_FRAME_MAX_MAGIC 32
+
+// events returned by serial_frame_feed()
+#define SERIAL_FRAME_NONE 0 // need more bytes
+#define SERIAL_FRAME_PATCH 1 // f->payload holds f->payload_len verified bytes
+#define SERIAL_FRAME_REBOOT 2
+#define SERIAL_FRAME_BAD_CRC 3 // a whole payload arrived, but didn't match its crc
+#define SERIAL_FRAME_TOO_LONG 4 // the header announced more than payload_cap bytes
+#define SERIAL_FRAME_PARAMS 5 // like SERIAL_FRAME_PATCH, but holding serial_params
+#define SERIAL_FRAME_TRACE 6
+#define SERIAL_FRAME_CAPTURE 7
+#define SERIAL_FRAME_BANK 8
+
+// one parameter change, see synth_set_param()
+struct serial_param {
+	uint8_t osc_index;
+	uint8_t param; // PARAM_*
+	float value;
+} __attribute__((packed));
+
+struct serial_magic {
+	const char* s;
+	unsigned len;
+	unsigned matched;
+	uint8_t fallback[SERIAL_FRAME_MAX_MAGIC]; // KMP failure function
+};
+
+struct serial_frame {
+	uint8_t* payload;
+	size_t payload_cap;
+	size_t payload_len;
+
+	int state;
+	int kind; // SERIAL_FRAME_PATCH or SERIAL_FRAME_PARAMS
+	size_t got; // bytes of the current header field or payload received so far
+	uint8_t header[6];
+	uint32_t expected_crc;
+	uint32_t crc; // of the payload bytes received so far
+
+	struct serial_magic patch_magic;
+	struct serial_magic params_magic;
+	struct serial_magic reboot_magic;
+	struct serial_magic trace_magic;
+	struct serial_magic capture_magic;
+	struct serial_magic bank_magic;
+};
+
+// payload must hold payload_cap bytes; at most 65535 can ever be announced
+void serial_frame_init(struct serial_frame* f, uint8_t* payload, size_t payload_cap);
+
+// Consumes bytes from data up to and including the one that completes an
+// event, and returns that event (or SERIAL_FRAME_NONE once data is used up).
+// *consumed is set to the number of bytes used; call again with the rest.
+// After SERIAL_FRAME_PATCH the payload stays valid until the next call.
+int serial_frame_feed(struct serial_frame* f, const uint8_t* data, size_t len, size_t* consumed);
+
+#ifdef __cplusplus
+}
+#endif
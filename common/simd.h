@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+
+// A thin layer over the NEON and SSE2 operations the vectorized render code
+// needs, so each loop is written once rather than once per instruction set.
+// Only for use in .c files; SIMD is defined when either is available, and
+// code without it falls back to plain C.
+//
+// vf is SIMD_LANES floats, vi as many 32 bit ints.
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SIMD
+#define SIMD_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD
+#define SIMD_SSE
+#endif
+
+#ifdef SIMD
+
+#define SIMD_LANES 4
+
+#if defined(SIMD_NEON)
+
+typedef float32x4_t vf;
+typedef int32x4_t vi;
+
+static inline vf vf_load(const float* p) { return vld1q_f32(p); }
+static inline void vf_store(float* p, vf x) { vst1q_f32(p, x); }
+static inline vf vf_set(float x) { return vdupq_n_f32(x); }
+static inline vf vf_add(vf a, vf b) { return vaddq_f32(a, b); }
+static inline vf vf_sub(vf a, vf b) { return vsubq_f32(a, b); }
+static inline vf vf_mul(vf a, vf b) { return vmulq_f32(a, b); }
+static inline vf vf_min(vf a, vf b) { return vminq_f32(a, b); }
+static inline vf vf_max(vf a, vf b) { return vmaxq_f32(a, b); }
+// a > b ? x : y
+static inline vf vf_gt_select(vf a, vf b, vf x, vf y) { return vbslq_f32(vcgtq_f32(a, b), x, y); }
+static inline vf vf_lt_select(vf a, vf b, vf x, vf y) { return vbslq_f32(vcltq_f32(a, b), x, y); }
+static inline vi vf_bits(vf x) { return vreinterpretq_s32_f32(x); }
+static inline vf vi_as_float(vi x) { return vreinterpretq_f32_s32(x); }
+static inline vi vf_to_int(vf x) { return vcvtq_s32_f32(x); }
+static inline vf vi_to_float(vi x) { return vcvtq_f32_s32(x); }
+static inline vi vi_set(int32_t x) { return vdupq_n_s32(x); }
+static inline vi vi_add(vi a, vi b) { return vaddq_s32(a, b); }
+static inline vi vi_sub(vi a, vi b) { return vsubq_s32(a, b); }
+static inline vi vi_and(vi a, vi b) { return vandq_s32(a, b); }
+static inline vi vi_or(vi a, vi b) { return vorrq_s32(a, b); }
+static inline vi vi_shl23(vi x) { return vshlq_n_s32(x, 23); }
+static inline vi vi_sra23(vi x) { return vshrq_n_s32(x, 23); }
+
+static inline vf vf_div(vf a, vf b)
+{
+#if defined(__aarch64__)
+	return vdivq_f32(a, b);
+#else
+	// no divide on 32-bit NEON; refine the reciprocal estimate twice
+	vf r = vrecpeq_f32(b);
+	r = vmulq_f32(r, vrecpsq_f32(b, r));
+	r = vmulq_f32(r, vrecpsq_f32(b, r));
+	return vmulq_f32(a, r);
+#endif
+}
+
+#else
+
+typedef __m128 vf;
+typedef __m128i vi;
+
+static inline vf vf_load(const float* p) { return _mm_loadu_ps(p); }
+static inline void vf_store(float* p, vf x) { _mm_storeu_ps(p, x); }
+static inline vf vf_set(float x) { return _mm_set1_ps(x); }
+static inline vf vf_add(vf a, vf b) { return _mm_add_ps(a, b); }
+static inline vf vf_sub(vf a, vf b) { return _mm_sub_ps(a, b); }
+static inline vf vf_mul(vf a, vf b) { return _mm_mul_ps(a, b); }
+static inline vf vf_div(vf a, vf b) { return _mm_div_ps(a, b); }
+static inline vf vf_min(vf a, vf b) { return _mm_min_ps(a, b); }
+static inline vf vf_max(vf a, vf b) { return _mm_max_ps(a, b); }
+static inline vf vf_select(vf mask, vf x, vf y) { return _mm_or_ps(_mm_and_ps(mask, x), _mm_andnot_ps(mask, y)); }
+static inline vf vf_gt_select(vf a, vf b, vf x, vf y) { return vf_select(_mm_cmpgt_ps(a, b), x, y); }
+static inline vf vf_lt_select(vf a, vf b, vf x, vf y) { return vf_select(_mm_cmplt_ps(a, b), x, y); }
+static inline vi vf_bits(vf x) { return _mm_castps_si128(x); }
+static inline vf vi_as_float(vi x) { return _mm_castsi128_ps(x); }
+static inline vi vf_to_int(vf x) { return _mm_cvttps_epi32(x); }
+static inline vf vi_to_float(vi x) { return _mm_cvtepi32_ps(x); }
+static inline vi vi_set(int32_t x) { return _mm_set1_epi32(x); }
+static inline vi vi_add(vi a, vi b) { return _mm_add_epi32(a, b); }
+static inline vi vi_sub(vi a, vi b) { return _mm_sub_epi32(a, b); }
+static inline vi vi_and(vi a, vi b) { return _mm_and_si128(a, b); }
+static inline vi vi_or(vi a, vi b) { return _mm_or_si128(a, b); }
+static inline vi vi_shl23(vi x) { return _mm_slli_epi32(x, 23); }
+static inline vi vi_sra23(vi x) { return _mm_srai_epi32(x, 23); }
+
+#endif
+
+static inline vf vf_abs(vf x)
+{
+	return vi_as_float(vi_and(vf_bits(x), vi_set(0x7fffffff)));
+}
+
+// the sum of all the lanes
+static inline float vf_sum(vf x)
+{
+	float v[SIMD_LANES];
+	vf_store(v, x);
+	return (v[0] + v[1]) + (v[2] + v[3]);
+}
+
+#endif
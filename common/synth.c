@@ -1,5 +1,5 @@
 #include "synth.h"
-#include "bad_rand.h"
+#include "fast_math.h"
 #include "sine_table.h"
 
 void foo(char* p)
@@ -10,15 +10,12 @@ void foo(char* p)
 #ifdef __circle__
 #include "atof.h"
 #include <circle/util.h>
-#include <circle/alloc.h>
 
 // these are in util.h
 // int strcmp (const char *pString1, const char *pString2);
 // int strcasecmp (const char *pString1, const char *pString2);
 // int strncmp (const char *pString1, const char *pString2, size_t nMaxLen);
 // int strncasecmp (const char *pString1, const char *pString2, size_t nMaxLen);
-#define uint32_t unsigned
-#define NULL 0
 #else
 #include <stdlib.h>
 #include <string.h>
@@ -36,15 +33,29 @@ const char* load_patch_err()
 	return synth_error_message;
 }
 
-int synth_new(struct key** keys)
+void patch_set_err(const char* msg)
+{
+	size_t i = 0;
+	for (; msg[i] && i < MAX_SYNTH_ERR_MSG_SIZE - 1; i++) {
+		synth_error_message[i] = msg[i];
+	}
+	synth_error_message[i] = '\0';
+}
+
+int synth_new(struct key** keys, struct arena* arena, struct arena* osc_arenas, int num_osc_arenas)
 {
-	size_t key_bytes = sizeof(struct key) * MAX_KEYS;
 	size_t osc_bytes = sizeof(struct osc) * NUM_OSCS * NUM_OSC_TYPES;
-	*keys = malloc(key_bytes); // static_cast<struct key*>(::operator new(key_bytes));
-	memset(*keys, 0, key_bytes);
+	*keys = arena_alloc(arena, sizeof(struct key) * MAX_KEYS);
+	if (*keys == NULL) {
+		return 1;
+	}
 	for (size_t i = 0; i < MAX_KEYS; i++) {
-		(*keys)[i].oscs = malloc(osc_bytes); // static_cast<struct osc*>(::operator new(osc_bytes));
-		memset((*keys)[i].oscs, 0, osc_bytes);
+		struct arena* a = &osc_arenas[i * num_osc_arenas / MAX_KEYS];
+		(*keys)[i].oscs = arena_alloc(a, osc_bytes);
+		(*keys)[i].xfade_oscs = arena_alloc(a, osc_bytes);
+		if ((*keys)[i].oscs == NULL || (*keys)[i].xfade_oscs == NULL) {
+			return 1;
+		}
 	}
 	return 0;
 }
@@ -53,65 +64,275 @@ void synth_clear(struct key* keys)
 {
 	for (size_t i = 0; i < MAX_KEYS; i++) {
 		struct osc *p = keys[i].oscs;
+		struct osc *x = keys[i].xfade_oscs;
 		memset(&(keys[i]), 0, sizeof(struct key));
 		keys[i].oscs = p;
+		keys[i].xfade_oscs = x;
 		memset(p, 0, sizeof(struct osc)*NUM_OSCS * NUM_OSC_TYPES);
+		memset(x, 0, sizeof(struct osc)*NUM_OSCS * NUM_OSC_TYPES);
+	}
+}
+
+// dst is a copy of the oscillators in src; point their phase_input and
+// amp_input at dst too
+static void move_inputs(struct osc* dst, const struct osc* src)
+{
+	for (int i = 0; i < NUM_OSCS * NUM_OSC_TYPES; i++) {
+		struct osc* o = &dst[i];
+		if (o->phase_input) {
+			o->phase_input = dst + (o->phase_input - src);
+		}
+		if (o->amp_input) {
+			o->amp_input = dst + (o->amp_input - src);
+		}
 	}
 }
 
-int parse_wave_type(const char* s)
+void key_move_oscs(struct key* key, struct osc* oscs, struct osc* xfade_oscs)
 {
-	if (strcasecmp(s, "none") == 0) {
+	size_t osc_bytes = sizeof(struct osc) * NUM_OSCS * NUM_OSC_TYPES;
+	memcpy(oscs, key->oscs, osc_bytes);
+	move_inputs(oscs, key->oscs);
+	memcpy(xfade_oscs, key->xfade_oscs, osc_bytes);
+	move_inputs(xfade_oscs, key->xfade_oscs);
+	key->oscs = oscs;
+	key->xfade_oscs = xfade_oscs;
+}
+
+// tokens handed around by the patch parser point straight into the patch
+// source; they are never NUL terminated
+static bool tok_eq(const char* s, size_t n, const char* lit)
+{
+	size_t i = 0;
+	for (; i < n; i++) {
+		if (lit[i] == '\0' || lit[i] != s[i]) {
+			return false;
+		}
+	}
+	return lit[i] == '\0';
+}
+
+static bool tok_caseeq(const char* s, size_t n, const char* lit)
+{
+	size_t i = 0;
+	for (; i < n; i++) {
+		char a = s[i];
+		char b = lit[i];
+		if (b == '\0') {
+			return false;
+		}
+		if (a >= 'A' && a <= 'Z') {
+			a += 'a' - 'A';
+		}
+		if (a != b) {
+			return false;
+		}
+	}
+	return lit[i] == '\0';
+}
+
+int parse_wave_type(const char* s, size_t n)
+{
+	if (tok_caseeq(s, n, "none")) {
 		return WAVE_TYPE_NONE;
 	}
-	if (strcasecmp(s, "sine") == 0) {
+	if (tok_caseeq(s, n, "sine")) {
 		return WAVE_TYPE_SINE;
 	}
-	if (strcasecmp(s, "triangle") == 0) {
+	if (tok_caseeq(s, n, "triangle")) {
 		return WAVE_TYPE_TRIANGLE;
 	}
-	if (strcasecmp(s, "saw_up") == 0) {
+	if (tok_caseeq(s, n, "saw_up")) {
 		return WAVE_TYPE_SAW_UP;
 	}
-	if (strcasecmp(s, "saw_down") == 0) {
+	if (tok_caseeq(s, n, "saw_down")) {
 		return WAVE_TYPE_SAW_DOWN;
 	}
-	if (strcasecmp(s, "square") == 0) {
+	if (tok_caseeq(s, n, "square")) {
 		return WAVE_TYPE_SQUARE;
 	}
-	if (strcasecmp(s, "pulse12") == 0) {
+	if (tok_caseeq(s, n, "pulse12")) {
 		return WAVE_TYPE_PULSE12;
 	}
-	if (strcasecmp(s, "pulse25") == 0) {
+	if (tok_caseeq(s, n, "pulse25")) {
 		return WAVE_TYPE_PULSE25;
 	}
-	if (strcasecmp(s, "random") == 0) {
+	if (tok_caseeq(s, n, "random")) {
 		return WAVE_TYPE_RAND;
 	}
-	// fprintf(stderr, "unknown wave type: %s\n", s);
-	return 0;
+	if (tok_caseeq(s, n, "sample_hold")) {
+		return WAVE_TYPE_SAMPLE_HOLD;
+	}
+	if (tok_caseeq(s, n, "wavetable")) {
+		return WAVE_TYPE_WAVETABLE;
+	}
+	return -1;
 }
 
-int parse_osc(const char* s, int* osc_type, int* n)
+int parse_osc(const char* s, size_t n, int* osc_type, int* osc_num)
 {
-	if (strlen(s) < 4) {
+	if (n < 4) {
 		return 1;
 	}
-	if (strncmp(s, "vfo", 3) == 0) {
+	if (tok_eq(s, 3, "vfo")) {
 		*osc_type = OSC_TYPE_VFO;
-	} else if (strncmp(s, "lfo", 3) == 0) {
+	} else if (tok_eq(s, 3, "lfo")) {
 		*osc_type = OSC_TYPE_LFO;
 	} else {
 		return 1;
 	}
-	s += 3;
-	*n = atoi(s);
-	if (*n == 0 || *n > NUM_OSCS) {
+	*osc_num = 0;
+	for (size_t i = 3; i < n; i++) {
+		if (s[i] < '0' || s[i] > '9' || *osc_num > NUM_OSCS) {
+			return 1;
+		}
+		*osc_num = *osc_num * 10 + (s[i] - '0');
+	}
+	if (*osc_num == 0 || *osc_num > NUM_OSCS) {
+		return 1;
+	}
+	return 0;
+}
+
+// parses [-]digits[.digits]; unlike atof, the whole token must be a number
+int parse_float(const char* s, size_t n, float* f)
+{
+	// accumulate the digits as an integer and divide once at the end, so
+	// values like 0.03 round the same way the libc parser would
+	unsigned long long mantissa = 0;
+	double divisor = 1.0;
+	bool decimal = false;
+	bool negative = false;
+	bool digits = false;
+	size_t i = 0;
+
+	if (i < n && (s[i] == '-' || s[i] == '+')) {
+		negative = s[i] == '-';
+		i++;
+	}
+	for (; i < n; i++) {
+		if (s[i] == '.' && !decimal) {
+			decimal = true;
+			continue;
+		}
+		if (s[i] < '0' || s[i] > '9') {
+			return 1;
+		}
+		digits = true;
+		if (mantissa > 100000000000000000ull) {
+			// beyond what a float can represent anyway
+			if (!decimal) {
+				divisor /= 10.0;
+			}
+			continue;
+		}
+		mantissa = mantissa * 10 + (s[i] - '0');
+		if (decimal) {
+			divisor *= 10.0;
+		}
+	}
+	if (!digits) {
 		return 1;
 	}
+	float result = (float)(mantissa / divisor);
+	*f = negative ? -result : result;
 	return 0;
 }
 
+// indexed by PARAM_*; the names are the patch file keys
+static const char* param_names[NUM_PARAMS] = {
+	"type",
+	"freq",
+	"freq_m",
+	"detune",
+	"output",
+	"phase_input_m",
+	"amp_input_m",
+	"attack",
+	"decay",
+	"sustain",
+	"release",
+	"pitch_m",
+	"mod_freq_m",
+	"mod_output_m",
+	"unison",
+	"unison_detune",
+	"unison_spread",
+	"position",
+};
+
+int parse_param(const char* s, size_t n)
+{
+	for (int i = 0; i < NUM_PARAMS; i++) {
+		if (tok_eq(s, n, param_names[i])) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static float* param_field(struct osc* osc, int param)
+{
+	switch (param) {
+	case PARAM_FREQ:
+		return &osc->freq;
+	case PARAM_FREQ_M:
+		return &osc->freq_m;
+	case PARAM_DETUNE:
+		return &osc->detune;
+	case PARAM_OUTPUT:
+		return &osc->output_volume_m;
+	case PARAM_PHASE_INPUT_M:
+		return &osc->phase_input_m;
+	case PARAM_AMP_INPUT_M:
+		return &osc->amp_input_m;
+	case PARAM_ATTACK:
+		return &osc->attack;
+	case PARAM_DECAY:
+		return &osc->decay;
+	case PARAM_SUSTAIN:
+		return &osc->sustain;
+	case PARAM_RELEASE:
+		return &osc->release;
+	case PARAM_PITCH_M:
+		return &osc->pitch_m;
+	case PARAM_MOD_FREQ_M:
+		return &osc->mod_freq_m;
+	case PARAM_MOD_OUTPUT_M:
+		return &osc->mod_output_m;
+	case PARAM_UNISON_DETUNE:
+		return &osc->unison.detune;
+	case PARAM_UNISON_SPREAD:
+		return &osc->unison.spread;
+	case PARAM_POSITION:
+		return &osc->position;
+	}
+	return NULL;
+}
+
+static float param_clamp(int param, float f)
+{
+	if (param == PARAM_FREQ) {
+		return MAX(f, 0.f);
+	}
+	if (param == PARAM_ATTACK) {
+		return MAX(f, ATTACK_MIN);
+	}
+	if (param == PARAM_DECAY) {
+		return MAX(f, DECAY_MIN);
+	}
+	if (param == PARAM_UNISON) {
+		return MIN(MAX(f, 1.f), UNISON_MAX);
+	}
+	if (param == PARAM_UNISON_DETUNE) {
+		return MIN(MAX(f, 0.f), UNISON_DETUNE_MAX);
+	}
+	if (param == PARAM_UNISON_SPREAD || param == PARAM_POSITION) {
+		return MIN(MAX(f, 0.f), 1.f);
+	}
+	return f;
+}
+
 float ads_level(float t, float attack, float attack_start, float decay, float sustain)
 {
 	if (t < attack) {
@@ -148,218 +369,672 @@ int osc_num_to_index(int osc_num, int osc_type)
 	return i;
 }
 
-#define MAX_LINE 1024
+// circle doesnt have sprintf
+static void err_append(size_t* len, const char* s, size_t n)
+{
+	while (n-- && *s && *len < MAX_SYNTH_ERR_MSG_SIZE - 1) {
+		synth_error_message[(*len)++] = *s++;
+	}
+	synth_error_message[*len] = '\0';
+}
 
-int load_patch(char* src, struct osc* oscs)
+static void err_append_int(size_t* len, int v)
 {
-	synth_error_message[0] = '\0';
-	int n;
+	char buf[12];
+	int i = sizeof(buf);
+	do {
+		buf[--i] = '0' + v % 10;
+		v /= 10;
+	} while (v > 0 && i > 0);
+	err_append(len, buf + i, sizeof(buf) - i);
+}
+
+int patch_error(int line, int col, const char* msg, const char* tok, size_t tok_len)
+{
+	size_t len = 0;
+	err_append(&len, "line ", 5);
+	err_append_int(&len, line);
+	err_append(&len, ", col ", 6);
+	err_append_int(&len, col);
+	err_append(&len, ": ", 2);
+	err_append(&len, msg, MAX_SYNTH_ERR_MSG_SIZE);
+	if (tok_len) {
+		err_append(&len, " ", 1);
+		err_append(&len, tok, tok_len);
+	}
+	return 1;
+}
+
+// circle has no memchr
+static const char* find_char(const char* s, size_t n, char c)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (s[i] == c) {
+			return &s[i];
+		}
+	}
+	return NULL;
+}
+
+static bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static void trim(const char** s, size_t* n)
+{
+	while (*n && is_space(**s)) {
+		(*s)++;
+		(*n)--;
+	}
+	while (*n && is_space((*s)[*n - 1])) {
+		(*n)--;
+	}
+}
+
+static void init_osc_defaults(struct osc* osc, int osc_type)
+{
+	memset(osc, 0, sizeof(struct osc));
+	osc->osc_type = osc_type;
+	osc->freq_m = 1.0;
+	osc->attack = ATTACK_MIN;
+	osc->sustain = 1.0;
+	osc->decay = DECAY_MIN;
+	osc->phase_input_m = 1.0;
+	osc->amp_input_m = 1.0;
+	osc->unison.copies = 1;
+	osc->unison.detune = UNISON_DETUNE_DEFAULT;
+	osc->unison.spread = UNISON_SPREAD_DEFAULT;
+	if (osc_type == OSC_TYPE_VFO) {
+		osc->output_volume_m = 1.0;
+	} else if (osc_type == OSC_TYPE_LFO) {
+		osc->freq = 1.0;
+	}
+}
+
+#define SECTION_NONE 0
+#define SECTION_OSC 1
+#define SECTION_PATCH 2
+#define SECTION_CC 3
+#define SECTION_MOD 4
+#define SECTION_FILTER 5
+#define SECTION_CHORUS 6
+#define SECTION_DELAY 7
+#define SECTION_REVERB 8
+
+// parses a whole token of decimal digits
+static int parse_uint(const char* s, size_t n, int* v)
+{
+	if (n == 0 || n > 6) {
+		return 1;
+	}
+	*v = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (s[i] < '0' || s[i] > '9') {
+			return 1;
+		}
+		*v = *v * 10 + (s[i] - '0');
+	}
+	return 0;
+}
 
+// parses lfo1, env2, velocity, ... into a MOD_SRC_*
+static int parse_mod_src(const char* s, size_t n)
+{
+	int osc_type;
 	int osc_num;
+	if (n > 3 && tok_eq(s, 3, "env")) {
+		// envN is the envelope of vfoN
+		if (parse_uint(s + 3, n - 3, &osc_num) != 0 || osc_num < 1 || osc_num > NUM_OSCS) {
+			return -1;
+		}
+		return MOD_SRC_ENV1 + osc_num - 1;
+	}
+	if (parse_osc(s, n, &osc_type, &osc_num) == 0 && osc_type == OSC_TYPE_LFO) {
+		return MOD_SRC_LFO1 + osc_num - 1;
+	}
+	if (tok_eq(s, n, "velocity")) {
+		return MOD_SRC_VELOCITY;
+	}
+	if (tok_eq(s, n, "keytrack")) {
+		return MOD_SRC_KEYTRACK;
+	}
+	if (tok_eq(s, n, "modwheel")) {
+		return MOD_SRC_MODWHEEL;
+	}
+	if (tok_eq(s, n, "pitchbend")) {
+		return MOD_SRC_PITCHBEND;
+	}
+	if (tok_eq(s, n, "aftertouch")) {
+		return MOD_SRC_AFTERTOUCH;
+	}
+	return -1;
+}
+
+// parses vfo1.pitch, lfo2.amp, ..., filter.cutoff or filter.resonance
+static int parse_mod_dst(const char* s, size_t n, int* osc_index, int* dst)
+{
+	const char* dot = find_char(s, n, '.');
+	if (dot == NULL) {
+		return 1;
+	}
+	if (tok_eq(s, dot - s, "filter")) {
+		const char* name = dot + 1;
+		size_t name_len = n - (dot - s) - 1;
+		if (tok_eq(name, name_len, "cutoff")) {
+			*dst = MOD_DST_CUTOFF;
+		} else if (tok_eq(name, name_len, "resonance")) {
+			*dst = MOD_DST_RESONANCE;
+		} else {
+			return 1;
+		}
+		*osc_index = 0;
+		return 0;
+	}
 	int osc_type;
+	int osc_num;
+	if (parse_osc(s, dot - s, &osc_type, &osc_num) != 0) {
+		return 1;
+	}
+	const char* name = dot + 1;
+	size_t name_len = n - (dot - s) - 1;
+	if (tok_eq(name, name_len, "pitch")) {
+		*dst = MOD_DST_PITCH;
+	} else if (tok_eq(name, name_len, "amp")) {
+		*dst = MOD_DST_AMP;
+	} else if (tok_eq(name, name_len, "pw")) {
+		*dst = MOD_DST_PW;
+	} else if (tok_eq(name, name_len, "env")) {
+		*dst = MOD_DST_ENV;
+	} else if (tok_eq(name, name_len, "position")) {
+		*dst = MOD_DST_POSITION;
+	} else {
+		return 1;
+	}
+	*osc_index = osc_num_to_index(osc_num, osc_type);
+	return 0;
+}
+
+int parse_filter_type(const char* s, size_t n)
+{
+	if (tok_eq(s, n, "none")) {
+		return FILTER_NONE;
+	}
+	if (tok_eq(s, n, "lowpass")) {
+		return FILTER_LOWPASS;
+	}
+	if (tok_eq(s, n, "highpass")) {
+		return FILTER_HIGHPASS;
+	}
+	if (tok_eq(s, n, "bandpass")) {
+		return FILTER_BANDPASS;
+	}
+	return -1;
+}
+
+// parses vfo1.attack, lfo2.freq, ...
+static int parse_target(const char* s, size_t n, int* osc_index, int* param)
+{
+	const char* dot = find_char(s, n, '.');
+	if (dot == NULL) {
+		return 1;
+	}
+	int osc_type;
+	int osc_num;
+	if (parse_osc(s, dot - s, &osc_type, &osc_num) != 0) {
+		return 1;
+	}
+	*param = parse_param(dot + 1, n - (dot - s) - 1);
+	if (*param < 0) {
+		return 1;
+	}
+	*osc_index = osc_num_to_index(osc_num, osc_type);
+	return 0;
+}
+
+// the field a key in one of the effect sections sets
+static float* fx_field(struct fx* fx, int section, const char* key, size_t key_len)
+{
+	bool mix = tok_eq(key, key_len, "mix");
+	switch (section) {
+	case SECTION_CHORUS:
+		if (tok_eq(key, key_len, "rate")) {
+			return &fx->chorus_rate;
+		}
+		if (tok_eq(key, key_len, "depth")) {
+			return &fx->chorus_depth;
+		}
+		return mix ? &fx->chorus_mix : NULL;
+	case SECTION_DELAY:
+		if (tok_eq(key, key_len, "time")) {
+			return &fx->delay_time;
+		}
+		if (tok_eq(key, key_len, "feedback")) {
+			return &fx->delay_feedback;
+		}
+		return mix ? &fx->delay_mix : NULL;
+	case SECTION_REVERB:
+		if (tok_eq(key, key_len, "size")) {
+			return &fx->reverb_size;
+		}
+		if (tok_eq(key, key_len, "damping")) {
+			return &fx->reverb_damping;
+		}
+		return mix ? &fx->reverb_mix : NULL;
+	}
+	return NULL;
+}
 
-	char line[MAX_LINE];
-	char key[MAX_LINE];
-	char value[MAX_LINE];
+void fx_clamp(struct fx* fx)
+{
+	fx->chorus_mix = MIN(fx->chorus_mix, 1.f);
+	fx->delay_time = MIN(fx->delay_time, FX_DELAY_MAX);
+	fx->delay_feedback = MIN(fx->delay_feedback, 0.95f);
+	fx->reverb_size = MIN(fx->reverb_size, 1.f);
+	fx->reverb_damping = MIN(fx->reverb_damping, 1.f);
+	fx->reverb_mix = MIN(fx->reverb_mix, 1.f);
+}
 
-	bool eof = false;
+// Single pass over the patch text; nothing is copied, every token is a
+// pointer and length into src. The result is written to patch only once the
+// whole source has parsed, so a bad patch never leaves a half loaded one behind.
+int patch_compile(const char* src, size_t len, struct patch* patch)
+{
+	struct patch staging;
+	struct osc* oscs = staging.oscs;
 	struct osc* osc = NULL;
-	while(*src) {
-		size_t n = 0;
-		char *l = 0;
-		char* eol = strchr(src, '\n');
-		if( eol ) {
-			n = eol - src;
-		} else {
-			if( strlen(src) ) {
-				strcpy(synth_error_message, "patch must end with a newline");
-				return 1;
-			}
-			break;
+	struct cc_map* cc = NULL;
+	struct mod_route* route = NULL;
+	int section = SECTION_NONE;
+
+	synth_error_message[0] = '\0';
+	memset(&staging, 0, sizeof(struct patch));
+	staging.swap_mode = PATCH_SWAP_KEEP;
+	staging.crossfade = PATCH_CROSSFADE_DEFAULT;
+	staging.filter.cutoff = FILTER_CUTOFF_DEFAULT;
+
+	const char* end = src + len;
+	int line_num = 0;
+	while (src < end) {
+		const char* line = src;
+		const char* eol = find_char(src, end - src, '\n');
+		size_t n = eol ? (size_t)(eol - src) : (size_t)(end - src);
+		src += eol ? n + 1 : n;
+		line_num++;
+
+		const char* comment = find_char(line, n, '#');
+		if (comment) {
+			n = comment - line;
 		}
-		if( n >= (MAX_LINE-1) ) {
-			strcpy(synth_error_message, "line too long");
-			return 1;
+		const char* l = line;
+		trim(&l, &n);
+		if (n == 0) {
+			continue;
 		}
-		memcpy(line, src, n);
-		line[n] = '\0';
-		src += n+1;
+		int col = (l - line) + 1;
 
-		if( !*line ) {
-			// blank line
+		if (l[0] == '[') {
+			if (l[n - 1] != ']') {
+				return patch_error(line_num, col, "expected ] to close", l, n);
+			}
+			const char* name = l + 1;
+			size_t name_len = n - 2;
+			trim(&name, &name_len);
+			if (tok_eq(name, name_len, "patch")) {
+				section = SECTION_PATCH;
+				continue;
+			}
+			if (tok_eq(name, name_len, "filter")) {
+				section = SECTION_FILTER;
+				staging.filter.type = FILTER_LOWPASS;
+				continue;
+			}
+			if (tok_eq(name, name_len, "chorus")) {
+				section = SECTION_CHORUS;
+				staging.fx.chorus_rate = 0.8f;
+				staging.fx.chorus_depth = 0.003f;
+				staging.fx.chorus_mix = 0.5f;
+				continue;
+			}
+			if (tok_eq(name, name_len, "delay")) {
+				section = SECTION_DELAY;
+				staging.fx.delay_time = 0.3f;
+				staging.fx.delay_feedback = 0.4f;
+				staging.fx.delay_mix = 0.3f;
+				continue;
+			}
+			if (tok_eq(name, name_len, "reverb")) {
+				section = SECTION_REVERB;
+				staging.fx.reverb_size = 0.5f;
+				staging.fx.reverb_damping = 0.5f;
+				staging.fx.reverb_mix = 0.25f;
+				continue;
+			}
+			if (name_len > 2 && tok_eq(name, 2, "cc")) {
+				int num;
+				if (parse_uint(name + 2, name_len - 2, &num) != 0 || num > 127) {
+					return patch_error(line_num, col + 1, "expected a CC number from 0 to 127 but got", name, name_len);
+				}
+				if (staging.num_cc_maps == MAX_CC_MAPS) {
+					return patch_error(line_num, col + 1, "too many CC sections at", name, name_len);
+				}
+				section = SECTION_CC;
+				cc = &staging.cc_maps[staging.num_cc_maps++];
+				cc->cc = num;
+				cc->osc_index = -1;
+				cc->min = 0.f;
+				cc->max = 1.f;
+				cc->smoothing = CC_SMOOTHING_DEFAULT;
+				continue;
+			}
+			if (name_len > 3 && tok_eq(name, 3, "mod")) {
+				int num;
+				if (parse_uint(name + 3, name_len - 3, &num) != 0) {
+					return patch_error(line_num, col + 1, "failed to parse", name, name_len);
+				}
+				if (staging.num_mod_routes == MAX_MOD_ROUTES) {
+					return patch_error(line_num, col + 1, "too many modulation sections at", name, name_len);
+				}
+				section = SECTION_MOD;
+				route = &staging.mod_routes[staging.num_mod_routes++];
+				route->src = -1;
+				route->dst = -1;
+				route->depth = 0.f;
+				continue;
+			}
+			int osc_type;
+			int osc_num;
+			if (parse_osc(name, name_len, &osc_type, &osc_num) != 0) {
+				return patch_error(line_num, col + 1, "failed to parse", name, name_len);
+			}
+			section = SECTION_OSC;
+			osc = &oscs[osc_num_to_index(osc_num, osc_type)];
+			init_osc_defaults(osc, osc_type);
 			continue;
 		}
-		if( line[0] == '#' ) {
-			// ignore comment
+		if (section == SECTION_NONE) {
 			continue;
 		}
 
-		n = strlen(line);
-		for (int j = n - 1; j >= 0; j--) {
-			if (line[j] == '\n') {
-				line[j] = '\0';
-				n--;
+		const char* eq = find_char(l, n, '=');
+		if (eq == NULL) {
+			return patch_error(line_num, col, "failed to parse key=value pair", l, n);
+		}
+		const char* key = l;
+		size_t key_len = eq - l;
+		const char* value = eq + 1;
+		size_t value_len = n - key_len - 1;
+		trim(&key, &key_len);
+		trim(&value, &value_len);
+		int value_col = (value - line) + 1;
+
+		float f = 0.f;
+		bool is_float = parse_float(value, value_len, &f) == 0;
+
+		if (section == SECTION_MOD) {
+			if (tok_eq(key, key_len, "source")) {
+				route->src = parse_mod_src(value, value_len);
+				if (route->src < 0) {
+					return patch_error(line_num, value_col, "unknown modulation source", value, value_len);
+				}
+			} else if (tok_eq(key, key_len, "dest")) {
+				if (parse_mod_dst(value, value_len, &route->osc_index, &route->dst) != 0) {
+					return patch_error(line_num, value_col, "expected a destination (e.g. vfo1.pitch) but got", value, value_len);
+				}
+			} else if (tok_eq(key, key_len, "depth")) {
+				if (!is_float) {
+					return patch_error(line_num, value_col, "expected a number but got", value, value_len);
+				}
+				route->depth = f;
 			}
+			continue;
 		}
-		// printf("here with line %s\n", line);
-		if (line[0] == '[' && line[n - 1] == ']') {
-			line[n - 1] = '\0';
-			char* s = &line[1];
 
-			if (parse_osc(s, &osc_type, &osc_num) != 0) {
-				// circle doesnt have sprintf
-				strcpy(synth_error_message, "failed to parse ");
-				strcpy(synth_error_message+strlen(synth_error_message), s);
-				return 1;
+		if (section == SECTION_CC) {
+			if (tok_eq(key, key_len, "target")) {
+				if (parse_target(value, value_len, &cc->osc_index, &cc->param) != 0) {
+					return patch_error(line_num, value_col, "expected an oscillator parameter (e.g. vfo1.attack) but got", value, value_len);
+				}
+				continue;
 			}
+			float* field = NULL;
+			if (tok_eq(key, key_len, "min")) {
+				field = &cc->min;
+			} else if (tok_eq(key, key_len, "max")) {
+				field = &cc->max;
+			} else if (tok_eq(key, key_len, "smoothing")) {
+				field = &cc->smoothing;
+			} else {
+				continue;
+			}
+			if (!is_float) {
+				return patch_error(line_num, value_col, "expected a number but got", value, value_len);
+			}
+			*field = f;
+			continue;
+		}
 
-			if (osc_num < 1 || osc_num > NUM_OSCS) {
-				// circle doesnt have sprintf
-				strcpy(synth_error_message, "expected osc number in range 1-10 while parsing ");
-				strcpy(synth_error_message+strlen(synth_error_message), s);
-				return 1;
+		if (section == SECTION_FILTER) {
+			if (tok_eq(key, key_len, "type")) {
+				int type = parse_filter_type(value, value_len);
+				if (type < 0) {
+					return patch_error(line_num, value_col, "expected lowpass, highpass, bandpass or none but got", value, value_len);
+				}
+				staging.filter.type = type;
+			} else if (tok_eq(key, key_len, "cutoff")) {
+				if (!is_float || f <= 0.f) {
+					return patch_error(line_num, value_col, "expected a frequency in Hz but got", value, value_len);
+				}
+				staging.filter.cutoff = f;
+			} else if (tok_eq(key, key_len, "resonance")) {
+				if (!is_float) {
+					return patch_error(line_num, value_col, "expected a number but got", value, value_len);
+				}
+				staging.filter.resonance = MIN(MAX(f, 0.f), FILTER_RESONANCE_MAX);
 			}
-			osc = &oscs[osc_num_to_index(osc_num, osc_type)];
-			osc->osc_type = osc_type;
-
-			// init defaults
-			osc->freq_m = 1.0;
-			osc->attack = ATTACK_MIN;
-			osc->sustain = 1.0;
-			osc->decay = DECAY_MIN;
-			osc->phase_input_m = 1.0;
-			osc->amp_input_m = 1.0;
-			if (osc->osc_type == OSC_TYPE_VFO) {
-				osc->freq_m = 1.0;
-				osc->output_volume_m = 1.0;
-				osc->osc_type = WAVE_TYPE_SINE;
-			} else if (osc->osc_type == OSC_TYPE_LFO) {
-				osc->freq = 1.0;
+			continue;
+		}
+
+		if (section == SECTION_CHORUS || section == SECTION_DELAY || section == SECTION_REVERB) {
+			float* field = fx_field(&staging.fx, section, key, key_len);
+			if (field == NULL) {
+				continue;
+			}
+			if (!is_float || f < 0.f) {
+				return patch_error(line_num, value_col, "expected a positive number but got", value, value_len);
 			}
+			*field = f;
+			fx_clamp(&staging.fx);
+			continue;
+		}
 
+		if (section == SECTION_PATCH) {
+			if (tok_eq(key, key_len, "swap")) {
+				if (tok_eq(value, value_len, "keep")) {
+					staging.swap_mode = PATCH_SWAP_KEEP;
+				} else if (tok_eq(value, value_len, "crossfade")) {
+					staging.swap_mode = PATCH_SWAP_CROSSFADE;
+				} else {
+					return patch_error(line_num, value_col, "expected keep or crossfade but got", value, value_len);
+				}
+			} else if (tok_eq(key, key_len, "crossfade")) {
+				if (!is_float || f < 0.f) {
+					return patch_error(line_num, value_col, "expected a number of seconds but got", value, value_len);
+				}
+				staging.crossfade = f;
+			}
 			continue;
 		}
-		if (osc == NULL) {
+
+		if (tok_eq(key, key_len, "type")) {
+			int wave_type = parse_wave_type(value, value_len);
+			if (wave_type < 0) {
+				return patch_error(line_num, value_col, "unknown wave type", value, value_len);
+			}
+			osc->wave_type = wave_type;
 			continue;
 		}
-		// printf("here2 with line %s\n", line);
-		char* v = strstr(line, "=");
-		if (v == NULL) {
-			// printf("failed %s\n", line);
-			strcpy(synth_error_message, "failed to parse key=value pair ");
-			strcpy(synth_error_message+strlen(synth_error_message), line);
-			return 1;
+		if (tok_eq(key, key_len, "freq") && tok_eq(value, value_len, "sync")) {
+			osc->freq_sync = true;
+			continue;
 		}
-		n = v-line;
-		memcpy(key, line, n);
-		key[n] = '\0';
-		strcpy(value, v+1);
-		
-		for( v = value; *v; v++ ) {
-			if( *v == '#' ) {
-				*v = '\0';
-				v--;
-				break;
+		if (tok_eq(key, key_len, "scope")) {
+			if (tok_eq(value, value_len, "global")) {
+				if (osc->osc_type != OSC_TYPE_LFO) {
+					return patch_error(line_num, value_col, "only an LFO can be", value, value_len);
+				}
+				osc->global = true;
+			} else if (tok_eq(value, value_len, "voice")) {
+				osc->global = false;
+			} else {
+				return patch_error(line_num, value_col, "expected global or voice but got", value, value_len);
 			}
+			continue;
 		}
-		while(v >= value ) {
-			if( *v == ' ' ) {
-				*v = '\0';
-				v--;
+		if (tok_eq(key, key_len, "phase_input") || tok_eq(key, key_len, "amp_input")) {
+			int osc_type;
+			int osc_num;
+			if (parse_osc(value, value_len, &osc_type, &osc_num) != 0) {
+				return patch_error(line_num, value_col, "failed to parse oscillator", value, value_len);
+			}
+			struct osc* input = &oscs[osc_num_to_index(osc_num, osc_type)];
+			if (key_len == strlen("phase_input")) {
+				osc->phase_input = input;
 			} else {
-				break;
+				osc->amp_input = input;
+			}
+			continue;
+		}
+
+		if (tok_eq(key, key_len, "wavetable")) {
+			const char* err;
+			osc->table = wavetable_load(value, value_len, &err);
+			if (osc->table == NULL) {
+				return patch_error(line_num, value_col, err, value, value_len);
 			}
+			continue;
 		}
 
-		 // printf("got key: %s; value: %s\n", key, value);
+		if (tok_eq(key, key_len, "unison")) {
+			if (!is_float || f < 1.f || f > UNISON_MAX || f != (int)f) {
+				return patch_error(line_num, value_col, "expected a number of copies from 1 to 8 but got", value, value_len);
+			}
+			osc->unison.copies = (int)f;
+			continue;
+		}
 
+		int param = parse_param(key, key_len);
+		if (param < 0) {
+			// unknown keys are ignored so older firmware can load newer patches
+			continue;
+		}
+		if (!is_float) {
+			return patch_error(line_num, value_col, "expected a number but got", value, value_len);
+		}
+		*param_field(osc, param) = param_clamp(param, f);
+	}
 
-		if (strcmp(key, "type") == 0) {
-			osc->wave_type = parse_wave_type(value);
-		} else if (strcmp(key, "freq") == 0) {
-			if (strcmp(value, "sync") == 0) {
-				osc->freq_sync = true;
-			} else {
-				osc->freq = atof(value);
-			}
-		} else if (strcmp(key, "freq_m") == 0) {
-			osc->freq_m = atof(value);
-		} else if (strcmp(key, "detune") == 0) {
-			osc->detune = atof(value);
-		} else if (strcmp(key, "output") == 0) {
-			osc->output_volume_m = atof(value);
-		} else if (strcmp(key, "phase_input") == 0) {
-			if (parse_osc(value, &osc_type, &osc_num) != 0) {
-				strcpy(synth_error_message, "failed to parse phase_input ");
-				strcpy(synth_error_message+strlen(synth_error_message), value);
-				return 1;
-			}
-			int osc_i = osc_num_to_index(osc_num, osc_type);
-			if (osc_i < 0) {
-				strcpy(synth_error_message, "failed to convert phase_input ");
-				strcpy(synth_error_message+strlen(synth_error_message), value);
-				return 1;
-			}
-			osc->phase_input = &oscs[osc_i];
-		} else if (strcmp(key, "phase_input_m") == 0) {
-			osc->phase_input_m = atof(value);
-		} else if (strcmp(key, "amp_input") == 0) {
-			if (parse_osc(value, &osc_type, &osc_num) != 0) {
-				strcpy(synth_error_message, "failed to parse amp_input ");
-				strcpy(synth_error_message+strlen(synth_error_message), value);
-				return 1;
-			}
-			int osc_i = osc_num_to_index(osc_num, osc_type);
-			if (osc_i < 0) {
-				strcpy(synth_error_message, "failed to convert amp_input ");
-				strcpy(synth_error_message+strlen(synth_error_message), value);
-				return 1;
-			}
-			osc->amp_input = &oscs[osc_i];
-		} else if (strcmp(key, "amp_input_m") == 0) {
-			osc->amp_input_m = atof(value);
-		} else if (strcmp(key, "attack") == 0) {
-			osc->attack = MAX(atof(value), ATTACK_MIN);
-		} else if (strcmp(key, "decay") == 0) {
-			osc->decay = MAX(atof(value), DECAY_MIN);
-		} else if (strcmp(key, "sustain") == 0) {
-			osc->sustain = atof(value);
-		} else if (strcmp(key, "release") == 0) {
-			osc->release = atof(value);
-		} else if (strcmp(key, "pitch_m") == 0) {
-			osc->pitch_m = atof(value);
-		} else if (strcmp(key, "mod_freq_m") == 0) {
-			osc->mod_freq_m = atof(value);
-		} else if (strcmp(key, "mod_output_m") == 0) {
-			osc->mod_output_m = atof(value);
-		} else {
-			// printf("unhandled line %s\n", key);
+	for (int i = 0; i < staging.num_cc_maps; i++) {
+		if (staging.cc_maps[i].osc_index < 0) {
+			patch_set_err("every [ccN] section needs a target");
+			return 1;
 		}
 	}
 
+	for (int i = 0; i < staging.num_mod_routes; i++) {
+		if (staging.mod_routes[i].src < 0 || staging.mod_routes[i].dst < 0) {
+			patch_set_err("every [modN] section needs a source and a dest");
+			return 1;
+		}
+	}
+
+	for (int i = 0; i < NUM_OSCS * NUM_OSC_TYPES; i++) {
+		if (staging.oscs[i].wave_type == WAVE_TYPE_WAVETABLE && staging.oscs[i].table == NULL) {
+			patch_set_err("every type=wavetable oscillator needs a wavetable=<file.wav>");
+			return 1;
+		}
+	}
+
+	for (int i = NUM_OSCS; i < NUM_OSCS * NUM_OSC_TYPES; i++) {
+		const struct osc* o = &staging.oscs[i];
+		if (!o->global) {
+			continue;
+		}
+		if (o->freq_sync) {
+			patch_set_err("a global LFO can't follow the note (freq=sync)");
+			return 1;
+		}
+		if ((o->phase_input && !o->phase_input->global) || (o->amp_input && !o->amp_input->global)) {
+			patch_set_err("a global LFO can only take input from other global LFOs");
+			return 1;
+		}
+	}
+
+	for (int i = 0; i < NUM_OSCS * NUM_OSC_TYPES; i++) {
+		struct osc* o = &staging.oscs[i];
+		if (o->osc_type != 0) {
+			unison_setup(&o->unison, NULL);
+		}
+	}
+	patch_copy(patch, &staging);
+	patch_update_active(patch);
 	return 0;
 }
 
-void osc_set_output(struct key* key, struct osc* osc, struct params* params, float t, float dt)
+void patch_copy(struct patch* dst, const struct patch* src)
 {
-	if (osc->wave_type == WAVE_TYPE_NONE) {
-		assert(osc->output == 0.0f);
-		return;
-	}
+	memcpy(dst, src, sizeof(struct patch));
+	move_inputs(dst->oscs, src->oscs);
+}
 
-	float freq = osc->freq * osc->freq_m;
-	if (freq <= 0.0) {
-		osc->output = 0.0f;
-		return;
+void patch_update_active(struct patch* patch)
+{
+	patch->num_active = 0;
+	for (int i = 0; i < NUM_OSCS * NUM_OSC_TYPES; i++) {
+		if (patch->oscs[i].osc_type != 0) {
+			patch->active[patch->num_active++] = i;
+		}
 	}
+}
 
-	freq = exp2f(log2f(freq) + params->pitch * osc->pitch_m + params->mod * osc->mod_freq_m + osc->detune);
-
-	if (osc->phase_input && osc->phase_input->wave_type) {
-		freq += osc->phase_input->output * osc->phase_input_m;
+// Copies the oscillators listed in active from src to dst, pointing
+// phase_input and amp_input at the copies. The ones dst was using before
+// (dst_active) are cleared first, so every slot outside the list stays zero
+// and only the oscillators in use are ever touched.
+static void copy_oscs(struct osc* dst, unsigned char* dst_active, int* dst_num_active,
+    const struct osc* src, const unsigned char* active, int num_active)
+{
+	for (int i = 0; i < *dst_num_active; i++) {
+		memset(&dst[dst_active[i]], 0, sizeof(struct osc));
+	}
+	for (int i = 0; i < num_active; i++) {
+		struct osc* osc = &dst[active[i]];
+		*osc = src[active[i]];
+		if (osc->phase_input) {
+			osc->phase_input = dst + (osc->phase_input - src);
+		}
+		if (osc->amp_input) {
+			osc->amp_input = dst + (osc->amp_input - src);
+		}
+		dst_active[i] = active[i];
 	}
+	*dst_num_active = num_active;
+}
 
-	osc->wave_pos = fmod(osc->wave_pos + dt * freq, 1.f);
+void patch_instantiate(const struct patch* patch, struct key* key)
+{
+	copy_oscs(key->oscs, key->active, &key->num_active, patch->oscs, patch->active, patch->num_active);
+	key->filter = patch->filter;
+}
+
+// advances the oscillator's phase by step cycles and sets output to the
+// wave at the new phase
+static void osc_wave(struct key* key, struct osc* osc, float step)
+{
+	float wave_pos = osc->wave_pos + step;
+	bool wrapped = wave_pos >= 1.f;
+	// what fmod() would give, without a call into libm
+	osc->wave_pos = wave_pos - (int)wave_pos;
 
 	switch (osc->wave_type) {
 
@@ -392,7 +1067,7 @@ void osc_set_output(struct key* key, struct osc* osc, struct params* params, flo
 	}
 
 	case WAVE_TYPE_SQUARE: {
-		if (osc->wave_pos < 0.5f) {
+		if (osc->wave_pos < 0.5f + osc->mod_pw) {
 			osc->output = 1.0;
 		} else {
 			osc->output = -1.0;
@@ -401,7 +1076,7 @@ void osc_set_output(struct key* key, struct osc* osc, struct params* params, flo
 	}
 
 	case WAVE_TYPE_PULSE12: {
-		if (osc->wave_pos < 0.125f) {
+		if (osc->wave_pos < 0.125f + osc->mod_pw) {
 			osc->output = 1.0;
 		} else {
 			osc->output = -1.0;
@@ -410,7 +1085,7 @@ void osc_set_output(struct key* key, struct osc* osc, struct params* params, flo
 	}
 
 	case WAVE_TYPE_PULSE25: {
-		if (osc->wave_pos < 0.25f) {
+		if (osc->wave_pos < 0.25f + osc->mod_pw) {
 			osc->output = 1.0;
 		} else {
 			osc->output = -1.0;
@@ -419,15 +1094,66 @@ void osc_set_output(struct key* key, struct osc* osc, struct params* params, flo
 	}
 
 	case WAVE_TYPE_RAND: {
-		// osc->output = bad_normalf();
-		osc->output = bad_randf();
+		if (key->noise_left == 0) {
+			rng_fill(&key->rng, key->noise, RNG_BLOCK);
+			key->noise_left = RNG_BLOCK;
+		}
+		osc->output = key->noise[--key->noise_left];
+		break;
+	}
+
+	case WAVE_TYPE_SAMPLE_HOLD: {
+		if (wrapped) {
+			osc->held = rng_float(&key->rng) * 2.f - 1.f;
+		}
+		osc->output = osc->held;
+		break;
+	}
+
+	case WAVE_TYPE_WAVETABLE: {
+		// type can be set live on an oscillator without a table
+		osc->output = osc->table ? wavetable_lookup(osc->table, osc->wave_pos, osc->position + osc->mod_position, step) : 0.f;
 		break;
 	}
 	}
+}
+
+void osc_set_output(struct key* key, struct osc* osc, struct params* params, float t, float dt)
+{
+	if (osc->wave_type == WAVE_TYPE_NONE) {
+		assert(osc->output == 0.0f);
+		return;
+	}
+
+	if (osc->global) {
+		// rendered once for every voice by controls_publish(); follow it
+		osc->output += osc->global_step;
+		return;
+	}
+
+	float freq = osc->freq * osc->freq_m;
+	if (freq <= 0.0) {
+		osc->output = 0.0f;
+		return;
+	}
+
+	freq *= fast_exp2(params->pitch * osc->pitch_m + params->mod * osc->mod_freq_m + osc->detune + osc->mod_pitch);
+
+	if (osc->phase_input && osc->phase_input->wave_type) {
+		freq += osc->phase_input->output * osc->phase_input_m;
+	}
+
+	if (osc->unison.copies > 1 && osc->wave_type < WAVE_TYPE_RAND) {
+		// noise is no thicker for being stacked, so random waves ignore unison
+		osc->output = unison_render(&osc->unison, osc->wave_type, dt * freq, osc->mod_pw);
+	} else {
+		osc_wave(key, osc, dt * freq);
+	}
 
 	if (osc->amp_input && osc->amp_input->wave_type) {
 		osc->output *= (osc->amp_input->output + 1.0) / 2.0 * osc->amp_input_m;
 	}
+	osc->output *= 1.f + osc->mod_amp;
 
 	if (osc->mod_output_m > 0.0f) {
 		osc->output *= osc->mod_output_m * params->mod;
@@ -440,39 +1166,375 @@ void osc_set_output(struct key* key, struct osc* osc, struct params* params, flo
 	}
 
 	// ASDR filtering
+	float env = 1.f + osc->mod_env;
 	if (key->pressed_at > key->released_at) {
 		float time_since_press = t - key->pressed_at;
-		osc->output_volume = ads_level(time_since_press, osc->attack, osc->output_volume_attack_start, osc->decay, osc->sustain);
+		osc->output_volume = ads_level(time_since_press, osc->attack * env, osc->output_volume_attack_start, osc->decay * env, osc->sustain);
 		osc->output_volume_at_release = osc->output_volume;
 	} else if (key->released_at > key->pressed_at) {
 		float time_since_release = t - key->released_at;
-		osc->output_volume = r_level(time_since_release, osc->output_volume_at_release, osc->decay);
+		osc->output_volume = r_level(time_since_release, osc->output_volume_at_release, osc->decay * env);
+	}
+}
+
+#define MIDDLE_C 261.626f
+
+void synth_modulate(const struct mod_route* routes, int num_routes, const struct params* params, struct key* keys, const unsigned char* voices, int n)
+{
+	// sources and destinations are laid out voice-minor, so each route is
+	// one multiply-add across all the voices at once
+	float src[NUM_MOD_SRCS][MAX_KEYS];
+	float acc[NUM_MOD_DSTS][NUM_OSCS * NUM_OSC_TYPES][MAX_KEYS];
+
+	for (int r = 0; r < num_routes; r++) {
+		memset(acc[routes[r].dst][routes[r].osc_index], 0, sizeof(float) * n);
+	}
+	for (int k = 0; k < n; k++) {
+		const struct key* key = &keys[voices[k]];
+		for (int i = 0; i < NUM_OSCS; i++) {
+			src[MOD_SRC_LFO1 + i][k] = 0.f;
+			src[MOD_SRC_ENV1 + i][k] = 0.f;
+		}
+		for (int i = 0; i < key->num_active; i++) {
+			int j = key->active[i];
+			if (j < NUM_OSCS) {
+				src[MOD_SRC_ENV1 + j][k] = key->oscs[j].output_volume;
+			} else {
+				src[MOD_SRC_LFO1 + j - NUM_OSCS][k] = key->oscs[j].output;
+			}
+		}
+		src[MOD_SRC_VELOCITY][k] = key->velocity;
+		src[MOD_SRC_KEYTRACK][k] = key->freq > 0.f ? fast_log2(key->freq / MIDDLE_C) : 0.f;
+		src[MOD_SRC_MODWHEEL][k] = params->mod;
+		src[MOD_SRC_PITCHBEND][k] = params->pitch;
+		src[MOD_SRC_AFTERTOUCH][k] = params->aftertouch;
+	}
+
+	for (int r = 0; r < num_routes; r++) {
+		const struct mod_route* route = &routes[r];
+		const float* x = src[route->src];
+		float* a = acc[route->dst][route->osc_index];
+		const float depth = route->depth;
+		for (int k = 0; k < n; k++) {
+			a[k] += depth * x[k];
+		}
+	}
+
+	// only the routed destinations of oscillators the voice uses are written;
+	// a destination that is routed more than once just gets the same sum again
+	for (int k = 0; k < n; k++) {
+		struct key* key = &keys[voices[k]];
+		for (int a = 0; a < key->num_active; a++) {
+			struct osc* osc = &key->oscs[key->active[a]];
+			osc->mod_pitch = 0.f;
+			osc->mod_amp = 0.f;
+			osc->mod_pw = 0.f;
+			osc->mod_env = 0.f;
+			osc->mod_position = 0.f;
+		}
+		key->mod_cutoff = 0.f;
+		key->mod_resonance = 0.f;
+		for (int r = 0; r < num_routes; r++) {
+			int i = routes[r].osc_index;
+			if (routes[r].dst == MOD_DST_CUTOFF) {
+				key->mod_cutoff = acc[MOD_DST_CUTOFF][i][k];
+				continue;
+			}
+			if (routes[r].dst == MOD_DST_RESONANCE) {
+				key->mod_resonance = acc[MOD_DST_RESONANCE][i][k];
+				continue;
+			}
+			struct osc* osc = &key->oscs[i];
+			if (osc->osc_type == 0) {
+				continue;
+			}
+			switch (routes[r].dst) {
+			case MOD_DST_PITCH:
+				osc->mod_pitch = acc[MOD_DST_PITCH][i][k];
+				break;
+			case MOD_DST_AMP:
+				osc->mod_amp = MAX(acc[MOD_DST_AMP][i][k], -1.f);
+				break;
+			case MOD_DST_PW:
+				osc->mod_pw = MIN(MAX(acc[MOD_DST_PW][i][k], -0.49f), 0.49f);
+				break;
+			case MOD_DST_ENV:
+				osc->mod_env = fast_exp2(acc[MOD_DST_ENV][i][k]) - 1.f;
+				break;
+			case MOD_DST_POSITION:
+				osc->mod_position = acc[MOD_DST_POSITION][i][k];
+				break;
+			}
+		}
+	}
+}
+
+static float render_oscs(struct key* key, struct osc* oscs, const unsigned char* active, int num_active,
+    struct params* params, float t, float dt, bool* done)
+{
+	float output = 0.0f;
+	for (int j = 0; j < num_active; j++) {
+		struct osc* osc = &oscs[active[j]];
+		osc_set_output(key, osc, params, t, dt);
+		if (osc->osc_type == OSC_TYPE_VFO) {
+			output += osc->output * osc->output_volume * osc->output_volume_m;
+			if (osc->output_volume > 0.0 || key->released_at == 0.0) {
+				*done = false;
+			}
+		}
+	}
+	return output;
+}
+
+float key_render(struct key* key, struct params* params, float t, float dt)
+{
+	bool done = true;
+	float output = render_oscs(key, key->oscs, key->active, key->num_active, params, t, dt, &done);
+
+	if (key->xfade_left > 0) {
+		float old = render_oscs(key, key->xfade_oscs, key->xfade_active, key->xfade_num_active, params, t, dt, &done);
+		float g = (float)key->xfade_left / key->xfade_len;
+		output = output * (1.0f - g) + old * g;
+		key->xfade_left--;
+	}
+
+	if (done) {
+		key->pressed_at = 0.f;
+		key->released_at = 0.f;
+		key->freq = 0.f;
+		key->xfade_left = 0;
+	}
+	return output;
+}
+
+// see synth_note_on()
+static struct key* alloc_key(struct key* keys, int part, const struct voice_limit* limits, float freq)
+{
+	int held = 0;
+	for (int i = 0; i < MAX_KEYS; i++) {
+		if (keys[i].freq == freq && keys[i].part == part) {
+			return &keys[i];
+		}
+		held += keys[i].freq != 0.f && keys[i].part == part;
+	}
+	bool full = limits != NULL && held >= limits[part].max_voices;
+	if (!full) {
+		for (int i = 0; i < MAX_KEYS; i++) {
+			if (keys[i].freq == 0.f) {
+				return &keys[i];
+			}
+		}
+	}
+
+	struct key* oldest = NULL;
+	for (int i = 0; i < MAX_KEYS; i++) {
+		struct key* k = &keys[i];
+		if (k->freq == 0.f) {
+			continue;
+		}
+		if (full ? k->part != part : limits != NULL && limits[k->part].priority > limits[part].priority) {
+			continue;
+		}
+		if (oldest == NULL || k->pressed_at < oldest->pressed_at) {
+			oldest = k;
+		}
+	}
+	return oldest;
+}
+
+int synth_sounding(const struct key* keys, int start, int end)
+{
+	int n = 0;
+	for (int i = start; i < end; i++) {
+		n += keys[i].freq > 0.f;
+	}
+	return n;
+}
+
+struct key* synth_note_on(struct key* keys, const struct patch* patch, int part, const struct voice_limit* limits, float freq, float velocity, float t)
+{
+	struct key* k = alloc_key(keys, part, limits, freq);
+	if (!k) {
+		return 0;
+	}
+
+	// re-pressing a note that is still sounding starts the attack from
+	// wherever its envelope currently is, rather than from silence
+	// (slots the key isn't using are zero, so they start from silence)
+	float attack_start[NUM_OSCS];
+	bool keep_output = (k->freq == freq && k->part == part);
+	for (int i = 0; i < patch->num_active; i++) {
+		int j = patch->active[i];
+		if (j < NUM_OSCS) {
+			attack_start[j] = keep_output ? k->oscs[j].output_volume : 0.f;
+		}
 	}
+
+	patch_instantiate(patch, k);
+
+	k->filter_reset = !keep_output;
+	k->freq = freq;
+	k->part = part;
+	k->velocity = velocity;
+	k->pressed_at = t;
+	k->released_at = 0.0f;
+	// a patch swap's crossfade was from the voice's previous oscillators
+	k->xfade_left = 0;
+	k->xfade_num_active = 0;
+
+	// the same note at the same time always gets the same noise
+	uint32_t freq_bits, t_bits;
+	memcpy(&freq_bits, &freq, sizeof(freq_bits));
+	memcpy(&t_bits, &t, sizeof(t_bits));
+	rng_seed(&k->rng, freq_bits ^ (t_bits << 16 | t_bits >> 16));
+	k->noise_left = 0;
+
+	for (int i = 0; i < k->num_active; i++) {
+		int j = k->active[i];
+		struct osc* osc = &k->oscs[j];
+		if (osc->wave_type == WAVE_TYPE_SAMPLE_HOLD) {
+			// start on a random level rather than waiting out the first cycle
+			osc->held = rng_float(&k->rng) * 2.f - 1.f;
+		}
+		if (osc->unison.copies > 1) {
+			unison_seed(&osc->unison, &k->rng);
+		}
+		if (j < NUM_OSCS) {
+			osc->freq = freq;
+			osc->output_volume_attack_start = attack_start[j];
+		} else if (osc->freq_sync) {
+			// LFOs are in the second set
+			osc->freq = freq;
+		}
+	}
+	return k;
 }
 
-void get_key(struct key* keys, float freq, struct key** key, bool insert)
+void synth_note_off(struct key* keys, int part, float freq, float t)
 {
 	for (int i = 0; i < MAX_KEYS; i++) {
-		if (keys[i].freq == freq) {
-			*key = &keys[i];
+		if (keys[i].freq == freq && keys[i].part == part) {
+			keys[i].released_at = t;
 			return;
 		}
 	}
-	if (!insert) {
-		// key was not found, don't insert one
+}
+
+int synth_set_param(struct patch* patch, struct key* keys, int part, int osc_index, int param, float value)
+{
+	if (osc_index < 0 || osc_index >= NUM_OSCS * NUM_OSC_TYPES || param < 0 || param >= NUM_PARAMS || !isfinite(value)) {
+		return 1;
+	}
+	if (patch->oscs[osc_index].osc_type == 0) {
+		// not defined by the patch
+		return 1;
+	}
+	if (param == PARAM_WAVE_TYPE && (value < WAVE_TYPE_NONE || value > WAVE_TYPE_WAVETABLE)) {
+		return 1;
+	}
+	value = param_clamp(param, value);
+
+	struct osc* osc = &patch->oscs[osc_index];
+	if (param == PARAM_WAVE_TYPE) {
+		osc->wave_type = (int)value;
+	} else if (param == PARAM_UNISON) {
+		osc->unison.copies = (int)(value + 0.5f);
+	} else {
+		*param_field(osc, param) = value;
+	}
+	if (param >= PARAM_UNISON && param <= PARAM_UNISON_SPREAD) {
+		unison_setup(&osc->unison, NULL);
+	}
+	if (keys == NULL) {
+		return 0;
+	}
+
+	for (int i = 0; i < MAX_KEYS; i++) {
+		if (keys[i].freq != 0.f && keys[i].part == part) {
+			key_set_param(&keys[i], osc_index, param, value);
+		}
+	}
+	return 0;
+}
+
+void key_set_param(struct key* key, int osc_index, int param, float value)
+{
+	osc_set_param(&key->oscs[osc_index], param, value, &key->rng);
+}
+
+void osc_set_param(struct osc* osc, int param, float value, struct rng* rng)
+{
+	if (osc->osc_type == 0) {
+		// not defined by the voice's patch; leave the slot zeroed
+		return;
+	}
+	if (param == PARAM_WAVE_TYPE) {
+		osc->wave_type = (int)value;
+	} else if (param == PARAM_FREQ && (osc->osc_type == OSC_TYPE_VFO || osc->freq_sync)) {
+		// these follow the note being played
+	} else if (param == PARAM_UNISON) {
+		osc->unison.copies = (int)(param_clamp(param, value) + 0.5f);
+	} else {
+		*param_field(osc, param) = param_clamp(param, value);
+	}
+	if (param >= PARAM_UNISON && param <= PARAM_UNISON_SPREAD) {
+		// copies joining the stack start from random phases
+		unison_setup(&osc->unison, rng);
+	}
+}
+
+float synth_get_param(const struct patch* patch, int osc_index, int param)
+{
+	struct osc* osc = (struct osc*)&patch->oscs[osc_index];
+	if (param == PARAM_WAVE_TYPE) {
+		return osc->wave_type;
+	}
+	if (param == PARAM_UNISON) {
+		return osc->unison.copies;
+	}
+	return *param_field(osc, param);
+}
+
+void synth_swap_patch(struct key* keys, int part, const struct patch* patch, float sample_rate)
+{
+	if (patch->swap_mode != PATCH_SWAP_CROSSFADE) {
+		// each voice already owns a copy of the oscillators it was started
+		// with, so it simply keeps playing them until released
 		return;
 	}
-	float oldest_pressed = 0.0;
-	int oldest_i = 0;
+
+	unsigned len = patch->crossfade * sample_rate;
 	for (int i = 0; i < MAX_KEYS; i++) {
-		if (keys[i].freq == 0.0) {
-			*key = &keys[i];
-			return;
+		struct key* k = &keys[i];
+		if (k->freq == 0.f || k->part != part) {
+			continue;
 		}
-		if (keys[i].pressed_at > 0.0 && (oldest_pressed == 0.0 || keys[i].pressed_at < oldest_pressed)) {
-			oldest_pressed = keys[i].pressed_at;
-			oldest_i = i;
+
+		// the current oscillators become the ones being faded out
+		copy_oscs(k->xfade_oscs, k->xfade_active, &k->xfade_num_active, k->oscs, k->active, k->num_active);
+		patch_instantiate(patch, k);
+
+		// carry phase and envelope state across so the new patch picks up
+		// exactly where the old one was
+		for (int i = 0; i < k->num_active; i++) {
+			int j = k->active[i];
+			struct osc* osc = &k->oscs[j];
+			const struct osc* prev = &k->xfade_oscs[j];
+			osc->wave_pos = prev->wave_pos;
+			osc->output = prev->output;
+			osc->output_volume = prev->output_volume;
+			osc->output_volume_at_release = prev->output_volume_at_release;
+			osc->output_volume_attack_start = prev->output_volume_attack_start;
+			if (osc->unison.copies > 1) {
+				for (int c = 0; c < osc->unison.copies; c++) {
+					osc->unison.pos[c] = c < prev->unison.copies ? prev->unison.pos[c] : rng_float(&k->rng);
+				}
+			}
+			if (osc->osc_type == OSC_TYPE_VFO || osc->freq_sync) {
+				osc->freq = k->freq;
+			}
 		}
+		k->xfade_left = len;
+		k->xfade_len = len;
 	}
-	*key = &keys[oldest_i];
 }
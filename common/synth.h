@@ -5,6 +5,12 @@ extern "C" {
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "rng.h"
+#include "unison.h"
+#include "wavetable.h"
 
 #define WAVE_TYPE_NONE 0
 #define WAVE_TYPE_SINE 1
@@ -14,7 +20,9 @@ extern "C" {
 #define WAVE_TYPE_SQUARE 5
 #define WAVE_TYPE_PULSE12 6
 #define WAVE_TYPE_PULSE25 7
-#define WAVE_TYPE_RAND 8
+#define WAVE_TYPE_RAND 8 // white noise, 0 to 1
+#define WAVE_TYPE_SAMPLE_HOLD 9 // a new random level, -1 to 1, each cycle
+#define WAVE_TYPE_WAVETABLE 10 // read from a WAV file, see wavetable.h
 
 #define OSC_TYPE_VFO 1
 #define OSC_TYPE_LFO 2
@@ -22,7 +30,30 @@ extern "C" {
 #define ATTACK_MIN 0.01
 #define DECAY_MIN 0.01
 
-#define NUM_OSCS 3
+// parameters that can be changed on a running patch, see synth_set_param()
+#define PARAM_WAVE_TYPE 0
+#define PARAM_FREQ 1
+#define PARAM_FREQ_M 2
+#define PARAM_DETUNE 3
+#define PARAM_OUTPUT 4
+#define PARAM_PHASE_INPUT_M 5
+#define PARAM_AMP_INPUT_M 6
+#define PARAM_ATTACK 7
+#define PARAM_DECAY 8
+#define PARAM_SUSTAIN 9
+#define PARAM_RELEASE 10
+#define PARAM_PITCH_M 11
+#define PARAM_MOD_FREQ_M 12
+#define PARAM_MOD_OUTPUT_M 13
+#define PARAM_UNISON 14
+#define PARAM_UNISON_DETUNE 15
+#define PARAM_UNISON_SPREAD 16
+#define PARAM_POSITION 17
+#define NUM_PARAMS 18
+
+// the most oscillators of each type a patch can use; voices only ever touch
+// the ones their patch actually defines
+#define NUM_OSCS 16
 #define NUM_OSC_TYPES 2
 
 #define MAX_KEYS 8
@@ -41,6 +72,7 @@ struct osc {
 	float freq;
 	float wave_pos;
 	bool freq_sync;
+	bool global; // an LFO shared by every voice, see controls_publish()
 	float freq_m;
 	float detune;
 	int osc_type;
@@ -57,6 +89,16 @@ struct osc {
 	float pitch_m; // if set, multiply pitch bend by this amount
 	float mod_freq_m; // if set, multiply modulation by this amount and apply it to the freq
 	float mod_output_m; // if set, multiply modulation by this amount and apply it to volume output
+	struct unison unison; // stacked, detuned copies of the wave, see unison.h
+	const struct wavetable* table; // for WAVE_TYPE_WAVETABLE
+	float position; // in the wavetable, 0 (first frame) to 1 (last)
+
+	// set once per control block by synth_modulate(); all 0 means unmodulated
+	float mod_pitch; // octaves
+	float mod_amp; // added to a gain of 1
+	float mod_pw; // added to the pulse width of square and pulse waves
+	float mod_env; // added to a scale of 1 on envelope times
+	float mod_position; // added to position
 
 	// internal values
 	// float pressed_at; // TODO remove these
@@ -67,33 +109,241 @@ struct osc {
 	float output_volume_at_release;
 	float output_volume_attack_start;
 	float output;
+	float held; // WAVE_TYPE_SAMPLE_HOLD's level for the current cycle
+	float global_step; // how far a global LFO's output moves each sample, set by controls_step()
+};
+
+#define FILTER_NONE 0
+#define FILTER_LOWPASS 1
+#define FILTER_HIGHPASS 2
+#define FILTER_BANDPASS 3
+
+#define FILTER_CUTOFF_DEFAULT 1000.f
+#define FILTER_RESONANCE_MAX 0.98f // 1 would ring forever
+
+// the voice filter, from the [filter] section; see filter.h
+struct filter {
+	int type; // FILTER_*
+	float cutoff; // Hz
+	float resonance; // 0 to 1
 };
 
 struct key {
 	float freq;
+	int part; // whose patch the note was started from, see parts.h
 	float pressed_at;
 	float released_at;
 	float velocity;
 	struct osc* oscs;
+	int num_active;
+	unsigned char active[NUM_OSCS * NUM_OSC_TYPES]; // indexes into oscs, see struct patch
+
+	// while xfade_left > 0, the oscillators of the previous patch keep
+	// rendering from xfade_oscs and are faded out over xfade_len samples
+	struct osc* xfade_oscs;
+	int xfade_num_active;
+	unsigned char xfade_active[NUM_OSCS * NUM_OSC_TYPES];
+	unsigned xfade_left;
+	unsigned xfade_len;
+
+	struct filter filter;
+	float mod_cutoff; // octaves, from the modulation matrix
+	float mod_resonance;
+	bool filter_reset; // a new note; the renderer clears the filter's state
+
+	// seeded at note-on; random oscillators take noise[] from the end down,
+	// refilling it when noise_left reaches 0
+	struct rng rng;
+	float noise[RNG_BLOCK];
+	int noise_left;
 
 	float future_released_at; // only to be used while using computer keyboard trigger
-};
+} __attribute__((aligned(CACHE_LINE))); // voices rendered on different cores never share a line
 
 struct params {
 	float pitch;
 	float mod;
+	float aftertouch;
+};
+
+// modulation sources
+#define MOD_SRC_LFO1 0 // up to MOD_SRC_LFO1 + NUM_OSCS - 1
+#define MOD_SRC_ENV1 (MOD_SRC_LFO1 + NUM_OSCS) // a VFO's envelope, likewise
+#define MOD_SRC_VELOCITY (MOD_SRC_ENV1 + NUM_OSCS)
+#define MOD_SRC_KEYTRACK (MOD_SRC_VELOCITY + 1) // octaves above middle C
+#define MOD_SRC_MODWHEEL (MOD_SRC_KEYTRACK + 1)
+#define MOD_SRC_PITCHBEND (MOD_SRC_MODWHEEL + 1)
+#define MOD_SRC_AFTERTOUCH (MOD_SRC_PITCHBEND + 1)
+#define NUM_MOD_SRCS (MOD_SRC_AFTERTOUCH + 1)
+
+// modulation destinations, per oscillator
+#define MOD_DST_PITCH 0
+#define MOD_DST_AMP 1
+#define MOD_DST_PW 2
+#define MOD_DST_ENV 3 // attack, decay and release times, in octaves
+// and per voice; routes to these have an osc_index of 0
+#define MOD_DST_CUTOFF 4 // in octaves
+#define MOD_DST_RESONANCE 5
+// per oscillator again; added after the per voice ones were
+#define MOD_DST_POSITION 6
+#define NUM_MOD_DSTS 7
+
+#define MAX_MOD_ROUTES 16
+
+// one row of the modulation matrix, from a [modN] section
+struct mod_route {
+	int src; // MOD_SRC_*
+	int dst; // MOD_DST_*
+	int osc_index;
+	float depth;
+};
+
+// what happens to sounding voices when a new patch is swapped in
+#define PATCH_SWAP_KEEP 0 // they finish with the patch they were started with
+#define PATCH_SWAP_CROSSFADE 1 // they crossfade to the new patch
+
+#define PATCH_CROSSFADE_DEFAULT 0.05f
+
+#define MAX_CC_MAPS 8
+#define CC_SMOOTHING_DEFAULT 0.02f
+
+// a MIDI CC driving one oscillator parameter, from a [ccN] section
+struct cc_map {
+	int cc;
+	int osc_index;
+	int param; // PARAM_*
+	float min; // value at CC 0
+	float max; // value at CC 127
+	float smoothing; // seconds, see controls.h
+};
+
+#define FX_DELAY_MAX 2.f // seconds
+
+// master effects, from the [chorus], [delay] and [reverb] sections; an
+// effect whose mix is 0 is off. See fx.h
+struct fx {
+	float chorus_rate; // Hz
+	float chorus_depth; // seconds of delay sweep
+	float chorus_mix; // 0 (dry) to 1 (wet)
+	float delay_time; // seconds, up to FX_DELAY_MAX
+	float delay_feedback; // 0 to 0.95
+	float delay_mix; // level of the echoes; the dry signal is kept as is
+	float reverb_size; // 0 to 1
+	float reverb_damping; // 0 to 1
+	float reverb_mix; // 0 (dry) to 1 (wet)
 };
 
-int synth_new(struct key** keys);
+// A compiled patch; the oscillators every voice is instantiated from.
+// Treat it as immutable once patch_compile() has returned.
+struct patch {
+	struct osc oscs[NUM_OSCS * NUM_OSC_TYPES];
+
+	// the oscillators the patch defines, in render order; everything else in
+	// oscs is zero, and stays zero in every voice instantiated from it
+	int num_active;
+	unsigned char active[NUM_OSCS * NUM_OSC_TYPES];
+	int swap_mode;
+	float crossfade; // seconds
+	int num_cc_maps;
+	struct cc_map cc_maps[MAX_CC_MAPS];
+	int num_mod_routes;
+	struct mod_route mod_routes[MAX_MOD_ROUTES];
+	struct filter filter;
+	struct fx fx;
+};
+
+// bytes one voice's oscillators (and the ones it crossfades from) take
+#define SYNTH_OSC_ARENA_BYTES (2 * ARENA_SIZE(sizeof(struct osc) * NUM_OSCS * NUM_OSC_TYPES))
+
+// Allocates MAX_KEYS voices from arena. The voices are split evenly over
+// num_osc_arenas, each group taking its oscillators from its own arena
+// (e.g. one per core), so a group's state stays in that arena's memory.
+// Returns non-zero if any arena is too small.
+int synth_new(struct key** keys, struct arena* arena, struct arena* osc_arenas, int num_osc_arenas);
 void synth_clear(struct key* keys);
 
-int parse_wave_type(const char* s);
-int parse_osc(const char* s, int* osc_type, int* n);
-int load_patch(char* src, struct osc* oscs);
+// moves the key's oscillators, and the ones it's crossfading from, into
+// oscs and xfade_oscs (each NUM_OSCS * NUM_OSC_TYPES long), e.g. into the arena
+// of the core that renders it now; the old ones are left as they were
+void key_move_oscs(struct key* key, struct osc* oscs, struct osc* xfade_oscs);
+
+int parse_wave_type(const char* s, size_t n);
+int parse_filter_type(const char* s, size_t n);
+
+// keeps every effect setting within its documented range
+void fx_clamp(struct fx* fx);
+int parse_osc(const char* s, size_t n, int* osc_type, int* osc_num);
+int parse_float(const char* s, size_t n, float* f);
+
+// returns a PARAM_* for a patch file key (e.g. "attack"), or -1
+int parse_param(const char* s, size_t n);
+
+// src does not need to be NUL terminated; on failure patch is left untouched
+// and load_patch_err() describes the line and column of the problem
+int patch_compile(const char* src, size_t len, struct patch* patch);
+
+// rebuilds patch->active from the oscillators present in patch->oscs
+void patch_update_active(struct patch* patch);
+
+// copies src into dst, pointing phase_input and amp_input at dst's own
+// oscillators; src and dst must not overlap
+void patch_copy(struct patch* dst, const struct patch* src);
+
+// copies patch's oscillators into the key, clearing any the key was using
+// that the patch doesn't define
+void patch_instantiate(const struct patch* patch, struct key* key);
+
 void osc_set_output(struct key* key, struct osc* osc, struct params* params, float t, float dt);
-void get_key(struct key* keys, float freq, struct key** key, bool insert);
+
+// Evaluates the modulation matrix for the n keys listed in voices, setting the
+// mod_* fields of their oscillators. Called once per control block.
+void synth_modulate(const struct mod_route* routes, int num_routes, const struct params* params, struct key* keys, const unsigned char* voices, int n);
+
+// renders one sample of every oscillator in the key and returns the key's
+// output; frees the key once all its envelopes have finished
+float key_render(struct key* key, struct params* params, float t, float dt);
+
+// how many of keys[start..end) are playing a note
+int synth_sounding(const struct key* keys, int start, int end);
+
+// how much of the voice pool a part may take; see parts.h
+struct voice_limit {
+	int max_voices; // voices it may hold at once
+	int priority; // its notes may steal voices from parts of no higher priority
+};
+
+// Instantiates the patch into a key for part to play freq on, and returns it:
+// the key already playing freq on that part, else a free one (unless the part
+// holds all it may), else the oldest the part may steal; its own once it is
+// at its limit. Returns NULL, dropping the note, if there is none. limits is
+// indexed by part; NULL for none.
+struct key* synth_note_on(struct key* keys, const struct patch* patch, int part, const struct voice_limit* limits, float freq, float velocity, float t);
+void synth_note_off(struct key* keys, int part, float freq, float t);
+
+// Changes a single parameter of one oscillator, both in patch and in every
+// voice part is sounding, without disturbing phases or envelopes. keys may be
+// NULL. Must be called between blocks. Fails, changing nothing, for a value
+// that isn't finite or an oscillator the patch doesn't define.
+int synth_set_param(struct patch* patch, struct key* keys, int part, int osc_index, int param, float value);
+
+// the same, for a single voice; the caller has already validated the ids
+void key_set_param(struct key* key, int osc_index, int param, float value);
+
+// and for a single oscillator, e.g. a global LFO; rng seeds unison copies
+void osc_set_param(struct osc* osc, int param, float value, struct rng* rng);
+
+float synth_get_param(const struct patch* patch, int osc_index, int param);
+
+// Makes patch the one part's sounding voices use, according to
+// patch->swap_mode. Must be called between blocks, while no core is rendering
+// keys.
+void synth_swap_patch(struct key* keys, int part, const struct patch* patch, float sample_rate);
 
 const char* load_patch_err();
+void patch_set_err(const char* msg);
+
+// sets an error message of the form "line 3, col 5: <msg> <tok>" and returns 1
+int patch_error(int line, int col, const char* msg, const char* tok, size_t tok_len);
 
 // TODO remove this
 int osc_num_to_index(int osc_num, int osc_type);
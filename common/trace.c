@@ -0,0 +1,205 @@
+#include "trace.h"
+
+#ifdef TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <time.h>
+#include <x86intrin.h>
+#endif
+
+static struct trace_ring rings[TRACE_MAX_CORES];
+static volatile int recording = 1;
+static uint64_t ticks_per_sec = 1000000000;
+
+static inline uint64_t read_ticks(void)
+{
+#if defined(__aarch64__)
+	uint64_t t;
+	__asm__ volatile("mrs %0, cntvct_el0" : "=r"(t));
+	return t;
+#elif defined(__arm__)
+	uint64_t t;
+	__asm__ volatile("mrrc p15, 1, %Q0, %R0, c14" : "=r"(t));
+	return t;
+#else
+	return __rdtsc();
+#endif
+}
+
+void trace_init(void)
+{
+#if defined(__aarch64__)
+	uint64_t f;
+	__asm__ volatile("mrs %0, cntfrq_el0" : "=r"(f));
+	ticks_per_sec = f;
+#elif defined(__arm__)
+	uint32_t f;
+	__asm__ volatile("mrc p15, 0, %0, c14, c0, 0" : "=r"(f));
+	ticks_per_sec = f;
+#else
+	// the TSC's rate isn't advertised anywhere handy; time it for 20 ms
+	struct timespec a, b;
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	uint64_t t0 = read_ticks();
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &b);
+	} while ((b.tv_sec - a.tv_sec) * 1000000000L + (b.tv_nsec - a.tv_nsec) < 20000000L);
+	uint64_t t1 = read_ticks();
+	uint64_t ns = (b.tv_sec - a.tv_sec) * 1000000000UL + (b.tv_nsec - a.tv_nsec);
+	ticks_per_sec = (t1 - t0) * 1000000000UL / ns;
+#endif
+}
+
+void trace_name_core(int core, const char* name)
+{
+	rings[core].name = name;
+}
+
+void trace_event(int core, const char* name, char phase, int32_t arg)
+{
+	if (!recording) {
+		return;
+	}
+	struct trace_ring* r = &rings[core];
+	// an interrupt on this core may record in between; taking the slot
+	// atomically keeps both events
+	uint32_t i = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED) & (TRACE_RING - 1);
+	struct trace_event* e = &r->events[i];
+	e->ticks = read_ticks();
+	e->name = name;
+	e->arg = arg;
+	e->phase = phase;
+}
+
+void trace_stop(void)
+{
+	recording = 0;
+}
+
+void trace_start(void)
+{
+	recording = 1;
+}
+
+// JSON is built up in a small buffer and handed to the writer a line or so
+// at a time; there's no printf on the Pi
+struct out {
+	trace_write_fn write;
+	void* user;
+	char buf[256];
+	size_t len;
+};
+
+static void flush(struct out* o)
+{
+	o->write(o->user, o->buf, o->len);
+	o->len = 0;
+}
+
+static void put_str(struct out* o, const char* s)
+{
+	while (*s) {
+		if (o->len == sizeof(o->buf)) {
+			flush(o);
+		}
+		o->buf[o->len++] = *s++;
+	}
+}
+
+static void put_u64(struct out* o, uint64_t x, int min_digits)
+{
+	char tmp[21];
+	int n = 0;
+	do {
+		tmp[n++] = '0' + x % 10;
+		x /= 10;
+	} while (x > 0 || n < min_digits);
+	while (n > 0) {
+		char c[2] = { tmp[--n], '\0' };
+		put_str(o, c);
+	}
+}
+
+// microseconds since base, to the nanosecond
+static void put_ts(struct out* o, uint64_t ticks, uint64_t base)
+{
+	uint64_t t = ticks - base;
+	uint64_t ns = t / ticks_per_sec * 1000000000UL + t % ticks_per_sec * 1000000000UL / ticks_per_sec;
+	put_u64(o, ns / 1000, 1);
+	put_str(o, ".");
+	put_u64(o, ns % 1000, 3);
+}
+
+void trace_dump(trace_write_fn write, void* user)
+{
+	recording = 0;
+
+	struct out o = { write, user, { 0 }, 0 };
+	uint32_t first[TRACE_MAX_CORES], last[TRACE_MAX_CORES];
+	uint64_t base = UINT64_MAX;
+	for (int c = 0; c < TRACE_MAX_CORES; c++) {
+		last[c] = __atomic_load_n(&rings[c].head, __ATOMIC_ACQUIRE);
+		first[c] = last[c] > TRACE_RING ? last[c] - TRACE_RING : 0;
+		if (first[c] != last[c] && rings[c].events[first[c] & (TRACE_RING - 1)].ticks < base) {
+			base = rings[c].events[first[c] & (TRACE_RING - 1)].ticks;
+		}
+	}
+
+	put_str(&o, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	int comma = 0;
+	for (int c = 0; c < TRACE_MAX_CORES; c++) {
+		if (first[c] == last[c]) {
+			continue;
+		}
+		if (rings[c].name) {
+			put_str(&o, comma ? ",\n" : "");
+			put_str(&o, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":");
+			put_u64(&o, c, 1);
+			put_str(&o, ",\"args\":{\"name\":\"");
+			put_str(&o, rings[c].name);
+			put_str(&o, "\"}}");
+			comma = 1;
+		}
+
+		// the oldest events may be the ends of scopes whose beginnings have
+		// been overwritten; those are dropped so everything nests
+		int depth = 0;
+		for (uint32_t i = first[c]; i != last[c]; i++) {
+			const struct trace_event* e = &rings[c].events[i & (TRACE_RING - 1)];
+			if (e->phase == 'E' && depth == 0) {
+				continue;
+			}
+			depth += e->phase == 'B' ? 1 : e->phase == 'E' ? -1 : 0;
+
+			char ph[2] = { e->phase, '\0' };
+			put_str(&o, comma ? ",\n" : "");
+			put_str(&o, "{\"name\":\"");
+			put_str(&o, e->name);
+			put_str(&o, "\",\"ph\":\"");
+			put_str(&o, ph);
+			put_str(&o, "\",\"ts\":");
+			put_ts(&o, e->ticks, base);
+			put_str(&o, ",\"pid\":0,\"tid\":");
+			put_u64(&o, c, 1);
+			if (e->phase == 'i') {
+				put_str(&o, ",\"s\":\"g\"");
+			}
+			if (e->arg >= 0) {
+				put_str(&o, ",\"args\":{\"n\":");
+				put_u64(&o, e->arg, 1);
+				put_str(&o, "}");
+			}
+			put_str(&o, "}");
+			comma = 1;
+		}
+	}
+	put_str(&o, "\n]}\n");
+	flush(&o);
+
+	for (int c = 0; c < TRACE_MAX_CORES; c++) {
+		rings[c].head = 0;
+	}
+	recording = 1;
+}
+
+#endif
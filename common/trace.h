@@ -0,0 +1,120 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// A timeline of what every core does, block by block, for chrome://tracing
+// or ui.perfetto.dev. Only compiled in when TRACE is defined (-DTRACE; see
+// the README); otherwise every TRACE_* macro is empty and costs nothing.
+//
+// Each core records into its own ring of the last TRACE_RING events, written
+// only from that core (and its interrupts), so recording is a timestamp read
+// and a few stores, with no locks and no shared cache lines. Timestamps come
+// from the CPU's cycle counter (the generic timer on ARM, the TSC on x86).
+//
+// Recording stops on the first TRACE_STOP(), e.g. at an underrun, so the
+// rings keep the blocks leading up to it until they are dumped; a dump
+// empties the rings and starts recording again.
+
+#define TRACE_MAX_CORES 4
+#ifndef TRACE_RING
+#define TRACE_RING 1024 // per core; must be a power of two
+#endif
+
+#ifdef TRACE
+
+struct trace_event {
+	uint64_t ticks;
+	const char* name; // must be a string literal, or otherwise live forever
+	int32_t arg; // shown as args.n; -1 for none
+	char phase; // 'B'egin, 'E'nd or 'i'nstant, as in the trace format
+};
+
+struct trace_ring {
+	struct trace_event events[TRACE_RING];
+	const char* name;
+	uint32_t head __attribute__((aligned(CACHE_LINE)));
+} __attribute__((aligned(CACHE_LINE)));
+
+struct trace_scope {
+	int core;
+	const char* name;
+};
+
+// called with pieces of the JSON as it is produced
+typedef void (*trace_write_fn)(void* user, const char* s, size_t n);
+
+// works out the cycle counter's rate; call once before recording
+void trace_init(void);
+
+// the thread name the core's events are shown under
+void trace_name_core(int core, const char* name);
+
+void trace_event(int core, const char* name, char phase, int32_t arg);
+void trace_stop(void);
+void trace_start(void);
+
+// Writes everything the rings hold as Chrome trace JSON, then empties them
+// and starts recording again. The caller must make sure no core records
+// while it runs.
+void trace_dump(trace_write_fn write, void* user);
+
+static inline struct trace_scope trace_scope_begin(int core, const char* name)
+{
+	struct trace_scope s = { core, name };
+	trace_event(core, name, 'B', -1);
+	return s;
+}
+
+static inline void trace_scope_end(struct trace_scope* s)
+{
+	trace_event(s->core, s->name, 'E', -1);
+}
+
+#define TRACE_CAT_(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT_(a, b)
+
+#define TRACE_BEGIN(core, name) trace_event((core), (name), 'B', -1)
+#define TRACE_BEGIN_N(core, name, n) trace_event((core), (name), 'B', (n))
+#define TRACE_END(core, name) trace_event((core), (name), 'E', -1)
+#define TRACE_INSTANT(core, name) trace_event((core), (name), 'i', -1)
+#define TRACE_STOP() trace_stop()
+
+// traces from here to the end of the enclosing block
+#define TRACE_SCOPE(core, name)                           \
+	struct trace_scope TRACE_CAT(trace_scope_, __LINE__) \
+	    __attribute__((cleanup(trace_scope_end)))       \
+	    = trace_scope_begin((core), (name))
+
+#else
+
+#define TRACE_BEGIN(core, name) \
+	do {                    \
+	} while (0)
+#define TRACE_BEGIN_N(core, name, n) \
+	do {                         \
+	} while (0)
+#define TRACE_END(core, name) \
+	do {                  \
+	} while (0)
+#define TRACE_INSTANT(core, name) \
+	do {                      \
+	} while (0)
+#define TRACE_STOP() \
+	do {         \
+	} while (0)
+#define TRACE_SCOPE(core, name) \
+	do {                    \
+	} while (0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,130 @@
+#include "unison.h"
+#include "fast_math.h"
+#include "simd.h"
+#include "synth.h"
+
+#ifdef SIMD
+#define UNISON_LANES SIMD_LANES
+#else
+#define UNISON_LANES 1
+#endif
+
+void unison_setup(struct unison* u, struct rng* rng)
+{
+	int before = u->copies;
+	u->copies = MIN(MAX(u->copies, 1), UNISON_MAX);
+	u->lanes = (u->copies + UNISON_LANES - 1) / UNISON_LANES * UNISON_LANES;
+
+	float sum = 0.f;
+	for (int i = 0; i < UNISON_MAX; i++) {
+		u->ratio[i] = 0.f;
+		u->gain[i] = 0.f;
+		if (i >= u->copies) {
+			continue;
+		}
+		// -1 for the lowest copy to 1 for the highest
+		float x = u->copies > 1 ? 2.f * i / (u->copies - 1) - 1.f : 0.f;
+		u->ratio[i] = fast_exp2(x * u->detune / 1200.f);
+		// the middle copy, or the middle two of an even stack
+		bool middle = 2 * i == u->copies - 1 || 2 * i == u->copies || 2 * i + 2 == u->copies;
+		u->gain[i] = middle ? 1.f : u->spread;
+		sum += u->gain[i];
+		if (i >= before) {
+			u->pos[i] = rng ? rng_float(rng) : 0.f;
+		}
+	}
+	for (int i = 0; i < u->copies; i++) {
+		u->gain[i] /= sum;
+	}
+}
+
+void unison_seed(struct unison* u, struct rng* rng)
+{
+	for (int i = 0; i < u->copies; i++) {
+		u->pos[i] = rng_float(rng);
+	}
+}
+
+#ifdef SIMD
+
+// the wave at phase p, per lane; mirrors osc_set_output()
+static inline vf shape(int wave_type, vf p, float pw)
+{
+	vf one = vf_set(1.f);
+	vf minus_one = vf_set(-1.f);
+	switch (wave_type) {
+	case WAVE_TYPE_TRIANGLE: {
+		vf p4 = vf_mul(p, vf_set(4.f));
+		return vf_lt_select(p, vf_set(0.5f), vf_sub(p4, one), vf_sub(vf_set(3.f), p4));
+	}
+	case WAVE_TYPE_SAW_UP:
+		return vf_sub(vf_add(p, p), one);
+	case WAVE_TYPE_SAW_DOWN:
+		return vf_sub(one, vf_add(p, p));
+	case WAVE_TYPE_SQUARE:
+		return vf_lt_select(p, vf_set(0.5f + pw), one, minus_one);
+	case WAVE_TYPE_PULSE12:
+		return vf_lt_select(p, vf_set(0.125f + pw), one, minus_one);
+	case WAVE_TYPE_PULSE25:
+		return vf_lt_select(p, vf_set(0.25f + pw), one, minus_one);
+	}
+	return vf_set(0.f);
+}
+
+float unison_render(struct unison* u, int wave_type, float step, float pw)
+{
+	const vf s = vf_set(step);
+	vf sum = vf_set(0.f);
+	for (int i = 0; i < u->lanes; i += SIMD_LANES) {
+		vf p = vf_add(vf_load(&u->pos[i]), vf_mul(vf_load(&u->ratio[i]), s));
+		// wrap into 0 .. 1, as fmod() would
+		p = vf_sub(p, vi_to_float(vf_to_int(p)));
+		vf_store(&u->pos[i], p);
+		if (wave_type == WAVE_TYPE_SINE) {
+			// the sine table can't be looked up lane by lane
+			float out[SIMD_LANES];
+			fast_sin_turns_block(out, &u->pos[i], SIMD_LANES);
+			sum = vf_add(sum, vf_mul(vf_load(out), vf_load(&u->gain[i])));
+		} else {
+			sum = vf_add(sum, vf_mul(shape(wave_type, p, pw), vf_load(&u->gain[i])));
+		}
+	}
+	return vf_sum(sum);
+}
+
+#else
+
+static inline float shape(int wave_type, float p, float pw)
+{
+	switch (wave_type) {
+	case WAVE_TYPE_TRIANGLE:
+		return p < 0.5f ? 4.f * p - 1.f : 3.f - 4.f * p;
+	case WAVE_TYPE_SAW_UP:
+		return 2.f * p - 1.f;
+	case WAVE_TYPE_SAW_DOWN:
+		return 1.f - 2.f * p;
+	case WAVE_TYPE_SINE:
+		return fast_sin_turns(p);
+	case WAVE_TYPE_SQUARE:
+		return p < 0.5f + pw ? 1.f : -1.f;
+	case WAVE_TYPE_PULSE12:
+		return p < 0.125f + pw ? 1.f : -1.f;
+	case WAVE_TYPE_PULSE25:
+		return p < 0.25f + pw ? 1.f : -1.f;
+	}
+	return 0.f;
+}
+
+float unison_render(struct unison* u, int wave_type, float step, float pw)
+{
+	float sum = 0.f;
+	for (int i = 0; i < u->copies; i++) {
+		float p = u->pos[i] + u->ratio[i] * step;
+		p -= (int)p;
+		u->pos[i] = p;
+		sum += shape(wave_type, p, pw) * u->gain[i];
+	}
+	return sum;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include "rng.h"
+
+// Unison: an oscillator played as a stack of detuned copies of itself, the
+// supersaw sound. The copies are rendered side by side in SIMD lanes, so an
+// eight copy stack costs two vector oscillators rather than eight scalar
+// ones.
+//
+// The copies are spread evenly in pitch, detune cents either side of the
+// oscillator's own pitch. The one or two nearest the middle play at full
+// level, the rest at spread (0 to 1); the output is mono, so spread sets
+// how much of the stack's width is heard rather than where it sits. Levels
+// are scaled to sum to 1, so a stack peaks no higher than a single copy.
+#define UNISON_MAX 8
+
+#define UNISON_DETUNE_DEFAULT 10.f // cents
+#define UNISON_DETUNE_MAX 1200.f // an octave
+#define UNISON_SPREAD_DEFAULT 1.f
+
+struct unison {
+	int copies; // 0 or 1 for none
+	int lanes; // copies, rounded up to whole vectors
+	float detune; // cents from the middle to the outermost copy
+	float spread;
+
+	// per copy, worked out by unison_setup(); lanes past copies have a
+	// ratio and gain of 0, so they stand still and add nothing
+	float ratio[UNISON_MAX]; // of the oscillator's frequency
+	float gain[UNISON_MAX];
+
+	float pos[UNISON_MAX]; // each copy's phase, 0 to 1
+};
+
+// works out ratio and gain from copies, detune and spread; call after
+// changing any of them. Copies that weren't sounding before start from a
+// random phase drawn from rng, or from 0 if rng is NULL.
+void unison_setup(struct unison* u, struct rng* rng);
+
+// starts every copy from a random phase, so no two notes stack up the same
+void unison_seed(struct unison* u, struct rng* rng);
+
+// advances every copy by step cycles (times its ratio) and returns their
+// sum; wave_type is one of the periodic WAVE_TYPE_*s, and pw is added to the
+// pulse width of square and pulse waves
+float unison_render(struct unison* u, int wave_type, float step, float pw);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,311 @@
+#include "wavetable.h"
+#include "synth.h"
+
+#ifdef __circle__
+#include <circle/util.h>
+#else
+#include <string.h>
+#endif
+
+#include <math.h>
+#include <stdint.h>
+
+static struct arena* table_arena;
+static struct wavetable tables[WAVETABLE_MAX];
+static int num_tables;
+
+// scratch for building one frame; tables are only ever built by the thread
+// loading patches
+#define FFT_MAX WAVETABLE_MAX_FRAME_SIZE
+static float fft_re[FFT_MAX];
+static float fft_im[FFT_MAX];
+static float frame_buf[FFT_MAX];
+static float harm_re[WAVETABLE_HARMONICS + 1];
+static float harm_im[WAVETABLE_HARMONICS + 1];
+
+void wavetable_init(struct arena* arena)
+{
+	table_arena = arena;
+	num_tables = 0;
+}
+
+// in-place radix-2 FFT of n (a power of two) points; sign is -1 for the
+// forward transform and 1 for the inverse, which isn't scaled
+static void fft(float* re, float* im, int n, int sign)
+{
+	for (int i = 1, j = 0; i < n; i++) {
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1) {
+			j ^= bit;
+		}
+		j |= bit;
+		if (i < j) {
+			float t = re[i];
+			re[i] = re[j];
+			re[j] = t;
+			t = im[i];
+			im[i] = im[j];
+			im[j] = t;
+		}
+	}
+	for (int m = 2; m <= n; m <<= 1) {
+		// twiddles by recurrence, in double so 8192 points stay accurate
+		double a = sign * 2.0 * 3.14159265358979323846 / m;
+		double wr_m = cos(a);
+		double wi_m = sin(a);
+		double wr = 1.0;
+		double wi = 0.0;
+		for (int k = 0; k < m / 2; k++) {
+			for (int i = k; i < n; i += m) {
+				int j = i + m / 2;
+				float tr = wr * re[j] - wi * im[j];
+				float ti = wr * im[j] + wi * re[j];
+				re[j] = re[i] - tr;
+				im[j] = im[i] - ti;
+				re[i] += tr;
+				im[i] += ti;
+			}
+			double t = wr * wr_m - wi * wi_m;
+			wi = wr * wi_m + wi * wr_m;
+			wr = t;
+		}
+	}
+}
+
+static uint32_t read_u32(const uint8_t* p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t read_u16(const uint8_t* p)
+{
+	return p[0] | p[1] << 8;
+}
+
+struct wav {
+	const uint8_t* data;
+	size_t samples; // per channel
+	int channels;
+	int bits;
+	bool is_float;
+	int frame_size; // from a clm chunk, or 0
+};
+
+// finds the fmt, data and (if there is one) clm chunks of a RIFF WAVE file
+static const char* parse_wav(const uint8_t* p, size_t len, struct wav* w)
+{
+	if (len < 12 || memcmp(p, "RIFF", 4) != 0 || memcmp(p + 8, "WAVE", 4) != 0) {
+		return "not a WAV file:";
+	}
+	memset(w, 0, sizeof(*w));
+	int format = 0;
+	size_t data_len = 0;
+	for (size_t off = 12; off + 8 <= len;) {
+		const uint8_t* chunk = p + off + 8;
+		size_t n = read_u32(p + off + 4);
+		if (n > len - off - 8) {
+			return "truncated WAV file:";
+		}
+		if (memcmp(p + off, "fmt ", 4) == 0 && n >= 16) {
+			format = read_u16(chunk);
+			w->channels = read_u16(chunk + 2);
+			w->bits = read_u16(chunk + 14);
+			if (format == 0xfffe && n >= 26) {
+				// WAVE_FORMAT_EXTENSIBLE; the real format leads the subformat GUID
+				format = read_u16(chunk + 24);
+			}
+		} else if (memcmp(p + off, "data", 4) == 0) {
+			w->data = chunk;
+			data_len = n;
+		} else if (memcmp(p + off, "clm ", 4) == 0 && n > 3 && memcmp(chunk, "<!>", 3) == 0) {
+			// Serum's frame size, e.g. "<!>2048 ..."
+			for (size_t i = 3; i < n && chunk[i] >= '0' && chunk[i] <= '9' && w->frame_size <= WAVETABLE_MAX_FRAME_SIZE; i++) {
+				w->frame_size = w->frame_size * 10 + (chunk[i] - '0');
+			}
+		}
+		off += 8 + n + (n & 1);
+	}
+	w->is_float = format == 3;
+	if (!((format == 1 && (w->bits == 8 || w->bits == 16 || w->bits == 24 || w->bits == 32))
+	        || (format == 3 && w->bits == 32))
+	    || w->channels < 1) {
+		return "expected 8, 16, 24 or 32 bit PCM or 32 bit float WAV in";
+	}
+	if (w->data == NULL) {
+		return "no samples in";
+	}
+	w->samples = data_len / (w->channels * w->bits / 8);
+	return NULL;
+}
+
+// sample i of the first channel, -1 to 1
+static float wav_sample(const struct wav* w, size_t i)
+{
+	const uint8_t* s = w->data + i * w->channels * (w->bits / 8);
+	switch (w->bits) {
+	case 8:
+		return (s[0] - 128) / 128.f;
+	case 16:
+		return (int16_t)read_u16(s) / 32768.f;
+	case 24:
+		return (int32_t)((uint32_t)s[0] << 8 | (uint32_t)s[1] << 16 | (uint32_t)s[2] << 24) / 2147483648.f;
+	}
+	uint32_t u = read_u32(s);
+	if (w->is_float) {
+		float f;
+		memcpy(&f, &u, sizeof(f));
+		return f;
+	}
+	return (int32_t)u / 2147483648.f;
+}
+
+// the DFT of one frame, resampled to n points, as harmonics 1 to
+// WAVETABLE_HARMONICS in harm_re and harm_im
+static void analyse_frame(const struct wav* w, size_t start, int frame_size, int n)
+{
+	for (int i = 0; i < frame_size; i++) {
+		frame_buf[i] = wav_sample(w, start + i);
+	}
+	for (int i = 0; i < n; i++) {
+		if (n == frame_size) {
+			fft_re[i] = frame_buf[i];
+		} else {
+			// Catmull-Rom, wrapping round the cycle; n is never smaller
+			// than frame_size, so this only ever adds points
+			float x = (float)i * frame_size / n;
+			int k = (int)x;
+			float t = x - k;
+			float y0 = frame_buf[(k + frame_size - 1) % frame_size];
+			float y1 = frame_buf[k];
+			float y2 = frame_buf[(k + 1) % frame_size];
+			float y3 = frame_buf[(k + 2) % frame_size];
+			fft_re[i] = y1 + 0.5f * t * (y2 - y0 + t * (2.f * y0 - 5.f * y1 + 4.f * y2 - y3 + t * (3.f * (y1 - y2) + y3 - y0)));
+		}
+		fft_im[i] = 0.f;
+	}
+	fft(fft_re, fft_im, n, -1);
+	// the DC offset is dropped along with everything past the top harmonic
+	harm_re[0] = 0.f;
+	harm_im[0] = 0.f;
+	for (int k = 1; k <= WAVETABLE_HARMONICS; k++) {
+		harm_re[k] = fft_re[k] / n;
+		harm_im[k] = fft_im[k] / n;
+	}
+}
+
+// writes the first harmonics of the analysed frame as len samples, plus the
+// wrap around copy of the first
+static void synthesise_level(float* out, int len, int harmonics)
+{
+	memset(fft_re, 0, sizeof(float) * len);
+	memset(fft_im, 0, sizeof(float) * len);
+	for (int k = 1; k <= harmonics; k++) {
+		fft_re[k] = harm_re[k];
+		fft_im[k] = harm_im[k];
+		fft_re[len - k] = harm_re[k];
+		fft_im[len - k] = -harm_im[k];
+	}
+	fft(fft_re, fft_im, len, 1);
+	memcpy(out, fft_re, sizeof(float) * len);
+	out[len] = out[0];
+}
+
+static const char* build(struct wavetable* t, const void* data, size_t len)
+{
+	struct wav w;
+	const char* err = parse_wav(data, len, &w);
+	if (err) {
+		return err;
+	}
+	int frame_size = w.frame_size;
+	if (frame_size == 0) {
+		bool whole_frames = w.samples > WAVETABLE_FRAME_DEFAULT && w.samples % WAVETABLE_FRAME_DEFAULT == 0;
+		frame_size = whole_frames ? WAVETABLE_FRAME_DEFAULT : (int)MIN(w.samples, WAVETABLE_MAX_FRAME_SIZE + 1);
+	}
+	if (frame_size < 2 || frame_size > WAVETABLE_MAX_FRAME_SIZE) {
+		return "expected frames of 2 to 8192 samples in";
+	}
+	size_t frames = w.samples / frame_size;
+	if (frames < 1 || frames > WAVETABLE_MAX_FRAMES) {
+		return "expected 1 to 256 frames in";
+	}
+
+	size_t floats = 0;
+	for (int l = 0; l < WAVETABLE_LEVELS; l++) {
+		t->len[l] = MAX(WAVETABLE_SIZE >> l, WAVETABLE_MIN_LEN);
+		floats += frames * (t->len[l] + 1);
+	}
+	float* mem = arena_alloc(table_arena, sizeof(float) * floats);
+	if (mem == NULL) {
+		return "out of wavetable memory loading";
+	}
+	float* levels[WAVETABLE_LEVELS];
+	levels[0] = mem;
+	for (int l = 1; l < WAVETABLE_LEVELS; l++) {
+		levels[l] = levels[l - 1] + frames * (t->len[l - 1] + 1);
+	}
+
+	// the FFT size: a power of two, with room for every harmonic kept
+	int n = WAVETABLE_SIZE;
+	while (n < frame_size) {
+		n *= 2;
+	}
+	float peak = 0.f;
+	for (size_t f = 0; f < frames; f++) {
+		analyse_frame(&w, f * frame_size, frame_size, n);
+		for (int l = 0; l < WAVETABLE_LEVELS; l++) {
+			float* out = levels[l] + f * (t->len[l] + 1);
+			synthesise_level(out, t->len[l], WAVETABLE_HARMONICS >> l);
+			for (int i = 0; l == 0 && i < t->len[l]; i++) {
+				peak = MAX(peak, fabsf(out[i]));
+			}
+		}
+	}
+	// every frame is scaled alike, so the frames keep their relative levels
+	if (peak > 0.f) {
+		for (size_t i = 0; i < floats; i++) {
+			mem[i] /= peak;
+		}
+	}
+	for (int l = 0; l < WAVETABLE_LEVELS; l++) {
+		t->level[l] = levels[l];
+	}
+	t->frames = frames;
+	t->frame_size = frame_size;
+	return NULL;
+}
+
+const struct wavetable* wavetable_load(const char* name, size_t n, const char** err)
+{
+	if (n == 0 || n >= WAVETABLE_NAME_MAX) {
+		*err = "expected a file name of up to 63 characters but got";
+		return NULL;
+	}
+	for (int i = 0; i < num_tables; i++) {
+		if (strncmp(tables[i].name, name, n) == 0 && tables[i].name[n] == '\0') {
+			return &tables[i];
+		}
+	}
+	if (table_arena == NULL || num_tables == WAVETABLE_MAX) {
+		*err = "too many wavetables to load";
+		return NULL;
+	}
+
+	struct wavetable* t = &tables[num_tables];
+	memset(t, 0, sizeof(*t));
+	memcpy(t->name, name, n);
+	size_t len;
+	const void* data = wavetable_file_open(t->name, &len);
+	if (data == NULL) {
+		*err = "can't read wavetable";
+		return NULL;
+	}
+	*err = build(t, data, len);
+	wavetable_file_close(data, len);
+	if (*err) {
+		return NULL;
+	}
+	// the renderers only find it through a patch compiled after this
+	num_tables++;
+	return t;
+}
@@ -0,0 +1,101 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma once
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "fast_math.h"
+
+// Wavetables: oscillator waves read from WAV files, for timbres the built in
+// shapes can't make. A file holds one cycle, or a run of frames (cycles) of
+// frame_size samples each that the position parameter scans through.
+//
+// Everything expensive happens once, when a patch first names the file: each
+// frame is resampled to WAVETABLE_SIZE samples, and its spectrum is cut into
+// WAVETABLE_LEVELS band-limited copies (mip levels), each with half the
+// harmonics of the one before. The renderer picks the level whose harmonics
+// all sit below Nyquist at the note's pitch, so high notes don't alias, and
+// reads it with two linear interpolations (in the frame, and between frames);
+// a rich wavetable costs no more than a sine.
+//
+// Tables are cached by name and never freed; reloading a patch that names a
+// table already loaded reuses it.
+
+#define WAVETABLE_SIZE 2048 // samples in a frame at level 0
+#define WAVETABLE_HARMONICS 512 // kept at level 0; WAVETABLE_SIZE / 4, so interpolation stays clean
+#define WAVETABLE_LEVELS 10 // down to a single harmonic
+#define WAVETABLE_MIN_LEN 64 // levels are never shorter than this
+#define WAVETABLE_MAX_FRAMES 256
+#define WAVETABLE_MAX_FRAME_SIZE 8192 // in the file
+#define WAVETABLE_MAX 16 // tables loaded at once
+#define WAVETABLE_NAME_MAX 64
+
+// frame size for files that don't say (the one most wavetable editors use)
+#define WAVETABLE_FRAME_DEFAULT 2048
+
+struct wavetable {
+	char name[WAVETABLE_NAME_MAX]; // as the patch named it
+	int frames;
+	int frame_size; // in the file
+
+	// level l holds every frame in turn, each len[l] samples plus a copy of
+	// the first, so interpolation never wraps
+	int len[WAVETABLE_LEVELS];
+	const float* level[WAVETABLE_LEVELS];
+};
+
+// Supplied by each platform: returns the contents of the named file, with its
+// size in *len, or NULL if it can't be read. On Linux names are relative to
+// the patch file; on the Pi, to the root of the SD card. The contents are
+// only read until wavetable_file_close().
+const void* wavetable_file_open(const char* name, size_t* len);
+void wavetable_file_close(const void* data, size_t len);
+
+// tables are built in arena; size it for every table a session may load
+void wavetable_init(struct arena* arena);
+
+// Returns the named table, loading it the first time. On failure returns
+// NULL and sets *err to why. Call from whichever thread loads patches; the
+// renderers only ever see tables that are already built.
+const struct wavetable* wavetable_load(const char* name, size_t n, const char** err);
+
+// the wave at phase (0 to 1) and position (0 to 1, first frame to last), for
+// an oscillator advancing step cycles per sample
+static inline float wavetable_lookup(const struct wavetable* t, float phase, float position, float step)
+{
+	// the first level whose top harmonic is below Nyquist: level l keeps
+	// WAVETABLE_HARMONICS >> l, so l = ceil(log2(2 * step * WAVETABLE_HARMONICS))
+	float x = (step < 0.f ? -step : step) * (2 * WAVETABLE_HARMONICS);
+	int l = (int)((fast_math_bits(x) + 0x007fffff) >> 23) - 127;
+	l = l < 0 ? 0 : l;
+	l = l > WAVETABLE_LEVELS - 1 ? WAVETABLE_LEVELS - 1 : l;
+
+	position = position < 0.f ? 0.f : position;
+	position = position > 1.f ? 1.f : position;
+	float f = position * (t->frames - 1);
+	int frame = (int)f;
+	int next = frame + 1 < t->frames ? frame + 1 : frame;
+	f -= frame;
+
+	const int len = t->len[l];
+	float p = phase * len;
+	int i = (int)p;
+	if (i < 0 || i >= len) {
+		i = 0;
+		p = 0.f;
+	} else {
+		p -= i;
+	}
+	const float* a = t->level[l] + frame * (len + 1) + i;
+	const float* b = t->level[l] + next * (len + 1) + i;
+	float sa = a[0] + (a[1] - a[0]) * p;
+	float sb = b[0] + (b[1] - b[0]) * p;
+	return sa + (sb - sa) * f;
+}
+
+#ifdef __cplusplus
+}
+#endif
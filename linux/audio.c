@@ -0,0 +1,53 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "audio.h"
+
+// in order of preference
+static struct audio_backend* backends[] = {
+#ifdef HAVE_PULSE
+	&audio_pulse,
+#endif
+#ifdef HAVE_ALSA
+	&audio_alsa,
+#endif
+	&audio_null,
+};
+
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+struct audio_backend* audio_find_backend(const char* name)
+{
+	if (name == NULL) {
+		return backends[0];
+	}
+	for (size_t i = 0; i < NUM_BACKENDS; i++) {
+		if (strcmp(backends[i]->name, name) == 0) {
+			return backends[i];
+		}
+	}
+	return NULL;
+}
+
+void audio_list_backends(void)
+{
+	for (size_t i = 0; i < NUM_BACKENDS; i++) {
+		fprintf(stderr, "%s%s", i ? ", " : "", backends[i]->name);
+	}
+	fprintf(stderr, "\n");
+}
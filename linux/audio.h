@@ -0,0 +1,60 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Called from the backend's audio thread whenever the device wants more
+// samples; it must write exactly `frames` mono s16 samples to `out`.
+typedef void (*audio_fill_fn)(void* user, int16_t* out, size_t frames);
+
+struct audio_config {
+	unsigned rate;
+	unsigned period_frames; // alsa period size; pulse minreq
+	unsigned buffer_frames; // alsa buffer size; pulse tlength
+	const char* device; // alsa device name, or output wav path for the null backend
+
+	// for the thread that calls fill, see rt.h
+	int rt_priority; // SCHED_FIFO priority, or 0 to leave it alone
+	int cpu; // the one to pin it to, or -1 for any
+};
+
+struct audio_backend {
+	const char* name;
+	int (*start)(struct audio_backend* b, const struct audio_config* cfg, audio_fill_fn fill, void* user);
+	void (*stop)(struct audio_backend* b);
+
+	// returns the number of frames currently queued between the render
+	// engine and the speaker, or -1 if unknown
+	long (*latency_frames)(struct audio_backend* b);
+
+	void* priv;
+};
+
+#ifdef HAVE_PULSE
+extern struct audio_backend audio_pulse;
+#endif
+#ifdef HAVE_ALSA
+extern struct audio_backend audio_alsa;
+#endif
+extern struct audio_backend audio_null;
+
+// returns the named backend, or the first available one if name is NULL
+struct audio_backend* audio_find_backend(const char* name);
+
+void audio_list_backends(void);
@@ -0,0 +1,167 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifdef HAVE_ALSA
+
+#include <alsa/asoundlib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio.h"
+#include "rt.h"
+
+struct alsa_priv {
+	audio_fill_fn fill;
+	void* user;
+	int rt_priority;
+	int cpu;
+
+	snd_pcm_t* pcm;
+	snd_pcm_uframes_t period;
+	int16_t* buf;
+
+	pthread_t thread;
+	volatile bool stop;
+	unsigned xruns;
+};
+
+static struct alsa_priv alsa_priv;
+
+static void* alsa_thread(void* arg)
+{
+	struct alsa_priv* p = arg;
+	rt_thread("alsa", p->rt_priority, p->cpu);
+	while (!p->stop) {
+		p->fill(p->user, p->buf, p->period);
+
+		snd_pcm_uframes_t done = 0;
+		while (done < p->period && !p->stop) {
+			snd_pcm_sframes_t n = snd_pcm_writei(p->pcm, p->buf + done, p->period - done);
+			if (n == -EAGAIN) {
+				continue;
+			}
+			if (n < 0) {
+				if (n == -EPIPE) {
+					p->xruns++;
+					fprintf(stderr, "alsa: underrun %u\n", p->xruns);
+				}
+				if (snd_pcm_recover(p->pcm, n, 1) < 0) {
+					fprintf(stderr, "alsa: write failed: %s\n", snd_strerror(n));
+					return NULL;
+				}
+				continue;
+			}
+			done += n;
+		}
+	}
+	return NULL;
+}
+
+static int alsa_start(struct audio_backend* b, const struct audio_config* cfg, audio_fill_fn fill, void* user)
+{
+	struct alsa_priv* p = b->priv;
+	memset(p, 0, sizeof(struct alsa_priv));
+	p->fill = fill;
+	p->user = user;
+	p->rt_priority = cfg->rt_priority;
+	p->cpu = cfg->cpu;
+
+	const char* device = cfg->device ? cfg->device : "default";
+	int err = snd_pcm_open(&p->pcm, device, SND_PCM_STREAM_PLAYBACK, 0);
+	if (err < 0) {
+		fprintf(stderr, "alsa: failed to open %s: %s\n", device, snd_strerror(err));
+		return 1;
+	}
+
+	snd_pcm_hw_params_t* hw;
+	snd_pcm_hw_params_alloca(&hw);
+	snd_pcm_hw_params_any(p->pcm, hw);
+	snd_pcm_hw_params_set_access(p->pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED);
+	snd_pcm_hw_params_set_format(p->pcm, hw, SND_PCM_FORMAT_S16_LE);
+	snd_pcm_hw_params_set_channels(p->pcm, hw, 1);
+	unsigned rate = cfg->rate;
+	snd_pcm_hw_params_set_rate_near(p->pcm, hw, &rate, NULL);
+	snd_pcm_uframes_t period = cfg->period_frames;
+	snd_pcm_hw_params_set_period_size_near(p->pcm, hw, &period, NULL);
+	snd_pcm_uframes_t buffer = cfg->buffer_frames;
+	snd_pcm_hw_params_set_buffer_size_near(p->pcm, hw, &buffer);
+	err = snd_pcm_hw_params(p->pcm, hw);
+	if (err < 0) {
+		fprintf(stderr, "alsa: failed to set hw params: %s\n", snd_strerror(err));
+		snd_pcm_close(p->pcm);
+		return 1;
+	}
+	if (rate != cfg->rate) {
+		fprintf(stderr, "alsa: wanted %u Hz but got %u Hz\n", cfg->rate, rate);
+	}
+
+	snd_pcm_sw_params_t* sw;
+	snd_pcm_sw_params_alloca(&sw);
+	snd_pcm_sw_params_current(p->pcm, sw);
+	snd_pcm_sw_params_set_avail_min(p->pcm, sw, period);
+	snd_pcm_sw_params_set_start_threshold(p->pcm, sw, period);
+	snd_pcm_sw_params(p->pcm, sw);
+
+	fprintf(stderr, "alsa: period=%lu buffer=%lu frames\n", (unsigned long)period, (unsigned long)buffer);
+
+	p->period = period;
+	p->buf = malloc(sizeof(int16_t) * period);
+	if (p->buf == NULL) {
+		snd_pcm_close(p->pcm);
+		return 1;
+	}
+
+	if (pthread_create(&p->thread, NULL, alsa_thread, p) != 0) {
+		fprintf(stderr, "alsa: unable to create thread\n");
+		free(p->buf);
+		p->buf = NULL;
+		snd_pcm_close(p->pcm);
+		return 1;
+	}
+	return 0;
+}
+
+static void alsa_stop(struct audio_backend* b)
+{
+	struct alsa_priv* p = b->priv;
+	p->stop = true;
+	pthread_join(p->thread, NULL);
+	snd_pcm_drain(p->pcm);
+	snd_pcm_close(p->pcm);
+	free(p->buf);
+	p->buf = NULL;
+}
+
+static long alsa_latency_frames(struct audio_backend* b)
+{
+	struct alsa_priv* p = b->priv;
+	snd_pcm_sframes_t delay;
+	if (snd_pcm_delay(p->pcm, &delay) < 0) {
+		return -1;
+	}
+	return delay;
+}
+
+struct audio_backend audio_alsa = {
+	.name = "alsa",
+	.start = alsa_start,
+	.stop = alsa_stop,
+	.latency_frames = alsa_latency_frames,
+	.priv = &alsa_priv,
+};
+
+#endif
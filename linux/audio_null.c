@@ -0,0 +1,208 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// The null backend has no device; it pretends to be a sound card with a
+// buffer_frames sized ring that drains at exactly cfg->rate, so the engine is
+// driven by the same clock it would be on real hardware. If a path is given,
+// everything rendered is also written to a wav file.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio.h"
+#include "rt.h"
+
+struct wav_header {
+	char riff[4]; /* "RIFF"                                  */
+	int32_t flength; /* file length in bytes                    */
+	char wave[4]; /* "WAVE"                                  */
+	char fmt[4]; /* "fmt "                                  */
+	int32_t chunk_size; /* size of FMT chunk in bytes (usually 16) */
+	int16_t format_tag; /* 1=PCM, 257=Mu-Law, 258=A-Law, 259=ADPCM */
+	int16_t num_chans; /* 1=mono, 2=stereo                        */
+	int32_t srate; /* Sampling rate in samples per second     */
+	int32_t bytes_per_sec; /* bytes per second = srate*bytes_per_samp */
+	int16_t bytes_per_samp; /* 2=16-bit mono, 4=16-bit stereo          */
+	int16_t bits_per_samp; /* Number of bits per sample               */
+	char data[4]; /* "data"                                  */
+	int32_t dlength; /* data length in bytes (filelength - 44)  */
+};
+
+struct null_priv {
+	struct audio_config cfg;
+	audio_fill_fn fill;
+	void* user;
+
+	FILE* wave_fp;
+	int16_t* buf;
+
+	pthread_t thread;
+	struct timespec start;
+	volatile bool stop;
+	uint64_t rendered;
+	uint64_t written;
+};
+
+static struct null_priv null_priv;
+
+static void write_wav_header(FILE* fp, int32_t sample_rate, int32_t data_length)
+{
+	struct wav_header wavh;
+	memcpy(wavh.riff, "RIFF", 4);
+	memcpy(wavh.wave, "WAVE", 4);
+	memcpy(wavh.fmt, "fmt ", 4);
+	memcpy(wavh.data, "data", 4);
+
+	wavh.chunk_size = 16;
+	wavh.format_tag = 1;
+	wavh.num_chans = 1;
+	wavh.srate = sample_rate;
+	wavh.bits_per_samp = 16;
+	wavh.bytes_per_sec = wavh.srate * wavh.bits_per_samp / 8 * wavh.num_chans;
+	wavh.bytes_per_samp = wavh.bits_per_samp / 8 * wavh.num_chans;
+	wavh.dlength = data_length;
+	wavh.flength = data_length + sizeof(struct wav_header) - 8;
+
+	fseek(fp, 0, SEEK_SET);
+	fwrite(&wavh, 1, sizeof(struct wav_header), fp);
+}
+
+static uint64_t frames_played(struct null_priv* p)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t ns = (now.tv_sec - p->start.tv_sec) * 1000000000ull + now.tv_nsec - p->start.tv_nsec;
+	return ns * p->cfg.rate / 1000000000ull;
+}
+
+static void* null_thread(void* arg)
+{
+	struct null_priv* p = arg;
+	const unsigned period = p->cfg.period_frames;
+	const unsigned buffer = p->cfg.buffer_frames;
+	rt_thread("null", p->cfg.rt_priority, p->cfg.cpu);
+
+	while (!p->stop) {
+		uint64_t rendered = __atomic_load_n(&p->rendered, __ATOMIC_RELAXED);
+		uint64_t played = frames_played(p);
+		if (played > rendered) {
+			// we fell behind the clock; a real device would have underrun here
+			fprintf(stderr, "null: underrun of %lu frames\n", (unsigned long)(played - rendered));
+			rendered = played;
+		}
+
+		if (rendered + period - played <= buffer) {
+			p->fill(p->user, p->buf, period);
+			if (p->wave_fp) {
+				fwrite(p->buf, sizeof(int16_t), period, p->wave_fp);
+			}
+			p->written += period;
+			__atomic_store_n(&p->rendered, rendered + period, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		// sleep until there is room for another period
+		uint64_t wake_frame = rendered + period - buffer;
+		uint64_t ns = wake_frame * 1000000000ull / p->cfg.rate;
+		struct timespec wake = p->start;
+		wake.tv_sec += ns / 1000000000ull;
+		wake.tv_nsec += ns % 1000000000ull;
+		if (wake.tv_nsec >= 1000000000) {
+			wake.tv_sec++;
+			wake.tv_nsec -= 1000000000;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+	}
+	return NULL;
+}
+
+static int null_start(struct audio_backend* b, const struct audio_config* cfg, audio_fill_fn fill, void* user)
+{
+	struct null_priv* p = b->priv;
+	memset(p, 0, sizeof(struct null_priv));
+	p->cfg = *cfg;
+	p->fill = fill;
+	p->user = user;
+	if (p->cfg.buffer_frames < p->cfg.period_frames) {
+		p->cfg.buffer_frames = p->cfg.period_frames;
+	}
+
+	p->buf = malloc(sizeof(int16_t) * p->cfg.period_frames);
+	if (p->buf == NULL) {
+		return 1;
+	}
+
+	if (cfg->device) {
+		p->wave_fp = fopen(cfg->device, "wb");
+		if (p->wave_fp == NULL) {
+			fprintf(stderr, "null: failed to open %s\n", cfg->device);
+			free(p->buf);
+			return 1;
+		}
+		write_wav_header(p->wave_fp, cfg->rate, 0);
+	}
+
+	// like a real device, fill the buffer before the clock starts running;
+	// the clock is then set once, before the thread (and latency_frames)
+	// can read it
+	while (p->rendered + p->cfg.period_frames <= p->cfg.buffer_frames) {
+		p->fill(p->user, p->buf, p->cfg.period_frames);
+		if (p->wave_fp) {
+			fwrite(p->buf, sizeof(int16_t), p->cfg.period_frames, p->wave_fp);
+		}
+		p->written += p->cfg.period_frames;
+		p->rendered += p->cfg.period_frames;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &p->start);
+	if (pthread_create(&p->thread, NULL, null_thread, p) != 0) {
+		fprintf(stderr, "null: unable to create thread\n");
+		return 1;
+	}
+	return 0;
+}
+
+static void null_stop(struct audio_backend* b)
+{
+	struct null_priv* p = b->priv;
+	p->stop = true;
+	pthread_join(p->thread, NULL);
+
+	if (p->wave_fp) {
+		write_wav_header(p->wave_fp, p->cfg.rate, p->written * sizeof(int16_t));
+		fclose(p->wave_fp);
+		p->wave_fp = NULL;
+	}
+	free(p->buf);
+	p->buf = NULL;
+}
+
+static long null_latency_frames(struct audio_backend* b)
+{
+	struct null_priv* p = b->priv;
+	uint64_t rendered = __atomic_load_n(&p->rendered, __ATOMIC_RELAXED);
+	uint64_t played = frames_played(p);
+	return played > rendered ? 0 : (long)(rendered - played);
+}
+
+struct audio_backend audio_null = {
+	.name = "null",
+	.start = null_start,
+	.stop = null_stop,
+	.latency_frames = null_latency_frames,
+	.priv = &null_priv,
+};
@@ -0,0 +1,236 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifdef HAVE_PULSE
+
+#include <pulse/error.h>
+#include <pulse/pulseaudio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "audio.h"
+#include "rt.h"
+
+struct pulse_priv {
+	audio_fill_fn fill;
+	void* user;
+	int rt_priority;
+	int cpu;
+	bool rt_done; // rt_thread() has been called on the mainloop thread
+
+	pa_threaded_mainloop* mainloop;
+	pa_context* context;
+	pa_stream* stream;
+};
+
+static struct pulse_priv pulse_priv;
+
+static void context_state_cb(pa_context* c, void* userdata)
+{
+	struct pulse_priv* p = userdata;
+	switch (pa_context_get_state(c)) {
+	case PA_CONTEXT_READY:
+	case PA_CONTEXT_FAILED:
+	case PA_CONTEXT_TERMINATED:
+		pa_threaded_mainloop_signal(p->mainloop, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+static void stream_state_cb(pa_stream* s, void* userdata)
+{
+	struct pulse_priv* p = userdata;
+	switch (pa_stream_get_state(s)) {
+	case PA_STREAM_READY:
+	case PA_STREAM_FAILED:
+	case PA_STREAM_TERMINATED:
+		pa_threaded_mainloop_signal(p->mainloop, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+// runs on the pulse mainloop thread; render exactly what the server asked for
+static void stream_write_cb(pa_stream* s, size_t nbytes, void* userdata)
+{
+	struct pulse_priv* p = userdata;
+	if (!p->rt_done) {
+		// the mainloop thread is pulse's, so this is the first chance
+		rt_thread("pulse", p->rt_priority, p->cpu);
+		p->rt_done = true;
+	}
+	while (nbytes > 0) {
+		void* data;
+		size_t n = nbytes;
+		if (pa_stream_begin_write(s, &data, &n) < 0 || n == 0) {
+			return;
+		}
+		n -= n % sizeof(int16_t);
+		p->fill(p->user, data, n / sizeof(int16_t));
+		pa_stream_write(s, data, n, NULL, 0, PA_SEEK_RELATIVE);
+		nbytes -= n;
+	}
+}
+
+static void stream_underflow_cb(pa_stream* s, void* userdata)
+{
+	fprintf(stderr, "pulse: underflow\n");
+}
+
+// tears down whatever pulse_start got as far as creating
+static void pulse_free(struct pulse_priv* p)
+{
+	pa_threaded_mainloop_lock(p->mainloop);
+	if (p->stream) {
+		pa_stream_disconnect(p->stream);
+		pa_stream_unref(p->stream);
+		p->stream = NULL;
+	}
+	if (p->context) {
+		pa_context_disconnect(p->context);
+	}
+	pa_threaded_mainloop_unlock(p->mainloop);
+	pa_threaded_mainloop_stop(p->mainloop);
+	if (p->context) {
+		pa_context_unref(p->context);
+		p->context = NULL;
+	}
+	pa_threaded_mainloop_free(p->mainloop);
+	p->mainloop = NULL;
+}
+
+static int pulse_start(struct audio_backend* b, const struct audio_config* cfg, audio_fill_fn fill, void* user)
+{
+	struct pulse_priv* p = b->priv;
+	memset(p, 0, sizeof(struct pulse_priv));
+	p->fill = fill;
+	p->user = user;
+	p->rt_priority = cfg->rt_priority;
+	p->cpu = cfg->cpu;
+
+	p->mainloop = pa_threaded_mainloop_new();
+	if (p->mainloop == NULL) {
+		return 1;
+	}
+	p->context = pa_context_new(pa_threaded_mainloop_get_api(p->mainloop), "synthtestbed");
+	if (p->context == NULL) {
+		fprintf(stderr, "pulse: failed to create context\n");
+		pa_threaded_mainloop_free(p->mainloop);
+		p->mainloop = NULL;
+		return 1;
+	}
+	pa_context_set_state_callback(p->context, context_state_cb, p);
+
+	pa_threaded_mainloop_lock(p->mainloop);
+	if (pa_threaded_mainloop_start(p->mainloop) < 0) {
+		goto fail;
+	}
+	if (pa_context_connect(p->context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0) {
+		goto fail;
+	}
+	for (;;) {
+		pa_context_state_t state = pa_context_get_state(p->context);
+		if (state == PA_CONTEXT_READY) {
+			break;
+		}
+		if (!PA_CONTEXT_IS_GOOD(state)) {
+			goto fail;
+		}
+		pa_threaded_mainloop_wait(p->mainloop);
+	}
+
+	const pa_sample_spec ss = {
+		.format = PA_SAMPLE_S16LE, .rate = cfg->rate, .channels = 1
+	};
+	p->stream = pa_stream_new(p->context, "playback", &ss, NULL);
+	if (p->stream == NULL) {
+		goto fail;
+	}
+	pa_stream_set_state_callback(p->stream, stream_state_cb, p);
+	pa_stream_set_write_callback(p->stream, stream_write_cb, p);
+	pa_stream_set_underflow_callback(p->stream, stream_underflow_cb, p);
+
+	// tlength is the total amount the server keeps queued; minreq is how
+	// small a request it is allowed to make of us
+	pa_buffer_attr attr;
+	attr.maxlength = (uint32_t)-1;
+	attr.tlength = cfg->buffer_frames * sizeof(int16_t);
+	attr.prebuf = (uint32_t)-1;
+	attr.minreq = cfg->period_frames * sizeof(int16_t);
+	attr.fragsize = (uint32_t)-1;
+
+	pa_stream_flags_t flags = PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE;
+	if (pa_stream_connect_playback(p->stream, NULL, &attr, flags, NULL, NULL) < 0) {
+		goto fail;
+	}
+	for (;;) {
+		pa_stream_state_t state = pa_stream_get_state(p->stream);
+		if (state == PA_STREAM_READY) {
+			break;
+		}
+		if (!PA_STREAM_IS_GOOD(state)) {
+			goto fail;
+		}
+		pa_threaded_mainloop_wait(p->mainloop);
+	}
+
+	const pa_buffer_attr* got = pa_stream_get_buffer_attr(p->stream);
+	if (got) {
+		fprintf(stderr, "pulse: tlength=%u minreq=%u frames\n",
+		    got->tlength / (unsigned)sizeof(int16_t), got->minreq / (unsigned)sizeof(int16_t));
+	}
+	pa_threaded_mainloop_unlock(p->mainloop);
+	return 0;
+
+fail:
+	fprintf(stderr, "pulse: %s\n", pa_strerror(pa_context_errno(p->context)));
+	pa_threaded_mainloop_unlock(p->mainloop);
+	pulse_free(p);
+	return 1;
+}
+
+static void pulse_stop(struct audio_backend* b)
+{
+	pulse_free(b->priv);
+}
+
+static long pulse_latency_frames(struct audio_backend* b)
+{
+	struct pulse_priv* p = b->priv;
+	pa_usec_t usec;
+	int negative;
+	long frames = -1;
+
+	pa_threaded_mainloop_lock(p->mainloop);
+	if (pa_stream_get_latency(p->stream, &usec, &negative) == 0) {
+		const pa_sample_spec* ss = pa_stream_get_sample_spec(p->stream);
+		frames = negative ? 0 : (long)(usec * ss->rate / 1000000);
+	}
+	pa_threaded_mainloop_unlock(p->mainloop);
+	return frames;
+}
+
+struct audio_backend audio_pulse = {
+	.name = "pulse",
+	.start = pulse_start,
+	.stop = pulse_stop,
+	.latency_frames = pulse_latency_frames,
+	.priv = &pulse_priv,
+};
+
+#endif
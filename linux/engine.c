@@ -0,0 +1,628 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../common/arena.h"
+#include "../common/capture.h"
+#include "../common/controls.h"
+#include "../common/filter.h"
+#include "../common/fx.h"
+#include "../common/midi.h"
+#include "../common/note_queue.h"
+#include "../common/parts.h"
+#include "../common/patch_bin.h"
+#include "../common/synth.h"
+#include "../common/trace.h"
+#include "../common/wavetable.h"
+#include "engine.h"
+#include "wavetable_file.h"
+
+// the largest block render_block() takes; a replay renders in the blocks
+// the Pi used
+#define ENGINE_MAX_BLOCK 1024
+
+static struct key* keys;
+static const char* patch_file;
+static unsigned rate = RATE; // a replay runs at the rate it was captured at
+
+// all the voices and the effects' delay lines, allocated once by engine_init
+static struct arena arena;
+static unsigned char arena_mem[ARENA_SIZE(sizeof(struct key) * MAX_KEYS) + MAX_KEYS * SYNTH_OSC_ARENA_BYTES + FX_ARENA_BYTES]
+    __attribute__((aligned(CACHE_LINE)));
+
+// every wavetable a patch has named; left alone by alloc_engine(), so a
+// replay at another rate keeps them
+#define WAVETABLE_ARENA_BYTES (64 << 20)
+static struct arena wavetable_arena;
+static unsigned char wavetable_mem[WAVETABLE_ARENA_BYTES] __attribute__((aligned(CACHE_LINE)));
+
+// the audio thread renders each part from one of its two slots;
+// engine_reload() compiles into the other one of the first part's and
+// publishes it through pending, which the audio thread picks up at the start
+// of its next block. Only a replay has more than the one part.
+static struct patch patches[MAX_PARTS][2];
+static struct patch* pending = NULL;
+static struct parts parts;
+static struct control_snapshot snaps[MAX_PARTS]; // the audio thread's copies
+static struct filter_bank filters;
+static struct fx_state fx;
+// a key pressed at time 0 is one that never was, so the live clock starts a
+// sample in; a replay's starts where the Pi's did
+static unsigned long tick = 1;
+
+// written by the UI thread, taken by the audio thread once per block
+static char pending_key = '\0';
+
+static float get_freq(const char c)
+{
+	switch (c) {
+	case 'z':
+		return 261.626;
+	case 'x':
+		return 277.183;
+	case 'c':
+		return 293.665;
+	case 'v':
+		return 311.127;
+	case 'b':
+		return 329.628;
+	case 'n':
+		return 349.228;
+	case 'm':
+		return 369.994;
+	case ',':
+		return 391.995;
+	case '.':
+		return 415.305;
+	case '/':
+		return 440.000;
+	default:
+		return 0.0f;
+	}
+}
+
+static int read_file_into_new_string(const char* path, char** buf, size_t* len)
+{
+	long length;
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "failed to read %s\n", path);
+		return 1;
+	}
+
+	fseek(f, 0, SEEK_END);
+	length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	*buf = malloc(length + 1);
+	if (*buf == NULL) {
+		fprintf(stderr, "failed to read %s: OOM\n", path);
+		fclose(f);
+		return 1;
+	}
+	if (fread(*buf, 1, length, f) != (size_t)length) {
+		fprintf(stderr, "failed to read %s\n", path);
+		fclose(f);
+		return 1;
+	}
+	(*buf)[length] = '\0';
+	*len = length;
+	fclose(f);
+	return 0;
+}
+
+static int load_patch_file(const char* patch_path, struct patch* patch)
+{
+	char* patch_contents = NULL;
+	size_t patch_len = 0;
+	if (read_file_into_new_string(patch_path, &patch_contents, &patch_len)) {
+		return 1;
+	}
+
+	wavetable_file_dir(patch_path);
+	int err;
+	if (patch_bin_detect(patch_contents, patch_len)) {
+		err = patch_bin_load(patch_contents, patch_len, patch);
+	} else {
+		err = patch_compile(patch_contents, patch_len, patch);
+	}
+	if (err) {
+		fprintf(stderr, "failed to load %s: %s\n", patch_path, load_patch_err());
+		free(patch_contents);
+		return 1;
+	}
+	free(patch_contents);
+	return 0;
+}
+
+// (re)allocates the voices and effects for the current rate
+static int alloc_engine(void)
+{
+	arena_init(&arena, arena_mem, sizeof(arena_mem));
+	if (synth_new(&keys, &arena, &arena, 1) != 0 || fx_init(&fx, &arena, rate) != 0) {
+		fprintf(stderr, "engine arena is too small: %zu bytes, needs %zu\n", arena.size, arena.wanted);
+		return 1;
+	}
+	return 0;
+}
+
+int engine_init(const char* patch_path)
+{
+	if (alloc_engine() != 0) {
+		return 1;
+	}
+	arena_init(&wavetable_arena, wavetable_mem, sizeof(wavetable_mem));
+	wavetable_init(&wavetable_arena);
+	patch_file = patch_path;
+	if (load_patch_file(patch_path, &patches[0][0]) != 0) {
+		return 1;
+	}
+	struct part_setup setup;
+	part_setup_default(&setup);
+	parts_init(&parts, &setup, &patches[0][0]);
+	filter_bank_init(&filters);
+	return 0;
+}
+
+// the slot part isn't playing from
+static struct patch* staging_patch(int part)
+{
+	return parts.patch[part] == &patches[part][0] ? &patches[part][1] : &patches[part][0];
+}
+
+int engine_reload(void)
+{
+	TRACE_SCOPE(TRACE_UI, "reload");
+	if (__atomic_load_n(&pending, __ATOMIC_ACQUIRE) != NULL) {
+		fprintf(stderr, "previous reload has not been applied yet\n");
+		return 1;
+	}
+	struct patch* staging = staging_patch(0);
+	if (load_patch_file(patch_file, staging) != 0) {
+		return 1;
+	}
+	__atomic_store_n(&pending, staging, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int engine_save_patch_bin(const char* path)
+{
+	char buf[PATCH_BIN_MAX_SIZE];
+	size_t n = patch_bin_encode(parts.patch[0], buf, sizeof(buf));
+	FILE* f = fopen(path, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "failed to open %s\n", path);
+		return 1;
+	}
+	if (fwrite(buf, 1, n, f) != n) {
+		fprintf(stderr, "failed to write %s\n", path);
+		fclose(f);
+		return 1;
+	}
+	fclose(f);
+	return 0;
+}
+
+void engine_press(char c)
+{
+	__atomic_store_n(&pending_key, c, __ATOMIC_RELEASE);
+}
+
+static void press(float freq, float t, float held)
+{
+	struct key* k = synth_note_on(keys, parts.patch[0], 0, parts.limits, freq, 1.0f, t);
+	k->future_released_at = t + held;
+}
+
+// every voice sounding, each a different note
+static void press_chord(float held)
+{
+	static const char chord[] = "zxcvbnm,./";
+	for (int i = 0; i < MAX_KEYS && chord[i]; i++) {
+		press(get_freq(chord[i]), ((float)tick) / rate, held);
+	}
+}
+
+void engine_chord(float seconds)
+{
+	press_chord(seconds);
+}
+
+static void swap_in(int part, struct patch* p)
+{
+	TRACE_SCOPE(TRACE_RENDER, "swap patch");
+	parts_swap(&parts, keys, part, p, rate);
+}
+
+static void render_block(int16_t* out, size_t frames)
+{
+	const float dt = 1.f / rate;
+	TRACE_SCOPE(TRACE_RENDER, "block");
+
+	struct patch* p = __atomic_load_n(&pending, __ATOMIC_ACQUIRE);
+	if (p != NULL) {
+		swap_in(0, p);
+		__atomic_store_n(&pending, NULL, __ATOMIC_RELEASE);
+	}
+
+	const int num_parts = parts.setup.num_parts;
+	for (int i = 0; i < num_parts; i++) {
+		snaps[i] = *controls_publish(&parts.controls[i], parts.patch[i], rate, frames);
+	}
+	struct params params[MAX_PARTS];
+	float mix[ENGINE_MAX_BLOCK];
+
+	char c = __atomic_exchange_n(&pending_key, '\0', __ATOMIC_ACQUIRE);
+	float freq = get_freq(c);
+	if (freq > 0.f) {
+		press(freq, ((float)tick) / rate, 10.3); // hold for some extra time (only while using computer keyboard)
+	}
+
+	// each part's voices are stepped and rendered together
+	unsigned char voices[MAX_KEYS];
+	int first[MAX_PARTS + 1];
+	parts_group(keys, 0, MAX_KEYS, num_parts, voices, first);
+
+	TRACE_BEGIN_N(TRACE_RENDER, "voices", synth_sounding(keys, 0, MAX_KEYS));
+	for (size_t n = 0; n < frames; n++) {
+		if (n % CONTROL_BLOCK == 0) {
+			for (int i = 0; i < num_parts; i++) {
+				controls_step(&snaps[i], &params[i], keys, voices + first[i], first[i + 1] - first[i]);
+			}
+			filter_bank_update(&filters, keys, 0, MAX_KEYS, rate);
+		}
+		// as on the Pi: a sample's time is taken before the clock moves on
+		float t = ((float)tick) / rate;
+		tick++;
+
+		for (int v = 0; v < MAX_KEYS; v++) {
+			int i = voices[v];
+			struct key* k = &keys[i];
+			if (k->future_released_at != 0.f && k->future_released_at < t) {
+				k->future_released_at = 0.f;
+				k->released_at = t;
+			}
+
+			filters.in[i] = key_render(k, &params[k->part], t, dt);
+		}
+		mix[n] = filter_bank_render(&filters, MAX_KEYS);
+	}
+	TRACE_END(TRACE_RENDER, "voices");
+
+	const float* in = mix;
+	TRACE_BEGIN(TRACE_RENDER, "effects");
+	// the master effects are the first part's
+	fx_process(&fx, &parts.patch[0]->fx, &in, 1, mix, frames);
+	TRACE_END(TRACE_RENDER, "effects");
+
+	for (size_t n = 0; n < frames; n++) {
+		float output = mix[n];
+		if (output > 1.0f) {
+			output = 1.0f;
+		} else if (output < -1.0f) {
+			output = -1.0f;
+		}
+
+		out[n] = output * 32700;
+	}
+}
+
+int engine_bench(int seconds)
+{
+	press_chord(10.3);
+
+	int16_t out[ENGINE_BLOCK];
+	size_t frames = (size_t)seconds * rate;
+	struct timespec start, end;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	for (size_t n = 0; n < frames; n += ENGINE_BLOCK) {
+		render_block(out, ENGINE_BLOCK);
+	}
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	printf("%s: %.1f ns per sample (%d voices), %.2f%% of one core in real time\n",
+	    patch_file, elapsed * 1e9 / frames, MAX_KEYS, elapsed * 100. / seconds);
+	return 0;
+}
+
+// what a replay keeps track of to spot voices misbehaving
+struct replay {
+	const struct capture_header* h;
+	bool note_down[MAX_PARTS][128]; // the keys held down on each part
+	float reported_at[MAX_KEYS]; // pressed_at of the note last reported, so each is reported once
+	int num_anomalies;
+	bool clipping; // only the start of a run of clipped blocks is reported
+	unsigned long clipped_samples;
+	unsigned clipped_blocks;
+};
+
+#define REPLAY_MAX_REPORTED 50
+#define REPLAY_RELEASE_LIMIT 10.f // seconds a released note may take to die away
+
+static void anomaly(struct replay* r, uint32_t sample, const char* fmt, ...)
+{
+	if (r->num_anomalies++ < REPLAY_MAX_REPORTED) {
+		va_list ap;
+		va_start(ap, fmt);
+		printf("  %9.3f s  block %-6u  ", (double)(sample - r->h->start) / rate, (sample - r->h->start) / r->h->block);
+		vprintf(fmt, ap);
+		printf("\n");
+		va_end(ap);
+	}
+}
+
+static int midi_note(float freq)
+{
+	for (int n = 0; n < 128; n++) {
+		if (midi_key_freq[n] == freq) {
+			return n;
+		}
+	}
+	return -1;
+}
+
+static void replay_event(struct replay* r, const struct capture_event* e, struct note_queue* notes, const void* data, size_t len)
+{
+	switch (e->type) {
+	case CAPTURE_MIDI: {
+		int type = e->msg[0] >> 4;
+		int note = e->msg[1] & 0x7f;
+		if (type == MIDI_CC && e->msg[1] == MIDI_CC_VOLUME) {
+			break; // the Pi's master volume; not part of the engine
+		}
+		if (type == MIDI_PROGRAM_CHANGE) {
+			break; // the patch it picked from the bank follows as a CAPTURE_PATCH
+		}
+		for (int i = 0; i < parts.setup.num_parts; i++) {
+			const struct part* part = &parts.setup.parts[i];
+			if (!part_hears(part, e->msg[0]) || note < part->lo || note > part->hi) {
+				continue;
+			}
+			if (type == MIDI_NOTE_ON) {
+				r->note_down[i][note] = (e->msg[2] & 0x7f) > 0;
+			} else if (type == MIDI_NOTE_OFF) {
+				r->note_down[i][note] = false;
+			}
+		}
+		int err = midi_apply(e->msg, notes, &parts);
+		if (err == MIDI_QUEUE_FULL) {
+			anomaly(r, e->sample, "note queue full; dropped note %d", note);
+		} else if (err == MIDI_UNHANDLED) {
+			anomaly(r, e->sample, "unhandled MIDI message %02x %02x %02x", e->msg[0], e->msg[1], e->msg[2]);
+		}
+		break;
+	}
+	case CAPTURE_PATCH: {
+		int part = e->msg[0];
+		if (part >= parts.setup.num_parts) {
+			anomaly(r, e->sample, "patch %u is for part %d, which the capture's setup doesn't have", e->arg, part + 1);
+			break;
+		}
+		size_t patch_len;
+		const void* patch_data = capture_find_patch(data, len, e->arg, &patch_len);
+		struct patch* staging = staging_patch(part);
+		if (patch_data == NULL || patch_bin_load(patch_data, patch_len, staging) != 0) {
+			anomaly(r, e->sample, "patch %u wasn't kept in the capture; playing on with the old one", e->arg);
+			break;
+		}
+		swap_in(part, staging);
+		break;
+	}
+	case CAPTURE_PARAM: {
+		// parameters sent over serial edit the first part
+		float value;
+		memcpy(&value, &e->arg, sizeof(value));
+		if (synth_set_param(parts.patch[0], keys, 0, e->msg[0], e->msg[1], value) != 0) {
+			anomaly(r, e->sample, "invalid parameter %d of osc %d", e->msg[1], e->msg[0]);
+		}
+		break;
+	}
+	}
+}
+
+// looks for voices that are doing something no player asked for
+static void check_voices(struct replay* r, uint32_t sample, const int16_t* out, size_t n)
+{
+	float t = ((float)tick) / rate;
+	for (int i = 0; i < MAX_KEYS; i++) {
+		const struct key* k = &keys[i];
+		if (k->freq <= 0.f || r->reported_at[i] == k->pressed_at) {
+			continue;
+		}
+		int note = midi_note(k->freq);
+		bool held = k->pressed_at > k->released_at;
+		if (held && note >= 0 && !r->note_down[k->part][note]) {
+			anomaly(r, sample, "stuck note: voice %d holds note %d, but its key is up", i, note);
+			r->reported_at[i] = k->pressed_at;
+		} else if (!held && t - k->released_at > REPLAY_RELEASE_LIMIT) {
+			anomaly(r, sample, "voice %d (note %d) is still sounding %.0f s after its release", i, note, REPLAY_RELEASE_LIMIT);
+			r->reported_at[i] = k->pressed_at;
+		}
+	}
+
+	int clipped = 0;
+	for (size_t j = 0; j < n; j++) {
+		clipped += out[j] == 32700 || out[j] == -32700;
+	}
+	if (clipped > 0 && !r->clipping) {
+		anomaly(r, sample, "output starts clipping (%d samples in this block)", clipped);
+	}
+	r->clipping = clipped > 0;
+	r->clipped_samples += clipped;
+	r->clipped_blocks += clipped > 0;
+}
+
+// whether the capture opens by swapping a patch into part
+static bool starts_with_patch(const struct capture_header* h, const struct capture_event* events, int part)
+{
+	for (uint32_t i = 0; i < h->num_events && events[i].sample == h->start; i++) {
+		if (events[i].type == CAPTURE_PATCH && events[i].msg[0] == part) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int compare_double(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int engine_replay(const char* capture_path, int16_t* out, size_t max_samples)
+{
+	char* data = NULL;
+	size_t len = 0;
+	if (read_file_into_new_string(capture_path, &data, &len)) {
+		return 1;
+	}
+	const struct capture_event* events;
+	const struct capture_header* h = capture_parse(data, len, &events);
+	if (h == NULL) {
+		fprintf(stderr, "%s is not a capture\n", capture_path);
+		free(data);
+		return 1;
+	}
+	if (h->block == 0 || h->block > ENGINE_MAX_BLOCK || h->block % CONTROL_BLOCK != 0) {
+		fprintf(stderr, "%s: can't replay blocks of %u samples\n", capture_path, h->block);
+		free(data);
+		return 1;
+	}
+
+	// start from the state the Pi was in, as near as the capture knows it
+	rate = h->sample_rate;
+	if (alloc_engine() != 0) {
+		free(data);
+		return 1;
+	}
+	struct part_setup setup;
+	part_setup_default(&setup);
+	setup.num_parts = h->num_parts;
+	for (int i = 0; i < MAX_PARTS; i++) {
+		setup.parts[i].channel = h->parts[i].channel;
+		setup.parts[i].lo = h->parts[i].lo;
+		setup.parts[i].hi = h->parts[i].hi;
+		setup.parts[i].max_voices = h->parts[i].max_voices;
+		setup.parts[i].priority = h->parts[i].priority;
+	}
+	parts_init(&parts, &setup, &patches[0][0]);
+	for (int i = 0; i < (int)h->num_parts; i++) {
+		size_t patch_len;
+		const void* base = capture_find_patch(data, len, h->base_patch[i], &patch_len);
+		struct patch* staging = staging_patch(i);
+		if (base != NULL && patch_bin_load(base, patch_len, staging) == 0) {
+			parts_swap(&parts, keys, i, staging, rate);
+		} else if (!starts_with_patch(h, events, i)) {
+			fprintf(stderr, "%s: the patch part %d was playing at the start wasn't kept; using %s\n", capture_path, i + 1, patch_file);
+		}
+	}
+	filter_bank_init(&filters);
+	static struct note_queue notes;
+	note_queue_init(&notes);
+	tick = h->start;
+
+	struct replay r;
+	memset(&r, 0, sizeof(r));
+	r.h = h;
+	for (int i = 0; i < MAX_KEYS; i++) {
+		r.reported_at[i] = -1.f;
+	}
+
+	uint32_t num_blocks = (h->end - h->start) / h->block;
+	double* cost = malloc(sizeof(double) * (num_blocks + 1));
+	if (cost == NULL) {
+		fprintf(stderr, "%s: no memory for %u blocks' costs\n", capture_path, num_blocks);
+		free(data);
+		return 1;
+	}
+	int16_t block[ENGINE_MAX_BLOCK];
+	printf("%s: %u events over %.1f s (%u blocks of %u samples at %u Hz)\n", capture_path, h->num_events,
+	    (double)(h->end - h->start) / rate, num_blocks, h->block, h->sample_rate);
+	printf("anomalies:\n");
+
+	uint32_t e = 0;
+	uint32_t worst = 0;
+	for (uint32_t b = 0; b < num_blocks; b++) {
+		uint32_t sample = h->start + b * h->block;
+		// events are stamped with the block they took effect in, and
+		// applied just as FillChunkBuff does on the Pi
+		for (; e < h->num_events && events[e].sample - h->start <= sample - h->start; e++) {
+			replay_event(&r, &events[e], &notes, data, len);
+		}
+		note_queue_apply(&notes, keys, &parts, ((float)tick) / rate);
+
+		double start = now_sec();
+		render_block(block, h->block);
+		cost[b] = now_sec() - start;
+		if (cost[b] > cost[worst]) {
+			worst = b;
+		}
+		check_voices(&r, sample, block, h->block);
+		size_t done = (size_t)b * h->block;
+		if (out != NULL && done < max_samples) {
+			memcpy(out + done, block, sizeof(int16_t) * MIN(h->block, max_samples - done));
+		}
+	}
+	if (r.num_anomalies > REPLAY_MAX_REPORTED) {
+		printf("  ... and %d more\n", r.num_anomalies - REPLAY_MAX_REPORTED);
+	} else if (r.num_anomalies == 0) {
+		printf("  none\n");
+	}
+	if (r.clipped_blocks > 0) {
+		printf("%lu samples clipped, in %u blocks\n", r.clipped_samples, r.clipped_blocks);
+	}
+
+	if (num_blocks > 0) {
+		double budget = (double)h->block / rate;
+		double sum = 0.;
+		for (uint32_t b = 0; b < num_blocks; b++) {
+			sum += cost[b];
+		}
+		double mean = sum / num_blocks;
+		double max = cost[worst];
+		qsort(cost, num_blocks, sizeof(double), compare_double);
+		double p99 = cost[num_blocks * 99 / 100];
+		printf("render cost per block: mean %.1f us, p99 %.1f us, max %.1f us at %.3f s (block %u); %.1f%% / %.1f%% / %.1f%% of real time\n",
+		    mean * 1e6, p99 * 1e6, max * 1e6, (double)worst * h->block / rate, worst,
+		    mean * 100 / budget, p99 * 100 / budget, max * 100 / budget);
+	}
+
+	free(cost);
+	free(data);
+	return 0;
+}
+
+void engine_render(void* user, int16_t* out, size_t frames)
+{
+	while (frames > 0) {
+		size_t n = frames < ENGINE_BLOCK ? frames : ENGINE_BLOCK;
+		render_block(out, n);
+		out += n;
+		frames -= n;
+	}
+}
@@ -0,0 +1,61 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RATE 44100
+
+// the engine never renders more than this many samples between looking at
+// keyboard input, no matter how large a request the backend makes
+#define ENGINE_BLOCK 64
+
+// which row of the trace (see common/trace.h) each thread records to
+#define TRACE_RENDER 0 // whoever calls engine_render()
+#define TRACE_UI 1
+#define TRACE_DEVICE 2 // the audio device's callback, when rendering ahead through the ring
+
+// patch_path may be either a text or a binary patch
+int engine_init(const char* patch_path);
+
+// recompile the patch file and swap it in at the next block boundary;
+// call from the UI thread, never the audio thread
+int engine_reload(void);
+
+// write the loaded patch in the binary patch format
+int engine_save_patch_bin(const char* path);
+
+// queue a computer keyboard key press; safe to call from any thread
+void engine_press(char c);
+
+// hold the chord engine_bench() renders for seconds; call only while nothing
+// is rendering
+void engine_chord(float seconds);
+
+// render seconds of a full chord as fast as possible, without an audio
+// device, and print how much CPU time it took
+int engine_bench(int seconds);
+
+// Replays a capture dumped by the Pi (see common/capture.h) as fast as
+// possible, sample for sample as the Pi rendered it, and prints what each
+// block cost and any voices that misbehaved: stuck notes, notes that never
+// die away, dropped notes, clipping. If out isn't NULL, the first
+// max_samples samples replayed are also written there.
+int engine_replay(const char* capture_path, int16_t* out, size_t max_samples);
+
+// audio_fill_fn compatible render callback
+void engine_render(void* user, int16_t* out, size_t frames);
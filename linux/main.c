@@ -14,442 +14,330 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
-#include <assert.h>
-#include <dirent.h>
-#include <fcntl.h>
-#include <math.h>
-#include <mpg123.h>
 #include <pthread.h>
-#include <pulse/error.h>
-#include <pulse/simple.h>
-#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <time.h>
 #include <unistd.h>
 
 #include <ncurses.h>
 
-#include "../common/bad_rand.h"
-#include "../common/synth.h"
-#include <stdint.h>
+#include "../common/trace.h"
+#include "audio.h"
+#include "engine.h"
+#include "ring.h"
+#include "rt.h"
 
-#define RATE 44100
+static struct ring ring;
+static volatile bool do_shutdown = false;
+static int producer_priority = 0; // see rt_thread()
+static int producer_cpu = -1;
 
-FILE* wave_fp = NULL;
-
-FILE* log_file = NULL;
-void debuglog(const char* s)
+// renders up to a block into the ring's free space
+static void render_ahead(void)
 {
-	if (log_file == NULL) {
-		log_file = fopen("/tmp/synth.log", "w");
-		if (log_file == NULL) {
-			fprintf(stderr, "failed to open logfile");
-			assert(log_file);
-		}
+	int16_t* p;
+	size_t n = ring_write_ptr(&ring, &p);
+	if (n > ENGINE_BLOCK) {
+		n = ENGINE_BLOCK;
 	}
-	fprintf(log_file, "%s", s);
-	fflush(log_file);
+	engine_render(NULL, p, n);
+	ring_commit(&ring, n);
 }
 
-float get_freq(const char c)
+// renders ahead of the audio device into the ring, sleeping whenever the ring
+// is above its high watermark
+static void* producer(void* param)
 {
-	switch (c) {
-	case 'z':
-		return 261.626;
-	case 'x':
-		return 277.183;
-	case 'c':
-		return 293.665;
-	case 'v':
-		return 311.127;
-	case 'b':
-		return 329.628;
-	case 'n':
-		return 349.228;
-	case 'm':
-		return 369.994;
-	case ',':
-		return 391.995;
-	case '.':
-		return 415.305;
-	case '/':
-		return 440.000;
-	default:
-		return 0.0f;
+	rt_thread("producer", producer_priority, producer_cpu);
+	while (!do_shutdown) {
+		ring_wait(&ring);
+		if (do_shutdown) {
+			break;
+		}
+		render_ahead();
 	}
+	return NULL;
 }
 
-struct wav_header {
-	char riff[4]; /* "RIFF"                                  */
-	int32_t flength; /* file length in bytes                    */
-	char wave[4]; /* "WAVE"                                  */
-	char fmt[4]; /* "fmt "                                  */
-	int32_t chunk_size; /* size of FMT chunk in bytes (usually 16) */
-	int16_t format_tag; /* 1=PCM, 257=Mu-Law, 258=A-Law, 259=ADPCM */
-	int16_t num_chans; /* 1=mono, 2=stereo                        */
-	int32_t srate; /* Sampling rate in samples per second     */
-	int32_t bytes_per_sec; /* bytes per second = srate*bytes_per_samp */
-	int16_t bytes_per_samp; /* 2=16-bit mono, 4=16-bit stereo          */
-	int16_t bits_per_samp; /* Number of bits per sample               */
-	// char data[4]; /* "data"                                  */
-	// int32_t dlength; /* data length in bytes (filelength - 44)  */
-};
-
-void write_wav_header(int32_t sample_rate)
+// audio_fill_fn used in place of engine_render when the ring is enabled
+static void consumer(void* user, int16_t* out, size_t frames)
 {
-	struct wav_header wavh;
-	strncpy(wavh.riff, "RIFF", 4);
-	strncpy(wavh.wave, "WAVE", 4);
-	strncpy(wavh.fmt, "fmt ", 4);
-
-	wavh.chunk_size = 16;
-	wavh.format_tag = 1;
-	wavh.num_chans = 1;
-	wavh.srate = sample_rate;
-	wavh.bits_per_samp = 16;
-	wavh.bytes_per_sec = wavh.srate * wavh.bits_per_samp / 8 * wavh.num_chans;
-	wavh.bytes_per_samp = wavh.bits_per_samp / 8 * wavh.num_chans;
-
-	const int header_length = sizeof(struct wav_header);
-	fwrite(&wavh, 1, header_length, wave_fp);
-}
-
-void write_wave_data(uint32_t length, char* buffer)
-{
-	fwrite("data", 1, 4, wave_fp);
-	fwrite(&length, 4, 1, wave_fp); // Data size
-	fwrite(buffer, 1, length, wave_fp);
-}
-
-uint32_t rate_increment = 1e9 / RATE;
-
-pa_simple* pa_handle;
-
-bool do_shutdown = false;
-pthread_mutex_t the_lock;
-pthread_cond_t the_cond;
-char the_key = '\0';
-
-size_t buf_num_samples;
-char* buf[2];
-int which_buf;
-bool buf_full;
-struct key* keys;
-
-void* producer(void* param)
-{
-	char pressed_key = '\0';
-	float t = 0.f;
-	uint32_t tt = 0;
-	for (;;) {
-
-		for (uint32_t i = 0; i < buf_num_samples; i++) {
-			// t += 1.f / RATE;
-			tt += rate_increment;
-			t = tt / (float)1e9;
-
-			float freq = get_freq(pressed_key);
-			if (freq > 0.f) {
-				struct key* k;
-				get_key(keys, freq, &k, TRUE);
-				// simulate a key press
-				// printf("pressed at %f\n", t);
-				k->future_released_at = t + 10.3; // hold for some extra time (only while using computer keyboard)
-
-				bool keep_output = (k->released_at > 0.0f && k->freq == freq);
-				k->freq = freq;
-				k->velocity = 1.0f;
-				k->pressed_at = t;
-				k->released_at = 0.0f;
-				for (int i = 0; i < NUM_OSCS; i++) {
-					struct osc* osc = &k->oscs[i];
-					osc->freq = freq;
-					if (keep_output) {
-						osc->output_volume_attack_start = osc->output_volume;
-					} else {
-						osc->output_volume_attack_start = 0;
-					}
-				}
-				for (int i = 0; i < NUM_OSCS; i++) {
-					struct osc* osc = &k->oscs[i + NUM_OSCS]; // LFOs are in the second set
-					if (osc->freq_sync) {
-						osc->freq = freq;
-					}
-				}
-			}
-
-			for (int i = 0; i < MAX_KEYS; i++) {
-				if (keys[i].future_released_at != 0.f && keys[i].future_released_at < t) {
-					keys[i].future_released_at = 0.f;
-					keys[i].released_at = t;
-					debuglog("released\n");
-				}
-			}
-
-			float output = 0.0f;
-			for (int i = 0; i < MAX_KEYS; i++) {
-				bool done = true;
-				for (int j = 0; j < NUM_OSCS * NUM_OSC_TYPES; j++) {
-					struct osc* osc = &keys[i].oscs[j];
-					osc_set_output(&keys[i], osc, t);
-					if (osc->osc_type == OSC_TYPE_VFO) {
-						output += osc->output * osc->output_volume * osc->output_volume_m;
-						if (osc->output_volume > 0.0 || keys[i].released_at == 0.0) {
-							done = false;
-						}
-					}
-				}
-				if (done) {
-					keys[i].pressed_at = 0.f;
-					keys[i].released_at = 0.f;
-				}
-			}
-
-			if (output > 1.0f) {
-				output = 1.0f;
-			} else if (output < -1.0f) {
-				output = -1.0f;
-			}
-
-			int16_t data = output * 32700;
-
-			((int16_t*)buf[which_buf])[i] = data;
-			// if (wave_i < wave_file_samples) {
-			//	((int16_t*)wave_file_data)[wave_i++] = data;
-			// }
-		}
-
-		pthread_mutex_lock(&the_lock);
-		// char sss[1024];
-		// sprintf(sss, "buf full for %d\n", which_buf);
-		// debuglog(sss);
-		buf_full = true;
-		pthread_mutex_unlock(&the_lock);
-
-		bool ready_for_more = false;
-		while (!ready_for_more) {
-			pthread_mutex_lock(&the_lock);
-			if (buf_full) {
-				pthread_cond_wait(&the_cond, &the_lock);
-			}
-			ready_for_more = !buf_full || do_shutdown;
-			if (ready_for_more) {
-				pressed_key = the_key;
-				the_key = '\0';
-			}
-			pthread_mutex_unlock(&the_lock);
-		}
-
-		if (do_shutdown) {
-			debuglog("producer exit\n");
-			return NULL;
-		}
-
-		// int num_repeat_plays = 1;
-		// for (int i = 0; i < num_repeat_plays; i++) {
-		//	int n = 2 * buf_num_samples;
-		//	int res = pa_simple_write(pa_handle, buf, n, &error);
-		//	if (res < 0) {
-		//		fprintf(stderr, "res=%d err=%d pa_simple_write failed", res, error);
-		//		debuglog("pa_simple_write failed\n");
-		//	}
-		// }
-
-		// if (write_wave_file && wave_i == wave_file_samples) {
-		//	break;
-		// }
+	unsigned long underruns = ring.underruns;
+	ring_read(&ring, out, frames);
+	if (ring.underruns != underruns) {
+		// keep the blocks that led up to it
+		TRACE_INSTANT(TRACE_DEVICE, "underrun");
+		TRACE_STOP();
 	}
 }
 
-void* consumer(void* param)
+#ifdef TRACE
+static void write_trace(void* user, const char* s, size_t n)
 {
-	int error;
-	char* b = NULL;
-	for (;;) {
-		pthread_mutex_lock(&the_lock);
-		if (buf_full) {
-			b = buf[which_buf];
-			buf_full = false;
-			which_buf = (which_buf + 1) % 2;
-		}
-		pthread_mutex_unlock(&the_lock);
-		pthread_cond_signal(&the_cond);
-
-		if (b) {
-			int n = 2 * buf_num_samples;
-			int res = pa_simple_write(pa_handle, b, n, &error);
-			if (res < 0) {
-				fprintf(stderr, "res=%d err=%d pa_simple_write failed", res, error);
-				debuglog("pa_simple_write failed\n");
-			}
-		}
-
-		if (do_shutdown) {
-			pa_simple_drain(pa_handle, &error);
-			debuglog("consumer exit\n");
-			return NULL;
-		}
-	}
+	fwrite(s, 1, n, (FILE*)user);
 }
 
-int read_file_into_new_string(const char* path, char** buf)
+static int save_trace(const char* path)
 {
-	long length;
-	FILE* f = fopen(path, "rb");
+	FILE* f = fopen(path, "w");
 	if (f == NULL) {
-		fprintf(stderr, "failed to read %s", path);
+		fprintf(stderr, "failed to open %s\n", path);
 		return 1;
 	}
-
-	fseek(f, 0, SEEK_END);
-	length = ftell(f);
-	fseek(f, 0, SEEK_SET);
-	*buf = malloc(length);
-	if (*buf == NULL) {
-		fprintf(stderr, "failed to read %s: OOM", path);
-		return 1;
-	}
-	fread(*buf, 1, length, f); // TODO error handling
+	trace_dump(write_trace, f);
 	fclose(f);
 	return 0;
 }
+#endif
 
-int main(int argc, char** argv, char** env)
+static void usage(const char* prog)
 {
+	fprintf(stderr, "usage: %s [-b backend] [-p period] [-B buffer] [-d device] [-r frames] [-P priority] [-A cpu[,cpu]] [-n seconds] [-E out.bin] [-T seconds] [-J seconds] [-R capture.bin] [-t trace.json] [patch]\n", prog);
+	fprintf(stderr, "  -b  audio backend; one of: ");
+	audio_list_backends();
+	fprintf(stderr, "  -p  frames per request (alsa period size, pulse minreq); default 256\n");
+	fprintf(stderr, "  -B  frames of buffering (alsa buffer size, pulse tlength); default 1024\n");
+	fprintf(stderr, "  -d  alsa device, or wav file to write for the null backend\n");
+	fprintf(stderr, "  -r  render ahead on a separate thread through a ring of this many frames (at least buffer + period)\n");
+	fprintf(stderr, "  -P  real-time mode: lock memory and render at this SCHED_FIFO priority, 1 to %d\n", RT_PRIORITY_MAX);
+	fprintf(stderr, "  -A  pin the rendering thread to this cpu (and, with -r, the device thread to the second)\n");
+	fprintf(stderr, "  -n  run without a terminal for this many seconds, playing a single note\n");
+	fprintf(stderr, "  -E  compile the patch to the binary patch format and exit\n");
+	fprintf(stderr, "  -T  benchmark: render this many seconds of a full chord, report the cost and exit\n");
+	fprintf(stderr, "  -J  jitter test: render a full chord a period at a time on a timer for this many seconds, without\n");
+	fprintf(stderr, "      and then with real-time mode, report wake-up latency and render time, and exit\n");
+	fprintf(stderr, "  -R  replay a capture from the pi, report each block's cost and any stuck notes, and exit\n");
+	fprintf(stderr, "  -t  on exit, write a chrome trace of the last few blocks (needs a -DTRACE build)\n");
+}
 
-	bool interactive = true;
-	bool write_wave_file = false;
-
-	size_t wave_file_samples = RATE * 60; // 1 minute
-	char* wave_file_data = NULL;
-	size_t wave_i = 0;
-
-	if (write_wave_file) {
-		wave_fp = fopen("out.wav", "w");
-		wave_file_data = malloc(wave_file_samples * sizeof(int16_t));
-		write_wav_header(RATE);
+static void report_latency(struct audio_backend* backend, const struct audio_config* cfg, bool interactive)
+{
+	long frames = backend->latency_frames(backend);
+	if (frames < 0) {
+		return;
+	}
+	float ms = frames * 1000.f / cfg->rate;
+	if (interactive) {
+		mvprintw(0, 0, "%s: %ld frames buffered (%.1f ms)\n", backend->name, frames, ms);
+		refresh();
 	} else {
-		wave_file_samples = 0;
+		fprintf(stderr, "%s: %ld frames buffered (%.1f ms)\n", backend->name, frames, ms);
 	}
+}
 
-	static const pa_sample_spec ss = {
-		.format = PA_SAMPLE_S16LE, .rate = RATE, .channels = 1
+int main(int argc, char** argv, char** env)
+{
+	const char* backend_name = NULL;
+	const char* patch_path = "patch";
+	int headless_seconds = 0;
+	const char* encode_path = NULL;
+	int bench_seconds = 0;
+	int jitter_seconds = 0;
+	int rt_priority = 0;
+	int render_cpu = -1;
+	int device_cpu = -1;
+	const char* trace_path = NULL;
+	const char* replay_path = NULL;
+	size_t ring_frames = 0;
+	pthread_t producer_thread;
+
+	struct audio_config cfg = {
+		.rate = RATE,
+		.period_frames = 256,
+		.buffer_frames = 1024,
+		.device = NULL,
+		.rt_priority = 0,
+		.cpu = -1,
 	};
 
-	int error;
-	pa_handle = pa_simple_new(NULL, "synthtestbed", PA_STREAM_PLAYBACK, NULL, "playback",
-	    &ss, NULL, NULL, &error);
-	if (pa_handle == NULL) {
-		fprintf(stderr, __FILE__ ": pa_simple_new() failed: %s\n",
-		    pa_strerror(error));
-		assert(0);
+	int opt;
+	while ((opt = getopt(argc, argv, "b:p:B:d:r:P:A:n:E:T:J:R:t:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			backend_name = optarg;
+			break;
+		case 'p':
+			cfg.period_frames = atoi(optarg);
+			break;
+		case 'B':
+			cfg.buffer_frames = atoi(optarg);
+			break;
+		case 'd':
+			cfg.device = optarg;
+			break;
+		case 'r':
+			ring_frames = atoi(optarg);
+			break;
+		case 'P':
+			rt_priority = atoi(optarg);
+			break;
+		case 'A':
+			if (sscanf(optarg, "%d,%d", &render_cpu, &device_cpu) == 1) {
+				device_cpu = render_cpu;
+			}
+			break;
+		case 'n':
+			headless_seconds = atoi(optarg);
+			break;
+		case 'E':
+			encode_path = optarg;
+			break;
+		case 'T':
+			bench_seconds = atoi(optarg);
+			break;
+		case 'J':
+			jitter_seconds = atoi(optarg);
+			break;
+		case 'R':
+			replay_path = optarg;
+			break;
+		case 't':
+			trace_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc) {
+		patch_path = argv[optind];
+	}
+	if (cfg.period_frames == 0 || cfg.buffer_frames < cfg.period_frames) {
+		fprintf(stderr, "buffer must be at least one period\n");
+		return 1;
 	}
 
-	// size_t buf_seconds = 60;
-
-	size_t chunk = 1;
-
-	// assert(RATE % chunk == 0);
+	if (ring_frames > 0 && ring_frames < cfg.buffer_frames + cfg.period_frames) {
+		fprintf(stderr, "ring must hold at least a buffer and a period (%u frames)\n", cfg.buffer_frames + cfg.period_frames);
+		return 1;
+	}
 
-	buf_num_samples = 10000;
-	for (int i = 0; i < 2; i++) {
-		buf[i] = malloc(sizeof(int16_t) * buf_num_samples);
-		memset(buf[i], 0, sizeof(int16_t) * buf_num_samples);
+	if (rt_priority < 0 || rt_priority > RT_PRIORITY_MAX) {
+		fprintf(stderr, "priority must be from 1 to %d\n", RT_PRIORITY_MAX);
+		return 1;
 	}
-	which_buf = 0;
-	buf_full = false;
 
-	size_t key_bytes = sizeof(struct key) * MAX_KEYS;
-	size_t osc_bytes = sizeof(struct osc) * NUM_OSCS * NUM_OSC_TYPES;
-	keys = malloc(key_bytes);
-	memset(keys, 0, key_bytes);
-	for (size_t i = 0; i < MAX_KEYS; i++) {
-		keys[i].oscs = malloc(osc_bytes);
+#ifdef TRACE
+	trace_init();
+	trace_name_core(TRACE_RENDER, "render");
+	trace_name_core(TRACE_UI, "ui");
+	trace_name_core(TRACE_DEVICE, "device");
+#else
+	if (trace_path) {
+		fprintf(stderr, "built without tracing; rebuild with TRACE=1 ./make.linux\n");
+		return 1;
 	}
+#endif
 
-	char* patch_contents = NULL;
-	if (read_file_into_new_string("patch", &patch_contents)) {
+	struct audio_backend* backend = audio_find_backend(backend_name);
+	if (backend == NULL) {
+		fprintf(stderr, "unknown backend %s\n", backend_name);
+		usage(argv[0]);
 		return 1;
 	}
 
-	memset(keys[0].oscs, 0, osc_bytes);
-	if (load_patch(patch_contents, keys[0].oscs) != 0) {
-		goto shutdown;
+	if (engine_init(patch_path) != 0) {
+		return 1;
 	}
-	for (size_t i = 1; i < MAX_KEYS; i++) {
-		memcpy(keys[i].oscs, keys[0].oscs, osc_bytes);
+	if (encode_path) {
+		return engine_save_patch_bin(encode_path);
 	}
-
-	if (interactive) {
-		initscr();
-		cbreak();
-		noecho();
-		keypad(stdscr, TRUE);
-		// nodelay(stdscr, TRUE);
+	if (jitter_seconds > 0) {
+		// held through both passes, so each renders the same
+		engine_chord(2 * jitter_seconds + 1);
+		return rt_jitter(jitter_seconds, RATE, cfg.period_frames, engine_render, rt_priority ? rt_priority : RT_DEFAULT_PRIORITY, render_cpu);
+	}
+	if (bench_seconds > 0 || replay_path) {
+		int err = replay_path ? engine_replay(replay_path, NULL, 0) : engine_bench(bench_seconds);
+#ifdef TRACE
+		if (trace_path) {
+			err |= save_trace(trace_path);
+		}
+#endif
+		return err;
 	}
 
-	pthread_mutex_init(&the_lock, NULL);
-	pthread_cond_init(&the_cond, NULL);
-
-	pthread_t tid1, tid2;
-	int i;
+	engine_press('b'); // start with a note immediately
 
-	the_key = 'b'; // start with a note immediately
+	if (rt_priority > 0) {
+		rt_lock_memory();
+	}
+	// whichever thread renders gets rt_priority; rendering ahead, the device
+	// thread only copies out of the ring, and must never wait on the producer
+	cfg.rt_priority = rt_priority;
+	cfg.cpu = render_cpu;
+	audio_fill_fn fill = engine_render;
+	if (ring_frames > 0) {
+		if (ring_init_for_device(&ring, ring_frames, cfg.period_frames, cfg.buffer_frames) != 0) {
+			return 1;
+		}
+		// the device's first request may be for its whole buffer
+		while (ring_fill(&ring) < ring.high_watermark) {
+			render_ahead();
+		}
+		producer_priority = rt_priority;
+		producer_cpu = render_cpu;
+		cfg.rt_priority = rt_priority ? rt_priority + 1 : 0;
+		cfg.cpu = device_cpu;
+		if (pthread_create(&producer_thread, NULL, producer, NULL) != 0) {
+			fprintf(stderr, "Unable to create producer thread\n");
+			return 1;
+		}
+		fill = consumer;
+	}
 
-	/* create the threads; may be any number, in general */
-	if (pthread_create(&tid1, NULL, producer, NULL) != 0) {
-		fprintf(stderr, "Unable to create producer thread\n");
-		goto shutdown;
+	if (backend->start(backend, &cfg, fill, NULL) != 0) {
+		fprintf(stderr, "failed to start %s backend\n", backend->name);
+		return 1;
 	}
-	if (pthread_create(&tid2, NULL, consumer, NULL) != 0) {
-		fprintf(stderr, "Unable to create consumer thread\n");
+
+	if (headless_seconds > 0) {
+		for (int i = 0; i < headless_seconds; i++) {
+			sleep(1);
+			report_latency(backend, &cfg, false);
+		}
 		goto shutdown;
 	}
 
-	// TODO call these on shutdown
-	// pthread_join(tid1,NULL);
-	// pthread_join(tid2,NULL);
+	initscr();
+	cbreak();
+	noecho();
+	keypad(stdscr, TRUE);
+	halfdelay(5);
 
 	for (;;) {
-		printf("waiting for ch\n");
-		char ch = getch();
+		report_latency(backend, &cfg, true);
+		int ch = getch();
+		if (ch == ERR) {
+			continue;
+		}
 		if (ch == 'q') {
-			goto shutdown;
+			break;
 		}
-		pthread_mutex_lock(&the_lock);
-		the_key = ch;
-		pthread_mutex_unlock(&the_lock);
+		if (ch == 'r') {
+			engine_reload();
+			continue;
+		}
+		engine_press(ch);
 	}
 
+	endwin();
+
 shutdown:
-	if (interactive) {
-		endwin();
+	backend->stop(backend);
+	if (ring_frames > 0) {
+		do_shutdown = true;
+		ring_wake(&ring);
+		pthread_join(producer_thread, NULL);
+		fprintf(stderr, "ring: %lu underruns, %lu overruns\n", ring.underruns, ring.overruns);
+		ring_free(&ring);
 	}
-	if (wave_fp != NULL) {
-		write_wave_data(wave_file_samples * 2, wave_file_data);
-		fclose(wave_fp);
-		free(wave_file_data);
+#ifdef TRACE
+	if (trace_path) {
+		return save_trace(trace_path);
 	}
-
-	pthread_mutex_lock(&the_lock);
-	do_shutdown = true;
-	pthread_mutex_unlock(&the_lock);
-	pthread_cond_signal(&the_cond);
-
-	printf("waiting for threads before exiting\n");
-
-	pthread_join(tid1, NULL);
-	pthread_join(tid2, NULL);
-
-error:
-
-	free(buf[0]);
-	free(buf[1]);
-
+#endif
 	return 0;
 }
@@ -0,0 +1,136 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+static void futex_wait(int* addr, int val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(int* addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+int ring_init(struct ring* r, size_t capacity, size_t low_watermark, size_t high_watermark)
+{
+	memset(r, 0, sizeof(struct ring));
+	r->capacity = 1;
+	while (r->capacity < capacity) {
+		r->capacity <<= 1;
+	}
+	r->high_watermark = high_watermark < r->capacity ? high_watermark : r->capacity;
+	r->low_watermark = low_watermark < r->high_watermark ? low_watermark : r->high_watermark / 2;
+	r->buf = calloc(r->capacity, sizeof(int16_t));
+	return r->buf == NULL;
+}
+
+int ring_init_for_device(struct ring* r, size_t capacity, size_t period, size_t buffer)
+{
+	if (period == 0 || capacity < buffer + period) {
+		return 1;
+	}
+	if (ring_init(r, capacity, buffer, capacity) != 0) {
+		return 1;
+	}
+	// capacity may have been rounded up; keep all of it full
+	r->high_watermark = r->capacity;
+	return 0;
+}
+
+void ring_free(struct ring* r)
+{
+	free(r->buf);
+	r->buf = NULL;
+}
+
+size_t ring_fill(struct ring* r)
+{
+	size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	return head - tail;
+}
+
+size_t ring_write_ptr(struct ring* r, int16_t** p)
+{
+	size_t head = r->head;
+	size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	size_t space = r->capacity - (head - tail);
+	size_t i = head & (r->capacity - 1);
+	if (space > r->capacity - i) {
+		space = r->capacity - i;
+	}
+	if (space == 0) {
+		r->overruns++;
+	}
+	*p = &r->buf[i];
+	return space;
+}
+
+void ring_commit(struct ring* r, size_t n)
+{
+	__atomic_store_n(&r->head, r->head + n, __ATOMIC_RELEASE);
+}
+
+void ring_wait(struct ring* r)
+{
+	if (ring_fill(r) < r->high_watermark) {
+		return;
+	}
+	__atomic_store_n(&r->producer_sleeping, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	// the consumer may have drained the ring between the check above and
+	// announcing we are asleep; in that case it may not have seen the flag
+	if (ring_fill(r) >= r->low_watermark) {
+		futex_wait(&r->producer_sleeping, 1);
+	}
+	__atomic_store_n(&r->producer_sleeping, 0, __ATOMIC_RELAXED);
+}
+
+void ring_wake(struct ring* r)
+{
+	if (__atomic_exchange_n(&r->producer_sleeping, 0, __ATOMIC_SEQ_CST)) {
+		futex_wake(&r->producer_sleeping);
+	}
+}
+
+void ring_read(struct ring* r, int16_t* out, size_t n)
+{
+	size_t tail = r->tail;
+	size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	size_t avail = head - tail;
+	size_t take = n < avail ? n : avail;
+
+	size_t i = tail & (r->capacity - 1);
+	size_t first = take < r->capacity - i ? take : r->capacity - i;
+	memcpy(out, &r->buf[i], first * sizeof(int16_t));
+	memcpy(out + first, r->buf, (take - first) * sizeof(int16_t));
+	if (take < n) {
+		memset(out + take, 0, (n - take) * sizeof(int16_t));
+		r->underruns++;
+	}
+	__atomic_store_n(&r->tail, tail + take, __ATOMIC_SEQ_CST);
+
+	if (avail - take < r->low_watermark && __atomic_load_n(&r->producer_sleeping, __ATOMIC_SEQ_CST)) {
+		ring_wake(r);
+	}
+}
@@ -0,0 +1,68 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Single producer, single consumer sample ring. Neither side ever takes a
+// lock; the producer only sleeps once the ring fills past high_watermark, and
+// the consumer only wakes it once the ring drains below low_watermark.
+struct ring {
+	int16_t* buf;
+	size_t capacity; // always a power of two
+	size_t low_watermark;
+	size_t high_watermark;
+
+	// head is only written by the producer, tail only by the consumer; they
+	// live on separate cache lines so the two threads don't fight over them
+	size_t head __attribute__((aligned(64)));
+	unsigned long overruns;
+
+	size_t tail __attribute__((aligned(64)));
+	unsigned long underruns;
+
+	int producer_sleeping __attribute__((aligned(64)));
+};
+
+// capacity is rounded up to a power of two
+int ring_init(struct ring* r, size_t capacity, size_t low_watermark, size_t high_watermark);
+void ring_free(struct ring* r);
+
+// Sized for a device that takes up to buffer frames at once (typically its
+// first request) and period frames at a time after that: the producer keeps
+// the whole ring full, and is only woken once less than a device buffer is
+// left. Fails unless capacity is at least buffer + period, so the producer
+// always has at least a period to render when it wakes.
+int ring_init_for_device(struct ring* r, size_t capacity, size_t period, size_t buffer);
+
+size_t ring_fill(struct ring* r);
+
+// producer side: returns contiguous free space at the head, then commit what was written
+size_t ring_write_ptr(struct ring* r, int16_t** p);
+void ring_commit(struct ring* r, size_t n);
+
+// producer side: blocks while the ring is above its high watermark; returns
+// early if ring_wake() is called
+void ring_wait(struct ring* r);
+
+// consumer side: always fills out with n samples, padding with silence (and
+// counting an underrun) if the producer hasn't kept up
+void ring_read(struct ring* r, int16_t* out, size_t n);
+
+// wake a sleeping producer regardless of watermarks (e.g. on shutdown)
+void ring_wake(struct ring* r);
@@ -0,0 +1,240 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <malloc.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "rt.h"
+
+// how much of each real-time thread's stack to fault in; far more than the
+// engine uses
+#define RT_STACK_PREFAULT (256 * 1024)
+
+int rt_lock_memory(void)
+{
+	// keep freed memory in the (locked) heap rather than trimming it, or
+	// serving big allocations from fresh mmaps, which would fault again
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		fprintf(stderr, "rt: can't lock memory (%s); pages may be swapped out under load. "
+				"Raise the memlock limit (ulimit -l) or run as root\n",
+		    strerror(errno));
+		return 1;
+	}
+	rt_prefault_stack();
+	return 0;
+}
+
+void rt_prefault_stack(void)
+{
+	volatile unsigned char stack[RT_STACK_PREFAULT];
+	for (size_t i = 0; i < sizeof(stack); i += 4096) {
+		stack[i] = 0;
+	}
+}
+
+int rt_thread(const char* name, int priority, int cpu)
+{
+	if (priority == 0 && cpu < 0) {
+		return 0;
+	}
+
+	int err = 0;
+	if (cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		int e = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (e != 0) {
+			fprintf(stderr, "rt: can't pin the %s thread to cpu %d (%s); it runs on any\n", name, cpu, strerror(e));
+			err = 1;
+		}
+	}
+	if (priority > 0) {
+		struct sched_param param = { .sched_priority = priority };
+		int e = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (e != 0) {
+			fprintf(stderr, "rt: can't make the %s thread SCHED_FIFO priority %d (%s); it runs at normal priority. "
+					"Raise the rtprio limit (ulimit -r, or /etc/security/limits.conf) or run as root\n",
+			    name, priority, strerror(e));
+			err = 1;
+		}
+	}
+	rt_prefault_stack();
+	return err;
+}
+
+// one pass of rt_jitter()
+struct jitter_run {
+	unsigned rate;
+	unsigned period_frames;
+	audio_fill_fn fill;
+	int priority;
+	int cpu;
+
+	size_t periods;
+	int16_t* buf;
+	double* wake_us; // how late each wake-up was
+	double* render_us; // and how long the period then took to render
+	unsigned missed; // periods that finished after the next was due
+	bool denied; // rt_thread() wasn't permitted all it was asked for
+};
+
+static double us_between(const struct timespec* a, const struct timespec* b)
+{
+	return (b->tv_sec - a->tv_sec) * 1e6 + (b->tv_nsec - a->tv_nsec) * 1e-3;
+}
+
+static void add_ns(struct timespec* t, uint64_t ns)
+{
+	t->tv_sec += ns / 1000000000ull;
+	t->tv_nsec += ns % 1000000000ull;
+	if (t->tv_nsec >= 1000000000) {
+		t->tv_sec++;
+		t->tv_nsec -= 1000000000;
+	}
+}
+
+static void* jitter_thread(void* arg)
+{
+	struct jitter_run* j = arg;
+	j->denied = rt_thread("jitter", j->priority, j->cpu) != 0;
+
+	const uint64_t period_ns = (uint64_t)j->period_frames * 1000000000ull / j->rate;
+	struct timespec due;
+	clock_gettime(CLOCK_MONOTONIC, &due);
+	for (size_t i = 0; i < j->periods; i++) {
+		add_ns(&due, period_ns);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+		struct timespec woke, done;
+		clock_gettime(CLOCK_MONOTONIC, &woke);
+		j->fill(NULL, j->buf, j->period_frames);
+		clock_gettime(CLOCK_MONOTONIC, &done);
+
+		j->wake_us[i] = us_between(&due, &woke);
+		j->render_us[i] = us_between(&woke, &done);
+
+		// a real device would have underrun; start again from now rather
+		// than rendering a burst of periods back to back to catch up
+		struct timespec next = due;
+		add_ns(&next, period_ns);
+		if (us_between(&next, &done) > 0) {
+			j->missed++;
+			due = done;
+		}
+	}
+	return NULL;
+}
+
+static int cmp_double(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void print_stats(double* v, size_t n, bool stddev)
+{
+	double sum = 0;
+	for (size_t i = 0; i < n; i++) {
+		sum += v[i];
+	}
+	double mean = sum / n;
+	double var = 0;
+	for (size_t i = 0; i < n; i++) {
+		var += (v[i] - mean) * (v[i] - mean);
+	}
+	qsort(v, n, sizeof(double), cmp_double);
+	printf("  %8.1f", mean);
+	if (stddev) {
+		printf(" %8.1f", sqrt(var / n));
+	}
+	printf(" %8.1f %8.1f", v[(size_t)(n * 0.99)], v[n - 1]);
+}
+
+static int jitter_pass(const char* label, struct jitter_run* j)
+{
+	pthread_t thread;
+	j->missed = 0;
+	if (pthread_create(&thread, NULL, jitter_thread, j) != 0) {
+		fprintf(stderr, "rt: unable to create jitter thread\n");
+		return 1;
+	}
+	pthread_join(thread, NULL);
+
+	char row[32];
+	snprintf(row, sizeof(row), "%s%s", label, j->denied ? " (denied)" : "");
+	printf("%-22s", row);
+	print_stats(j->wake_us, j->periods, false);
+	print_stats(j->render_us, j->periods, true);
+	printf("  %6u\n", j->missed);
+	return 0;
+}
+
+int rt_jitter(int seconds, unsigned rate, unsigned period_frames, audio_fill_fn fill, int priority, int cpu)
+{
+	struct jitter_run j = {
+		.rate = rate,
+		.period_frames = period_frames,
+		.fill = fill,
+		.priority = 0,
+		.cpu = -1,
+		.periods = (size_t)seconds * rate / period_frames,
+	};
+	if (j.periods == 0) {
+		fprintf(stderr, "rt: %d s is less than a period\n", seconds);
+		return 1;
+	}
+	j.buf = calloc(period_frames, sizeof(int16_t));
+	j.wake_us = calloc(j.periods, sizeof(double));
+	j.render_us = calloc(j.periods, sizeof(double));
+	if (j.buf == NULL || j.wake_us == NULL || j.render_us == NULL) {
+		fprintf(stderr, "rt: out of memory\n");
+		return 1;
+	}
+
+	printf("%u frame periods (%.2f ms), %d s each; all times in us\n", period_frames, period_frames * 1000. / rate, seconds);
+	printf("%-22s  %-26s  %-35s  %6s\n", "", "wake-up latency", "render time", "missed");
+	printf("%-22s  %8s %8s %8s  %8s %8s %8s %8s\n", "", "mean", "p99", "max", "mean", "stddev", "p99", "max");
+
+	int err = jitter_pass("normal", &j);
+
+	// the memory already touched is locked now too, including the arrays
+	// above and everything the engine allocated
+	rt_lock_memory();
+	j.priority = priority;
+	j.cpu = cpu;
+	char label[32];
+	snprintf(label, sizeof(label), "rt (fifo %d)", priority);
+	err |= jitter_pass(label, &j);
+
+	free(j.buf);
+	free(j.wake_us);
+	free(j.render_us);
+	return err;
+}
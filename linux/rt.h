@@ -0,0 +1,50 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "audio.h"
+
+// Opt-in real-time mode (-P): the threads that render run SCHED_FIFO, every
+// page the process touches is locked into RAM and faulted in up front, and
+// each thread can be pinned to a CPU. Without the privileges for any of it
+// (RLIMIT_RTPRIO, RLIMIT_MEMLOCK, or CAP_SYS_NICE / CAP_IPC_LOCK) a warning
+// says what's missing and the thread carries on as it would have.
+
+#define RT_PRIORITY_MAX 98 // leaves 99 for the device thread when rendering ahead through the ring
+#define RT_DEFAULT_PRIORITY 80 // for -J, when -P isn't given
+
+// Locks the process's memory, current and future, and keeps malloc from
+// handing freed pages back to the kernel, so the audio path never page
+// faults; call once, early, from the main thread.
+int rt_lock_memory(void);
+
+// Faults in the calling thread's stack; called by rt_thread().
+void rt_prefault_stack(void);
+
+// Makes the calling thread SCHED_FIFO at priority (nothing if 0) and pins it
+// to cpu (anywhere if -1). name is only for the warning printed when either
+// isn't permitted; returns non-zero then, but the thread keeps running.
+int rt_thread(const char* name, int priority, int cpu);
+
+// Measures what real-time mode buys: a thread wakes every period on an
+// absolute timer and renders one period with fill, for seconds, first as an
+// ordinary thread and then as a real-time one (with memory locked), and
+// prints the wake-up latency and render time of each.
+int rt_jitter(int seconds, unsigned rate, unsigned period_frames, audio_fill_fn fill, int priority, int cpu);
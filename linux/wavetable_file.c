@@ -0,0 +1,69 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../common/wavetable.h"
+#include "wavetable_file.h"
+
+static char dir[PATH_MAX];
+
+void wavetable_file_dir(const char* patch_path)
+{
+	const char* slash = strrchr(patch_path, '/');
+	size_t n = slash ? (size_t)(slash - patch_path) + 1 : 0;
+	if (n >= sizeof(dir)) {
+		n = 0;
+	}
+	memcpy(dir, patch_path, n);
+	dir[n] = '\0';
+}
+
+// the file is mapped rather than read; only the pages the WAV parser touches
+// are ever brought in
+const void* wavetable_file_open(const char* name, size_t* len)
+{
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : dir, name) >= (int)sizeof(path)) {
+		return NULL;
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return NULL;
+	}
+	*len = st.st_size;
+	return data;
+}
+
+void wavetable_file_close(const void* data, size_t len)
+{
+	munmap((void*)data, len);
+}
@@ -0,0 +1,44 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <stdio.h>
+
+// Each test is a plain program: CHECK() reports a failure and carries on, so
+// one run shows all of them, and check_done() turns them into the exit code.
+
+static int check_failures;
+
+#define CHECK(cond, ...)                                                     \
+	do {                                                                 \
+		if (!(cond)) {                                               \
+			check_failures++;                                    \
+			fprintf(stderr, "%s:%d: failed: %s: ", __FILE__, __LINE__, #cond); \
+			fprintf(stderr, __VA_ARGS__);                        \
+			fprintf(stderr, "\n");                               \
+		}                                                            \
+	} while (0)
+
+static inline int check_done(const char* name)
+{
+	if (check_failures) {
+		fprintf(stderr, "%s: %d failed\n", name, check_failures);
+		return 1;
+	}
+	printf("%s: ok\n", name);
+	return 0;
+}
@@ -0,0 +1,220 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Accuracy check for common/fast_math.h: the worst error of each
+// approximation against libm, in double precision, over the ranges its
+// header documents, held to the figures given there. The scalar and _block
+// forms are checked separately, since the _block ones run their own SIMD
+// code. By default every 61st float of a range is tried (1/64th of the sin
+// points); -a tries all of them, as the header's figures were measured,
+// which takes a few minutes.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../common/fast_math.h"
+#include "check.h"
+
+#define BATCH 1024
+
+static int stride = 61;
+static int sin_points_shift = 6;
+
+struct worst {
+	double abs;
+	double rel;
+	float abs_at;
+	float rel_at;
+};
+
+struct error_range {
+	const char* name;
+	float lo;
+	float hi;
+	// what the header promises; 0 if it doesn't give one
+	double max_abs;
+	double max_rel;
+	float (*scalar)(float);
+	void (*block)(float* out, const float* in, size_t n);
+	double (*exact)(double);
+	// points evenly spaced, rather than floats one after another
+	bool evenly;
+};
+
+static double exact_sin_turns(double turns)
+{
+	// turns is a float, so this is exact and sin() sees a small argument
+	return sin(2 * M_PI * (turns - nearbyint(turns)));
+}
+
+// orders the floats as integers, negatives included, so a range can be
+// walked a float at a time
+static int64_t float_key(float x)
+{
+	uint32_t u = fast_math_bits(x);
+	return u & 0x80000000 ? -(int64_t)(u & 0x7fffffff) : (int64_t)u;
+}
+
+static float key_float(int64_t k)
+{
+	return k < 0 ? fast_math_float((uint32_t)-k | 0x80000000) : fast_math_float((uint32_t)k);
+}
+
+static void note_error(struct worst* w, float x, float got, double want)
+{
+	double abs = fabs((double)got - want);
+	if (!(abs <= w->abs)) {
+		w->abs = abs;
+		w->abs_at = x;
+	}
+	if (want != 0) {
+		double rel = abs / fabs(want);
+		if (!(rel <= w->rel)) {
+			w->rel = rel;
+			w->rel_at = x;
+		}
+	}
+}
+
+static void measure_batch(const struct error_range* r, const float* in, size_t n,
+    struct worst* scalar, struct worst* block)
+{
+	float out[BATCH];
+	r->block(out, in, n);
+	for (size_t i = 0; i < n; i++) {
+		double want = r->exact(in[i]);
+		note_error(scalar, in[i], r->scalar(in[i]), want);
+		note_error(block, in[i], out[i], want);
+	}
+}
+
+static void check_worst(const struct error_range* r, const char* form, const struct worst* w, long points)
+{
+	printf("  %-16s %-6s %11g .. %-11g %9ld points", r->name, form, r->lo, r->hi, points);
+	if (r->max_abs) {
+		printf("  absolute %.2e at %.9g", w->abs, w->abs_at);
+	}
+	if (r->max_rel) {
+		printf("  relative %.2e at %.9g", w->rel, w->rel_at);
+	}
+	printf("\n");
+	// the header rounds to two figures
+	if (r->max_abs) {
+		CHECK(w->abs < r->max_abs * 1.005, "%s %s over %g .. %g: absolute error %.3e at %.9g, documented %.1e",
+		    r->name, form, r->lo, r->hi, w->abs, w->abs_at, r->max_abs);
+	}
+	if (r->max_rel) {
+		CHECK(w->rel < r->max_rel * 1.005, "%s %s over %g .. %g: relative error %.3e at %.9g, documented %.1e",
+		    r->name, form, r->lo, r->hi, w->rel, w->rel_at, r->max_rel);
+	}
+}
+
+static void measure(const struct error_range* r)
+{
+	struct worst scalar = { 0 }, block = { 0 };
+	float in[BATCH];
+	size_t n = 0;
+	long points = 0;
+	if (r->evenly) {
+		long count = (1L << 24) >> sin_points_shift;
+		for (long i = 0; i < count; i++) {
+			in[n++] = (float)(r->lo + ((double)r->hi - r->lo) * i / (count - 1));
+			if (n == BATCH) {
+				measure_batch(r, in, n, &scalar, &block);
+				n = 0;
+			}
+		}
+		points = count;
+	} else {
+		int64_t lo = float_key(r->lo), hi = float_key(r->hi);
+		for (int64_t k = lo; k <= hi; k += stride) {
+			// the last float of the range is always tried
+			in[n++] = key_float(k + stride > hi ? hi : k);
+			points++;
+			if (n == BATCH) {
+				measure_batch(r, in, n, &scalar, &block);
+				n = 0;
+			}
+		}
+	}
+	measure_batch(r, in, n, &scalar, &block);
+	check_worst(r, "scalar", &scalar, points);
+	check_worst(r, "block", &block, points);
+}
+
+// the header's table
+static const struct error_range ranges[] = {
+	{ "fast_exp2", -126.f, 126.f, 0, 9.5e-8, fast_exp2, fast_exp2_block, exp2 },
+	{ "fast_log2", 0x1p-126f, 0x1.fffffep127f, 0, 3.7e-7, fast_log2, fast_log2_block, log2 },
+	{ "fast_sin_turns", -4.f, 4.f, 2.0e-7, 0, fast_sin_turns, fast_sin_turns_block, exact_sin_turns, true },
+	{ "fast_sin_turns", -0x1p22f, 0x1p22f, 2.0e-7, 0, fast_sin_turns, fast_sin_turns_block, exact_sin_turns, true },
+	{ "fast_tanh", -20.f, 20.f, 1.4e-7, 6.2e-7, fast_tanh, fast_tanh_block, tanh },
+};
+
+// fast_sin has no _block form
+static void measure_sin(float lo, float hi, double max_abs)
+{
+	struct worst w = { 0 };
+	long count = (1L << 24) >> sin_points_shift;
+	for (long i = 0; i < count; i++) {
+		float x = (float)(lo + ((double)hi - lo) * i / (count - 1));
+		note_error(&w, x, fast_sin(x), sin(x));
+	}
+	struct error_range r = { "fast_sin", lo, hi, max_abs };
+	check_worst(&r, "scalar", &w, count);
+}
+
+// what the header promises besides the error bounds
+static void test_edges(void)
+{
+	CHECK(fast_exp2(0.f) == 1.f, "fast_exp2(0) = %.9g", fast_exp2(0.f));
+	CHECK(fast_log2(1.f) == 0.f, "fast_log2(1) = %.9g", fast_log2(1.f));
+	const float clamped[] = { -1000.f, 1000.f, -INFINITY, INFINITY };
+	for (size_t i = 0; i < sizeof(clamped) / sizeof(clamped[0]); i++) {
+		float y = fast_exp2(clamped[i]);
+		CHECK(y > 0.f && isfinite(y), "fast_exp2(%g) = %g", clamped[i], y);
+	}
+	CHECK(fast_tanh(100.f) == 1.f && fast_tanh(-100.f) == -1.f, "fast_tanh(+-100) = %g, %g",
+	    fast_tanh(100.f), fast_tanh(-100.f));
+
+	// the _block forms take any n, and may work in place
+	float buf[7], want[7];
+	for (int i = 0; i < 7; i++) {
+		buf[i] = i * 0.3f - 1.f;
+		want[i] = fast_tanh(buf[i]);
+	}
+	fast_tanh_block(buf, buf, 7);
+	for (int i = 0; i < 7; i++) {
+		CHECK(fabsf(buf[i] - want[i]) < 1e-6f, "in place fast_tanh_block[%d] = %g, not %g", i, buf[i], want[i]);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1 && strcmp(argv[1], "-a") == 0) {
+		stride = 1;
+		sin_points_shift = 0;
+	}
+	test_edges();
+	for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+		measure(&ranges[i]);
+	}
+	measure_sin(-7.f, 7.f, 6.4e-7);
+	measure_sin(-1000.f, 1000.f, 8.8e-5);
+	return check_done("fast_math_accuracy");
+}
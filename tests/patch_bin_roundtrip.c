@@ -0,0 +1,239 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Round trip of the binary patch format (common/patch_bin.h): every text
+// patch in sound-patches/ compiles, encodes, loads back and encodes again to
+// the same bytes, with the oscillators' inputs rebased onto the loaded
+// patch. Truncated and corrupted binaries, and oscillators holding values the
+// text compiler never produces, must be refused, leaving the patch they were
+// loaded into untouched.
+
+#include <dirent.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/crc32.h"
+#include "../common/patch_bin.h"
+#include "../common/synth.h"
+#include "check.h"
+
+#define NUM_SLOTS (NUM_OSCS * NUM_OSC_TYPES)
+
+static struct patch compiled, loaded, untouched;
+
+static char* read_file(const char* path, size_t* len)
+{
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	long n = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char* buf = malloc(n + 1);
+	*len = fread(buf, 1, n, f);
+	buf[*len] = '\0';
+	fclose(f);
+	return buf;
+}
+
+// the slot an input points at, -1 for none, or -2 if it points outside p
+static int slot_of(const struct patch* p, const struct osc* input)
+{
+	if (input == NULL) {
+		return -1;
+	}
+	if (input < p->oscs || input >= p->oscs + NUM_SLOTS) {
+		return -2;
+	}
+	return input - p->oscs;
+}
+
+static void check_inputs(const char* name)
+{
+	for (int i = 0; i < NUM_SLOTS; i++) {
+		const struct osc* a = &compiled.oscs[i];
+		const struct osc* b = &loaded.oscs[i];
+		CHECK(slot_of(&loaded, b->phase_input) == slot_of(&compiled, a->phase_input),
+		    "%s: slot %d phase_input is slot %d, compiled %d", name, i, slot_of(&loaded, b->phase_input), slot_of(&compiled, a->phase_input));
+		CHECK(slot_of(&loaded, b->amp_input) == slot_of(&compiled, a->amp_input),
+		    "%s: slot %d amp_input is slot %d, compiled %d", name, i, slot_of(&loaded, b->amp_input), slot_of(&compiled, a->amp_input));
+	}
+	CHECK(loaded.num_active == compiled.num_active && memcmp(loaded.active, compiled.active, sizeof(loaded.active)) == 0,
+	    "%s: active oscillators differ", name);
+}
+
+// loading bin must fail, and leave the patch as it was
+static void check_refused(const char* name, const void* bin, size_t len, const char* what)
+{
+	memcpy(&loaded, &untouched, sizeof(struct patch));
+	CHECK(patch_bin_load(bin, len, &loaded) != 0, "%s: %s was loaded", name, what);
+	CHECK(memcmp(&loaded, &untouched, sizeof(struct patch)) == 0, "%s: refusing %s changed the patch", name, what);
+}
+
+// rewrites the checksum, so a broken record gets past it to the validation
+static void fix_crc(uint8_t* bin, size_t len)
+{
+	struct patch_bin_header h;
+	memcpy(&h, bin, sizeof(h));
+	h.crc32 = crc32(bin + sizeof(h), len - sizeof(h));
+	memcpy(bin, &h, sizeof(h));
+}
+
+static void check_corruption(const char* name, const uint8_t* bin, size_t len)
+{
+	uint8_t* bad = malloc(len);
+
+	for (size_t n = 0; n < len; n++) {
+		check_refused(name, bin, n, "a truncated binary");
+	}
+
+	// any flipped bit fails the checksum, or the header checks; the
+	// header's reserved field is the only thing nothing reads
+	const size_t reserved = offsetof(struct patch_bin_header, reserved);
+	for (size_t i = 0; i < len; i++) {
+		if (i >= reserved && i < reserved + sizeof(uint32_t)) {
+			continue;
+		}
+		for (int bit = 0; bit < 8; bit++) {
+			memcpy(bad, bin, len);
+			bad[i] ^= 1 << bit;
+			check_refused(name, bad, len, "a flipped bit");
+		}
+	}
+
+	// records that are wrong but checksummed correctly
+	const size_t first = sizeof(struct patch_bin_header);
+	memcpy(bad, bin, len);
+	bad[first + 1] = 0;
+	fix_crc(bad, len);
+	check_refused(name, bad, len, "a zero sized record");
+
+	memcpy(bad, bin, len);
+	bad[first + 1] = 255;
+	fix_crc(bad, len);
+	check_refused(name, bad, len, "a record running past the end");
+
+	memcpy(bad, bin, len);
+	((struct patch_bin_header*)bad)->num_records++;
+	fix_crc(bad, len);
+	check_refused(name, bad, len, "a record count that's too high");
+
+	for (size_t i = first; i + 2 <= len; i += bin[i + 1]) {
+		if (bin[i] != PATCH_BIN_REC_OSC) {
+			continue;
+		}
+		memcpy(bad, bin, len);
+		bad[i + offsetof(struct patch_bin_osc, index)] = NUM_SLOTS;
+		fix_crc(bad, len);
+		check_refused(name, bad, len, "an oscillator slot out of range");
+
+		memcpy(bad, bin, len);
+		bad[i + offsetof(struct patch_bin_osc, phase_input)] = NUM_SLOTS;
+		fix_crc(bad, len);
+		check_refused(name, bad, len, "a phase input out of range");
+
+		memcpy(bad, bin, len);
+		bad[i + offsetof(struct patch_bin_osc, amp_input)] = NUM_SLOTS;
+		fix_crc(bad, len);
+		check_refused(name, bad, len, "an amp input out of range");
+
+		memcpy(bad, bin, len);
+		bad[i + offsetof(struct patch_bin_osc, wave_type)] = 0xee;
+		fix_crc(bad, len);
+		check_refused(name, bad, len, "an unknown wave type");
+
+		static const struct {
+			size_t field;
+			float value;
+			const char* what;
+		} floats[] = {
+			{ offsetof(struct patch_bin_osc, sustain), NAN, "a NaN sustain" },
+			{ offsetof(struct patch_bin_osc, output_volume_m), INFINITY, "an infinite output" },
+			{ offsetof(struct patch_bin_osc, freq), -1.f, "a negative freq" },
+			{ offsetof(struct patch_bin_osc, attack), 0.f, "an attack below ATTACK_MIN" },
+			{ offsetof(struct patch_bin_osc, decay), -1.f, "a negative decay" },
+		};
+		for (size_t j = 0; j < sizeof(floats) / sizeof(floats[0]); j++) {
+			memcpy(bad, bin, len);
+			memcpy(bad + i + floats[j].field, &floats[j].value, sizeof(float));
+			fix_crc(bad, len);
+			check_refused(name, bad, len, floats[j].what);
+		}
+		break;
+	}
+	free(bad);
+}
+
+static void check_patch(const char* dir, const char* name)
+{
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	size_t len;
+	char* src = read_file(path, &len);
+	CHECK(src != NULL, "%s: can't read it", path);
+	if (src == NULL) {
+		return;
+	}
+	int err = patch_compile(src, len, &compiled);
+	free(src);
+	CHECK(err == 0, "%s: %s", path, load_patch_err());
+	if (err) {
+		return;
+	}
+
+	static uint8_t first[PATCH_BIN_MAX_SIZE], second[PATCH_BIN_MAX_SIZE];
+	size_t n1 = patch_bin_encode(&compiled, first, sizeof(first));
+	CHECK(n1 > 0, "%s: didn't encode", name);
+	CHECK(patch_bin_detect(first, n1), "%s: not detected as binary", name);
+
+	memset(&loaded, 0xa5, sizeof(struct patch));
+	err = patch_bin_load(first, n1, &loaded);
+	CHECK(err == 0, "%s: didn't load: %s", name, load_patch_err());
+	if (err) {
+		return;
+	}
+	size_t n2 = patch_bin_encode(&loaded, second, sizeof(second));
+	CHECK(n1 == n2 && memcmp(first, second, n1) == 0, "%s: encoded %zu bytes, re-encoded %zu different ones", name, n1, n2);
+	check_inputs(name);
+
+	memset(&untouched, 0x5a, sizeof(struct patch));
+	check_corruption(name, first, n1);
+	printf("  %s: %zu bytes\n", name, n1);
+}
+
+int main(int argc, char** argv)
+{
+	const char* dir = argc > 1 ? argv[1] : "sound-patches";
+	DIR* d = opendir(dir);
+	CHECK(d != NULL, "can't open %s", dir);
+	if (d == NULL) {
+		return check_done("patch_bin_roundtrip");
+	}
+	int num_patches = 0;
+	struct dirent* e;
+	while ((e = readdir(d)) != NULL) {
+		if (e->d_name[0] == '.') {
+			continue;
+		}
+		check_patch(dir, e->d_name);
+		num_patches++;
+	}
+	closedir(d);
+	CHECK(num_patches > 0, "no patches in %s", dir);
+	return check_done("patch_bin_roundtrip");
+}
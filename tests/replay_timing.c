@@ -0,0 +1,218 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Replay timing (engine_replay() in linux/engine.c): a capture recorded the
+// way the Pi records one must replay, sample for sample, as the Pi rendered
+// it. The reference here renders the same notes the way the Pi's
+// FillChunkBuff() and VoiceManager::produce_keys() do: a note played during
+// a block is stamped with, and starts at, the first sample of the next one,
+// and each sample's time is taken before the sample clock moves on.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/capture.h"
+#include "../common/controls.h"
+#include "../common/filter.h"
+#include "../common/midi.h"
+#include "../common/note_queue.h"
+#include "../common/parts.h"
+#include "../common/synth.h"
+#include "../linux/engine.h"
+#include "check.h"
+
+#define SAMPLE_RATE 48000
+#define BLOCK 1024
+#define NUM_BLOCKS 40
+#define NUM_SAMPLES (NUM_BLOCKS * BLOCK)
+
+static const char patch_src[] = "[vfo1]\n"
+				"type=saw_up\n"
+				"output=0.25\n"
+				"attack=0.01\n"
+				"release=0.05\n"
+				"[vfo2]\n"
+				"type=square\n"
+				"output=0.1\n"
+				"phase_input=lfo1\n"
+				"[lfo1]\n"
+				"freq=6\n"
+				"[filter]\n"
+				"cutoff=2000\n"
+				"resonance=0.4\n";
+
+// (block the note is played during, status, note, velocity)
+static const uint8_t played[][4] = {
+	{ 0, 0x90, 60, 100 },
+	{ 2, 0x90, 64, 90 },
+	{ 5, 0x90, 67, 80 },
+	{ 9, 0x80, 60, 0 },
+	{ 12, 0x90, 72, 127 },
+	{ 12, 0x80, 64, 0 },
+	{ 20, 0x80, 67, 0 },
+	{ 25, 0x90, 60, 70 },
+	{ 31, 0x80, 72, 0 },
+	{ 35, 0x80, 60, 0 },
+};
+#define NUM_PLAYED (sizeof(played) / sizeof(played[0]))
+
+static struct patch patch;
+static struct capture capture;
+static int16_t replayed[NUM_SAMPLES];
+static int16_t reference[NUM_SAMPLES];
+
+static unsigned char dump[1 << 20];
+static size_t dump_len;
+
+static void write_dump(void* user, const void* data, size_t n)
+{
+	CHECK(dump_len + n <= sizeof(dump), "dump doesn't fit");
+	if (dump_len + n <= sizeof(dump)) {
+		memcpy(dump + dump_len, data, n);
+		dump_len += n;
+	}
+}
+
+static int write_file(const char* path, const void* data, size_t len)
+{
+	FILE* f = fopen(path, "wb");
+	if (f == NULL || fwrite(data, 1, len, f) != len) {
+		fprintf(stderr, "failed to write %s\n", path);
+		return 1;
+	}
+	fclose(f);
+	return 0;
+}
+
+// what the Pi records: the patch, then each note stamped with the block after
+// the one it was played during
+static void record(void)
+{
+	struct part_setup setup;
+	part_setup_default(&setup);
+	capture_init(&capture, SAMPLE_RATE, BLOCK);
+	capture_set_parts(&capture, &setup);
+	capture_patch(&capture, 0, 0, &patch);
+	for (uint32_t b = 0; b < NUM_BLOCKS; b++) {
+		capture_set_clock(&capture, (b + 1) * BLOCK);
+		for (size_t i = 0; i < NUM_PLAYED; i++) {
+			if (played[i][0] == b) {
+				capture_midi(&capture, &played[i][1]);
+			}
+		}
+	}
+	capture_dump(&capture, write_dump, NULL, NUM_SAMPLES);
+
+	const struct capture_event* events;
+	const struct capture_header* h = capture_parse(dump, dump_len, &events);
+	CHECK(h != NULL, "the capture doesn't parse");
+	int notes = 0;
+	for (uint32_t i = 0; h != NULL && i < h->num_events; i++) {
+		if (events[i].type != CAPTURE_MIDI) {
+			continue;
+		}
+		CHECK(events[i].sample == (played[notes][0] + 1u) * BLOCK, "note %d stamped %u, not %u",
+		    notes, events[i].sample, (played[notes][0] + 1u) * BLOCK);
+		notes++;
+	}
+	CHECK(notes == (int)NUM_PLAYED, "%d of %zu notes captured", notes, NUM_PLAYED);
+}
+
+static unsigned char arena_mem[ARENA_SIZE(sizeof(struct key) * MAX_KEYS) + MAX_KEYS * SYNTH_OSC_ARENA_BYTES];
+
+// the notes, rendered the Pi's way with a single renderer
+static void render_reference(void)
+{
+	static struct parts parts;
+	static struct note_queue notes;
+	static struct filter_bank filters;
+	static struct control_snapshot snap;
+	struct arena arena;
+	struct key* keys;
+	arena_init(&arena, arena_mem, sizeof(arena_mem));
+	CHECK(synth_new(&keys, &arena, &arena, 1) == 0, "synth_new");
+	struct part_setup setup;
+	part_setup_default(&setup);
+	parts_init(&parts, &setup, &patch);
+	note_queue_init(&notes);
+	filter_bank_init(&filters);
+
+	unsigned long tick = 0;
+	const float dt = 1.f / SAMPLE_RATE;
+	for (uint32_t b = 0; b < NUM_BLOCKS; b++) {
+		// played during the previous block, latched at the start of this one
+		for (size_t i = 0; b > 0 && i < NUM_PLAYED; i++) {
+			if (played[i][0] == b - 1) {
+				midi_apply(&played[i][1], &notes, &parts);
+			}
+		}
+		note_queue_apply(&notes, keys, &parts, ((float)tick) / SAMPLE_RATE);
+		snap = *controls_publish(&parts.controls[0], parts.patch[0], SAMPLE_RATE, BLOCK);
+
+		unsigned char voices[MAX_KEYS];
+		int first[MAX_PARTS + 1];
+		parts_group(keys, 0, MAX_KEYS, 1, voices, first);
+		struct params params;
+		for (int n = 0; n < BLOCK; n++) {
+			if (n % CONTROL_BLOCK == 0) {
+				controls_step(&snap, &params, keys, voices, MAX_KEYS);
+				filter_bank_update(&filters, keys, 0, MAX_KEYS, SAMPLE_RATE);
+			}
+			float t = ((float)tick) / SAMPLE_RATE;
+			tick++;
+			for (int v = 0; v < MAX_KEYS; v++) {
+				filters.in[voices[v]] = key_render(&keys[voices[v]], &params, t, dt);
+			}
+			float out = filter_bank_render(&filters, MAX_KEYS);
+			out = out > 1.f ? 1.f : out < -1.f ? -1.f : out;
+			reference[b * BLOCK + n] = out * 32700;
+		}
+	}
+}
+
+int main(void)
+{
+	CHECK(patch_compile(patch_src, sizeof(patch_src) - 1, &patch) == 0, "%s", load_patch_err());
+	record();
+	render_reference();
+
+	const char* patch_path = "_test/replay_timing.txt";
+	const char* capture_path = "_test/replay_timing.bin";
+	if (write_file(patch_path, patch_src, sizeof(patch_src) - 1) || write_file(capture_path, dump, dump_len)) {
+		return 1;
+	}
+	CHECK(engine_init(patch_path) == 0, "engine_init");
+	CHECK(engine_replay(capture_path, replayed, NUM_SAMPLES) == 0, "engine_replay");
+
+	int first_diff = -1, differing = 0;
+	for (int i = 0; i < NUM_SAMPLES; i++) {
+		if (replayed[i] != reference[i]) {
+			first_diff = first_diff < 0 ? i : first_diff;
+			differing++;
+		}
+	}
+	CHECK(differing == 0, "%d samples differ from the Pi's, the first at %d (block %d + %d): %d, not %d",
+	    differing, first_diff, first_diff / BLOCK, first_diff % BLOCK,
+	    first_diff < 0 ? 0 : replayed[first_diff], first_diff < 0 ? 0 : reference[first_diff]);
+
+	// and the notes were heard at all
+	int loud = 0;
+	for (int i = 0; i < NUM_SAMPLES; i++) {
+		loud += abs(reference[i]) > 1000;
+	}
+	CHECK(loud > NUM_SAMPLES / 4, "only %d loud samples", loud);
+	return check_done("replay_timing");
+}
@@ -0,0 +1,211 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Stress test for the render-ahead ring (linux/ring.h): its overrun and
+// underrun accounting, that nothing is lost or reordered between a producer
+// and consumer racing each other, and that a ring sized for a device serves
+// the device's first, whole-buffer request.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../linux/ring.h"
+#include "check.h"
+
+// exact counts, one thread
+static void test_accounting(void)
+{
+	struct ring r;
+	CHECK(ring_init(&r, 60, 16, 64) == 0, "init");
+	CHECK(r.capacity == 64, "capacity %zu not rounded up to 64", r.capacity);
+
+	int16_t* p;
+	CHECK(ring_write_ptr(&r, &p) == 64, "empty ring has all its space");
+	for (int i = 0; i < 64; i++) {
+		p[i] = i + 1;
+	}
+	ring_commit(&r, 64);
+	CHECK(ring_fill(&r) == 64, "fill %zu", ring_fill(&r));
+	CHECK(ring_write_ptr(&r, &p) == 0, "full ring has no space");
+	CHECK(ring_write_ptr(&r, &p) == 0, "full ring has no space");
+	CHECK(r.overruns == 2, "overruns %lu", r.overruns);
+
+	int16_t out[100];
+	ring_read(&r, out, 40);
+	CHECK(r.underruns == 0, "underruns %lu", r.underruns);
+	CHECK(out[0] == 1 && out[39] == 40, "read back %d..%d", out[0], out[39]);
+
+	// the free space wraps; the write pointer only ever offers the part up
+	// to the end of the buffer
+	CHECK(ring_write_ptr(&r, &p) == 40, "space up to the wrap");
+	ring_commit(&r, 0);
+
+	memset(out, 0x55, sizeof(out));
+	ring_read(&r, out, 30);
+	CHECK(r.underruns == 1, "short read counts one underrun, got %lu", r.underruns);
+	CHECK(out[0] == 41 && out[23] == 64, "read back %d..%d", out[0], out[23]);
+	bool padded = true;
+	for (int i = 24; i < 30; i++) {
+		padded = padded && out[i] == 0;
+	}
+	CHECK(padded, "short read padded with silence");
+	CHECK(ring_fill(&r) == 0, "drained");
+
+	ring_read(&r, out, 10);
+	CHECK(r.underruns == 2, "empty read counts an underrun, got %lu", r.underruns);
+	ring_free(&r);
+}
+
+// The watermarks main.c uses with -r: filled up front, the ring covers a
+// request for the device's whole buffer, and wakes the producer after it.
+// With the producer stopping two periods ahead, as it once did, this read
+// underran.
+static void test_device_sizing(void)
+{
+	const size_t period = 64;
+	const size_t buffer = 2048;
+	struct ring r;
+	CHECK(ring_init_for_device(&r, buffer, period, buffer) != 0, "a ring smaller than buffer + period is refused");
+	CHECK(ring_init_for_device(&r, buffer + period, period, buffer) == 0, "init");
+	CHECK(r.high_watermark == r.capacity, "high watermark %zu of %zu", r.high_watermark, r.capacity);
+
+	while (ring_fill(&r) < r.high_watermark) {
+		int16_t* p;
+		size_t n = ring_write_ptr(&r, &p);
+		memset(p, 1, n * sizeof(int16_t));
+		ring_commit(&r, n);
+	}
+	int16_t* out = malloc(buffer * sizeof(int16_t));
+	ring_read(&r, out, buffer);
+	CHECK(r.underruns == 0, "the first request for a whole buffer underran");
+	while (ring_fill(&r) >= r.low_watermark) {
+		ring_read(&r, out, period);
+	}
+	CHECK(r.underruns == 0, "the producer is woken while at least a buffer is left");
+	CHECK(r.high_watermark - r.low_watermark >= period, "the producer wakes to at least a period of room");
+	free(out);
+	ring_free(&r);
+}
+
+// A producer writing a counting sequence in random sized chunks, and a
+// consumer reading random sized requests as fast as it can, so it underruns
+// often. Every sample that isn't underrun padding
+// must be the next in the sequence, and the counts must match what each
+// side saw.
+
+#define STRESS_READS 100000
+#define STRESS_MAX_CHUNK 300
+
+struct stress {
+	struct ring ring;
+	volatile bool stop;
+	unsigned long full; // times the producer found no space
+	unsigned seed;
+};
+
+static int16_t sequence(unsigned long i)
+{
+	return (int16_t)(i % 32767 + 1); // never 0, which is padding
+}
+
+static void* stress_producer(void* arg)
+{
+	struct stress* s = arg;
+	unsigned long next = 0;
+	while (!s->stop) {
+		ring_wait(&s->ring);
+		int16_t* p;
+		size_t n = ring_write_ptr(&s->ring, &p);
+		if (n == 0) {
+			s->full++;
+			continue;
+		}
+		size_t chunk = 1 + rand_r(&s->seed) % STRESS_MAX_CHUNK;
+		if (n > chunk) {
+			n = chunk;
+		}
+		for (size_t i = 0; i < n; i++) {
+			p[i] = sequence(next++);
+		}
+		ring_commit(&s->ring, n);
+		if (rand_r(&s->seed) % 8 == 0) {
+			usleep(rand_r(&s->seed) % 50);
+		}
+	}
+	return NULL;
+}
+
+static void test_stress(size_t capacity, size_t low, size_t high)
+{
+	struct stress s;
+	memset(&s, 0, sizeof(s));
+	s.seed = 1234;
+	CHECK(ring_init(&s.ring, capacity, low, high) == 0, "init");
+
+	pthread_t producer;
+	CHECK(pthread_create(&producer, NULL, stress_producer, &s) == 0, "thread");
+
+	unsigned seed = 5678;
+	unsigned long expect = 0;
+	unsigned long short_reads = 0;
+	bool in_order = true;
+	bool padding_at_end = true;
+	int16_t out[STRESS_MAX_CHUNK];
+	for (int r = 0; r < STRESS_READS; r++) {
+		size_t n = 1 + rand_r(&seed) % STRESS_MAX_CHUNK;
+		ring_read(&s.ring, out, n);
+		size_t got = 0;
+		while (got < n && out[got] != 0) {
+			in_order = in_order && out[got] == sequence(expect);
+			expect++;
+			got++;
+		}
+		if (got < n) {
+			short_reads++;
+			for (size_t i = got; i < n; i++) {
+				padding_at_end = padding_at_end && out[i] == 0;
+			}
+		}
+		if (rand_r(&seed) % 16 == 0) {
+			usleep(rand_r(&seed) % 100);
+		}
+	}
+
+	s.stop = true;
+	ring_wake(&s.ring);
+	pthread_join(producer, NULL);
+
+	CHECK(in_order, "samples lost or reordered (capacity %zu)", capacity);
+	CHECK(padding_at_end, "silence only pads the end of a short read (capacity %zu)", capacity);
+	CHECK(s.ring.underruns == short_reads, "%lu underruns counted, %lu short reads seen", s.ring.underruns, short_reads);
+	CHECK(s.ring.overruns == s.full, "%lu overruns counted, producer found the ring full %lu times", s.ring.overruns, s.full);
+	CHECK(expect > 0, "nothing got through");
+	printf("  capacity %zu: %lu samples through, %lu underruns, %lu overruns\n", capacity, expect, s.ring.underruns, s.ring.overruns);
+	ring_free(&s.ring);
+}
+
+int main(void)
+{
+	test_accounting();
+	test_device_sizing();
+	test_stress(64, 16, 48);
+	test_stress(1024, 256, 1024);
+	test_stress(4096, 2048, 4096);
+	return check_done("ring_stress");
+}
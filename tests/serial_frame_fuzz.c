@@ -0,0 +1,425 @@
+// Copyright (C) 2025  Alex Couture-Beil <alex@mofo.ca>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Fuzz test for the serial framing (common/serial_frame.h) and its CRC32
+// (common/crc32.h). Random streams of frames, control strings and junk are
+// fed in random sized pieces, down to a byte at a time, and must produce
+// exactly the events they were built from: good frames with their payloads,
+// corrupted checksums, oversize and empty payloads, frames cut short by the
+// next one, and magic strings overlapping each other and the junk around
+// them. The CRC is checked against zlib's known values and a bitwise
+// reference, so the slice-by-8 tables are too.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/crc32.h"
+#include "../common/serial_frame.h"
+#include "check.h"
+
+#define PAYLOAD_CAP 512
+#define STREAM_CAP (1 << 20)
+#define MAX_EVENTS 4096
+#define NUM_STREAMS 300
+
+// the plain, bit at a time CRC-32 that zlib.crc32 computes
+static uint32_t crc32_bitwise(const uint8_t* data, size_t len)
+{
+	uint32_t crc = 0xffffffff;
+	for (size_t i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (int b = 0; b < 8; b++) {
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+static void test_crc32(void)
+{
+	static const struct {
+		const char* s;
+		uint32_t crc; // zlib.crc32(s)
+	} vectors[] = {
+		{ "", 0x00000000 },
+		{ "a", 0xe8b7be43 },
+		{ "abc", 0x352441c2 },
+		{ "message digest", 0x20159d7f },
+		{ "123456789", 0xcbf43926 },
+		{ "abcdefghijklmnopqrstuvwxyz", 0x4c2750bd },
+		{ "The quick brown fox jumps over the lazy dog", 0x414fa339 },
+		{ "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", 0x1fc2e6d2 },
+	};
+	for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		uint32_t got = crc32((const uint8_t*)vectors[i].s, strlen(vectors[i].s));
+		CHECK(got == vectors[i].crc, "crc32(\"%s\") = %08x, zlib says %08x", vectors[i].s, got, vectors[i].crc);
+	}
+
+	static uint8_t zeros[4096];
+	CHECK(crc32(zeros, sizeof(zeros)) == 0xc71c0011, "crc32 of 4096 zero bytes = %08x", crc32(zeros, sizeof(zeros)));
+
+	// every length and alignment around the 8 byte slices, and chained
+	// over arbitrary splits
+	static uint8_t buf[1024 + 8];
+	unsigned seed = 42;
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		buf[i] = rand_r(&seed);
+	}
+	for (size_t align = 0; align < 8; align++) {
+		for (size_t len = 0; len <= 1024; len += len < 64 ? 1 : 37) {
+			const uint8_t* p = buf + align;
+			uint32_t want = crc32_bitwise(p, len);
+			CHECK(crc32(p, len) == want, "crc32 of %zu bytes at offset %zu", len, align);
+			size_t split = len ? rand_r(&seed) % len : 0;
+			uint32_t chained = crc32_update(crc32_update(0, p, split), p + split, len - split);
+			CHECK(chained == want, "crc32_update split at %zu of %zu bytes", split, len);
+		}
+	}
+}
+
+// what the parser should report, in order
+struct event {
+	int type;
+	size_t len;
+	size_t offset; // of the payload in the stream
+};
+
+struct stream {
+	uint8_t* data;
+	size_t len;
+	struct event events[MAX_EVENTS];
+	int num_events;
+	size_t magic_at[MAX_EVENTS]; // where each magic string was deliberately put
+	int num_magics;
+	unsigned first_seed; // to tell which stream failed
+	unsigned seed;
+};
+
+static const char* const magics[] = {
+	SERIAL_FRAME_PATCH_MAGIC,
+	SERIAL_FRAME_PARAMS_MAGIC,
+	SERIAL_FRAME_REBOOT_MAGIC,
+	SERIAL_FRAME_TRACE_MAGIC,
+	SERIAL_FRAME_CAPTURE_MAGIC,
+	SERIAL_FRAME_BANK_MAGIC,
+};
+#define NUM_MAGICS (int)(sizeof(magics) / sizeof(magics[0]))
+
+static const int control_events[] = {
+	SERIAL_FRAME_REBOOT,
+	SERIAL_FRAME_TRACE,
+	SERIAL_FRAME_CAPTURE,
+	SERIAL_FRAME_BANK,
+};
+
+static unsigned rnd(struct stream* s, unsigned n)
+{
+	return rand_r(&s->seed) % n;
+}
+
+static void put(struct stream* s, const void* p, size_t n)
+{
+	memcpy(s->data + s->len, p, n);
+	s->len += n;
+}
+
+static void put_magic(struct stream* s, const char* m)
+{
+	s->magic_at[s->num_magics++] = s->len;
+	put(s, m, strlen(m));
+}
+
+static void expect(struct stream* s, int type, size_t len, size_t offset)
+{
+	s->events[s->num_events].type = type;
+	s->events[s->num_events].len = len;
+	s->events[s->num_events].offset = offset;
+	s->num_events++;
+}
+
+static void put_header(struct stream* s, unsigned len, uint32_t crc)
+{
+	uint8_t h[6] = { len, len >> 8, crc, crc >> 8, crc >> 16, crc >> 24 };
+	put(s, h, sizeof(h));
+}
+
+// Junk that looks a lot like the start of a frame: random bytes mixed with
+// prefixes of the magic strings, which the parser has to back out of.
+static void put_junk(struct stream* s)
+{
+	int pieces = rnd(s, 6);
+	for (int i = 0; i < pieces; i++) {
+		if (rnd(s, 2)) {
+			const char* m = magics[rnd(s, NUM_MAGICS)];
+			put(s, m, rnd(s, strlen(m)));
+		} else {
+			for (int n = rnd(s, 40); n > 0; n--) {
+				uint8_t c = rnd(s, 256);
+				put(s, &c, 1);
+			}
+		}
+	}
+}
+
+static size_t random_len(struct stream* s)
+{
+	switch (rnd(s, 6)) {
+	case 0:
+		return 0;
+	case 1:
+		return PAYLOAD_CAP;
+	case 2:
+		return 1 + rnd(s, 8);
+	default:
+		return rnd(s, PAYLOAD_CAP + 1);
+	}
+}
+
+static void put_frame(struct stream* s, bool corrupt)
+{
+	bool params = rnd(s, 2);
+	size_t len = random_len(s);
+	uint8_t payload[PAYLOAD_CAP];
+	for (size_t i = 0; i < len; i++) {
+		payload[i] = rnd(s, 256);
+	}
+	uint32_t crc = crc32(payload, len);
+	if (corrupt) {
+		crc ^= 1u << rnd(s, 32);
+	}
+	put_magic(s, params ? SERIAL_FRAME_PARAMS_MAGIC : SERIAL_FRAME_PATCH_MAGIC);
+	put_header(s, len, crc);
+	expect(s, corrupt ? SERIAL_FRAME_BAD_CRC : params ? SERIAL_FRAME_PARAMS : SERIAL_FRAME_PATCH, len, s->len);
+	put(s, payload, len);
+}
+
+static void put_item(struct stream* s)
+{
+	switch (rnd(s, 8)) {
+	case 0:
+	case 1:
+		put_frame(s, false);
+		break;
+	case 2:
+		put_frame(s, true);
+		break;
+	case 3: {
+		// more than fits; what was announced never arrives, and the next
+		// frame is found regardless
+		unsigned len = PAYLOAD_CAP + 1 + rnd(s, 65535 - PAYLOAD_CAP);
+		put_magic(s, rnd(s, 2) ? SERIAL_FRAME_PATCH_MAGIC : SERIAL_FRAME_PARAMS_MAGIC);
+		put_header(s, len, rnd(s, 1u << 31));
+		expect(s, SERIAL_FRAME_TOO_LONG, len, 0);
+		break;
+	}
+	case 4: {
+		// a frame cut short part way through its payload by the next one,
+		// and dropped without an event; until the next magic is complete
+		// its bytes are still payload, so there must be more than a magic
+		// string's worth left or it completes (with a bad crc) first
+		put_magic(s, rnd(s, 2) ? SERIAL_FRAME_PATCH_MAGIC : SERIAL_FRAME_PARAMS_MAGIC);
+		unsigned len = SERIAL_FRAME_MAX_MAGIC + rnd(s, PAYLOAD_CAP - SERIAL_FRAME_MAX_MAGIC);
+		put_header(s, len, rnd(s, 1u << 31));
+		for (unsigned n = rnd(s, len - SERIAL_FRAME_MAX_MAGIC + 1); n > 0; n--) {
+			uint8_t c = rnd(s, 256);
+			put(s, &c, 1);
+		}
+		put_frame(s, false);
+		break;
+	}
+	case 5: {
+		int c = rnd(s, 4);
+		put_magic(s, magics[2 + c]);
+		expect(s, control_events[c], 0, 0);
+		break;
+	}
+	case 6: {
+		// a magic string starting over part way through itself, or through
+		// another one
+		const char* m = magics[rnd(s, NUM_MAGICS)];
+		put(s, m, 1 + rnd(s, strlen(m) - 1));
+		int c = rnd(s, 4);
+		put_magic(s, magics[2 + c]);
+		expect(s, control_events[c], 0, 0);
+		break;
+	}
+	default:
+		put_junk(s);
+		break;
+	}
+}
+
+// true if every magic string in the stream is one put there on purpose, so
+// the junk and payloads didn't happen to spell one out
+static bool only_deliberate_magics(const struct stream* s)
+{
+	for (int m = 0; m < NUM_MAGICS; m++) {
+		size_t n = strlen(magics[m]);
+		for (size_t i = 0; i + n <= s->len; i++) {
+			if (memcmp(s->data + i, magics[m], n) != 0) {
+				continue;
+			}
+			bool deliberate = false;
+			for (int k = 0; k < s->num_magics && !deliberate; k++) {
+				deliberate = s->magic_at[k] == i;
+			}
+			if (!deliberate) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static void build_stream(struct stream* s, unsigned seed)
+{
+	do {
+		s->first_seed = s->seed = seed++;
+		s->len = 0;
+		s->num_events = 0;
+		s->num_magics = 0;
+		while (s->num_events < MAX_EVENTS - 4 && s->len < STREAM_CAP - 4 * PAYLOAD_CAP) {
+			put_item(s);
+			if (rnd(s, 64) == 0) {
+				break;
+			}
+		}
+	} while (!only_deliberate_magics(s));
+}
+
+static void feed_stream(const struct stream* s, unsigned seed, int max_chunk)
+{
+	static uint8_t payload[PAYLOAD_CAP];
+	struct serial_frame f;
+	serial_frame_init(&f, payload, sizeof(payload));
+
+	int n = 0;
+	size_t pos = 0;
+	while (pos < s->len) {
+		size_t chunk = 1 + rand_r(&seed) % max_chunk;
+		if (chunk > s->len - pos) {
+			chunk = s->len - pos;
+		}
+		size_t end = pos + chunk;
+		while (pos < end) {
+			size_t consumed;
+			int type = serial_frame_feed(&f, s->data + pos, end - pos, &consumed);
+			CHECK(consumed > 0 && consumed <= end - pos, "consumed %zu of %zu", consumed, end - pos);
+			pos += consumed;
+			if (type == SERIAL_FRAME_NONE) {
+				continue;
+			}
+			if (n >= s->num_events) {
+				CHECK(false, "stream %u: unexpected event %d at byte %zu", s->first_seed, type, pos);
+				return;
+			}
+			const struct event* e = &s->events[n++];
+			CHECK(type == e->type, "stream %u: event %d is %d, expected %d (byte %zu)", s->first_seed, n, type, e->type, pos);
+			if (type != e->type) {
+				return;
+			}
+			if (type == SERIAL_FRAME_PATCH || type == SERIAL_FRAME_PARAMS) {
+				CHECK(f.payload_len == e->len, "stream %u: event %d has %zu bytes, expected %zu", s->first_seed, n, f.payload_len, e->len);
+				CHECK(memcmp(f.payload, s->data + e->offset, e->len) == 0, "stream %u: event %d payload differs", s->first_seed, n);
+			}
+			if (type == SERIAL_FRAME_TOO_LONG) {
+				CHECK(f.payload_len == e->len, "stream %u: too long announced %zu, expected %zu", s->first_seed, f.payload_len, e->len);
+			}
+		}
+	}
+	CHECK(n == s->num_events, "stream %u: %d events, expected %d", s->first_seed, n, s->num_events);
+}
+
+static void test_fuzz(void)
+{
+	static struct stream s;
+	static uint8_t data[STREAM_CAP];
+	s.data = data;
+	unsigned long bytes = 0, events = 0;
+	for (unsigned i = 0; i < NUM_STREAMS; i++) {
+		build_stream(&s, i * 1000);
+		feed_stream(&s, i, 1);
+		feed_stream(&s, i, 7);
+		feed_stream(&s, i, 300);
+		feed_stream(&s, i, STREAM_CAP);
+		bytes += s.len;
+		events += s.num_events;
+	}
+	printf("  %u streams, %lu bytes, %lu events, each fed 4 ways\n", NUM_STREAMS, bytes, events);
+}
+
+// the cases the fuzzer only hits by chance, spelled out
+static void test_edges(void)
+{
+	static struct stream s;
+	static uint8_t data[4096];
+	s.data = data;
+
+	// an empty payload completes with its header
+	s.len = s.num_events = s.num_magics = 0;
+	put_magic(&s, SERIAL_FRAME_PATCH_MAGIC);
+	put_header(&s, 0, 0);
+	expect(&s, SERIAL_FRAME_PATCH, 0, s.len);
+	// exactly the capacity fits, one more doesn't
+	uint8_t full[PAYLOAD_CAP];
+	memset(full, 'x', sizeof(full));
+	put_magic(&s, SERIAL_FRAME_PARAMS_MAGIC);
+	put_header(&s, PAYLOAD_CAP, crc32(full, PAYLOAD_CAP));
+	expect(&s, SERIAL_FRAME_PARAMS, PAYLOAD_CAP, s.len);
+	put(&s, full, PAYLOAD_CAP);
+	put_magic(&s, SERIAL_FRAME_PATCH_MAGIC);
+	put_header(&s, PAYLOAD_CAP + 1, 0);
+	expect(&s, SERIAL_FRAME_TOO_LONG, PAYLOAD_CAP + 1, 0);
+	put_magic(&s, SERIAL_FRAME_PATCH_MAGIC);
+	put_header(&s, 65535, 0);
+	expect(&s, SERIAL_FRAME_TOO_LONG, 65535, 0);
+	// the same magic twice over, and one interrupted by another
+	put(&s, "here-comes-a-new-", 17);
+	put_magic(&s, SERIAL_FRAME_REBOOT_MAGIC);
+	expect(&s, SERIAL_FRAME_REBOOT, 0, 0);
+	put(&s, "send-me-the-", 12);
+	put_magic(&s, SERIAL_FRAME_TRACE_MAGIC);
+	expect(&s, SERIAL_FRAME_TRACE, 0, 0);
+	put(&s, "send-me-the-trace-", 18);
+	put_magic(&s, SERIAL_FRAME_CAPTURE_MAGIC);
+	expect(&s, SERIAL_FRAME_CAPTURE, 0, 0);
+	put_magic(&s, SERIAL_FRAME_BANK_MAGIC);
+	expect(&s, SERIAL_FRAME_BANK, 0, 0);
+	put_magic(&s, SERIAL_FRAME_BANK_MAGIC);
+	expect(&s, SERIAL_FRAME_BANK, 0, 0);
+	// a magic part way through a payload starts a new frame
+	put_magic(&s, SERIAL_FRAME_PATCH_MAGIC);
+	put_header(&s, 100, 0);
+	put(&s, "abc", 3);
+	put_magic(&s, SERIAL_FRAME_PATCH_MAGIC);
+	put_header(&s, 3, crc32((const uint8_t*)"xyz", 3));
+	expect(&s, SERIAL_FRAME_PATCH, 3, s.len);
+	put(&s, "xyz", 3);
+
+	s.first_seed = 0;
+	for (int chunk = 1; chunk <= 64; chunk *= 2) {
+		feed_stream(&s, chunk, chunk);
+	}
+}
+
+int main(void)
+{
+	test_crc32();
+	test_edges();
+	test_fuzz();
+	return check_done("serial_frame_fuzz");
+}
@@ -0,0 +1,54 @@
+import serial
+import sys
+import time
+
+# Asks the Pi for what it has been played with lately (MIDI, patch swaps and
+# parameter changes; see common/capture.h) and saves it for `./a.out -R`.
+
+SERIAL_PORT = '/dev/ttyUSB0'
+BAUD_RATE = 115200
+
+CAPTURE_MAGIC = b'send-me-the-capture-please'
+BEGIN = b'capture-begins\n'
+
+
+def read_exactly(ser, n):
+    data = b''
+    while len(data) < n:
+        chunk = ser.read(n - len(data))
+        if not chunk:
+            print(f'gave up after {len(data)} of {n} bytes')
+            sys.exit(1)
+        data += chunk
+    return data
+
+
+def main():
+    if len(sys.argv) != 2:
+        print('usage: capture.py <out.bin>')
+        sys.exit(1)
+
+    ser = serial.Serial(SERIAL_PORT, BAUD_RATE, timeout=5)
+    print(f"Port {ser.name} opened successfully.")
+    time.sleep(0.2)
+    ser.reset_input_buffer()
+    ser.write(CAPTURE_MAGIC)
+
+    seen = b''
+    while not seen.endswith(BEGIN):
+        c = ser.read(1)
+        if not c:
+            print('no answer')
+            sys.exit(1)
+        seen = (seen + c)[-len(BEGIN):]
+    size = int.from_bytes(read_exactly(ser, 4), byteorder='little')
+    data = read_exactly(ser, size)
+    ser.close()
+
+    with open(sys.argv[1], 'wb') as f:
+        f.write(data)
+    print(f'wrote {size} bytes to {sys.argv[1]}; replay it with ./a.out -R {sys.argv[1]}')
+
+
+if __name__ == '__main__':
+    main()
@@ -4,14 +4,18 @@ import sys
 import zlib
 
 reboot = False
+bank = False
 if len(sys.argv) != 2:
-    print('missing <path> or "reboot"')
+    print('missing <path>, "reboot", or "bank" (reload the patch bank from the SD card)')
     sys.exit(1)
 path = sys.argv[1]
 if path == "reboot":
     reboot = True
+elif path == "bank":
+    bank = True
 else:
-    data_to_send = open(path).read().encode('ascii')
+    # either a text patch, or a binary one produced by `./a.out -E patch.bin patch`
+    data_to_send = open(path, 'rb').read()
     crc = zlib.crc32(data_to_send) & 0xffffffff
     print(f'patch size is {len(data_to_send)}; crc is {crc}')
 
@@ -31,6 +35,8 @@ try:
 
     if reboot:
         ser.write('magic-reboot-string-omg'.encode('ascii'))
+    elif bank:
+        ser.write('reload-the-patch-bank'.encode('ascii'))
     else:
         ser.write('here-comes-a-new-patch'.encode('ascii'))
         ser.write(len(data_to_send).to_bytes(2, byteorder='little'))
@@ -0,0 +1,46 @@
+import serial
+import sys
+import time
+
+# Asks the Pi for the trace it has recorded (see common/trace.h; the kernel
+# must be built with -DTRACE) and saves it for chrome://tracing or
+# https://ui.perfetto.dev.
+
+SERIAL_PORT = '/dev/ttyUSB0'
+BAUD_RATE = 115200
+
+TRACE_MAGIC = b'send-me-the-trace-please'
+BEGIN = b'trace-begins\n'
+END = b'trace-ends\n'
+
+
+def main():
+    if len(sys.argv) != 2:
+        print('usage: trace.py <out.json>')
+        sys.exit(1)
+
+    ser = serial.Serial(SERIAL_PORT, BAUD_RATE, timeout=5)
+    print(f"Port {ser.name} opened successfully.")
+    time.sleep(0.2)
+    ser.reset_input_buffer()
+    ser.write(TRACE_MAGIC)
+
+    data = b''
+    while not data.endswith(END):
+        chunk = ser.read(4096)
+        if not chunk:
+            print('no answer' if BEGIN in data else 'no answer; is the kernel built with -DTRACE?')
+            sys.exit(1)
+        data += chunk
+        print(f'\r{len(data)} bytes', end='', flush=True)
+    print()
+    ser.close()
+
+    body = data[data.index(BEGIN) + len(BEGIN):-len(END)]
+    with open(sys.argv[1], 'wb') as f:
+        f.write(body)
+    print(f'wrote {sys.argv[1]}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,156 @@
+import os
+import serial
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import zlib
+
+# Watches a text patch and, every time it is saved, sends the Pi only the
+# parameters that changed. The patch is compiled with `./a.out -E` so it is
+# parsed by exactly the same code as on the device; the resulting binary
+# records are diffed field by field. Anything that can't be expressed as a
+# parameter change (added or removed oscillators, inputs, [patch] settings)
+# falls back to sending the whole patch, like tools/send.py does.
+
+SERIAL_PORT = '/dev/ttyUSB0'
+BAUD_RATE = 115200
+COMPILER = './a.out'
+
+PATCH_MAGIC = b'here-comes-a-new-patch'
+PARAMS_MAGIC = b'set-some-patch-params'
+
+PATCH_BIN_VERSION = 3
+PATCH_BIN_REC_OSC = 1
+PATCH_BIN_REC_UNISON = 7
+PATCH_BIN_REC_WAVETABLE = 8
+
+# struct patch_bin_osc in common/patch_bin.h
+OSC_RECORD = struct.Struct('<BBBBBBBB13f')
+# struct patch_bin_unison, which is left out while the settings are the defaults
+UNISON_RECORD = struct.Struct('<BBBBff')
+# struct patch_bin_wavetable; a different file is a structural change
+WAVETABLE_RECORD = struct.Struct('<BBBBf64s')
+
+# PARAM_* in common/synth.h, in the order the floats appear in struct patch_bin_osc
+PARAM_WAVE_TYPE = 0
+FLOAT_PARAMS = [
+    1,  # PARAM_FREQ
+    2,  # PARAM_FREQ_M
+    3,  # PARAM_DETUNE
+    5,  # PARAM_PHASE_INPUT_M
+    6,  # PARAM_AMP_INPUT_M
+    4,  # PARAM_OUTPUT
+    7,  # PARAM_ATTACK
+    8,  # PARAM_DECAY
+    9,  # PARAM_SUSTAIN
+    10,  # PARAM_RELEASE
+    11,  # PARAM_PITCH_M
+    12,  # PARAM_MOD_FREQ_M
+    13,  # PARAM_MOD_OUTPUT_M
+]
+PARAM_UNISON = 14
+PARAM_UNISON_DETUNE = 15
+PARAM_UNISON_SPREAD = 16
+UNISON_DEFAULTS = {PARAM_UNISON: 1.0, PARAM_UNISON_DETUNE: 10.0, PARAM_UNISON_SPREAD: 1.0}
+PARAM_POSITION = 17
+
+
+def compile_patch(path):
+    with tempfile.NamedTemporaryFile(suffix='.bin') as f:
+        result = subprocess.run([COMPILER, '-E', f.name, path], capture_output=True, text=True)
+        if result.returncode != 0:
+            print(result.stderr.strip())
+            return None
+        return f.read()
+
+
+def split_records(data):
+    '''returns (structure, {(osc index, param): value}) for a binary patch'''
+    magic, version, num_records, crc, reserved = struct.unpack_from('<IHHII', data)
+    assert version == PATCH_BIN_VERSION
+    off = 16
+    structure = []
+    values = {}
+    for _ in range(num_records):
+        rec_type, size = data[off], data[off + 1]
+        rec = data[off:off + size]
+        off += size
+        if rec_type == PATCH_BIN_REC_UNISON:
+            _, _, index, copies, detune, spread = UNISON_RECORD.unpack(rec)
+            values[(index, PARAM_UNISON)] = float(copies)
+            values[(index, PARAM_UNISON_DETUNE)] = detune
+            values[(index, PARAM_UNISON_SPREAD)] = spread
+            continue
+        if rec_type == PATCH_BIN_REC_WAVETABLE:
+            _, _, index, _, position, name = WAVETABLE_RECORD.unpack(rec)
+            structure.append((index, name))
+            values[(index, PARAM_POSITION)] = position
+            continue
+        if rec_type != PATCH_BIN_REC_OSC:
+            structure.append(rec)
+            continue
+        fields = OSC_RECORD.unpack(rec)
+        index, osc_type, wave_type, flags, phase_input, amp_input = fields[2:8]
+        structure.append((index, osc_type, flags, phase_input, amp_input))
+        values[(index, PARAM_WAVE_TYPE)] = float(wave_type)
+        for param, value in zip(FLOAT_PARAMS, fields[8:]):
+            values[(index, param)] = value
+        for param, value in UNISON_DEFAULTS.items():
+            values[(index, param)] = value
+    return structure, values
+
+
+def send_frame(ser, magic, payload):
+    crc = zlib.crc32(payload) & 0xffffffff
+    ser.write(magic)
+    ser.write(len(payload).to_bytes(2, byteorder='little'))
+    ser.write(crc.to_bytes(4, byteorder='little'))
+    ser.write(payload)
+
+
+def main():
+    if len(sys.argv) != 2:
+        print('usage: watch.py <patch>')
+        sys.exit(1)
+    path = sys.argv[1]
+
+    ser = serial.Serial(SERIAL_PORT, BAUD_RATE, timeout=1)
+    print(f"Port {ser.name} opened successfully.")
+    time.sleep(0.2)
+
+    sent = None
+    mtime = None
+    try:
+        while True:
+            time.sleep(0.05)
+            m = os.stat(path).st_mtime_ns
+            if m == mtime:
+                continue
+            mtime = m
+
+            data = compile_patch(path)
+            if data is None:
+                continue
+            structure, values = split_records(data)
+
+            if sent is None or structure != sent[0]:
+                send_frame(ser, PATCH_MAGIC, open(path, 'rb').read())
+                print(f'sent whole patch ({len(data)} bytes compiled)')
+            else:
+                changed = [(k, v) for k, v in values.items() if sent[1].get(k) != v]
+                if not changed:
+                    continue
+                payload = b''.join(struct.pack('<BBf', index, param, value) for (index, param), value in changed)
+                send_frame(ser, PARAMS_MAGIC, payload)
+                print(f'sent {len(changed)} parameter changes')
+            sent = (structure, values)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        ser.close()
+
+
+if __name__ == '__main__':
+    main()